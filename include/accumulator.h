@@ -0,0 +1,83 @@
+#ifndef ACCUMULATOR_H
+#define ACCUMULATOR_H
+
+#include "tuple.h"
+#include "canvas.h"
+
+/**
+ * Running per-pixel sums of the samples taken by a progressive renderer.
+ * Each rendering pass adds one sample to every pixel, the average of those
+ * samples is the current estimate of the image
+ */
+typedef struct
+{
+    /** @private Sum of every sample's red, green and blue channels, three floats per pixel.
+     * This buffer is shared memory, so that multiple child processes can add samples
+     */
+    float *color;
+
+    /** @private Sum of every sample's squared luminance, one float per pixel. Used to estimate noise */
+    float *luminance_squares;
+
+    /** @private Width of the accumulator in pixels */
+    unsigned width;
+
+    /** @private Height of the accumulator in pixels */
+    unsigned height;
+
+    /** The number of samples that have been added to every pixel */
+    unsigned samples;
+} Accumulator;
+
+/**
+ * @memberof Accumulator
+ * Generates an empty accumulator of the given size
+ */
+void ConstructAccumulator(Accumulator *a, unsigned width, unsigned height);
+
+/**
+ * @memberof Accumulator
+ * Cleans up an accumulator's memory allocations
+ */
+void DeconstructAccumulator(Accumulator *a);
+
+/**
+ * @memberof Accumulator
+ * Add a sample to the pixel at the given offset, equal to (width * y) + x
+ *
+ * @note This does not increment 'samples,' that happens once a pass over
+ * every pixel is complete
+ */
+void AccumulateSample(Accumulator *a, unsigned i, Tuple3 color);
+
+/**
+ * @memberof Accumulator
+ * Write the average of the accumulated samples to every pixel of the canvas
+ */
+void ResolveAccumulator(Accumulator *a, Canvas *c);
+
+/**
+ * @memberof Accumulator
+ * Estimate how noisy the accumulated image is. This is the average, over every pixel,
+ * of the standard error of the pixel's luminance relative to its mean luminance.
+ *
+ * @returns The estimated relative noise, or INFINITY if fewer than two samples have been taken
+ */
+double AccumulatorNoise(Accumulator *a);
+
+/**
+ * @memberof Accumulator
+ * Like ResolveAccumulator(), but only for one tile, whose pixels have each had 'samples'
+ * samples added. Used when tiles are refined separately, so 'samples' differs between tiles
+ */
+void ResolveAccumulatorTile(Accumulator *a, Canvas *c, Tile t, unsigned samples);
+
+/**
+ * @memberof Accumulator
+ * Like AccumulatorNoise(), but only over one tile, whose pixels have each had 'samples' samples added
+ *
+ * @returns The estimated relative noise, or INFINITY if fewer than two samples have been taken
+ */
+double AccumulatorTileNoise(Accumulator *a, Tile t, unsigned samples);
+
+#endif
@@ -2,7 +2,8 @@
 #define BOUNDING_H
 
 #include "tuple.h"
-#include "shape.h"
+#include "ray.h"
+#include "cpu.h"
 
 /**
  * Bounding box representation.
@@ -17,6 +18,9 @@ typedef struct
     Tuple3 maximum_bound;        
 } Bounds;
 
+// Shape caches its bounds, so Bounds is defined before shape.h is included
+#include "shape.h"
+
 /**
  * @memberof Shape
  * 
@@ -28,13 +32,13 @@ Bounds ShapeBounds(Shape *s);
 
 /**
  * @memberof Bounds
- * Transforms a given Bounds by the Matrix4x4 'm'. Returns the resulting transformed bounding box
+ * Transforms a given Bounds by the Affine 'm'. Returns the resulting transformed bounding box
  * 
  * @param 'Bounds b' The bounding volume to be transformed
- * @param 'Matrix4x4 m' The transformation to apply to the volume 
+ * @param 'Affine m' The transformation to apply to the volume 
  * @returns 'Bounds' the transformed bounding box
  */
-Bounds TransformBounds(Bounds b, Matrix4x4 m);
+Bounds TransformBounds(Bounds b, Affine m);
 
 /**
  * @memberof Bounds
@@ -46,6 +50,102 @@ Bounds TransformBounds(Bounds b, Matrix4x4 m);
  */
 bool IsInBounds(Bounds b, Ray r);
 
+/** The number of boxes IntersectFloatBounds() tests at once, one per AVX-512 lane or two AVX2 vectors */
+#define FLOAT_BOUNDS_WIDTH 16
+
+/**
+ * @private A list of bounding boxes in single precision, one array per axis so
+ * that IntersectFloatBounds() can test FLOAT_BOUNDS_WIDTH of them at a time.
+ * Each box is rounded outwards, so it always encloses the box it was made from
+ */
+typedef struct
+{
+    /** @private Minimum corners, one array per axis */
+    float *minimum[3];
+
+    /** @private Maximum corners, one array per axis */
+    float *maximum[3];
+
+    /** @private The number of boxes */
+    unsigned length;
+} FloatBounds;
+
+/**
+ * @private A ray prepared for IntersectFloatBounds()
+ */
+typedef struct
+{
+    /** @private The ray's origin, rounded to single precision */
+    float origin[3];
+
+    /** @private The reciprocal of the ray's direction */
+    float inverse_direction[3];
+
+    /** @private How far along the ray, on each axis, rounding the origin can move a box's sides */
+    float slack[3];
+} FloatRay;
+
+/**
+ * @memberof FloatBounds
+ * Allocate room for the given number of boxes. The boxes are empty until SetFloatBounds() is called
+ */
+void ConstructFloatBounds(FloatBounds *fb, unsigned length);
+
+/**
+ * @memberof FloatBounds
+ * Deallocate the boxes
+ */
+void DeconstructFloatBounds(FloatBounds *fb);
+
+/**
+ * @memberof FloatBounds
+ * Store a box at the given index, rounding its minimum down and its maximum up
+ */
+void SetFloatBounds(FloatBounds *fb, unsigned index, Bounds b);
+
+/**
+ * @memberof FloatRay
+ * Prepare a ray to be tested against FloatBounds
+ */
+FloatRay NewFloatRay(Ray r);
+
+/**
+ * @memberof FloatBounds
+ * Test a ray against up to FLOAT_BOUNDS_WIDTH boxes at once. The test is conservative,
+ * a box IsInBounds() reports as hit is always reported as hit here, but a ray that only
+ * grazes a box may hit it here and miss it in double precision
+ *
+ * @param 'unsigned first' The index of the first box to test, a multiple of FLOAT_BOUNDS_WIDTH
+ * @returns Bit 'n' is set if the ray hits box 'first + n'
+ */
+__mmask16 IntersectFloatBounds(FloatBounds *fb, unsigned first, FloatRay *r);
+
+/**
+ * @private
+ * The variants of IntersectFloatBounds() for each CPU_TARGET. All of them report the
+ * same hits. Call IntersectFloatBounds() instead, these are exposed to be tested and
+ * benchmarked against each other
+ */
+__mmask16 IntersectFloatBoundsScalar(FloatBounds *fb, unsigned first, FloatRay *r);
+__mmask16 IntersectFloatBoundsAvx2(FloatBounds *fb, unsigned first, FloatRay *r);
+__mmask16 IntersectFloatBoundsAvx512(FloatBounds *fb, unsigned first, FloatRay *r);
+
+/**
+ * @private
+ * Point IntersectFloatBounds() at its variant for the given target. Called by SetCpuTarget()
+ */
+void SelectBoundsKernels(CPU_TARGET target);
+
+/**
+ * @private
+ * The latest time a ray enters and the earliest time it leaves the slabs of a box,
+ * given the times it crosses each side on each axis
+ *
+ * @param 'Tuple3 tmins, tmaxs' The times the ray enters and leaves each slab
+ * @param 'double *tmin, *tmax' Filled with the times the ray enters and leaves the box
+ */
+void SlabInterval(Tuple3 tmins, Tuple3 tmaxs, double *tmin, double *tmax);
+
 /**
  * @memberof Bounds
  * Returns a point at the center of the given bounding box
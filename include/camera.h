@@ -15,14 +15,14 @@ typedef struct
      * @private
      * A transformation to be applied to the camera
      */
-    Matrix4x4 view_transformation;
+    Affine view_transformation;
 
     /**
      * @private
      * The inverse of view_transformation, cached here to prevent extra recalculations
      * of the inverse transformation
      */
-    Matrix4x4 inverse_view_transformation;
+    Affine inverse_view_transformation;
 
     /** @private Number of pixels wide the camera is */
     unsigned width;
@@ -41,8 +41,39 @@ typedef struct
 
     /** @private Size in world coordinates of a camera pixel */
     double pixel_size;
+
+    /** @private Where every ray starts, in world space */
+    Tuple3 ray_origin;
+
+    /** @private The unnormalized world space direction of the ray through the canvas' top left corner */
+    Tuple3 ray_corner;
+
+    /** @private How much the unnormalized direction changes for one pixel to the right */
+    Tuple3 ray_step_x;
+
+    /** @private How much the unnormalized direction changes for one pixel down */
+    Tuple3 ray_step_y;
 } Camera;
 
+/** The most rays a RayPacket holds, twice the width of a tile */
+#define RAY_PACKET_WIDTH 64
+
+/**
+ * Camera rays through neighbouring pixels of one row, stored as a structure of
+ * arrays. The rays share their origin, and the directions are normalized
+ */
+typedef struct
+{
+    /** The origin of every ray in the packet */
+    Tuple3 origin;
+
+    /** The directions' 'x', 'y' and 'z' components */
+    double direction[3][RAY_PACKET_WIDTH] align;
+
+    /** The number of rays */
+    unsigned length;
+} RayPacket;
+
 
 /**
  * @memberof Camera
@@ -73,4 +104,38 @@ void CameraApplyTransformation(Camera *c, Matrix4x4 t);
  */
 Ray RayForPixel(Camera *c, unsigned x, unsigned y);
 
-#endif
+/**
+ * @memberof Camera
+ * Generates a ray through a given location inside of a pixel. RayForPixel() is
+ * equivalent to a sample location of (0.5, 0.5)
+ * 
+ * @param 'Camera *c' The camera the ray will be gerated for
+ * @param 'unsigned x' The x coord of the pixel the ray will pass through
+ * @param 'unsigned y' the y coord of the pixel the ray will pass through
+ * @param 'double sample_x' Horizontal location in the pixel, on [0..1)
+ * @param 'double sample_y' Vertical location in the pixel, on [0..1)
+ */
+Ray RayForPixelSample(Camera *c, unsigned x, unsigned y, double sample_x, double sample_y);
+
+/**
+ * @memberof Camera
+ * Generates the rays through a run of pixels in one row. Each direction is found
+ * from ones precomputed by CameraApplyTransformation(), with a few multiply-adds
+ * and a normalize, and no matrix multiplications
+ *
+ * @param 'unsigned x' The x coord of the first pixel
+ * @param 'unsigned y' The y coord of the pixels
+ * @param 'unsigned count' The number of pixels, at most RAY_PACKET_WIDTH
+ * @param 'const double *sample_x' Horizontal location in each pixel, on [0..1), or NULL for the centers
+ * @param 'const double *sample_y' Vertical location in each pixel, or NULL for the centers
+ * @param 'RayPacket *packet' Filled with the rays
+ */
+void CameraRayPacket(Camera *c, unsigned x, unsigned y, unsigned count, const double *sample_x, const double *sample_y, RayPacket *packet);
+
+/**
+ * @memberof RayPacket
+ * @returns The ray at the given index
+ */
+Ray PacketRay(RayPacket *packet, unsigned index);
+
+#endif
\ No newline at end of file
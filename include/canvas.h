@@ -4,10 +4,78 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <stdbool.h>
 
 #include "tuple.h"
 #include "set.h"
 
+/**
+ * Flags for the optional auxiliary planes a canvas can hold alongside its colors.
+ * Combine them with '|' and pass them to EnableCanvasPlanes()
+ */
+typedef enum
+{
+    /** Surface color of the first hit, before lighting */
+    CANVAS_ALBEDO = 1 << 0,
+    /** World space shading normal of the first hit */
+    CANVAS_NORMAL = 1 << 1,
+    /** Distance from the camera to the first hit, INFINITY where nothing was hit */
+    CANVAS_DEPTH = 1 << 2,
+    /** Id of the shape hit first, 0 where nothing was hit. See Shape.id */
+    CANVAS_SHAPE_ID = 1 << 3,
+    /** BVH nodes visited and shapes tested while rendering the pixel, see TraversalSteps() */
+    CANVAS_STEPS = 1 << 4,
+} CANVAS_PLANE;
+
+/** Every auxiliary plane */
+#define CANVAS_ALL_PLANES (CANVAS_ALBEDO | CANVAS_NORMAL | CANVAS_DEPTH | CANVAS_SHAPE_ID | CANVAS_STEPS)
+
+/**
+ * What a camera ray first hit, written to a canvas' auxiliary planes
+ */
+typedef struct
+{
+    /** Surface color before lighting, black for misses */
+    Tuple3 albedo;
+
+    /** World space shading normal, the zero vector for misses */
+    Tuple3 normal;
+
+    /** Distance along the ray, INFINITY for misses */
+    double depth;
+
+    /** Id of the shape that was hit, 0 for misses */
+    unsigned shape_id;
+
+    /** Traversal steps spent on the pixel */
+    unsigned steps;
+} SurfaceSample;
+
+/** Width and height, in pixels, of the tiles rendering is split into */
+#define TILE_SIZE 32
+
+/**
+ * A rectangle of pixels on a canvas. Canvases are split into tiles of
+ * TILE_SIZE x TILE_SIZE pixels, tiles on the right and bottom edges may be smaller
+ */
+typedef struct
+{
+    /** The tile's number, counting across and then down the canvas */
+    unsigned index;
+
+    /** Pixel coordinates of the tile's top left corner */
+    unsigned x;
+
+    /** Pixel coordinates of the tile's top left corner */
+    unsigned y;
+
+    /** Width of the tile in pixels */
+    unsigned width;
+
+    /** Height of the tile in pixels */
+    unsigned height;
+} Tile;
+
 /**
  * Stores the output of a rendered frame 
  */
@@ -24,6 +92,27 @@ typedef struct
 
     /** @private Height of canvas in pixels*/
     unsigned canvas_height;
+
+    /** @private Which auxiliary planes are allocated, a combination of CANVAS_PLANE flags */
+    unsigned planes;
+
+    /** @private Albedo plane, shared memory. NULL unless CANVAS_ALBEDO is enabled */
+    Tuple3 *albedo;
+
+    /** @private Normal plane, shared memory. NULL unless CANVAS_NORMAL is enabled */
+    Tuple3 *normal;
+
+    /** @private Depth plane, shared memory. NULL unless CANVAS_DEPTH is enabled */
+    double *depth;
+
+    /** @private Shape id plane, shared memory. NULL unless CANVAS_SHAPE_ID is enabled */
+    unsigned *shape_id;
+
+    /** @private Traversal step plane, shared memory. NULL unless CANVAS_STEPS is enabled */
+    unsigned *steps;
+
+    /** @private False if 'buffer' belongs to the caller, see ConstructCanvasOver() */
+    bool owns_buffer;
 } Canvas;
 
 /**
@@ -36,6 +125,18 @@ typedef struct
  */
 void ConstructCanvas(Canvas *c, unsigned width, unsigned height);
 
+/**
+ * @memberof Canvas
+ * Like ConstructCanvas(), but the canvas' colors are written straight into the
+ * caller's framebuffer, which DeconstructCanvas() leaves alone
+ *
+ * @param 'Tuple3 *buffer' Room for width * height colors, one row after another. It must be
+ * shared memory, mapped with MAP_SHARED, so the child processes that render to it write to the caller's copy
+ *
+ * @note The canvas' auxiliary planes are still allocated and freed by the canvas
+ */
+void ConstructCanvasOver(Canvas *c, Tuple3 *buffer, unsigned width, unsigned height);
+
 /**
  * @memberof Canvas
  * Cleans up a canvas' memory allocations. After DeconstructCanvas() is called on a
@@ -67,6 +168,53 @@ void WritePixel(Canvas *c, Tuple3 color, unsigned x, unsigned y);
  */
 void DirectWritePixel(Canvas *c, Tuple3 color, unsigned i);
 
+/**
+ * @memberof Canvas
+ * Allocate the given auxiliary planes. Render functions fill every enabled
+ * plane alongside the canvas' colors
+ *
+ * @param 'Canvas *c' The canvas to add planes to
+ * @param 'unsigned planes' A combination of CANVAS_PLANE flags
+ */
+void EnableCanvasPlanes(Canvas *c, unsigned planes);
+
+/**
+ * @memberof Canvas
+ * Write a surface sample to every enabled auxiliary plane, at an offset
+ * equal to (canvas_width * y) + x
+ */
+void DirectWriteSurface(Canvas *c, SurfaceSample *sample, unsigned i);
+
+/**
+ * @memberof Canvas
+ * @returns The number of tiles across the canvas
+ */
+unsigned CanvasTilesAcross(Canvas *c);
+
+/**
+ * @memberof Canvas
+ * @returns The number of tiles the canvas is split into
+ */
+unsigned CanvasTileCount(Canvas *c);
+
+/**
+ * @memberof Canvas
+ * @returns The 'index'th tile of the canvas, on [0..CanvasTileCount())
+ */
+Tile CanvasTile(Canvas *c, unsigned index);
+
+/**
+ * @memberof Tile
+ * @returns The 'index'th tile of a frame of the given size, split the same way a canvas of that size is
+ */
+Tile FrameTile(unsigned width, unsigned height, unsigned index);
+
+/**
+ * @memberof Canvas
+ * Maps 't' on [0..1] to a false color, from blue (0) through green to red (1)
+ */
+Tuple3 HeatmapColor(double t);
+
 /**
  * @memberof Canvas
  * Writes a canvas to an output *.ppm file. If the file already contains data, the
@@ -77,4 +225,40 @@ void DirectWritePixel(Canvas *c, Tuple3 color, unsigned i);
  */
 void WriteToPPM(Canvas *c, const char *filename);
 
+/**
+ * @memberof Canvas
+ * The pixel's color as the 8 bit red, green and blue WriteToPPM() writes for it
+ */
+void PixelBytes(Canvas *c, unsigned location, unsigned char rgb[3]);
+
+/**
+ * @memberof Canvas
+ * Writes one of the canvas' auxiliary planes to a *.pfm file, at full precision. Albedo
+ * and normals are written as three channel images, the other planes as one channel images
+ *
+ * @param 'Canvas *c' The canvas to write
+ * @param 'CANVAS_PLANE plane' The plane to write, it must be enabled
+ * @param 'char *filename' The name of the file to write to
+ */
+void WritePlaneToPFM(Canvas *c, CANVAS_PLANE plane, const char *filename);
+
+/**
+ * @memberof Canvas
+ * Writes a viewable picture of one of the canvas' auxiliary planes to a *.ppm file. Normals are
+ * mapped from [-1..1] to [0..1], depth is shaded from white (near) to black (far), shape ids
+ * get a random color each and traversal steps are drawn as a heatmap
+ *
+ * @param 'Canvas *c' The canvas to write
+ * @param 'CANVAS_PLANE plane' The plane to write, it must be enabled
+ * @param 'char *filename' The name of the file to write to
+ */
+void WritePlaneToPPM(Canvas *c, CANVAS_PLANE plane, const char *filename);
+
+/**
+ * @memberof Canvas
+ * Write every enabled auxiliary plane to '<prefix>_<plane>.pfm' and '<prefix>_<plane>.ppm',
+ * where plane is one of 'albedo', 'normal', 'depth', 'shape_id' or 'steps'
+ */
+void WriteCanvasPlanes(Canvas *c, const char *prefix);
+
 #endif
@@ -0,0 +1,139 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "canvas.h"
+#include "accumulator.h"
+
+/**
+ * Controls how a long render saves its progress, so that it can be resumed
+ * after the process is stopped
+ */
+typedef struct
+{
+    /** The checkpoint file. NULL disables checkpointing */
+    const char *filename;
+
+    /**
+     * The fewest seconds between two writes of the checkpoint. Each write only
+     * costs the work finished since the last one, so this bounds the overhead
+     */
+    double interval;
+
+    /** Continue from the file's progress, if it exists and was written for the same frame */
+    bool resume;
+
+    /**
+     * Scene.hash of the scene being rendered, kept in the file. A file written for another
+     * scene file is started over rather than resumed, so stale tiles or samples are not mixed in
+     */
+    uint64_t scene_hash;
+
+    /** The seed of the scene's sampler, kept in the file. A file written with another seed is started over */
+    unsigned seed;
+} CheckpointSettings;
+
+/**
+ * @memberof CheckpointSettings
+ * Generates settings with sensible defaults
+ *
+ * @line
+ *
+ * Default Values
+ * - CheckpointSettings.filename = NULL;
+ * - CheckpointSettings.interval = 30;
+ * - CheckpointSettings.resume = true;
+ * - CheckpointSettings.scene_hash = 0;
+ * - CheckpointSettings.seed = 0;
+ */
+CheckpointSettings DefaultCheckpointSettings();
+
+/**
+ * Records which tiles of a canvas are finished, in a file that rendering appends
+ * the tiles' colors to as they complete. Set Scene.checkpoint to one of these, and
+ * tiles already in the file are skipped, see RenderSceneTile()
+ *
+ * The file holds a header describing the frame, scene and seed followed by one record per
+ * finished tile, its colors in single precision. A record cut short by the process
+ * stopping is ignored when the file is read back
+ */
+typedef struct
+{
+    /** @private The file finished tiles are appended to */
+    const char *filename;
+
+    /** @private The canvas whose tiles are recorded */
+    Canvas *canvas;
+
+    /** @private The fewest seconds between two writes */
+    double interval;
+
+    /** @private One TILE_STATE per tile, shared memory so that child processes can fill it in */
+    unsigned char *states;
+
+    /** @private The number of tiles */
+    unsigned tile_count;
+
+    /** @private When the file was last written, shared memory */
+    double *last_save;
+
+    /** @private Set while a process is writing the file, shared memory */
+    int *saving;
+} TileCheckpoint;
+
+/**
+ * @memberof TileCheckpoint
+ * Start recording the given canvas' tiles. When resuming from a file written
+ * for a canvas of the same size, and with the settings' scene hash and seed, its tiles
+ * are copied onto the canvas and marked finished, otherwise the file is started over
+ */
+void OpenTileCheckpoint(TileCheckpoint *tc, Canvas *c, CheckpointSettings settings);
+
+/**
+ * @memberof TileCheckpoint
+ * Write any finished tiles that are not in the file yet, and deallocate the checkpoint.
+ * The file is kept, resuming from it again renders nothing
+ */
+void CloseTileCheckpoint(TileCheckpoint *tc);
+
+/**
+ * @memberof TileCheckpoint
+ * @returns true if the tile is finished, either rendered or read from the file
+ */
+bool TileFinished(TileCheckpoint *tc, unsigned index);
+
+/**
+ * @memberof TileCheckpoint
+ * @returns The number of finished tiles
+ */
+unsigned FinishedTileCount(TileCheckpoint *tc);
+
+/**
+ * @memberof TileCheckpoint
+ * Mark a tile as finished. If the interval has passed since the file was last
+ * written, every finished tile that is not in the file yet is appended to it
+ *
+ * @note Safe to call from the child processes of ParallelForDynamic()
+ */
+void FinishTile(TileCheckpoint *tc, Tile t);
+
+/**
+ * @memberof Accumulator
+ * Write the accumulated samples to the settings' file, replacing it only once the new one is complete
+ *
+ * @returns false if the file could not be written
+ */
+bool SaveAccumulator(Accumulator *a, CheckpointSettings settings);
+
+/**
+ * @memberof Accumulator
+ * Read samples saved by SaveAccumulator() into an accumulator of the same size
+ *
+ * @returns false, leaving the accumulator untouched, if the file is missing, damaged
+ * or was written for a different size, scene hash or seed
+ */
+bool LoadAccumulator(Accumulator *a, CheckpointSettings settings);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include <stdbool.h>
+
+/**
+ * The tracer is built for AVX2 and FMA (x86-64-v3), so one binary runs on every
+ * node. The widest kernels, such as the ones that test a ray against a block of shapes or
+ * bounding boxes, are also compiled for AVX-512 and as plain scalar code. At startup
+ * the best variant the CPU supports is selected, see DetectCpuTarget()
+ */
+
+/**
+ * Tags for the instruction sets a kernel can be compiled for, from narrowest to widest
+ */
+typedef enum
+{
+    /** One lane at a time, no vector instructions */
+    CPU_SCALAR,
+    /** Four doubles or eight floats at a time */
+    CPU_AVX2,
+    /** Eight doubles or sixteen floats at a time, with mask registers */
+    CPU_AVX512,
+    /** The number of targets, not a target */
+    CPU_TARGET_COUNT,
+} CPU_TARGET;
+
+/** Compiles a function for AVX-512, it must only be called if DetectCpuTarget() returns CPU_AVX512 */
+#define AVX512_FUNCTION __attribute__((target("avx512f")))
+
+/**
+ * @returns The widest target this CPU and operating system support, read with cpuid
+ */
+CPU_TARGET DetectCpuTarget();
+
+/**
+ * @returns The target whose kernels are in use
+ */
+CPU_TARGET CpuTarget();
+
+/**
+ * Switch every dispatched kernel to its variant for the given target
+ *
+ * @returns false, leaving the kernels untouched, if the CPU does not support the target
+ */
+bool SetCpuTarget(CPU_TARGET target);
+
+/**
+ * @returns The target's name, as used in printed output
+ */
+const char *CpuTargetName(CPU_TARGET target);
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef DENOISE_H
+#define DENOISE_H
+
+#include <stdbool.h>
+
+#include "canvas.h"
+
+/**
+ * Settings for DenoiseCanvas()
+ */
+typedef struct
+{
+    /** The number of filter passes. Pass 'k' reaches 2^k pixels further than the first */
+    unsigned iterations;
+
+    /** How different two colors can be before they stop being blended. Halved every pass */
+    double sigma_color;
+
+    /** Exponent applied to the cosine between two normals. Higher values keep edges between faces sharper */
+    double sigma_normal;
+
+    /** How far apart, relative to their distance from the camera, two surfaces can be before they stop being blended */
+    double sigma_depth;
+
+    /** Filter lighting rather than color, by dividing out the albedo before filtering and multiplying it back after,
+     * so that textures are not blurred
+     */
+    bool demodulate_albedo;
+} DenoiseSettings;
+
+/**
+ * Generates the default denoiser settings
+ * - DenoiseSettings.iterations = 5;
+ * - DenoiseSettings.sigma_color = 1.0;
+ * - DenoiseSettings.sigma_normal = 64.0;
+ * - DenoiseSettings.sigma_depth = 0.05;
+ * - DenoiseSettings.demodulate_albedo = true;
+ */
+DenoiseSettings DefaultDenoiseSettings();
+
+/**
+ * @memberof Canvas
+ * Remove noise from a rendered canvas with an edge-avoiding a-trous wavelet filter, in
+ * the style of Dammertz et al. (2010) and SVGF. Neighbouring pixels are blended unless
+ * the canvas' auxiliary planes show an edge between them: a change of albedo, normal or depth.
+ * Planes that have not been enabled with EnableCanvasPlanes() are not used.
+ *
+ * Meant to be run after RenderScene() or RenderSceneProgressive(), so that a few samples
+ * per pixel still give a clean image
+ *
+ * @param 'Canvas *c' The canvas to filter, in place
+ * @param 'DenoiseSettings settings' Controls the strength of the filter
+ */
+void DenoiseCanvas(Canvas *c, DenoiseSettings settings);
+
+#endif
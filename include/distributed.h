@@ -0,0 +1,157 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "canvas.h"
+#include "server.h"
+
+/**
+ * Messages between a coordinator and its workers, see net.h. The types follow on
+ * from SERVER_MESSAGE, so the two can not be mistaken for each other
+ */
+typedef enum
+{
+    /** To a worker as it connects: uint64 HashSceneJson() of the scene, uint32 frame width and height */
+    WORK_HELLO = 16,
+    /** From a worker that does not have the scene loaded, no payload */
+    WORK_NEED_SCENE = 17,
+    /** To a worker: the scene's metadata file */
+    WORK_SCENE = 18,
+    /** From a worker once the scene is loaded, no payload */
+    WORK_READY = 19,
+    /** To a worker: uint32 index of a tile to render, see FrameTile() */
+    WORK_TILE = 20,
+    /** From a worker: uint32 tile index, then the tile's pixels, see CompressTile() */
+    WORK_RESULT = 21,
+    /** To a worker once the frame is complete, no payload */
+    WORK_FINISHED = 22,
+} WORK_MESSAGE;
+
+/**
+ * Controls RenderSceneDistributed()
+ */
+typedef struct
+{
+    /** The address workers connect to, see net.h */
+    const char *address;
+
+    /** The most tiles a worker is given before it returns one, so it does not wait on the network between tiles */
+    unsigned tiles_in_flight;
+
+    /** Rendering gives up if no worker sends anything for this many seconds */
+    double timeout;
+} CoordinatorSettings;
+
+/**
+ * @memberof CoordinatorSettings
+ * Generates settings with sensible defaults
+ *
+ * @line
+ *
+ * Default Values
+ * - CoordinatorSettings.address = "127.0.0.1:7878";
+ * - CoordinatorSettings.tiles_in_flight = 2;
+ * - CoordinatorSettings.timeout = 60;
+ */
+CoordinatorSettings DefaultCoordinatorSettings();
+
+/**
+ * Summary of a distributed render, returned by RenderSceneDistributed()
+ */
+typedef struct
+{
+    /** The number of workers that connected */
+    unsigned workers;
+
+    /** Tiles given to another worker because the one rendering them failed */
+    unsigned reissued_tiles;
+
+    /** Bytes of pixels received, and the bytes they would have been as 8 bit colors */
+    unsigned long compressed_bytes, raw_bytes;
+
+    /** Wall clock time spent rendering, in seconds */
+    double seconds;
+
+    /** False if rendering timed out with tiles missing */
+    bool complete;
+} DistributedReport;
+
+/**
+ * Render a scene on the workers that connect to the given address, see RunRenderWorker().
+ * Workers are sent the scene unless they have it loaded, then take tiles as they finish
+ * others. The tiles a worker had when it fails are given to the others, and once no tiles
+ * are left, workers that are idle also take tiles others are still rendering, so one slow
+ * worker does not hold up the frame
+ *
+ * @param 'const char *scene_json' The contents of the scene's metadata file
+ * @param 'Canvas *c' The canvas to write the image to, the size of the scene's camera
+ * @param 'CoordinatorSettings settings' Where workers connect, and how many tiles they are given
+ * @returns How many workers took part, and the time taken
+ *
+ * @note Colors are sent as the 8 bit values WriteToPPM() writes, so the canvas
+ * holds colors rounded to those
+ */
+DistributedReport RenderSceneDistributed(const char *scene_json, Canvas *c, CoordinatorSettings settings);
+
+/**
+ * Controls RunRenderWorker()
+ */
+typedef struct
+{
+    /** The address of the coordinator */
+    const char *address;
+
+    /** How many seconds to keep trying to connect, so workers can be started before the coordinator */
+    double connect_timeout;
+
+    /** After rendering this many tiles, the worker drops the connection as if it failed. 0 for no limit, used for testing */
+    unsigned max_tiles;
+} WorkerSettings;
+
+/**
+ * @memberof WorkerSettings
+ * Generates settings with sensible defaults
+ *
+ * @line
+ *
+ * Default Values
+ * - WorkerSettings.address = "127.0.0.1:7878";
+ * - WorkerSettings.connect_timeout = 10;
+ * - WorkerSettings.max_tiles = 0;
+ */
+WorkerSettings DefaultWorkerSettings();
+
+/**
+ * Render tiles for a coordinator until its frame is complete, see RenderSceneDistributed().
+ * Each worker renders one tile at a time, so run one per processor
+ *
+ * @param 'SceneCache *cache' Scenes already loaded, the coordinator's scene is added to it.
+ * Keep it across calls so a worker only loads a scene once
+ * @param 'WorkerSettings settings' Where the coordinator is
+ * @returns true if the frame was completed, false if the coordinator could not be reached or went away
+ *
+ * @note Like ReadScene(), a malformed scene stops the worker's process. The coordinator gives its tiles to other workers
+ */
+bool RunRenderWorker(SceneCache *cache, WorkerSettings settings);
+
+/**
+ * @memberof Canvas
+ * Run length encode the 8 bit colors of a tile of the canvas, as a byte holding how
+ * many times a color repeats, up to 255, followed by the color's red, green and blue
+ *
+ * @param 'unsigned char *out' Room for 4 bytes per pixel of the tile
+ * @returns The number of bytes written to 'out'
+ */
+size_t CompressTile(Canvas *c, Tile t, unsigned char *out);
+
+/**
+ * @memberof Canvas
+ * Write the colors CompressTile() encoded onto a tile of the canvas
+ *
+ * @returns false, leaving some of the tile unwritten, if the data does not cover exactly the tile's pixels
+ */
+bool DecompressTile(const unsigned char *in, size_t length, Canvas *c, Tile t);
+
+#endif
@@ -2,6 +2,8 @@
 #define INTERSECTION_H
 
 #include "ray.h"
+#include "shape.h"
+#include "cpu.h"
 
 #define MAX_NUMBER_INTERSECTIONS 2
 
@@ -50,6 +52,114 @@ Intersection NewIntersection(Shape *s, Ray r);
  */
 Intersection Intersect(Shape *s, Ray r);
 
+/**
+ * @private
+ * @memberof Shape
+ * Intersect a ray with a shape given only the data the test needs, the shape's type and
+ * inverse transform. Used by the BVH, which keeps this data packed apart from the rest of
+ * the shape. The caller fills in 'shape_ptr'
+ *
+ * @param 'SHAPE_TYPE type' The type of shape to be intersected
+ * @param 'Affine *inverse_transform' The shape's inverse transformation
+ * @param 'Ray r' The ray to intersect with
+ * @returns 'Intersection' An intersection with a NULL 'shape_ptr'
+ */
+Intersection IntersectTransformed(SHAPE_TYPE type, Affine *inverse_transform, Ray r);
+
+/** The number of shapes in a SphereBlock or TriangleBlock, one per AVX-512 lane or two AVX2 vectors */
+#define SHAPE_BLOCK_WIDTH 8
+
+/**
+ * @private Up to SHAPE_BLOCK_WIDTH spheres in world space, one per lane. Only spheres
+ * that their transformation keeps round can be stored this way, see PackSphere()
+ */
+typedef struct
+{
+    /** @private Centers of the spheres, one array per axis */
+    double center[3][SHAPE_BLOCK_WIDTH];
+
+    /** @private Squares of the radii */
+    double radius_squared[SHAPE_BLOCK_WIDTH];
+} SphereBlock;
+
+/**
+ * @private Up to SHAPE_BLOCK_WIDTH triangles in world space, one per lane
+ */
+typedef struct
+{
+    /** @private First corners of the triangles, one array per axis */
+    double p1[3][SHAPE_BLOCK_WIDTH];
+
+    /** @private Edges from the first to the second corners */
+    double e1[3][SHAPE_BLOCK_WIDTH];
+
+    /** @private Edges from the first to the third corners */
+    double e2[3][SHAPE_BLOCK_WIDTH];
+
+    /** @private EQUALITY_EPSILON scaled to world space, rays with a smaller determinant are parallel to the triangle */
+    double epsilon[SHAPE_BLOCK_WIDTH];
+} TriangleBlock;
+
+/**
+ * @private
+ * @memberof SphereBlock
+ * Store the sphere with the given transformation in a lane of the block
+ *
+ * @returns false, leaving the block untouched, if the transformation stretches or
+ * shears the sphere into an ellipsoid
+ */
+bool PackSphere(SphereBlock *block, unsigned lane, Affine *transformation);
+
+/**
+ * @private
+ * @memberof TriangleBlock
+ * Store the triangle with the given transformation in a lane of the block
+ */
+void PackTriangle(TriangleBlock *block, unsigned lane, Affine *transformation);
+
+/**
+ * @private
+ * @memberof SphereBlock
+ * Intersect a ray with every sphere in the block at once
+ *
+ * @param '__mmask8 lanes' Bit 'n' is set if lane 'n' holds a sphere
+ * @param 'double *near, *far' Filled with the times each sphere is entered and left. 'far'
+ * is DBL_MAX if the ray only touches the sphere
+ * @returns Bit 'n' is set if the ray hits the sphere in lane 'n'
+ */
+__mmask8 IntersectSphereBlock(SphereBlock *block, __mmask8 lanes, Ray r, double near[SHAPE_BLOCK_WIDTH], double far[SHAPE_BLOCK_WIDTH]);
+
+/**
+ * @private
+ * @memberof TriangleBlock
+ * Intersect a ray with every triangle in the block at once
+ *
+ * @param '__mmask8 lanes' Bit 'n' is set if lane 'n' holds a triangle
+ * @param 'double *times' Filled with the time the ray hits each triangle
+ * @returns Bit 'n' is set if the ray hits the triangle in lane 'n'
+ */
+__mmask8 IntersectTriangleBlock(TriangleBlock *block, __mmask8 lanes, Ray r, double times[SHAPE_BLOCK_WIDTH]);
+
+/**
+ * @private
+ * The variants of IntersectSphereBlock() and IntersectTriangleBlock() for each CPU_TARGET.
+ * All of them return the same hits and times. Call the dispatchers above instead, these
+ * are exposed to be tested and benchmarked against each other
+ */
+__mmask8 IntersectSphereBlockScalar(SphereBlock *block, __mmask8 lanes, Ray r, double near[SHAPE_BLOCK_WIDTH], double far[SHAPE_BLOCK_WIDTH]);
+__mmask8 IntersectSphereBlockAvx2(SphereBlock *block, __mmask8 lanes, Ray r, double near[SHAPE_BLOCK_WIDTH], double far[SHAPE_BLOCK_WIDTH]);
+__mmask8 IntersectSphereBlockAvx512(SphereBlock *block, __mmask8 lanes, Ray r, double near[SHAPE_BLOCK_WIDTH], double far[SHAPE_BLOCK_WIDTH]);
+__mmask8 IntersectTriangleBlockScalar(TriangleBlock *block, __mmask8 lanes, Ray r, double times[SHAPE_BLOCK_WIDTH]);
+__mmask8 IntersectTriangleBlockAvx2(TriangleBlock *block, __mmask8 lanes, Ray r, double times[SHAPE_BLOCK_WIDTH]);
+__mmask8 IntersectTriangleBlockAvx512(TriangleBlock *block, __mmask8 lanes, Ray r, double times[SHAPE_BLOCK_WIDTH]);
+
+/**
+ * @private
+ * Point IntersectSphereBlock() and IntersectTriangleBlock() at their variants for the
+ * given target. Called by SetCpuTarget()
+ */
+void SelectIntersectionKernels(CPU_TARGET target);
+
 /**
  * @memberof Intersection
  * Comparator for two intersections 
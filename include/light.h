@@ -1,27 +1,129 @@
 #ifndef LIGHT_H
 #define LIGHT_H
 
+#include "sampler.h"
 #include "tuple.h"
 
 /**
- * Represents a scene's point light
+ * Tags to indicate the shape of a light's emitting surface
+ */
+typedef enum
+{
+    /** An infinitely small light at 'origin', casts hard shadows */
+    POINT_LIGHT,
+    /** A parallelogram centered at 'origin' and spanned by the 'u' and 'v' edge vectors */
+    RECTANGLE_LIGHT,
+    /** A disk centered at 'origin', with 'u' and 'v' as radius-length axes in the disk's plane */
+    DISK_LIGHT,
+    /** A sphere centered at 'origin' with the given 'radius' */
+    SPHERE_LIGHT,
+} LIGHT_TYPE;
+
+/**
+ * The number of shadow rays cast before an area light decides whether
+ * it can skip its remaining samples. If all of these agree (fully lit or
+ * fully occluded) the rest of the samples are not taken
+ */
+#define ADAPTIVE_SHADOW_SAMPLES 4
+
+/**
+ * Represents a scene's light
  */
 typedef struct
 {
-    /** Light's origin */
+    /** Light's origin. For area lights, this is the center of the light */
     Tuple3 origin;
 
     /** Light's color */
     Tuple3 color;
+
+    /** @private First edge (rectangle) or in-plane axis (disk) of an area light */
+    Tuple3 u;
+
+    /** @private Second edge (rectangle) or in-plane axis (disk) of an area light */
+    Tuple3 v;
+
+    /** @private Radius of a sphere light */
+    double radius;
+
+    /** The number of shadow rays cast towards the light. Always 1 for point lights */
+    unsigned samples;
+
+    /** The shape of the light */
+    LIGHT_TYPE type;
+
+    /** How shadow rays are distributed across the light */
+    SAMPLER_TYPE sampling;
 } Light;
 
 /**
  * @memberof Light
  * Generates a white point light at the given origin
- * 
+ *
  * @param 'Tuple3 origin' The location of the light in world space
  * @returns 'Light' the generated point light
  */
 Light NewLight(Tuple3 origin);
 
+/**
+ * @memberof Light
+ * Generates a white rectangular area light
+ *
+ * @param 'Tuple3 center' The center of the light in world space
+ * @param 'Tuple3 u' The vector along the first edge of the light
+ * @param 'Tuple3 v' The vector along the second edge of the light
+ * @param 'unsigned samples' The number of shadow rays to cast towards the light
+ * @returns 'Light' the generated area light
+ */
+Light NewRectangleLight(Tuple3 center, Tuple3 u, Tuple3 v, unsigned samples);
+
+/**
+ * @memberof Light
+ * Generates a white disk shaped area light
+ *
+ * @param 'Tuple3 center' The center of the disk in world space
+ * @param 'Tuple3 normal' The direction the disk faces
+ * @param 'double radius' The radius of the disk
+ * @param 'unsigned samples' The number of shadow rays to cast towards the light
+ * @returns 'Light' the generated area light
+ */
+Light NewDiskLight(Tuple3 center, Tuple3 normal, double radius, unsigned samples);
+
+/**
+ * @memberof Light
+ * Generates a white spherical area light
+ *
+ * @param 'Tuple3 center' The center of the sphere in world space
+ * @param 'double radius' The radius of the sphere
+ * @param 'unsigned samples' The number of shadow rays to cast towards the light
+ * @returns 'Light' the generated area light
+ */
+Light NewSphereLight(Tuple3 center, double radius, unsigned samples);
+
+/**
+ * @memberof Light
+ * Maps a point on the unit square to a point on the light's surface.
+ *
+ * @param 'Light *l' The light to sample
+ * @param 'Tuple3 location' The point the light is being sampled from. Sphere lights only
+ * return points on the hemisphere facing this location
+ * @param 'double u, v' Sample coordinates, each on [0..1)
+ * @returns A point on the light's surface
+ */
+Tuple3 LightSamplePoint(Light *l, Tuple3 location, double u, double v);
+
+/**
+ * @memberof Light
+ * Generates the 'index'th of 'l->samples' sample coordinates for the light on the
+ * unit square. Samples are decorrelated between shading points with the given 'seed'.
+ * When the light takes more than ADAPTIVE_SHADOW_SAMPLES samples, the first ADAPTIVE_SHADOW_SAMPLES
+ * are one in each quadrant of the light, so the early-out in LightVisibility() has seen all of it
+ *
+ * @param 'Light *l' The light being sampled
+ * @param 'unsigned index' The sample number, on [0..l->samples)
+ * @param 'unsigned seed' Scrambles the sample pattern
+ * @param 'double *u, *v' Filled with the sample coordinates, each on [0..1)
+ */
+void LightSampleCoordinates(Light *l, unsigned index, unsigned seed, double *u, double *v);
+
 #endif
@@ -33,8 +33,8 @@ Tuple3 PhongShader(Scene *s, Set *intersections, unsigned long idx, int limit);
  */
 typedef struct
 {
-    /** The material's pattern (e.g. solid, striped, gradient etc)*/
-    Pattern pattern;
+    /** Index of the material's pattern (e.g. solid, striped, gradient etc) in the pattern table, see AddPattern() */
+    unsigned pattern;
 
     /** The ambient reflection of the material. Scaled from dull at 0.0 to bright at 1.0 */
     double ambient_reflection;
@@ -75,7 +75,7 @@ typedef struct
  * @line
  * 
  * Default Values
- * - Material.pattern = NewSolidPattern(color);
+ * - Material.pattern = AddPattern(NewSolidPattern(color));
  * - Material.ambient_reflection = 0.1;
  * - Material.diffuse_reflection = 0.9;
  * - Material.specular_reflection = 0.9;
@@ -88,4 +88,63 @@ typedef struct
 */
 Material NewMaterial(Tuple3 color);
 
+/**
+ * @memberof Material
+ * Add a material to the material table. Shapes refer to their material by its
+ * index in this table, identical materials share a single entry
+ *
+ * @param 'Material m' The material to add
+ * @returns The index of the material in the table
+ */
+unsigned AddMaterial(Material m);
+
+/**
+ * @memberof Material
+ * @returns The material at the given index of the material table. The pointer is
+ * only valid until the next material is added
+ */
+Material *MaterialAt(unsigned index);
+
+/**
+ * @memberof Material
+ * @returns The material's pattern, from the pattern table
+ */
+Pattern *MaterialPattern(Material *m);
+
+/**
+ * A material table and the pattern table its materials refer to. Each process has
+ * its own pair, used unless another is put in use with UseMaterialTables(). A program
+ * that loads and drops scenes, like a render server, gives each scene its own pair,
+ * so dropping the scene frees its materials
+ */
+typedef struct
+{
+    /** @private */
+    Table materials;
+
+    /** @private */
+    Table patterns;
+} MaterialTables;
+
+/**
+ * @memberof MaterialTables
+ * Generates empty tables
+ */
+void ConstructMaterialTables(MaterialTables *t);
+
+/**
+ * @memberof MaterialTables
+ * Frees the tables. Shapes that refer to them must not be rendered afterwards
+ */
+void DeconstructMaterialTables(MaterialTables *t);
+
+/**
+ * @memberof MaterialTables
+ * Put the tables in use. Materials and patterns added from then on go into them, and shapes
+ * are shaded with the materials in them, including in render processes started afterwards
+ *
+ * @param 'MaterialTables *t' The tables, or NULL for the process' own
+ */
+void UseMaterialTables(MaterialTables *t);
+
 #endif
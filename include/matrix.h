@@ -7,6 +7,7 @@
 
 #include "tuple.h"
 #include "alignment.h"
+#include "cpu.h"
 
 /**
  * A union representing a 4 by 4 matrix
@@ -18,12 +19,6 @@ typedef union
      *  The contents of the matrix represented as 4 256-bit vectors of four doubles 
      */
     __m256d contents[4] align;
-
-    /**
-     * @name chunks
-     * The contents of the matrix represented as 2 512-bit vectors of eight doubles
-    */
-   __m512d chunks[2] align;
 } Matrix4x4;
 
 /**
@@ -244,4 +239,129 @@ Matrix4x4 ViewMatrix(Tuple3 from, Tuple3 to, Tuple3 upvec);
 */
 Matrix4x4 RectifyMatrix(Matrix4x4 m);
 
+/**
+ * An affine transformation, a 4 by 4 matrix whose last row is [0 0 0 1]. Every
+ * transformation built by the functions above is affine, so only the first three
+ * rows are stored and the constant last row is never multiplied
+ */
+typedef union
+{
+    /**
+     * @name rows
+     * The first three rows of the matrix, a linear part in 'x', 'y' and 'z' and a translation in 'w'
+     */
+    __m256d rows[3] align;
+} Affine;
+
+/**
+ * @memberof Affine
+ * Drop the last row of an affine matrix
+ *
+ * @note The last row of 'm' is assumed to be [0 0 0 1], see MatrixIsAffine()
+ */
+Affine AffineFromMatrix(Matrix4x4 m);
+
+/**
+ * @memberof Affine
+ * @returns The affine transformation as a full matrix
+ */
+Matrix4x4 AffineToMatrix(Affine a);
+
+/**
+ * @memberof Matrix4x4
+ * @returns true if the matrix's last row is exactly [0 0 0 1]
+ */
+bool MatrixIsAffine(Matrix4x4 m);
+
+/**
+ * @memberof Affine
+ * @returns The identity transformation
+ */
+Affine AffineIdentity();
+
+/**
+ * @memberof Affine
+ * Multiply two affine transformations, equivalent to MatrixMultiply() on the full matrices
+ */
+Affine AffineMultiply(Affine a1, Affine a2);
+
+/**
+ * @memberof Affine
+ * Invert the given transformation. The linear part is inverted in closed form
+ * with its adjugate, and the translation is undone by the inverted linear part
+ *
+ * @note Like MatrixInvert(), a transformation that flattens space cannot be
+ * inverted, and the result will contain infinities or NaNs
+ */
+Affine AffineInvert(Affine a);
+
+/**
+ * @memberof Tuple3
+ * Apply an affine transformation to a tuple. Points ('w' of 1) are translated,
+ * vectors ('w' of 0) are not
+ *
+ * @param 'Affine a' The transformation to manipulate 't1' by
+ * @param 'Tuple3 t1' The tuple to transform
+ * @returns The transformed tuple, with the same 'w' as 't1'
+ */
+Tuple3 AffineTupleMultiply(Affine a, Tuple3 t1);
+
+/**
+ * @memberof Tuple3
+ * Apply an affine transformation to a tuple, see AffineTupleMultiply()
+ *
+ * @note Slightly slower than @ref AffineTupleMultiply(), but preserves infinities
+ */
+Tuple3 AffineTupleMultiplyPreserveInf(Affine a, Tuple3 t1);
+
+/**
+ * @memberof Tuple3
+ * Multiply a vector by the transpose of the transformation's linear part. Used to
+ * carry surface normals out of object space with the inverse transformation
+ *
+ * @returns The transformed vector, with a 'w' of 0
+ */
+Tuple3 AffineTransposeMultiply(Affine a, Tuple3 v);
+
+/**
+ * Many points laid out as a structure of arrays, one array per axis, so that
+ * AffineTransformPoints() can work on a whole vector register of tuples at a
+ * time. 'w' is not stored, it is implied to be 1. The arrays are owned
+ * by the caller and need no padding or alignment
+ */
+typedef struct
+{
+    /** The 'x', 'y' and 'z' components, in that order */
+    double *components[3];
+
+    /** The number of tuples */
+    unsigned length;
+} TupleBatch;
+
+/**
+ * @memberof TupleBatch
+ * Apply an affine transformation to a batch of points, equivalent to calling
+ * AffineTupleMultiply() on each with a 'w' of 1
+ *
+ * @param 'TupleBatch *in' The points to transform
+ * @param 'TupleBatch *out' Filled with the transformed points, it may be 'in' itself
+ *
+ * @note Each component is evaluated as a chain of fused multiply-adds, so results
+ * can differ from AffineTupleMultiply() in the last bit
+ */
+void AffineTransformPoints(Affine a, TupleBatch *in, TupleBatch *out);
+
+/**
+ * @private Batch transform kernels, 'm' holds the rows of the linear part and the
+ * translation. The variants agree bit for bit, see SelectMatrixKernels()
+ */
+void TransformTupleBatchScalar(double m[3][4], TupleBatch *in, TupleBatch *out);
+void TransformTupleBatchAvx2(double m[3][4], TupleBatch *in, TupleBatch *out);
+void TransformTupleBatchAvx512(double m[3][4], TupleBatch *in, TupleBatch *out);
+
+/**
+ * Point the batch transforms at the kernels for the given target, called by SetCpuTarget()
+ */
+void SelectMatrixKernels(CPU_TARGET target);
+
 #endif
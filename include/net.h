@@ -0,0 +1,72 @@
+#ifndef NET_H
+#define NET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @file
+ * Sockets and the messages sent over them by the render server and distributed
+ * rendering. A message is a header of two uint32 words, the message's type and the
+ * number of bytes that follow it, then those bytes
+ *
+ * Addresses are "host:port" for TCP, or the path of a Unix domain socket,
+ * which is anything with a '/' in it
+ */
+
+/** The size of a message's header */
+#define MESSAGE_HEADER_SIZE (2 * sizeof(uint32_t))
+
+/**
+ * Listen for connections on the given address. A Unix domain socket that already
+ * exists is replaced
+ *
+ * @returns The listening socket, or -1, printing why, if the address could not be used
+ */
+int ListenOn(const char *address);
+
+/**
+ * Close a socket returned by ListenOn(), removing a Unix domain socket's file
+ */
+void StopListening(const char *address, int fd);
+
+/**
+ * Connect to the given address
+ *
+ * @returns The connected socket, or -1 if nothing is listening on the address
+ */
+int ConnectTo(const char *address);
+
+/**
+ * Send every byte, unless the connection fails
+ *
+ * @note A peer that hung up is reported as a failure, rather than raising SIGPIPE
+ */
+bool SendAll(int fd, const void *data, size_t length);
+
+/**
+ * Receive exactly 'length' bytes, unless the connection fails or is closed
+ */
+bool ReceiveAll(int fd, void *data, size_t length);
+
+/**
+ * Write a message's header into the start of 'message', which has room for it and 'length' more bytes
+ */
+void WriteMessageHeader(unsigned char *message, uint32_t type, size_t length);
+
+/**
+ * Send a message with the given type and payload
+ */
+bool SendMessage(int fd, uint32_t type, const void *payload, size_t length);
+
+/**
+ * Receive a whole message
+ *
+ * @param 'uint32_t *type' Set to the message's type
+ * @param 'uint32_t *length' Set to the number of bytes in the payload
+ * @returns The payload, with a '\0' after it, to be freed by the caller. NULL if the connection failed
+ */
+unsigned char *ReceiveMessage(int fd, uint32_t *type, uint32_t *length);
+
+#endif
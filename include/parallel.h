@@ -0,0 +1,85 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stdbool.h>
+
+#include "set.h"
+
+/**
+ * Function type for work that can be split into sections. Each call handles
+ * the items on [start..end)
+ *
+ * @param 'void *context' Caller provided data, shared by every section
+ * @param 'unsigned start' The first item in the section
+ * @param 'unsigned end' One past the last item in the section
+ */
+typedef void (*SectionFunction)(void *context, unsigned start, unsigned end);
+
+/**
+ * Split the items on [0..length) into one section per processor, and run
+ * 'fn' on every section in its own child process. Returns once all sections
+ * are complete.
+ *
+ * @note Child processes do not share memory with the caller, so results must be written
+ * to memory allocated with shmalloc()
+ *
+ * @param 'unsigned length' The number of items to process
+ * @param 'SectionFunction fn' The function to run on each section
+ * @param 'void *context' Passed through to every call to 'fn'
+ */
+void ParallelForSections(unsigned length, SectionFunction fn, void *context);
+
+/**
+ * Like ParallelForSections(), but items are handed out one at a time. One child process
+ * per processor repeatedly claims the next unclaimed item and calls 'fn' on just that
+ * item, so a few slow items do not hold up everything else. Best for a moderate number
+ * of large items, like the tiles of an image
+ *
+ * @param 'unsigned length' The number of items to process
+ * @param 'SectionFunction fn' Called with [item..item + 1) for every item
+ * @param 'void *context' Passed through to every call to 'fn'
+ */
+void ParallelForDynamic(unsigned length, SectionFunction fn, void *context);
+
+/**
+ * Child processes started by StartParallelForDynamic()
+ */
+typedef struct
+{
+    /** @private The children that have not exited yet */
+    Set pids;
+
+    /** @private Shared memory, the next item a child will claim */
+    unsigned *next_item;
+
+    /** @private The number of items */
+    unsigned length;
+} ParallelJob;
+
+/**
+ * @memberof ParallelJob
+ * Like ParallelForDynamic(), but returns as soon as the child processes are started,
+ * so the caller can do other work while they run. Call FinishParallelJob() once it is done
+ */
+void StartParallelForDynamic(ParallelJob *job, unsigned length, SectionFunction fn, void *context);
+
+/**
+ * @memberof ParallelJob
+ * @returns true once every child process has exited, without waiting for them
+ */
+bool ParallelJobDone(ParallelJob *job);
+
+/**
+ * @memberof ParallelJob
+ * Stop handing out items. Each child finishes the item it is on, then exits
+ * without claiming another, so the job ends within one item's time
+ */
+void CancelParallelJob(ParallelJob *job);
+
+/**
+ * @memberof ParallelJob
+ * Wait for every child process to exit, and free the job's memory
+ */
+void FinishParallelJob(ParallelJob *job);
+
+#endif
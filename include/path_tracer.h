@@ -0,0 +1,200 @@
+#ifndef PATH_TRACER_H
+#define PATH_TRACER_H
+
+#include <stdbool.h>
+
+#include "scene.h"
+#include "accumulator.h"
+#include "checkpoint.h"
+
+/**
+ * Controls a progressive path traced render, see RenderSceneProgressive()
+ */
+typedef struct
+{
+    /** The most samples per pixel that will be taken before rendering stops */
+    unsigned max_samples;
+
+    /** The maximum number of bounces along a single path */
+    int max_depth;
+
+    /**
+     * Rendering stops early once AccumulatorNoise() falls below this value.
+     * A value of 0.0 disables early stopping
+     */
+    double target_noise;
+
+    /** The number of passes between intermediate images. A value of 0 disables intermediate images */
+    unsigned publish_interval;
+
+    /** The *.ppm file intermediate images are written to. Ignored if NULL */
+    const char *publish_filename;
+
+    /**
+     * Where the accumulated samples are saved between passes, see SaveAccumulator(). When
+     * resuming, a render starts from the saved samples. Disabled unless a filename is set. The
+     * scene hash and seed are taken from the scene
+     *
+     * @note The canvas' auxiliary planes are filled by the first pass, so a resumed render leaves them alone
+     */
+    CheckpointSettings checkpoint;
+} ProgressiveSettings;
+
+/**
+ * Summary of a progressive render, returned by RenderSceneProgressive()
+ */
+typedef struct
+{
+    /** The number of samples per pixel in the final image */
+    unsigned samples;
+
+    /** The final value of AccumulatorNoise() */
+    double noise;
+
+    /** Wall clock time spent rendering, in seconds */
+    double seconds;
+
+    /** True if rendering stopped because 'target_noise' was reached */
+    bool converged;
+} ProgressiveReport;
+
+/**
+ * @memberof ProgressiveSettings
+ * Generates settings with sensible defaults
+ *
+ * @line
+ *
+ * Default Values
+ * - ProgressiveSettings.max_samples = 64;
+ * - ProgressiveSettings.max_depth = 8;
+ * - ProgressiveSettings.target_noise = 0.0;
+ * - ProgressiveSettings.publish_interval = 0;
+ * - ProgressiveSettings.publish_filename = NULL;
+ * - ProgressiveSettings.checkpoint = DefaultCheckpointSettings();
+ */
+ProgressiveSettings DefaultProgressiveSettings();
+
+/**
+ * Controls a path traced render that has to finish within a wall clock budget, see RenderSceneBudgeted()
+ */
+typedef struct
+{
+    /** Seconds the render may take, counted from the start of the call */
+    double budget;
+
+    /** The maximum number of bounces in the first pass, which is kept cheap so that the image is complete early */
+    int preview_depth;
+
+    /** The first pass traces one path per square of this many pixels on a side, and fills the square with its color */
+    unsigned preview_scale;
+
+    /** The maximum number of bounces once a tile is refined */
+    int max_depth;
+
+    /** The most samples per pixel a tile is refined to */
+    unsigned max_samples;
+
+    /** The number of samples added to each tile picked for refinement, before the tiles' errors are compared again */
+    unsigned round_samples;
+
+    /** Tiles whose AccumulatorTileNoise() falls below this value are not refined further. 0.0 refines until the deadline */
+    double target_noise;
+} BudgetSettings;
+
+/**
+ * Summary of a budgeted render, returned by RenderSceneBudgeted(). Tiles are refined
+ * separately, so the quality reached differs across the image
+ */
+typedef struct
+{
+    /** The number of tiles refined past the first pass */
+    unsigned refined_tiles;
+
+    /** The number of tiles in the image */
+    unsigned tile_count;
+
+    /** The fewest samples per pixel in any tile, 0 if a tile only has the first pass */
+    unsigned min_samples;
+
+    /** The average number of samples per pixel over the image */
+    double mean_samples;
+
+    /** The average of AccumulatorTileNoise() over the tiles, weighted by their size. INFINITY until every tile has two refined samples */
+    double noise;
+
+    /** Wall clock time spent rendering, in seconds */
+    double seconds;
+
+    /** True if every tile reached 'target_noise' or 'max_samples' before the deadline */
+    bool converged;
+} BudgetReport;
+
+/**
+ * @memberof BudgetSettings
+ * Generates settings with sensible defaults
+ *
+ * @line
+ *
+ * Default Values
+ * - BudgetSettings.budget = 1.0;
+ * - BudgetSettings.preview_depth = 2;
+ * - BudgetSettings.preview_scale = 4;
+ * - BudgetSettings.max_depth = 8;
+ * - BudgetSettings.max_samples = 256;
+ * - BudgetSettings.round_samples = 4;
+ * - BudgetSettings.target_noise = 0.0;
+ */
+BudgetSettings DefaultBudgetSettings();
+
+/**
+ * @memberof Scene
+ * Follows a single path from the given ray through the scene, and returns an estimate
+ * of the light travelling back along it. Direct light is estimated with a shadow ray
+ * towards the scene's light at every bounce, indirect light by importance sampling the
+ * material (cosine weighted diffuse bounces, perfect mirror reflection and refraction)
+ *
+ * @param 'Scene *s' The scene to trace
+ * @param 'Ray r' The ray to start the path from
+ * @param 'int max_depth' The maximum number of bounces
+ * @param 'Sampler *sampler' Positioned at the path's pixel sample, each random decision uses its next dimension
+ * @param 'SurfaceSample *surface' Filled with the albedo, normal and depth of the path's first hit. May be NULL
+ * @returns The estimated color
+ */
+Tuple3 PathTrace(Scene *s, Ray r, int max_depth, Sampler *sampler, SurfaceSample *surface);
+
+/**
+ * @memberof Scene
+ * Render the scene with the path tracer, one sample per pixel per pass, adding every pass
+ * to the given accumulator. After every pass, the canvas holds the current estimate
+ * of the image. Rendering continues from the samples already in the accumulator,
+ * so repeated calls keep refining the same image. Sample points come from the scene
+ * sampler's type and seed, distributed over settings.max_samples samples per pixel.
+ *
+ * @param 'Scene *s' The scene to render
+ * @param 'Canvas *c' The canvas to write the image to
+ * @param 'Accumulator *a' The accumulator to add samples to, must match the canvas' size
+ * @param 'ProgressiveSettings settings' Controls when rendering stops, and intermediate images
+ * @returns How many samples were taken, the final noise level and the time taken
+ */
+ProgressiveReport RenderSceneProgressive(Scene *s, Canvas *c, Accumulator *a, ProgressiveSettings settings);
+
+/**
+ * @memberof Scene
+ * Render the scene with the path tracer, stopping at a deadline with a complete image.
+ * A first pass traces one path per settings.preview_scale pixels square at settings.preview_depth,
+ * so the canvas holds the whole image early. The rest of the budget goes to the tiles with
+ * the highest estimated error, which gain settings.round_samples samples at a time at
+ * settings.max_depth, replacing the first pass. Tiles with fewer than two samples come first,
+ * then the noisiest.
+ *
+ * @note The first pass is always finished, even past the deadline. After it, the deadline is
+ * checked before every sample of a tile, so it is overrun by at most one tile's sample
+ *
+ * @param 'Scene *s' The scene to render
+ * @param 'Canvas *c' The canvas to write the image to, its auxiliary planes are filled by the first pass at its resolution
+ * @param 'BudgetSettings settings' The budget, and how the image is refined within it
+ * @returns The quality the image reached, and the time taken
+ */
+BudgetReport RenderSceneBudgeted(Scene *s, Canvas *c, BudgetSettings settings);
+
+#endif
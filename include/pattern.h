@@ -3,6 +3,7 @@
 
 #include "tuple.h"
 #include "matrix.h"
+#include "table.h"
 
 /**
  * Tags to be applied to a pattern to indicate what type
@@ -43,9 +44,9 @@ typedef struct
     PATTERN_TYPE type;
 
     /** @private */
-    Matrix4x4 transform;
+    Affine transform;
     /** @private */
-    Matrix4x4 inverse_transform;
+    Affine inverse_transform;
 } Pattern;
 
 typedef struct Shape Shape; //For prevent circular dependencies
@@ -62,6 +63,32 @@ typedef struct Shape Shape; //For prevent circular dependencies
  */
 Tuple3 PatternColorAt(Shape *s, Tuple3 position);
 
+/**
+ * @memberof Pattern
+ * Add a pattern to the pattern table. Materials refer to their pattern by its
+ * index in this table, identical patterns share a single entry
+ *
+ * @param 'Pattern p' The pattern to add
+ * @returns The index of the pattern in the table
+ */
+unsigned AddPattern(Pattern p);
+
+/**
+ * @memberof Pattern
+ * @returns The pattern at the given index of the pattern table. The pointer is
+ * only valid until the next pattern is added
+ */
+Pattern *PatternAt(unsigned index);
+
+/**
+ * @memberof Pattern
+ * Put a pattern table in use, AddPattern() and PatternAt() use it from then on.
+ * See UseMaterialTables(), which is how this is normally called
+ *
+ * @param 'Table *t' A constructed table of patterns, or NULL for the process' own table
+ */
+void UsePatternTable(Table *t);
+
 /**
  * @memberof Pattern
  * Constructs a new solid pattern of a given color
@@ -0,0 +1,92 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdbool.h>
+
+/**
+ * Profiling reads the CPU's hardware counters (through perf_event_open) at the
+ * start and end of every traced scope, that is every phase of a run and every
+ * tile, in every process. StopProfile() reports the instructions per cycle
+ * and the cache and branch misses per ray traced, to show whether traversal
+ * is bound by memory or by mispredicted branches
+ *
+ * Counters the kernel will not open (no PMU in a virtual machine, a strict
+ * perf_event_paranoid setting, seccomp...) are reported as unavailable, and
+ * the phases and tiles are still profiled by wall time and rays traced
+ */
+
+/** Default number of samples a profile can hold, later samples are dropped */
+#define PROFILE_DEFAULT_CAPACITY 65536
+
+/**
+ * Tags for the hardware counters read while profiling
+ */
+typedef enum
+{
+    /** CPU cycles spent in user space */
+    COUNTER_CYCLES,
+    /** Instructions retired in user space */
+    COUNTER_INSTRUCTIONS,
+    /** Level 1 data cache read misses */
+    COUNTER_L1D_MISSES,
+    /** Last level cache misses */
+    COUNTER_LLC_MISSES,
+    /** Mispredicted branches */
+    COUNTER_BRANCH_MISSES,
+    /** The number of counters, not a counter */
+    COUNTER_COUNT,
+} HARDWARE_COUNTER;
+
+/**
+ * A reading of the current process' counters
+ */
+typedef struct
+{
+    /** Counter values, indexed by HARDWARE_COUNTER. Scaled up if the kernel had to multiplex them */
+    unsigned long counts[COUNTER_COUNT];
+
+    /** Rays traced by IntersectTree(), see TracedRays() */
+    unsigned long rays;
+
+    /** Wall time in nanoseconds */
+    double nanoseconds;
+
+    /** Bit 'n' is set if HARDWARE_COUNTER 'n' could be read */
+    unsigned available;
+} CounterSample;
+
+/**
+ * @returns The counter's name, as used in printed and JSON output
+ */
+const char *HardwareCounterName(HARDWARE_COUNTER counter);
+
+/**
+ * Start profiling, in this process and in every process forked from it
+ *
+ * @param 'unsigned capacity' The maximum number of samples to record
+ */
+void StartProfile(unsigned capacity);
+
+/**
+ * Stop profiling, print a summary of every phase and write the phases and
+ * tiles to the given file as JSON
+ */
+void StopProfile(const char *filename);
+
+/**
+ * @returns true if a profile is being recorded
+ */
+bool ProfileEnabled();
+
+/**
+ * Read the current process' counters, opening them the first time a process reads them
+ */
+CounterSample ReadCounters();
+
+/**
+ * @private Called when a traced scope ends. Records the difference between
+ * 'start' and the current counters as a sample of the named phase
+ */
+void RecordProfileSample(const char *name, const char *category, long argument, CounterSample *start);
+
+#endif
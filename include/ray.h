@@ -37,6 +37,6 @@ Tuple3 RayPosition(Ray r, double pos);
  * @memberof Ray
  * Transform the given ray according to the given matrix. Return the result
  */
-Ray RayTransform(Ray r, Matrix4x4 transformation);
+Ray RayTransform(Ray r, Affine transformation);
 
 #endif
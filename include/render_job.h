@@ -0,0 +1,145 @@
+#ifndef RENDER_JOB_H
+#define RENDER_JOB_H
+
+#include <stdbool.h>
+
+#include "scene.h"
+#include "canvas.h"
+#include "parallel.h"
+
+/**
+ * @private
+ * A slot of a TileQueue, 'ready' is set once 'tile' is written
+ */
+typedef struct
+{
+    Tile tile;
+    unsigned ready;
+} QueuedTile;
+
+/**
+ * @private
+ * Finished tiles in the order they were finished, in shared memory. Render processes
+ * claim the next slot with an atomic add and then publish it, so they never wait
+ * for each other or for the caller. There is a slot for every tile of the frame
+ */
+typedef struct
+{
+    /** Slots claimed so far */
+    unsigned claimed;
+
+    QueuedTile slots[];
+} TileQueue;
+
+/**
+ * A render running in the background, see StartRender(). The caller takes each
+ * tile as it is finished with NextFinishedTile(), and reads its pixels straight from
+ * the canvas being rendered to
+ */
+typedef struct
+{
+    /** @private */
+    Scene *scene;
+
+    /** @private */
+    Canvas *canvas;
+
+    /** @private The processes rendering tiles */
+    ParallelJob workers;
+
+    /** @private Shared memory, the tiles the workers have finished */
+    TileQueue *queue;
+
+    /** @private The number of tiles in the frame, and the number taken with NextFinishedTile() */
+    unsigned tile_count, taken;
+
+    /** @private When the job was started, in seconds on the monotonic clock */
+    double start;
+
+    /** @private Set by CancelRender() */
+    bool cancelled;
+} RenderJob;
+
+/**
+ * How far a RenderJob has got, see GetRenderProgress()
+ */
+typedef struct
+{
+    /** Tiles finished so far, including those not yet taken with NextFinishedTile() */
+    unsigned finished_tiles;
+
+    /** The number of tiles in the frame */
+    unsigned tile_count;
+
+    /** Seconds since the job was started */
+    double seconds;
+
+    /**
+     * Estimated seconds until the last tile is finished, from the time taken by the tiles
+     * finished so far. INFINITY until the first tile is finished, 0 once the job is complete or cancelled
+     */
+    double remaining_seconds;
+} RenderProgress;
+
+/**
+ * @memberof RenderJob
+ * Start rendering the scene to the canvas, as RenderScene() does, and return
+ * without waiting for any tile to be finished. Every job that is started must be finished with FinishRender()
+ *
+ * @param 'Canvas *c' The canvas to render to, which may hold the caller's framebuffer, see ConstructCanvasOver()
+ *
+ * @note The scene and canvas must not be changed until the job is finished. Scene.tile_done
+ * is still called from the render processes
+ */
+void StartRender(RenderJob *job, Scene *s, Canvas *c);
+
+/**
+ * @memberof RenderJob
+ * Take the next finished tile. Tiles are taken in the order they were finished,
+ * and each tile's pixels on the canvas are final once it is taken
+ *
+ * @param 'Tile *t' Set to the tile
+ * @param 'bool wait' Wait for a tile to be finished if none is ready
+ * @returns false if no tile was ready, or when waiting, once every tile has been taken
+ */
+bool NextFinishedTile(RenderJob *job, Tile *t, bool wait);
+
+/**
+ * @memberof RenderJob
+ * @returns How many tiles are finished, and an estimate of the time left. Can be called at any time
+ * before FinishRender(), it does not wait for the render processes
+ */
+RenderProgress GetRenderProgress(RenderJob *job);
+
+/**
+ * @memberof RenderJob
+ * Stop the render. Render processes check for this between tiles, so each finishes
+ * the tile it is on and exits, rather than being killed partway through writing it.
+ * Tiles finished before then can still be taken with NextFinishedTile()
+ *
+ * @note The job still has to be finished with FinishRender(), which returns once the
+ * tiles in progress are done, and frees the job's processes and memory
+ */
+void CancelRender(RenderJob *job);
+
+/**
+ * @memberof RenderJob
+ * Wait for the render processes to exit, and free the job
+ *
+ * @returns true if every tile was rendered, so the canvas holds the whole frame. false
+ * if the render was cancelled first, leaving the unfinished tiles' pixels as they were
+ */
+bool FinishRender(RenderJob *job);
+
+/**
+ * @memberof Scene
+ * Like RenderScene(), but calls 'fn' as each tile is finished. Unlike Scene.tile_done,
+ * 'fn' is called from the caller's process, so it can use the caller's memory, while
+ * the remaining tiles are rendered
+ *
+ * @param 'TileFunction fn' Called once for every tile, with the canvas
+ * @param 'void *context' Passed through to 'fn'
+ */
+void RenderSceneStreaming(Scene *s, Canvas *c, TileFunction fn, void *context);
+
+#endif
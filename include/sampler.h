@@ -0,0 +1,108 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+/**
+ * Tags to indicate how a Sampler distributes its sample points
+ */
+typedef enum
+{
+    /** Uncorrelated random points */
+    INDEPENDENT_SAMPLER,
+    /** Jittered points, one per cell of a grid */
+    STRATIFIED_SAMPLER,
+    /** Owen scrambled (0,2) Sobol points, scrambled differently for every pixel */
+    SOBOL_SAMPLER,
+    /** The same Owen scrambled Sobol points for every pixel, shifted by a per-pixel blue noise like dither */
+    BLUE_NOISE_SAMPLER,
+} SAMPLER_TYPE;
+
+/**
+ * Generates sample points for anti-aliasing, soft shadows and path tracing.
+ *
+ * Every point is a pure function of the seed, pixel, sample index and dimension, so
+ * images are identical no matter how the pixels are split between processes.
+ * Each call to SampleNext2D() or SampleNextSeed() moves on to the next dimension.
+ */
+typedef struct
+{
+    /** How sample points are distributed */
+    SAMPLER_TYPE type;
+
+    /** The number of samples expected per pixel. Stratified and Sobol points are best distributed over this many samples */
+    unsigned samples_per_pixel;
+
+    /** Seed for the whole image. Different seeds give different, equally valid, noise */
+    unsigned seed;
+
+    /** @private Pixel coordinates of the current sample */
+    unsigned x;
+
+    /** @private Pixel coordinates of the current sample */
+    unsigned y;
+
+    /** @private The current sample's index in its pixel */
+    unsigned sample_index;
+
+    /** @private The next dimension to hand out */
+    unsigned dimension;
+
+    /** @private Seed derived from 'seed' and the current pixel */
+    unsigned pixel_seed;
+} Sampler;
+
+/**
+ * @memberof Sampler
+ * Constructs a new sampler, positioned at the first sample of pixel (0, 0)
+ *
+ * @param 'SAMPLER_TYPE type' How sample points are distributed
+ * @param 'unsigned samples_per_pixel' The number of samples expected per pixel
+ * @param 'unsigned seed' Seed for the whole image
+ */
+Sampler NewSampler(SAMPLER_TYPE type, unsigned samples_per_pixel, unsigned seed);
+
+/**
+ * @memberof Sampler
+ * Move the sampler to the given sample of the given pixel, and reset its dimension
+ */
+void StartPixelSample(Sampler *s, unsigned x, unsigned y, unsigned sample_index);
+
+/**
+ * @memberof Sampler
+ * @returns The next dimension of the current sample, on [0..1)
+ */
+double SampleNext1D(Sampler *s);
+
+/**
+ * @memberof Sampler
+ * Fill 'u' and 'v' with the next two dimensions of the current sample, each on [0..1)
+ */
+void SampleNext2D(Sampler *s, double *u, double *v);
+
+/**
+ * @memberof Sampler
+ * @returns A hash of the current sample's next dimension. Used to scramble
+ * sequences that are generated with SampleSequence2D()
+ */
+unsigned SampleNextSeed(Sampler *s);
+
+/**
+ * @memberof Sampler
+ * Generates the 'index'th point of a 2D point set of 'count' points, independent of any pixel.
+ * Used when a single sample needs many well distributed points, e.g. the shadow rays cast
+ * towards an area light. Point sets with different seeds are decorrelated.
+ *
+ * @param 'SAMPLER_TYPE type' How the points are distributed. BLUE_NOISE_SAMPLER behaves like SOBOL_SAMPLER
+ * @param 'unsigned index' The point to generate
+ * @param 'unsigned count' The number of points in the set
+ * @param 'unsigned seed' Scrambles the point set
+ * @param 'double *u, *v' Filled with the point's coordinates, each on [0..1)
+ */
+void SampleSequence2D(SAMPLER_TYPE type, unsigned index, unsigned count, unsigned seed, double *u, double *v);
+
+/**
+ * @memberof Sampler
+ * A 32-bit integer hash with good avalanche behaviour
+ */
+unsigned SamplerHash(unsigned x);
+
+#endif
@@ -2,11 +2,66 @@
 #define SCENE_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "light.h"
 #include "tree.h"
 #include "camera.h"
 #include "canvas.h"
+#include "sampler.h"
+#include "stats.h"
+#include "checkpoint.h"
+
+/** The reflection/refraction recursion limit used by ColorFor() */
+#define RECURSION_LIMIT 8
+
+/**
+ * Where RenderSceneRegion() writes the pixels it renders
+ */
+typedef enum
+{
+    /** Into a canvas the size of the camera's frame, at the pixels' own locations */
+    REGION_IN_PLACE,
+    /** Into a canvas the size of the region, whose top left pixel is the region's */
+    REGION_CROPPED,
+} REGION_OUTPUT;
+
+/**
+ * A part of the camera's frame to render: a rectangle of pixels, optionally
+ * narrowed to a list of tiles. Pixels outside of it are left untouched
+ */
+typedef struct
+{
+    /** Pixel coordinates of the rectangle's top left corner */
+    unsigned x;
+
+    /** Pixel coordinates of the rectangle's top left corner */
+    unsigned y;
+
+    /** Width of the rectangle in pixels */
+    unsigned width;
+
+    /** Height of the rectangle in pixels */
+    unsigned height;
+
+    /** Indices of the frame's tiles to render, see FrameTile(). When NULL, every tile the rectangle touches is rendered */
+    unsigned *tiles;
+
+    /** The number of entries in 'tiles' */
+    unsigned tile_count;
+
+    /** Where the rendered pixels are written */
+    REGION_OUTPUT output;
+} RenderRegion;
+
+/**
+ * Function type called as each tile of a render is finished, see Scene.tile_done
+ *
+ * @param 'void *context' Scene.tile_done_context
+ * @param 'Canvas *c' The canvas the tile was rendered to
+ * @param 'Tile t' The tile, in the canvas' pixel coordinates. Its index is the frame's, see FrameTile()
+ */
+typedef void (*TileFunction)(void *context, Canvas *c, Tile t);
 
 /**
  * Represents a scene to be rendered
@@ -23,12 +78,50 @@ typedef struct Scene
 
     /** The camera that will capture the scene */
     Camera camera;
+
+    /** Generates the samples for anti-aliasing and soft shadows. With one sample
+     * per pixel, each pixel is sampled at its center
+     */
+    Sampler sampler;
+
+    /** When not NULL, rendering records its counters for every tile here. See FrameStats */
+    FrameStats *stats;
+
+    /** The part of the frame the scene file asks for, the whole frame unless it has a "region" */
+    RenderRegion region;
+
+    /**
+     * The views a scene file's "cameras" asks for, see RenderSceneViews(). 'camera' is the
+     * first of them unless the file also has a "camera". NULL, with a count of 0, for a single view
+     */
+    Camera *cameras;
+
+    /** The number of 'cameras' */
+    unsigned camera_count;
+
+    /** When not NULL, tiles it holds are skipped and every tile rendered is recorded in it, see TileCheckpoint */
+    TileCheckpoint *checkpoint;
+
+    /**
+     * When not NULL, called as each tile is finished, from the process that rendered it.
+     * Renders run in child processes, so anything it writes must be in shared memory, a file or a socket
+     */
+    TileFunction tile_done;
+
+    /** Passed through to 'tile_done' */
+    void *tile_done_context;
+
+    /** True while 'shapes' is the BVH GenerateSceneBVH() built, AddShape() clears it */
+    bool bvh_current;
+
+    /** HashSceneJson() of the metadata file the scene was read from, 0 for a scene built with ConstructScene() */
+    uint64_t hash;
 } Scene;
 
 /**
  * @memberof Scene
  * Fill out the given scene with a the camera and light, intializes
- * the shapes tree.
+ * the shapes tree. The scene samples each pixel once, at its center.
  */
 void ConstructScene(Scene *s, Camera c, Light);
 
@@ -57,6 +150,21 @@ void IntersectScene(Scene *s, Ray r, Set *intersection_set);
 */
 bool IsInShadow(Scene *s, Tuple3 location);
 
+/**
+ * @memberof Scene
+ * Returns true if any shape lies between the given location and the
+ * given target point
+ */
+bool IsOccluded(Scene *s, Tuple3 location, Tuple3 target);
+
+/**
+ * @memberof Scene
+ * Returns the fraction of the scene's light that is visible from the given
+ * location. This is 0.0 (fully occluded) or 1.0 (fully lit) for point lights,
+ * area lights will return values in between in their penumbra
+ */
+double LightVisibility(Scene *s, Tuple3 location);
+
 /**
  * @memberof Scene
  * Read a scene from the given metadata file
@@ -66,6 +174,17 @@ bool IsInShadow(Scene *s, Tuple3 location);
  */
 void ReadScene(Scene *s, const char *filename);
 
+/**
+ * @memberof Scene
+ * Like ReadScene(), but from the contents of a metadata file rather than its name
+ */
+void ReadSceneJson(Scene *s, const char *json);
+
+/**
+ * @returns A 64 bit FNV-1a hash of the contents of a scene metadata file
+ */
+uint64_t HashSceneJson(const char *json);
+
 /**
  * @memberof Scene
  * Read an object from the given metadata file,
@@ -96,10 +215,102 @@ Tuple3 ColorForLimited(Scene *s, Ray r, int limit);
 
 /**
  * @memberof Scene
- * Render a given scene to the given canvas
+ * Like ColorForLimited(), but also describes the surface the ray hit first, for
+ * the canvas' auxiliary planes
+ *
+ * @param 'Scene *s' The scene to find a color for
+ * @param 'Ray r' The ray to intersect the scene with
+ * @param 'int limit' The maximum recursion depth
+ * @param 'SurfaceSample *surface' Filled with the first hit's albedo, normal and depth. May be NULL
+ * @returns The color at the ray-scene intersection
+*/
+Tuple3 ColorForSurface(Scene *s, Ray r, int limit, SurfaceSample *surface);
+
+/**
+ * @memberof Scene
+ * Convert the scene's shape tree into a bounding volume hierarchy
+ */
+void GenerateSceneBVH(Scene *s);
+
+/**
+ * @memberof Scene
+ * Call GenerateSceneBVH(), unless the BVH is current. This is done by every
+ * render function before rendering starts, so a scene rendered repeatedly only
+ * builds its BVH once
+ *
+ * @note Shapes added other than with AddShape() need GenerateSceneBVH() to be called before the next render
+ */
+void UpdateSceneBVH(Scene *s);
+
+/**
+ * @memberof Scene
+ * Render a given scene to the given canvas, averaging the scene
+ * sampler's samples_per_pixel camera rays for every pixel
  */
 void RenderScene(Scene *s, Canvas *c);
 
+/**
+ * @memberof Scene
+ * Render a single tile of the given scene to the given canvas. Used by
+ * RenderScene(), which hands tiles out to every processor
+ *
+ * @note If the scene has a checkpoint for this canvas, a tile it already holds is
+ * not rendered again, and a tile that is rendered is recorded in it. Cropped
+ * regions, see RenderSceneRegion(), are not recorded
+ */
+void RenderSceneTile(Scene *s, Canvas *c, Tile t);
+
+/**
+ * @memberof Scene
+ * Like RenderSceneTile(), but onto a canvas whose top left pixel is the tile's. The
+ * canvas only has to be as large as the tile, so a worker rendering scattered tiles
+ * does not need a canvas the size of the frame
+ */
+void RenderSceneTileCropped(Scene *s, Canvas *c, Tile t);
+
+/**
+ * @memberof RenderRegion
+ * @returns A region covering the camera's whole frame, written in place
+ */
+RenderRegion FullFrameRegion(Camera *c);
+
+/**
+ * @memberof RenderRegion
+ * @returns The region with its rectangle cut down to the part inside the camera's frame.
+ * A cropped canvas for the region should be the size of this rectangle
+ */
+RenderRegion ClipRegion(Camera *c, RenderRegion r);
+
+/**
+ * @memberof Scene
+ * Render part of the camera's frame. Only the tiles that overlap the region
+ * are visited, so the time taken scales with the region's size rather than the frame's
+ *
+ * @param 'Scene *s' The scene to render
+ * @param 'Canvas *c' The canvas to write to, the size of the camera's frame for
+ * REGION_IN_PLACE, or of the region for REGION_CROPPED
+ * @param 'RenderRegion r' The part of the frame to render, it is clipped to the frame, see ClipRegion()
+ *
+ * @note The scene's FrameStats, if any, are indexed by the frame's tiles, so they
+ * must be constructed for a canvas the size of the camera's frame
+ */
+void RenderSceneRegion(Scene *s, Canvas *c, RenderRegion r);
+
+/**
+ * @memberof Scene
+ * Render the scene from several cameras at once, as RenderScene() would for each of them.
+ * Every view shares the scene's BVH, which is built once, and the tiles of all the views are
+ * handed out together, so processors that finish one view carry on with the next rather
+ * than waiting for the slowest tile of each
+ *
+ * @param 'Camera *cameras' The views, such as the scene's 'cameras'
+ * @param 'Canvas *canvases' A canvas for each view, the size of its camera
+ * @param 'unsigned count' The number of views
+ *
+ * @note The scene's FrameStats are indexed by a single frame's tiles, so they are not recorded
+ */
+void RenderSceneViews(Scene *s, Camera *cameras, Canvas *canvases, unsigned count);
+
 /**
  * @memberof Scene
  * Render the given scene to the given canvas without
@@ -0,0 +1,190 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "scene.h"
+#include "canvas.h"
+#include "material.h"
+
+/**
+ * Messages a render server sends back for a request, see net.h
+ */
+typedef enum
+{
+    /** uint64 scene hash, uint32 canvas width, uint32 canvas height, uint32 1 if the scene was already loaded */
+    SERVER_FRAME = 1,
+    /** uint32 tile index, x, y, width and height, then 8 bit red, green and blue for each of its pixels */
+    SERVER_TILE = 2,
+    /** double seconds spent on the request. Always the last message */
+    SERVER_DONE = 3,
+    /** A message describing what was wrong with the request. Always the last message */
+    SERVER_ERROR = 4,
+} SERVER_MESSAGE;
+
+/**
+ * Controls RunRenderServer()
+ */
+typedef struct
+{
+    /** The Unix domain socket the server listens on, replaced if it already exists. Also takes a TCP address, see net.h */
+    const char *socket_path;
+
+    /** The most scenes kept loaded, the least recently used is dropped to load another */
+    unsigned cache_size;
+
+    /**
+     * Seconds a client may take to send its whole request, and the longest any one send of the
+     * reply may wait for the client to read. Requests are served one at a time, so a client
+     * that never finishes sending or reading would otherwise hold up every later request
+     */
+    double request_timeout;
+} ServerSettings;
+
+/**
+ * @memberof ServerSettings
+ * Generates settings with sensible defaults
+ *
+ * @line
+ *
+ * Default Values
+ * - ServerSettings.socket_path = "/tmp/ctracer.sock";
+ * - ServerSettings.cache_size = 8;
+ * - ServerSettings.request_timeout = 10;
+ */
+ServerSettings DefaultServerSettings();
+
+/**
+ * A scene loaded by a render server, with its BVH built
+ */
+typedef struct
+{
+    /** @private HashSceneJson() of the file the scene was read from */
+    uint64_t hash;
+
+    /** @private */
+    Scene scene;
+
+    /** @private The scene's materials and patterns, freed with it */
+    MaterialTables tables;
+
+    /** @private The SceneCache.clock of the entry's last use */
+    unsigned long last_used;
+
+    /** @private */
+    bool loaded;
+} CachedScene;
+
+/**
+ * Scenes that are ready to render, keyed by the hash of their metadata file.
+ * Once full, loading a scene drops the least recently used one
+ *
+ * @note Each cached scene has its own MaterialTables, so its materials and patterns
+ * are freed when it is dropped, and a long running server holds only those of the
+ * scenes in its cache. FindCachedScene() and CacheScene() put the tables of the scene
+ * they return in use, see UseMaterialTables(), and they stay in use until another
+ * scene is returned or the cache is deconstructed. A scene read outside the cache
+ * while one is in use must be read after UseMaterialTables(NULL)
+ */
+typedef struct
+{
+    /** @private */
+    CachedScene *entries;
+
+    /** @private */
+    unsigned capacity;
+
+    /** @private Counts lookups, orders the entries by their last use */
+    unsigned long clock;
+} SceneCache;
+
+/**
+ * @memberof SceneCache
+ * Generates an empty cache that holds at most 'capacity' scenes
+ */
+void ConstructSceneCache(SceneCache *cache, unsigned capacity);
+
+/**
+ * @memberof SceneCache
+ * Deconstruct every scene in the cache, and the cache itself. The process' own
+ * material tables are put back in use
+ */
+void DeconstructSceneCache(SceneCache *cache);
+
+/**
+ * @memberof SceneCache
+ * @returns The scene read from a metadata file with the given hash, or NULL if it is not loaded
+ */
+Scene *FindCachedScene(SceneCache *cache, uint64_t hash);
+
+/**
+ * @memberof SceneCache
+ * Find the scene read from the given metadata file's contents, reading it and
+ * building its BVH if it is not loaded
+ *
+ * @param 'const char *json' The contents of a scene metadata file, see ReadSceneJson()
+ * @param 'bool *cached' Set to true if the scene was already loaded
+ * @returns The scene, which stays valid until the cache drops it
+ */
+Scene *CacheScene(SceneCache *cache, const char *json, bool *cached);
+
+/**
+ * Listen for render requests on a Unix domain socket, one per connection, until a
+ * request asks the server to shut down. A request is a JSON object, sent whole before
+ * the client shuts down its side of the connection for writing:
+ *
+ * - "scene": The name of a scene metadata file, read by the server
+ * - "scene_hash": Instead of "scene", the hash of a loaded scene as a string of hex digits
+ * - "camera": Optional, replaces the scene's camera, in the same form as in a scene file
+ * - "region": Optional, replaces the scene's region, in the same form as in a scene file
+ * - "shutdown": Optional, when true the server stops once it has replied
+ *
+ * The reply is a SERVER_FRAME message, a SERVER_TILE message as each tile is finished,
+ * and a SERVER_DONE message, or a SERVER_ERROR message instead, see SERVER_MESSAGE.
+ * A request not received within ServerSettings.request_timeout is answered with a SERVER_ERROR,
+ * and a client that does not read its reply is given up on once a send waits that long
+ *
+ * @note Requests are checked in a child process before they are used, so a malformed
+ * request or scene file is answered with an error rather than stopping the server
+ */
+void RunRenderServer(ServerSettings settings);
+
+/**
+ * Summary of a request to a render server, filled in by RequestServerRender()
+ */
+typedef struct
+{
+    /** The hash of the scene rendered, can be sent as "scene_hash" by later requests */
+    uint64_t scene_hash;
+
+    /** True if the scene was already loaded by the server */
+    bool cached;
+
+    /** The number of tiles received */
+    unsigned tiles;
+
+    /** Seconds the server spent on the request */
+    double seconds;
+} ServerReply;
+
+/**
+ * Send a request to a render server, and read the tiles it sends back
+ *
+ * @param 'const char *socket_path' The socket the server listens on
+ * @param 'const char *request' The request, see RunRenderServer()
+ * @param 'Canvas *c' Constructed with the size of the server's canvas, and filled in with the tiles.
+ * Deconstruct it when this returns true
+ * @param 'ServerReply *reply' Filled in with a summary of the reply
+ * @returns false, printing why, if the server could not be reached or replied with an error
+ */
+bool RequestServerRender(const char *socket_path, const char *request, Canvas *c, ServerReply *reply);
+
+/**
+ * Ask a render server to shut down, and wait for it to reply
+ *
+ * @returns false if the server could not be reached
+ */
+bool StopRenderServer(const char *socket_path);
+
+#endif
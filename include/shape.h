@@ -5,6 +5,7 @@
 #include "ray.h"
 #include "matrix.h"
 #include "material.h"
+#include "bounds.h"
 
 /** Tags to indicate what type of shape is being represented */
 typedef enum
@@ -24,15 +25,24 @@ typedef enum
 typedef struct Shape
 {
     /** @private */
-    Matrix4x4 transformation;
+    Affine transformation;
     /** @private */
-    Matrix4x4 inverse_transform;
+    Affine inverse_transform;
 
-    /** The shape's material */
-    Material material;
+    /** Index of the shape's material in the material table, see ShapeMaterial() and SetShapeMaterial() */
+    unsigned material;
 
     /** The shapes type tag, indicates the type of shape being represented */
     SHAPE_TYPE type;
+
+    /** The shape's number in its scene, starting from 1. Assigned by GenerateSceneBVH(), 0 until then */
+    unsigned id;
+
+    /** @private World space bounding box, see UpdateShapeBounds() */
+    Bounds bounds;
+
+    /** @private Center of 'bounds' */
+    Tuple3 centroid;
 } Shape;
 
 /**
@@ -41,6 +51,26 @@ typedef struct Shape
  */
 void ApplyTransformation(Shape *s, Matrix4x4 t);
 
+/**
+ * @memberof Shape
+ * Recalculate the shape's cached world space bounds and centroid. The constructors and
+ * ApplyTransformation() do this, call it after setting 'transformation' directly
+ */
+void UpdateShapeBounds(Shape *s);
+
+/**
+ * @memberof Shape
+ * @returns The shape's material, from the material table. The pointer is only
+ * valid until the next material is added to the table
+ */
+Material *ShapeMaterial(Shape *s);
+
+/**
+ * @memberof Shape
+ * Give the shape a material, adding it to the material table if it is not already there
+ */
+void SetShapeMaterial(Shape *s, Material m);
+
 /**
  * @memberof Shape
  * Generate a new sphere
@@ -0,0 +1,156 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "canvas.h"
+
+/**
+ * Tags for the counters kept while rendering. Counters are only collected
+ * when the tracer is built with RENDER_STATS defined (see 'make stats'),
+ * otherwise they cost nothing and always read zero
+ */
+typedef enum
+{
+    /** Rays traced through the BVH by IntersectTree() */
+    STAT_RAYS,
+    /** Nodes visited by IntersectNode() */
+    STAT_NODE_VISITS,
+    /** Ray-bounding box tests */
+    STAT_BOX_TESTS,
+    /** Ray-shape tests made by Intersect() */
+    STAT_PRIMITIVE_TESTS,
+    /** Ray-shape tests that found an intersection */
+    STAT_PRIMITIVE_HITS,
+    /** Shadow rays cast by IsOccluded() and IsInShadow() */
+    STAT_SHADOW_RAYS,
+    /** Calls to ColorForLimited(), primary and secondary rays that were shaded */
+    STAT_SHADE_CALLS,
+    /** Total length of every intersection list returned by IntersectTree() */
+    STAT_HIT_LIST_LENGTH,
+    /** Longest intersection list returned by IntersectTree() */
+    STAT_MAX_HIT_LIST_LENGTH,
+    /** Deepest reflection/refraction recursion reached by ColorForLimited() */
+    STAT_MAX_RECURSION_DEPTH,
+    /** The number of counters, not a counter */
+    STAT_COUNT,
+} RENDER_STAT;
+
+/**
+ * A set of render counters
+ */
+typedef struct
+{
+    /** Counter values, indexed by RENDER_STAT */
+    unsigned long counters[STAT_COUNT];
+} RenderStats;
+
+/**
+ * Counters for a whole frame, and for each of the frame's tiles
+ */
+typedef struct
+{
+    /** Counters for the whole frame, the sum (or maximum) of every tile's counters */
+    RenderStats frame;
+
+    /** @private Counters for every tile, shared memory so that child processes can fill them in */
+    RenderStats *tiles;
+
+    /** @private The tiles of the canvas the stats were collected for */
+    Canvas *canvas;
+
+    /** @private The number of tiles */
+    unsigned tile_count;
+} FrameStats;
+
+/**
+ * Counters for the current process. Rendering resets these at the start of every
+ * tile and copies them into the frame's stats at the end
+ */
+extern RenderStats process_stats;
+
+#ifdef RENDER_STATS
+/** Add 'n' to one of the current process' counters */
+#define STAT_ADD(stat, n) (process_stats.counters[(stat)] += (unsigned long)(n))
+/** Raise one of the current process' counters to at least 'n' */
+#define STAT_MAX(stat, n)                                              \
+    do                                                                 \
+    {                                                                  \
+        unsigned long stat_value = (unsigned long)(n);                 \
+        if (stat_value > process_stats.counters[(stat)])               \
+        {                                                              \
+            process_stats.counters[(stat)] = stat_value;               \
+        }                                                              \
+    } while (0)
+#else
+#define STAT_ADD(stat, n) ((void)0)
+#define STAT_MAX(stat, n) ((void)0)
+#endif
+
+/**
+ * @returns The counter's name, as used in printed and JSON output
+ */
+const char *RenderStatName(RENDER_STAT stat);
+
+/**
+ * @memberof RenderStats
+ * Set every counter to zero
+ */
+void ResetRenderStats(RenderStats *stats);
+
+/**
+ * @memberof RenderStats
+ * Combine 'source' into 'destination'. Maximum counters keep the larger
+ * value, all other counters are added together
+ */
+void MergeRenderStats(RenderStats *destination, RenderStats *source);
+
+/**
+ * @memberof FrameStats
+ * Allocate per tile counters for frames rendered onto the given canvas
+ */
+void ConstructFrameStats(FrameStats *f, Canvas *c);
+
+/**
+ * @memberof FrameStats
+ * Free the per tile counters
+ */
+void DeconstructFrameStats(FrameStats *f);
+
+/**
+ * @memberof FrameStats
+ * Zero the frame's and every tile's counters
+ */
+void ResetFrameStats(FrameStats *f);
+
+/**
+ * @memberof FrameStats
+ * Store the current process' counters as the given tile's counters. Reset the
+ * process' counters with ResetRenderStats() before rendering the tile
+ */
+void RecordTileStats(FrameStats *f, Tile t);
+
+/**
+ * @memberof FrameStats
+ * Recalculate the frame's counters from the tiles' counters
+ */
+void SumFrameStats(FrameStats *f);
+
+/**
+ * @memberof FrameStats
+ * Print the frame's counters, and a few averages, to stdout
+ */
+void PrintFrameStats(FrameStats *f);
+
+/**
+ * @memberof FrameStats
+ * Write the frame's counters and every tile's counters to a JSON file
+ */
+void WriteFrameStatsToJSON(FrameStats *f, const char *filename);
+
+/**
+ * @memberof FrameStats
+ * Write a false color picture of one counter to a *.ppm file, the size of
+ * the canvas. Every tile is filled with a color from blue (lowest) to red (highest)
+ */
+void WriteFrameStatsHeatmap(FrameStats *f, RENDER_STAT stat, const char *filename);
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef TABLE_H
+#define TABLE_H
+
+#include "set.h"
+
+/**
+ * A set of unique values. Inserting a value that is already in the table
+ * returns the index of the existing copy, so a value can be shared by
+ * storing its index instead of the value itself
+ */
+typedef struct
+{
+    /** @private The values, in the order they were first inserted */
+    Set values;
+
+    /** @private Open addressed hash table of value indexes plus one, zero for an empty bucket */
+    unsigned *buckets;
+
+    /** @private The number of buckets, always a power of two */
+    unsigned bucket_count;
+} Table;
+
+/**
+ * @memberof Table
+ * Constructs an empty table
+ *
+ * @param 'Table *t' The table to initialize
+ * @param 'unsigned data_width' The size of each value in bytes. Values are compared byte for byte
+ */
+void ConstructTable(Table *t, unsigned data_width);
+
+/**
+ * @memberof Table
+ * Frees the table's memory
+ */
+void DeconstructTable(Table *t);
+
+/**
+ * @memberof Table
+ * Add a value to the table, unless an identical value is already in it
+ *
+ * @param 'void *value' A pointer to the value to add, copied into the table
+ * @returns The index of the value in the table
+ */
+unsigned TableInsert(Table *t, void *value);
+
+/**
+ * @memberof Table
+ * @returns A pointer to the value at the given index. The pointer is only valid
+ * until the next value is inserted
+ */
+void *TableIndex(Table *t, unsigned index);
+
+/**
+ * @memberof Table
+ * @returns The number of unique values in the table
+ */
+unsigned TableLength(Table *t);
+
+#endif
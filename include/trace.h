@@ -0,0 +1,87 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+
+#include "profile.h"
+
+/**
+ * Trace events record when each phase of a run (reading the scene, building
+ * the BVH, rendering every tile, writing the image...) started and how long it
+ * took, in every process. StopTrace() writes them in the Chrome trace event
+ * format, which can be opened with chrome://tracing or https://ui.perfetto.dev
+ *
+ * Traced scopes are also where hardware counters are sampled while a profile
+ * is running, see profile.h. While neither is running, a traced scope costs two branches
+ */
+
+/** Default number of events a trace can hold, later events are dropped */
+#define TRACE_DEFAULT_CAPACITY 65536
+
+/**
+ * @private A traced scope that has started but not yet ended
+ */
+typedef struct
+{
+    /** Name of the event, must outlive the scope */
+    const char *name;
+
+    /** Category of the event, used to filter events in the viewer */
+    const char *category;
+
+    /** Number shown with the event, e.g. the tile index. Negative for none */
+    long argument;
+
+    /** Start time in microseconds, negative when tracing is disabled */
+    double start;
+
+    /** Counters at the start of the scope, only read while profiling */
+    CounterSample counters;
+
+    /** True if the scope started while profiling */
+    bool profiled;
+} TraceScope;
+
+/**
+ * Start recording trace events, in this process and in every process forked from it
+ *
+ * @param 'unsigned capacity' The maximum number of events to record
+ */
+void StartTrace(unsigned capacity);
+
+/**
+ * Stop recording trace events, and write every recorded event to the given file as Chrome trace JSON
+ */
+void StopTrace(const char *filename);
+
+/**
+ * @returns true if trace events are being recorded
+ */
+bool TraceEnabled();
+
+/**
+ * @private Use TRACE_SCOPE() or TRACE_SCOPE_ARGUMENT() instead
+ */
+TraceScope BeginTraceScope(const char *name, const char *category, long argument);
+
+/**
+ * @private Records the event (and profile sample) for a scope, called automatically when a TRACE_SCOPE() variable goes out of scope
+ */
+void EndTraceScope(TraceScope *scope);
+
+#define TRACE_CONCATENATE_(a, b) a##b
+#define TRACE_CONCATENATE(a, b) TRACE_CONCATENATE_(a, b)
+
+/**
+ * Record an event from this point to the end of the enclosing block
+ */
+#define TRACE_SCOPE(name, category) TRACE_SCOPE_ARGUMENT(name, category, -1)
+
+/**
+ * Like TRACE_SCOPE(), with a number attached to the event
+ */
+#define TRACE_SCOPE_ARGUMENT(name, category, argument)                                                 \
+    TraceScope TRACE_CONCATENATE(trace_scope_, __LINE__) __attribute__((cleanup(EndTraceScope))) = \
+        BeginTraceScope((name), (category), (long)(argument))
+
+#endif
@@ -6,6 +6,59 @@
 #include "material.h"
 #include "shape.h"
 #include "bounds.h"
+#include "intersection.h"
+
+/**
+ * Tags for the precision IntersectTree() tests a tree's bounding boxes in
+ */
+typedef enum
+{
+    /** Every node's box is tested in double precision, one node at a time */
+    DOUBLE_PRECISION_TRAVERSAL,
+
+    /** A node's children's boxes are tested in single precision, FLOAT_BOUNDS_WIDTH at
+     * a time, and only the children that are hit are visited. The boxes are rounded outwards,
+     * so no hits are lost, and shapes are still tested in double precision
+     */
+    SINGLE_PRECISION_TRAVERSAL,
+} TRAVERSAL_PRECISION;
+
+/** The number of SHAPE_TYPEs */
+#define SHAPE_TYPE_COUNT (TRIANGLE + 1)
+
+/**
+ * @private The data needed to intersect a node's shapes of one type, packed
+ * together so a leaf scan touches as few cache lines as possible. Everything
+ * else about a shape (material, transformation, id) is only read for the hits
+ */
+typedef struct
+{
+    /** @private Inverse transformations of the shapes */
+    Affine *inverse_transforms;
+
+    /** @private Where each shape is in its node's 'shapes' set */
+    unsigned *indices;
+
+    /** @private The number of shapes of this type */
+    unsigned length;
+} ShapeColumn;
+
+/**
+ * @private A node's spheres or triangles in world space, SHAPE_BLOCK_WIDTH to a
+ * block, so a single IntersectSphereBlock() or IntersectTriangleBlock() call tests
+ * a ray against a whole block
+ */
+typedef struct
+{
+    /** @private SphereBlocks or TriangleBlocks, depending on the column */
+    void *blocks;
+
+    /** @private Where each shape is in its node's 'shapes' set, one per lane */
+    unsigned *indices;
+
+    /** @private The number of shapes in the blocks, the last block may not be full */
+    unsigned length;
+} BlockColumn;
 
 /** @private A tree node */
 typedef struct Node
@@ -21,6 +74,21 @@ typedef struct Node
 
     /** @private The node's bounding box */
     Bounds bounds;
+
+    /** @private The node's shapes that are not in a block, split by type. Built by CalculateBounds() */
+    ShapeColumn columns[SHAPE_TYPE_COUNT];
+
+    /** @private The node's spheres that are still round in world space */
+    BlockColumn sphere_blocks;
+
+    /** @private The node's triangles */
+    BlockColumn triangle_blocks;
+
+    /** @private The bounds of the node's children in single precision, in the same order as 'children' */
+    FloatBounds child_bounds;
+
+    /** @private The number of shapes in 'columns' and the blocks, if this is not 'shapes.length' the columns are out of date and not used */
+    unsigned long packed_length;
 } Node;
 
 /** A tree of shapes */
@@ -28,6 +96,9 @@ typedef struct Tree
 {
     /** @private The root node in the tree */
     Node start;
+
+    /** The precision IntersectTree() tests bounding boxes in, DOUBLE_PRECISION_TRAVERSAL unless set */
+    TRAVERSAL_PRECISION precision;
 } Tree;
 
 /** 
@@ -55,7 +126,7 @@ void DeconstructTree(Tree *tree);
 /**
  * @memberof Tree
  * Copy the source tree to the destination tree, including all
- * shapes and child nodes.
+ * shapes, child nodes and traversal precision.
  * 
  * @note The destination node should be uninitialized before 
  * CloneTree() is called
@@ -90,10 +161,36 @@ void PropagateTransform(Tree *tree, Matrix4x4 transform);
 /**
  * @memberof Tree
  * Apply the given material to all shapes in the given 
- * tree
+ * tree. The material is added to the material table once, and
+ * every shape refers to that one entry
+ *
+ * @note This still visits every shape in the tree, writing its 32 bit
+ * material index. GenerateBVH() regroups the shapes and drops the tree's
+ * nodes, so a material kept on a node could not be found at hit time
  */
 void PropagateMaterial(Tree *tree, Material material);
 
+/**
+ * @memberof Tree
+ * Give every shape in the tree a unique id, counting up from 1 in
+ * the order the shapes were added
+ */
+void NumberShapes(Tree *tree);
+
+/**
+ * @memberof Tree
+ * @returns The number of nodes visited and shapes tested by IntersectTree() in
+ * this process so far. Subtract two readings to find the cost of the rays traced
+ * between them
+ */
+unsigned long TraversalSteps();
+
+/**
+ * @memberof Tree
+ * @returns The number of rays traced by IntersectTree() in this process so far
+ */
+unsigned long TracedRays();
+
 /**
  * @memberof Tree
  * Add the given shape to the root node of the given tree
@@ -104,7 +201,9 @@ void AddShapeToTree(Tree *tree, Shape *shape);
  * @memberof Tree
  * @private
  * Calculate the bounding boxes for every node in the given tree.
- * Store those bounding boxes on the nodes
+ * Store those bounding boxes on the nodes, and pack each node's
+ * shapes by type and its children's boxes in single precision
+ * for IntersectTree()
  */
 void CalculateBounds(Tree *tree);
 
@@ -18,14 +18,15 @@ typedef unsigned char uint8_t;
 */
 typedef __m256d Tuple3 align;
 
-#define SHUFFLE_M256(v1, v2, p1, p2, p3, p4) \
-    _mm256_permutex2var_pd(v1, _mm256_set_epi64x((p4 + 4), (p3 + 4), (p2), (p1)), v2)
+#define PERMUTE_IMMEDIATE(p1, p2, p3, p4) \
+    ((p1) | ((p2) << 2) | ((p3) << 4) | ((p4) << 6))
+#define SHUFFLE_M256(v1, v2, p1, p2, p3, p4)                                  \
+    _mm256_blend_pd(_mm256_permute4x64_pd(v1, PERMUTE_IMMEDIATE(p1, p2, p3, p4)), \
+                    _mm256_permute4x64_pd(v2, PERMUTE_IMMEDIATE(p1, p2, p3, p4)), 0xC)
 #define SWIZZLE_M256(val, p1, p2, p3, p4) \
     SHUFFLE_M256(val, val, p1, p2, p3, p4)
 #define ADJOINT_M256(val) \
     SWIZZLE_M256(val, 0, 2, 1, 3)
-#define DISTRIBUTE_256(A, B) \
-    _mm512_insertf64x4(_mm512_insertf64x4(_mm512_set1_pd(0.0), A, 0), B, 1)
 
 /**
  * @memberof Tuple3
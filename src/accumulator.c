@@ -0,0 +1,123 @@
+#include <math.h>
+#include <string.h>
+
+#include "accumulator.h"
+#include "shmem.h"
+#include "trace.h"
+
+/* Keeps nearly black pixels from dominating the relative noise estimate */
+#define NOISE_LUMINANCE_FLOOR 0.01
+
+static double Luminance(Tuple3 color)
+{
+    return 0.2126 * color[0] + 0.7152 * color[1] + 0.0722 * color[2];
+}
+
+void ConstructAccumulator(Accumulator *a, unsigned width, unsigned height)
+{
+    unsigned long num_pixels = (unsigned long)width * height;
+
+    a->color = shmalloc(num_pixels * 3 * sizeof(float));
+    a->luminance_squares = shmalloc(num_pixels * sizeof(float));
+    a->width = width;
+    a->height = height;
+    a->samples = 0;
+}
+
+void DeconstructAccumulator(Accumulator *a)
+{
+    unsigned long num_pixels = (unsigned long)a->width * a->height;
+
+    shfree(a->color, num_pixels * 3 * sizeof(float));
+    shfree(a->luminance_squares, num_pixels * sizeof(float));
+}
+
+void AccumulateSample(Accumulator *a, unsigned i, Tuple3 color)
+{
+    double luminance = Luminance(color);
+
+    a->color[3 * i] += (float)color[0];
+    a->color[3 * i + 1] += (float)color[1];
+    a->color[3 * i + 2] += (float)color[2];
+    a->luminance_squares[i] += (float)(luminance * luminance);
+}
+
+static Tuple3 PixelSum(Accumulator *a, unsigned i)
+{
+    Tuple3 sum = NewColor(0, 0, 0, 0);
+    sum[0] = a->color[3 * i];
+    sum[1] = a->color[3 * i + 1];
+    sum[2] = a->color[3 * i + 2];
+    return sum;
+}
+
+/* The standard error of the pixel's luminance relative to its mean, after 'samples' samples */
+static double PixelNoise(Accumulator *a, unsigned i, unsigned samples)
+{
+    double n = (double)samples;
+    double mean = Luminance(PixelSum(a, i)) / n;
+    double variance = fmax(0, (a->luminance_squares[i] / n - mean * mean) * n / (n - 1));
+
+    return sqrt(variance / n) / (mean + NOISE_LUMINANCE_FLOOR);
+}
+
+void ResolveAccumulator(Accumulator *a, Canvas *c)
+{
+    TRACE_SCOPE("ResolveAccumulator", "phase");
+
+    double scale = a->samples == 0 ? 0.0 : 1.0 / (double)a->samples;
+
+    for (unsigned i = 0; i < a->width * a->height; i++)
+    {
+        DirectWritePixel(c, TupleScalarMultiply(PixelSum(a, i), scale), i);
+    }
+}
+
+double AccumulatorNoise(Accumulator *a)
+{
+    if (a->samples < 2)
+    {
+        return INFINITY;
+    }
+
+    double total = 0;
+    for (unsigned i = 0; i < a->width * a->height; i++)
+    {
+        total += PixelNoise(a, i, a->samples);
+    }
+
+    return total / (double)(a->width * a->height);
+}
+
+void ResolveAccumulatorTile(Accumulator *a, Canvas *c, Tile t, unsigned samples)
+{
+    double scale = samples == 0 ? 0.0 : 1.0 / (double)samples;
+
+    for (unsigned y = t.y; y < t.y + t.height; y++)
+    {
+        for (unsigned x = t.x; x < t.x + t.width; x++)
+        {
+            unsigned i = y * a->width + x;
+            DirectWritePixel(c, TupleScalarMultiply(PixelSum(a, i), scale), i);
+        }
+    }
+}
+
+double AccumulatorTileNoise(Accumulator *a, Tile t, unsigned samples)
+{
+    if (samples < 2)
+    {
+        return INFINITY;
+    }
+
+    double total = 0;
+    for (unsigned y = t.y; y < t.y + t.height; y++)
+    {
+        for (unsigned x = t.x; x < t.x + t.width; x++)
+        {
+            total += PixelNoise(a, y * a->width + x, samples);
+        }
+    }
+
+    return total / (double)(t.width * t.height);
+}
@@ -1,261 +1,622 @@
+#include <math.h>
 #include <time.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <x86intrin.h>
 
 #include "matrix.h"
 #include "shape.h"
-#include "light.h"
 #include "intersection.h"
+#include "bounds.h"
+#include "sampler.h"
+#include "cpu.h"
+#include "camera.h"
 #include "canvas.h"
-#include "scene.h"
-#include "set.h"
-
-#define BENCHMARK_CYCLES 1080
-#define BENCHMARK(fn, width, samples)                               \
-    {                                                               \
-        double average = 0;                                         \
-        for (int i = 0; i < samples; i++)                           \
-        {                                                           \
-            clock_t start = clock();                                \
-            for (int j = 0; j < width; j++)                         \
-                fn;                                                 \
-            clock_t end = clock();                                  \
-            average += (double)(end - start);                       \
-        }                                                           \
-        printf("%s: %lf clocks\n", #fn, average / (double)samples); \
+
+/* The per-shape kernels are only reachable through their dispatchers in the headers,
+ * they are declared here so they can be timed on their own
+ */
+Intersection IntersectPlane(Shape *s, Ray r);
+Intersection IntersectSphere(Shape *s, Ray r);
+Intersection IntersectCube(Shape *s, Ray r);
+Intersection IntersectTriangle(Shape *s, Ray r);
+Bounds SphereBounds();
+Bounds CubeBounds();
+Bounds PlaneBounds();
+Bounds TriangleBounds();
+Tuple3 SphereNormalAt(Shape *s, Tuple3 p);
+Tuple3 PlaneNormalAt(Shape *s, Tuple3 p);
+Tuple3 TriangleNormalAt(Shape *s, Tuple3 p);
+Tuple3 CubeNormalAt(Shape *s, Tuple3 p);
+
+/** Untimed runs made before measuring, so caches, predictors and clocks settle */
+#define BENCHMARK_WARMUP_RUNS 3
+
+/** Timed runs per kernel, percentiles are taken over these */
+#define BENCHMARK_RUNS 31
+
+/** Calls made in each run. Large enough that the clock reads are noise */
+#define BENCHMARK_BATCH 4096
+
+/** Randomized inputs per kernel, a power of two so the index can be masked */
+#define BENCHMARK_INPUTS 1024
+
+/** Tuples per call of the batch transform kernels */
+#define TUPLE_BATCH_LENGTH 8
+
+#define BENCHMARK_DEFAULT_SEED 0x5EED
+#define BENCHMARK_DEFAULT_OUTPUT "./renderings/benchmark.json"
+
+/* Forces 'expression' to be computed and its result kept, without costing
+ * more than a store. The memory clobber stops inputs from being hoisted
+ * out of the benchmark loop
+ */
+#define DO_NOT_OPTIMIZE(expression)                         \
+    {                                                       \
+        __typeof__(expression) _result = (expression);      \
+        __asm__ volatile("" : : "m"(_result) : "memory");   \
+    }
+
+/* Defines a kernel that evaluates 'expression' 'count' times, stepping
+ * through the randomized inputs with 'k'
+ */
+#define KERNEL(name, expression)                         \
+    static void Kernel##name(unsigned count)             \
+    {                                                    \
+        for (unsigned i = 0; i < count; i++)             \
+        {                                                \
+            unsigned k = i & (BENCHMARK_INPUTS - 1);     \
+            (void)k;                                     \
+            DO_NOT_OPTIMIZE(expression);                 \
+        }                                                \
     }
 
-void BenchmarkMatrixEqual()
+typedef struct
 {
-    Matrix4x4 m1 = {
-        .contents = {
-            {1, 2, 3, 4},
-            {2, 4, 4, 2},
-            {8, 6, 4, 1},
-            {0, 0, 0, 1},
-        }};
-
-    Matrix4x4 m2 = {
-        .contents = {
-            {1, 2, 3, 4},
-            {2, 4, 4, 2},
-            {8, 6, 4, 1},
-            {0, 0, 0, 1},
-        }};
-
-    BENCHMARK(MatrixEqual(m1, m2), 1920, BENCHMARK_CYCLES);
-}
+    const char *group;
+    const char *name;
+    void (*kernel)(unsigned count);
 
-void BenchmarkMatrixFuzzyEqual()
+    /* The instruction set the kernel needs, it is skipped on CPUs without it */
+    CPU_TARGET target;
+} Benchmark;
+
+typedef struct
+{
+    double minimum;
+    double p5;
+    double median;
+    double p95;
+    double maximum;
+} Percentiles;
+
+typedef struct
+{
+    const Benchmark *benchmark;
+    Percentiles nanoseconds;
+    Percentiles ticks;
+} BenchmarkResult;
+
+static Tuple3 tuples_a[BENCHMARK_INPUTS];
+static Tuple3 tuples_b[BENCHMARK_INPUTS];
+static Tuple3 special_tuples[BENCHMARK_INPUTS];
+static double scalars[BENCHMARK_INPUTS];
+static Matrix4x4 matrices_a[BENCHMARK_INPUTS];
+static Matrix4x4 matrices_b[BENCHMARK_INPUTS];
+static Affine affines_a[BENCHMARK_INPUTS];
+static Affine affines_b[BENCHMARK_INPUTS];
+static Ray rays[BENCHMARK_INPUTS];
+static Tuple3 object_points[BENCHMARK_INPUTS];
+static Shape spheres[BENCHMARK_INPUTS];
+static Shape planes[BENCHMARK_INPUTS];
+static Shape cubes[BENCHMARK_INPUTS];
+static Shape triangles[BENCHMARK_INPUTS];
+static Shape mixed_shapes[BENCHMARK_INPUTS];
+static Bounds bounds[BENCHMARK_INPUTS];
+static FloatBounds float_bounds;
+static FloatRay float_rays[BENCHMARK_INPUTS];
+static SphereBlock sphere_blocks[BENCHMARK_INPUTS / SHAPE_BLOCK_WIDTH];
+static TriangleBlock triangle_blocks[BENCHMARK_INPUTS / SHAPE_BLOCK_WIDTH];
+static double block_times[2][SHAPE_BLOCK_WIDTH];
+static double batch_components[3][BENCHMARK_INPUTS];
+static TupleBatch tuple_batches[BENCHMARK_INPUTS / TUPLE_BATCH_LENGTH];
+static double batch_results[3][TUPLE_BATCH_LENGTH];
+static TupleBatch batch_output = {.components = {batch_results[0], batch_results[1], batch_results[2]}, .length = TUPLE_BATCH_LENGTH};
+static double batch_matrices[BENCHMARK_INPUTS][3][4];
+static Camera camera;
+static RayPacket ray_packet;
+static Intersection intersections_a[BENCHMARK_INPUTS];
+static Intersection intersections_b[BENCHMARK_INPUTS];
+
+static double RandomRange(Sampler *s, double low, double high)
 {
-    Matrix4x4 m1 = {
-        .contents = {
-            {1, 2, 3, 4},
-            {2, 4, 4, 2},
-            {8, 6, 4, 1},
-            {0, 0, 0, 1},
-        }};
-
-    Matrix4x4 m2 = {
-        .contents = {
-            {1, 2, 3, 4},
-            {2, 4, 4, 2},
-            {8, 6, 4, 1},
-            {0, 0, 0, 1},
-        }};
-
-    BENCHMARK(MatrixFuzzyEqual(m1, m2), 1920, BENCHMARK_CYCLES);
+    return low + (high - low) * SampleNext1D(s);
 }
 
-void BenchmarkMatrixMultiply()
+static Tuple3 RandomVec3(Sampler *s, double extent)
 {
-    Matrix4x4 m1 = {
-        .contents = {
-            {1, 2, 3, 4},
-            {2, 4, 4, 2},
-            {8, 6, 4, 1},
-            {0, 0, 0, 1},
-        }};
-
-    Matrix4x4 m2 = {
-        .contents = {
-            {1, 2, 3, 4},
-            {2, 4, 4, 2},
-            {8, 6, 4, 1},
-            {0, 0, 0, 1},
-        }};
-
-    BENCHMARK(MatrixMultiply(m1, m2), 1920, BENCHMARK_CYCLES);
+    return NewVec3(RandomRange(s, -extent, extent), RandomRange(s, -extent, extent), RandomRange(s, -extent, extent));
 }
 
-void BenchmarkMatrixTranspose()
+static Tuple3 RandomPnt3(Sampler *s, double extent)
 {
-    Matrix4x4 m1 = {
-        .contents = {
-            {1, 2, 3, 4},
-            {2, 4, 4, 2},
-            {8, 6, 4, 1},
-            {0, 0, 0, 1},
-        }};
-
-    BENCHMARK(MatrixTranspose(m1), 1920, BENCHMARK_CYCLES);
+    Tuple3 v = RandomVec3(s, extent);
+    v[3] = 1;
+    return v;
 }
 
-void BenchmarkMatrixInvert()
+/* Random rotation, scale and translation. Always invertible, so that
+ * inversion and the intersection routines see realistic matrices
+ */
+static Matrix4x4 RandomTransform(Sampler *s)
 {
-    Matrix4x4 m1 = ScalingMatrix(1, 2, 3);
-    BENCHMARK(MatrixInvert(m1), 1920, BENCHMARK_CYCLES);
+    Matrix4x4 rotation = RotationMatrix(RandomRange(s, 0, 2 * M_PI), RandomRange(s, 0, 2 * M_PI), RandomRange(s, 0, 2 * M_PI));
+    Matrix4x4 scaling = ScalingMatrix(RandomRange(s, 0.5, 2), RandomRange(s, 0.5, 2), RandomRange(s, 0.5, 2));
+    Matrix4x4 translation = TranslationMatrix(RandomRange(s, -1, 1), RandomRange(s, -1, 1), RandomRange(s, -1, 1));
+    return MatrixMultiply(translation, MatrixMultiply(rotation, scaling));
 }
 
-void BenchmarkMatrixTupleMultiply()
+/* Rays start on a shell around the origin and aim near it, so roughly
+ * half of them hit the randomly placed shapes
+ */
+static Ray RandomRay(Sampler *s)
 {
-    Matrix4x4 m1 = {
-        .contents = {
-            {1, 2, 3, 4},
-            {2, 4, 4, 2},
-            {8, 6, 4, 1},
-            {0, 0, 0, 1},
-        }};
-
-    Tuple3 t1 = NewTuple3(1, 2, 3, 4);
-
-    BENCHMARK(MatrixTupleMultiply(m1, t1), 1920, BENCHMARK_CYCLES);
+    Tuple3 origin = TupleAdd(NewPnt3(0, 0, 0), TupleScalarMultiply(TupleNormalize(RandomVec3(s, 1)), RandomRange(s, 4, 6)));
+    Tuple3 target = RandomPnt3(s, 1.5);
+    return NewRay(origin, TupleNormalize(TupleSubtract(target, origin)));
 }
 
-void BenchmarkRaySphereIntersection()
+static void GenerateInputs(unsigned seed)
 {
-    Shape sphere = NewSphere(NewPnt3(0, 0, 0), 1.0);
+    Sampler s = NewSampler(INDEPENDENT_SAMPLER, 1, seed);
+    StartPixelSample(&s, 0, 0, 0);
 
-    Ray r1 = {
-        .origin = NewPnt3(0, 0, -5),
-        .direction = NewVec3(0, 0, 1),
-    };
+    const double specials[] = {INFINITY, -INFINITY, NAN, 0.0};
 
-    BENCHMARK(Intersect(&sphere, r1), 1920, BENCHMARK_CYCLES);
-}
+    for (unsigned i = 0; i < BENCHMARK_INPUTS; i++)
+    {
+        tuples_a[i] = NewTuple3(RandomRange(&s, -10, 10), RandomRange(&s, -10, 10), RandomRange(&s, -10, 10), (double)(i & 1));
+        tuples_b[i] = NewTuple3(RandomRange(&s, -10, 10), RandomRange(&s, -10, 10), RandomRange(&s, -10, 10), (double)(i & 1));
+        scalars[i] = RandomRange(&s, 0.5, 10);
 
-void AssignDefaultTestMaterial(Material *m)
-{
-    m->pattern = NewSolidPattern(NewColor(255, 255, 255, 255));
-    m->ambient_reflection = 0.1;
-    m->diffuse_reflection = 0.9;
-    m->specular_reflection = 0.9;
-    m->shininess = 200;
-}
+        // A quarter of these have an infinity or NaN in a random lane
+        special_tuples[i] = tuples_a[i];
+        if (SampleNext1D(&s) < 0.25)
+        {
+            special_tuples[i][SampleNextSeed(&s) % 3] = specials[SampleNextSeed(&s) % 4];
+        }
 
-void ConstructDefaultScene(Scene *s)
-{
-    Camera c = NewCamera(1920, 1080, 3.14 / 4);
-    CameraApplyTransformation(&c, ViewMatrix(NewPnt3(0, 0, -1200), NewPnt3(0, 0, 0), NewVec3(0, 1, 0)));
+        matrices_a[i] = RandomTransform(&s);
+        matrices_b[i] = RandomTransform(&s);
+        affines_a[i] = AffineFromMatrix(matrices_a[i]);
+        affines_b[i] = AffineFromMatrix(matrices_b[i]);
+        rays[i] = RandomRay(&s);
+        object_points[i] = RandomPnt3(&s, 1);
+
+        spheres[i] = NewSphere(RandomPnt3(&s, 1), RandomRange(&s, 0.5, 1.5));
+        planes[i] = NewPlane(RandomPnt3(&s, 1), TupleNormalize(RandomVec3(&s, 1)));
+        cubes[i] = NewCube(RandomPnt3(&s, 1), RandomRange(&s, 0.5, 2));
+        triangles[i] = NewTriangle(RandomPnt3(&s, 2), RandomPnt3(&s, 2), RandomPnt3(&s, 2));
+        ApplyTransformation(&spheres[i], matrices_a[i]);
+        ApplyTransformation(&cubes[i], matrices_a[i]);
+
+        // Interleaved shape types, so the dispatchers cannot predict the branch
+        switch (SampleNextSeed(&s) % 4)
+        {
+        case 0:
+            mixed_shapes[i] = spheres[i];
+            break;
+        case 1:
+            mixed_shapes[i] = planes[i];
+            break;
+        case 2:
+            mixed_shapes[i] = cubes[i];
+            break;
+        default:
+            mixed_shapes[i] = triangles[i];
+            break;
+        }
+
+        bounds[i] = TransformBounds(CubeBounds(), affines_a[i]);
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            batch_components[axis][i] = tuples_a[i][axis];
+            _mm256_storeu_pd(batch_matrices[i][axis], affines_a[i].rows[axis]);
+        }
+    }
 
-    Light l = NewLight(NewPnt3(-300, -300, -300));
-    ConstructScene(s, c, l);
+    camera = NewCamera(BENCHMARK_INPUTS, BENCHMARK_INPUTS / 2, 1.047);
+    CameraApplyTransformation(&camera, ViewMatrix(NewPnt3(-2, 6, -10), NewPnt3(0, 0, 0), NewVec3(0, 1, 0)));
 
-    Shape s1 = NewSphere(NewPnt3(0, 0, 0), 1.0);
-    s1.material.diffuse_reflection = 0.7;
-    s1.material.specular_reflection = 0.2;
+    for (unsigned i = 0; i < BENCHMARK_INPUTS / TUPLE_BATCH_LENGTH; i++)
+    {
+        unsigned first = i * TUPLE_BATCH_LENGTH;
+        tuple_batches[i] = (TupleBatch){
+            .components = {batch_components[0] + first, batch_components[1] + first, batch_components[2] + first},
+            .length = TUPLE_BATCH_LENGTH,
+        };
+    }
 
-    Shape s2 = NewSphere(NewPnt3(0, 0, 0), 0.5);
+    ConstructFloatBounds(&float_bounds, BENCHMARK_INPUTS);
+    for (unsigned i = 0; i < BENCHMARK_INPUTS; i++)
+    {
+        intersections_a[i] = IntersectSphere(&spheres[i], rays[i]);
+        intersections_b[i] = IntersectCube(&cubes[i], rays[i]);
+        SetFloatBounds(&float_bounds, i, bounds[i]);
+        float_rays[i] = NewFloatRay(rays[i]);
+    }
 
-    AddShape(s, s1);
-    AddShape(s, s2);
+    // Blocks only hold spheres that are still round, so these are not the transformed 'spheres'
+    for (unsigned i = 0; i < BENCHMARK_INPUTS; i++)
+    {
+        Shape sphere = NewSphere(RandomPnt3(&s, 1), RandomRange(&s, 0.5, 1.5));
+        PackSphere(&sphere_blocks[i / SHAPE_BLOCK_WIDTH], i % SHAPE_BLOCK_WIDTH, &sphere.transformation);
+        PackTriangle(&triangle_blocks[i / SHAPE_BLOCK_WIDTH], i % SHAPE_BLOCK_WIDTH, &triangles[i].transformation);
+    }
 }
 
-void BenchmarkScene()
+KERNEL(Baseline, tuples_a[k])
+
+KERNEL(NewVec3, NewVec3(scalars[k], scalars[k], scalars[k]))
+KERNEL(NewPnt3, NewPnt3(scalars[k], scalars[k], scalars[k]))
+KERNEL(NewTuple3, NewTuple3(scalars[k], scalars[k], scalars[k], scalars[k]))
+KERNEL(NewColor, NewColor((uint8_t)k, (uint8_t)(k >> 2), (uint8_t)(k >> 4), 255))
+KERNEL(TupleHasNaNs, TupleHasNaNs(special_tuples[k]))
+KERNEL(TupleEqual, TupleEqual(tuples_a[k], tuples_b[k]))
+KERNEL(TupleContains, TupleContains(special_tuples[k], INFINITY))
+KERNEL(TupleHasInf, TupleHasInf(special_tuples[k]))
+KERNEL(TupleHasInfOrNans, TupleHasInfOrNans(special_tuples[k]))
+KERNEL(TupleFuzzyEqual, TupleFuzzyEqual(tuples_a[k], tuples_b[k]))
+KERNEL(TupleLessThan, TupleLessThan(tuples_a[k], tuples_b[k]))
+KERNEL(TupleScalarMultiply, TupleScalarMultiply(tuples_a[k], scalars[k]))
+KERNEL(TupleScalarDivide, TupleScalarDivide(tuples_a[k], scalars[k]))
+KERNEL(TupleScalarSubtract, TupleScalarSubtract(tuples_a[k], scalars[k]))
+KERNEL(TupleScalarAdd, TupleScalarAdd(tuples_a[k], scalars[k]))
+KERNEL(TupleNegate, TupleNegate(tuples_a[k]))
+KERNEL(TupleMagnitude, TupleMagnitude(tuples_a[k]))
+KERNEL(TupleFloorSum, TupleFloorSum(tuples_a[k]))
+KERNEL(TupleDotProduct, TupleDotProduct(tuples_a[k], tuples_b[k]))
+KERNEL(TupleDotProductPreserveInf, TupleDotProductPreserveInf(special_tuples[k], tuples_b[k]))
+KERNEL(TupleCrossProduct, TupleCrossProduct(tuples_a[k], tuples_b[k]))
+KERNEL(TupleNormalize, TupleNormalize(tuples_a[k]))
+KERNEL(TupleMultiplyPreserveInf, TupleMultiplyPreserveInf(special_tuples[k], tuples_b[k]))
+KERNEL(TupleMultiply, TupleMultiply(tuples_a[k], tuples_b[k]))
+KERNEL(TupleDivide, TupleDivide(tuples_a[k], tuples_b[k]))
+KERNEL(TupleAdd, TupleAdd(tuples_a[k], tuples_b[k]))
+KERNEL(TupleSubtract, TupleSubtract(tuples_a[k], tuples_b[k]))
+KERNEL(TupleReflect, TupleReflect(tuples_a[k], tuples_b[k]))
+KERNEL(MinComponent, MinComponent(tuples_a[k]))
+KERNEL(MaxComponent, MaxComponent(tuples_a[k]))
+
+KERNEL(MatrixEqual, MatrixEqual(matrices_a[k], matrices_b[k]))
+KERNEL(MatrixFuzzyEqual, MatrixFuzzyEqual(matrices_a[k], matrices_b[k]))
+KERNEL(MatrixMultiply, MatrixMultiply(matrices_a[k], matrices_b[k]))
+KERNEL(MatrixScalarMultiply, MatrixScalarMultiply(matrices_a[k], scalars[k]))
+KERNEL(MatrixAdd, MatrixAdd(matrices_a[k], matrices_b[k]))
+KERNEL(MatrixTupleMultiply, MatrixTupleMultiply(matrices_a[k], tuples_a[k]))
+KERNEL(MatrixTupleMultiplyPerserveInf, MatrixTupleMultiplyPerserveInf(matrices_a[k], special_tuples[k]))
+KERNEL(MatrixTranspose, MatrixTranspose(matrices_a[k]))
+KERNEL(MatrixInvert, MatrixInvert(matrices_a[k]))
+KERNEL(TranslationMatrix, TranslationMatrix(tuples_a[k][0], tuples_a[k][1], tuples_a[k][2]))
+KERNEL(ScalingMatrix, ScalingMatrix(tuples_a[k][0], tuples_a[k][1], tuples_a[k][2]))
+KERNEL(RotationXMatrix, RotationXMatrix(scalars[k]))
+KERNEL(RotationYMatrix, RotationYMatrix(scalars[k]))
+KERNEL(RotationZMatrix, RotationZMatrix(scalars[k]))
+KERNEL(RotationMatrix, RotationMatrix(tuples_a[k][0], tuples_a[k][1], tuples_a[k][2]))
+KERNEL(ShearingMatrix, ShearingMatrix(tuples_a[k][0], tuples_a[k][1], tuples_a[k][2], tuples_b[k][0], tuples_b[k][1], tuples_b[k][2]))
+KERNEL(IdentityMatrix, IdentityMatrix())
+KERNEL(ZeroMatrix, ZeroMatrix())
+KERNEL(ViewMatrix, ViewMatrix(rays[k].origin, object_points[k], NewVec3(0, 1, 0)))
+KERNEL(RectifyMatrix, RectifyMatrix(matrices_a[k]))
+KERNEL(AffineMultiply, AffineMultiply(affines_a[k], affines_b[k]))
+KERNEL(AffineInvert, AffineInvert(affines_a[k]))
+KERNEL(AffineTupleMultiply, AffineTupleMultiply(affines_a[k], tuples_a[k]))
+KERNEL(AffineTupleMultiplyPreserveInf, AffineTupleMultiplyPreserveInf(affines_a[k], special_tuples[k]))
+KERNEL(AffineTransposeMultiply, AffineTransposeMultiply(affines_a[k], tuples_a[k]))
+KERNEL(RayTransform, RayTransform(rays[k], affines_a[k]))
+// The batch kernels transform TUPLE_BATCH_LENGTH tuples per call, compare with AffineTupleMultiply() per tuple
+#define BATCH_KERNEL(name, call) KERNEL(name, (call, batch_results[0][0]))
+BATCH_KERNEL(AffineTransformPoints, AffineTransformPoints(affines_a[k], &tuple_batches[k / TUPLE_BATCH_LENGTH], &batch_output))
+BATCH_KERNEL(TransformTupleBatchScalar, TransformTupleBatchScalar(batch_matrices[k], &tuple_batches[k / TUPLE_BATCH_LENGTH], &batch_output))
+BATCH_KERNEL(TransformTupleBatchAvx2, TransformTupleBatchAvx2(batch_matrices[k], &tuple_batches[k / TUPLE_BATCH_LENGTH], &batch_output))
+BATCH_KERNEL(TransformTupleBatchAvx512, TransformTupleBatchAvx512(batch_matrices[k], &tuple_batches[k / TUPLE_BATCH_LENGTH], &batch_output))
+
+KERNEL(RayForPixel, RayForPixel(&camera, k, k / 2))
+// One packet is a row of a tile, compare with RayForPixel() per pixel
+KERNEL(CameraRayPacket, (CameraRayPacket(&camera, k, k / 2, TILE_SIZE, NULL, NULL, &ray_packet), ray_packet.direction[0][0]))
+
+KERNEL(NewIntersection, NewIntersection(&spheres[k], rays[k]))
+KERNEL(IntersectPlane, IntersectPlane(&planes[k], rays[k]))
+KERNEL(IntersectSphere, IntersectSphere(&spheres[k], rays[k]))
+KERNEL(IntersectCube, IntersectCube(&cubes[k], rays[k]))
+KERNEL(IntersectTriangle, IntersectTriangle(&triangles[k], rays[k]))
+KERNEL(Intersect, Intersect(&mixed_shapes[k], rays[k]))
+KERNEL(CompareIntersections, CompareIntersections(&intersections_a[k], &intersections_b[k]))
+// The block kernels test SHAPE_BLOCK_WIDTH shapes per call, compare with Intersect() per shape
+KERNEL(IntersectSphereBlock, IntersectSphereBlock(&sphere_blocks[k / SHAPE_BLOCK_WIDTH], 0xFF, rays[k], block_times[0], block_times[1]))
+KERNEL(IntersectSphereBlockScalar, IntersectSphereBlockScalar(&sphere_blocks[k / SHAPE_BLOCK_WIDTH], 0xFF, rays[k], block_times[0], block_times[1]))
+KERNEL(IntersectSphereBlockAvx2, IntersectSphereBlockAvx2(&sphere_blocks[k / SHAPE_BLOCK_WIDTH], 0xFF, rays[k], block_times[0], block_times[1]))
+KERNEL(IntersectSphereBlockAvx512, IntersectSphereBlockAvx512(&sphere_blocks[k / SHAPE_BLOCK_WIDTH], 0xFF, rays[k], block_times[0], block_times[1]))
+KERNEL(IntersectTriangleBlock, IntersectTriangleBlock(&triangle_blocks[k / SHAPE_BLOCK_WIDTH], 0xFF, rays[k], block_times[0]))
+KERNEL(IntersectTriangleBlockScalar, IntersectTriangleBlockScalar(&triangle_blocks[k / SHAPE_BLOCK_WIDTH], 0xFF, rays[k], block_times[0]))
+KERNEL(IntersectTriangleBlockAvx2, IntersectTriangleBlockAvx2(&triangle_blocks[k / SHAPE_BLOCK_WIDTH], 0xFF, rays[k], block_times[0]))
+KERNEL(IntersectTriangleBlockAvx512, IntersectTriangleBlockAvx512(&triangle_blocks[k / SHAPE_BLOCK_WIDTH], 0xFF, rays[k], block_times[0]))
+
+KERNEL(SphereBounds, SphereBounds())
+KERNEL(CubeBounds, CubeBounds())
+KERNEL(PlaneBounds, PlaneBounds())
+KERNEL(TriangleBounds, TriangleBounds())
+KERNEL(ShapeBounds, ShapeBounds(&mixed_shapes[k]))
+KERNEL(IsInBounds, IsInBounds(bounds[k], rays[k]))
+KERNEL(TransformBounds, TransformBounds(bounds[k], affines_b[k]))
+KERNEL(Centroid, Centroid(bounds[k]))
+KERNEL(NewFloatRay, NewFloatRay(rays[k]))
+// Tests FLOAT_BOUNDS_WIDTH boxes per call, compare with IsInBounds() per box
+KERNEL(IntersectFloatBounds, IntersectFloatBounds(&float_bounds, k & ~(FLOAT_BOUNDS_WIDTH - 1u), &float_rays[k]))
+KERNEL(IntersectFloatBoundsScalar, IntersectFloatBoundsScalar(&float_bounds, k & ~(FLOAT_BOUNDS_WIDTH - 1u), &float_rays[k]))
+KERNEL(IntersectFloatBoundsAvx2, IntersectFloatBoundsAvx2(&float_bounds, k & ~(FLOAT_BOUNDS_WIDTH - 1u), &float_rays[k]))
+KERNEL(IntersectFloatBoundsAvx512, IntersectFloatBoundsAvx512(&float_bounds, k & ~(FLOAT_BOUNDS_WIDTH - 1u), &float_rays[k]))
+
+KERNEL(SphereNormalAt, SphereNormalAt(&spheres[k], object_points[k]))
+KERNEL(PlaneNormalAt, PlaneNormalAt(&planes[k], object_points[k]))
+KERNEL(TriangleNormalAt, TriangleNormalAt(&triangles[k], object_points[k]))
+KERNEL(CubeNormalAt, CubeNormalAt(&cubes[k], object_points[k]))
+KERNEL(NormalAt, NormalAt(&mixed_shapes[k], rays[k].origin))
+
+#define ENTRY(group, name) {group, #name, Kernel##name, CPU_SCALAR}
+#define TARGET_ENTRY(group, name, target) {group, #name, Kernel##name, target}
+
+static const Benchmark benchmarks[] = {
+    ENTRY("harness", Baseline),
+
+    ENTRY("tuple", NewVec3),
+    ENTRY("tuple", NewPnt3),
+    ENTRY("tuple", NewTuple3),
+    ENTRY("tuple", NewColor),
+    ENTRY("tuple", TupleHasNaNs),
+    ENTRY("tuple", TupleEqual),
+    ENTRY("tuple", TupleContains),
+    ENTRY("tuple", TupleHasInf),
+    ENTRY("tuple", TupleHasInfOrNans),
+    ENTRY("tuple", TupleFuzzyEqual),
+    ENTRY("tuple", TupleLessThan),
+    ENTRY("tuple", TupleScalarMultiply),
+    ENTRY("tuple", TupleScalarDivide),
+    ENTRY("tuple", TupleScalarSubtract),
+    ENTRY("tuple", TupleScalarAdd),
+    ENTRY("tuple", TupleNegate),
+    ENTRY("tuple", TupleMagnitude),
+    ENTRY("tuple", TupleFloorSum),
+    ENTRY("tuple", TupleDotProduct),
+    ENTRY("tuple", TupleDotProductPreserveInf),
+    ENTRY("tuple", TupleCrossProduct),
+    ENTRY("tuple", TupleNormalize),
+    ENTRY("tuple", TupleMultiplyPreserveInf),
+    ENTRY("tuple", TupleMultiply),
+    ENTRY("tuple", TupleDivide),
+    ENTRY("tuple", TupleAdd),
+    ENTRY("tuple", TupleSubtract),
+    ENTRY("tuple", TupleReflect),
+    ENTRY("tuple", MinComponent),
+    ENTRY("tuple", MaxComponent),
+
+    ENTRY("matrix", MatrixEqual),
+    ENTRY("matrix", MatrixFuzzyEqual),
+    ENTRY("matrix", MatrixMultiply),
+    ENTRY("matrix", MatrixScalarMultiply),
+    ENTRY("matrix", MatrixAdd),
+    ENTRY("matrix", MatrixTupleMultiply),
+    ENTRY("matrix", MatrixTupleMultiplyPerserveInf),
+    ENTRY("matrix", MatrixTranspose),
+    ENTRY("matrix", MatrixInvert),
+    ENTRY("matrix", TranslationMatrix),
+    ENTRY("matrix", ScalingMatrix),
+    ENTRY("matrix", RotationXMatrix),
+    ENTRY("matrix", RotationYMatrix),
+    ENTRY("matrix", RotationZMatrix),
+    ENTRY("matrix", RotationMatrix),
+    ENTRY("matrix", ShearingMatrix),
+    ENTRY("matrix", IdentityMatrix),
+    ENTRY("matrix", ZeroMatrix),
+    ENTRY("matrix", ViewMatrix),
+    ENTRY("matrix", RectifyMatrix),
+    ENTRY("affine", AffineMultiply),
+    ENTRY("affine", AffineInvert),
+    ENTRY("affine", AffineTupleMultiply),
+    ENTRY("affine", AffineTupleMultiplyPreserveInf),
+    ENTRY("affine", AffineTransposeMultiply),
+    ENTRY("affine", RayTransform),
+    ENTRY("affine", AffineTransformPoints),
+    ENTRY("affine", TransformTupleBatchScalar),
+    TARGET_ENTRY("affine", TransformTupleBatchAvx2, CPU_AVX2),
+    TARGET_ENTRY("affine", TransformTupleBatchAvx512, CPU_AVX512),
+
+    ENTRY("camera", RayForPixel),
+    ENTRY("camera", CameraRayPacket),
+
+    ENTRY("intersection", NewIntersection),
+    ENTRY("intersection", IntersectPlane),
+    ENTRY("intersection", IntersectSphere),
+    ENTRY("intersection", IntersectCube),
+    ENTRY("intersection", IntersectTriangle),
+    ENTRY("intersection", Intersect),
+    ENTRY("intersection", CompareIntersections),
+    ENTRY("intersection", IntersectSphereBlock),
+    ENTRY("intersection", IntersectSphereBlockScalar),
+    TARGET_ENTRY("intersection", IntersectSphereBlockAvx2, CPU_AVX2),
+    TARGET_ENTRY("intersection", IntersectSphereBlockAvx512, CPU_AVX512),
+    ENTRY("intersection", IntersectTriangleBlock),
+    ENTRY("intersection", IntersectTriangleBlockScalar),
+    TARGET_ENTRY("intersection", IntersectTriangleBlockAvx2, CPU_AVX2),
+    TARGET_ENTRY("intersection", IntersectTriangleBlockAvx512, CPU_AVX512),
+
+    ENTRY("bounds", SphereBounds),
+    ENTRY("bounds", CubeBounds),
+    ENTRY("bounds", PlaneBounds),
+    ENTRY("bounds", TriangleBounds),
+    ENTRY("bounds", ShapeBounds),
+    ENTRY("bounds", IsInBounds),
+    ENTRY("bounds", TransformBounds),
+    ENTRY("bounds", Centroid),
+    ENTRY("bounds", NewFloatRay),
+    ENTRY("bounds", IntersectFloatBounds),
+    ENTRY("bounds", IntersectFloatBoundsScalar),
+    TARGET_ENTRY("bounds", IntersectFloatBoundsAvx2, CPU_AVX2),
+    TARGET_ENTRY("bounds", IntersectFloatBoundsAvx512, CPU_AVX512),
+
+    ENTRY("normal", SphereNormalAt),
+    ENTRY("normal", PlaneNormalAt),
+    ENTRY("normal", TriangleNormalAt),
+    ENTRY("normal", CubeNormalAt),
+    ENTRY("normal", NormalAt),
+};
+
+#define BENCHMARK_COUNT (sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+static double Nanoseconds()
 {
-    Ray r = NewRay(NewPnt3(0, 0, -5), NewVec3(0, 0, 1));
-
-    Set is;
-    ConstructSet(&is, sizeof(Intersection));
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
 
-    Scene s;
-    ConstructDefaultScene(&s);
+static int CompareDoubles(const void *a, const void *b)
+{
+    double d1 = *(const double *)a;
+    double d2 = *(const double *)b;
+    return (d1 > d2) - (d1 < d2);
+}
 
-    BENCHMARK(IntersectScene(&s, r, &is), 1920 * 1080, 5);
+/* Nearest rank percentiles of 'count' samples, sorts 'samples' in place */
+static Percentiles ComputePercentiles(double *samples, unsigned count)
+{
+    qsort(samples, count, sizeof(double), CompareDoubles);
+
+#define RANK(p) samples[(unsigned)((p) * (count - 1) + 0.5)]
+    Percentiles p = {
+        .minimum = samples[0],
+        .p5 = RANK(0.05),
+        .median = RANK(0.5),
+        .p95 = RANK(0.95),
+        .maximum = samples[count - 1],
+    };
+#undef RANK
 
-    DeconstructSet(&is);
-    DeconstructScene(&s);
+    return p;
 }
 
-void DemoSphereScene()
+static BenchmarkResult RunBenchmark(const Benchmark *b)
 {
-    Material m;
-    AssignDefaultTestMaterial(&m);
-    m.pattern = NewSolidPattern(NewColor(255, 0, 128, 255));
-
-    Light l;
-    l.origin = NewPnt3(-1000, -2000, -750);
-    l.color = NewColor(255, 255, 255, 255);
+    double nanoseconds[BENCHMARK_RUNS];
+    double ticks[BENCHMARK_RUNS];
 
-    Canvas c;
-    ConstructCanvas(&c, 800, 600);
+    for (int i = 0; i < BENCHMARK_WARMUP_RUNS; i++)
+    {
+        b->kernel(BENCHMARK_BATCH);
+    }
 
-    Shape s = NewSphere(NewPnt3(0, 0, 2), 500);
-    s.material = m;
+    for (int i = 0; i < BENCHMARK_RUNS; i++)
+    {
+        double start_ns = Nanoseconds();
+        unsigned long long start_ticks = __rdtsc();
 
-    Shape s2 = NewSphere(NewPnt3(1, 1, -5), 50);
-    m.pattern = NewSolidPattern(NewColor(0, 255, 128, 255));
-    s2.material = m;
+        b->kernel(BENCHMARK_BATCH);
 
-    Camera ca = NewCamera(800, 600, 3.1415 / 3);
-    CameraApplyTransformation(&ca, ViewMatrix(NewPnt3(0, 0, -600), NewPnt3(0, 0, 0), NewVec3(0, -1, 0)));
+        unsigned long long end_ticks = __rdtsc();
+        double end_ns = Nanoseconds();
 
-    Scene sc;
-    ConstructScene(&sc, ca, l);
-    AddShape(&sc, s);
-    AddShape(&sc, s2);
+        nanoseconds[i] = (end_ns - start_ns) / BENCHMARK_BATCH;
+        ticks[i] = (double)(end_ticks - start_ticks) / BENCHMARK_BATCH;
+    }
 
-    RenderScene(&sc, &c);
+    BenchmarkResult r = {
+        .benchmark = b,
+        .nanoseconds = ComputePercentiles(nanoseconds, BENCHMARK_RUNS),
+        .ticks = ComputePercentiles(ticks, BENCHMARK_RUNS),
+    };
 
-    WriteToPPM(&c, "renderings/benchmark_sphere_scene.ppm");
+    return r;
+}
 
-    DeconstructScene(&sc);
-    DeconstructCanvas(&c);
+static void WritePercentiles(FILE *fp, const char *name, Percentiles p)
+{
+    fprintf(fp, "\"%s\": {\"min\": %.3f, \"p5\": %.3f, \"median\": %.3f, \"p95\": %.3f, \"max\": %.3f}",
+            name, p.minimum, p.p5, p.median, p.p95, p.maximum);
 }
 
-void DemoJsonScene()
+static void WriteResultsToJSON(BenchmarkResult *results, unsigned count, unsigned seed, const char *filename)
 {
-    Scene s;
-    ReadScene(&s, "./scenes/three_spheres.json");
+    FILE *fp = fopen(filename, "w");
+    if (fp == NULL)
+    {
+        printf("Could not open '%s' to write benchmark results\n", filename);
+        return;
+    }
 
-    Canvas canvas;
-    ConstructCanvas(&canvas, s.camera.width, s.camera.height);
+    fprintf(fp, "{\n  \"seed\": %u, \"warmup_runs\": %d, \"runs\": %d, \"batch\": %d, \"inputs\": %d, \"cpu_target\": \"%s\",\n",
+            seed, BENCHMARK_WARMUP_RUNS, BENCHMARK_RUNS, BENCHMARK_BATCH, BENCHMARK_INPUTS, CpuTargetName(CpuTarget()));
+    fprintf(fp, "  \"benchmarks\": [\n");
 
-    RenderScene(&s, &canvas);
-    WriteToPPM(&canvas, "./renderings/three_spheres.ppm");
+    for (unsigned i = 0; i < count; i++)
+    {
+        fprintf(fp, "    {\"group\": \"%s\", \"name\": \"%s\", ", results[i].benchmark->group, results[i].benchmark->name);
+        WritePercentiles(fp, "ns_per_call", results[i].nanoseconds);
+        fprintf(fp, ", ");
+        WritePercentiles(fp, "ticks_per_call", results[i].ticks);
+        fprintf(fp, i + 1 == count ? "}\n" : "},\n");
+    }
 
-    DeconstructCanvas(&canvas);
-    DeconstructScene(&s);
+    fprintf(fp, "  ]\n}\n");
+    fclose(fp);
 }
 
-void BenchmarkCubeNormalization()
+/* usage: tracer [--filter substring] [--seed n] [--output file.json]
+ * Runs every kernel whose group or name contains the filter
+ */
+int main(int argc, char **argv)
 {
-    Shape cube = NewCube(NewPnt3(0, 0, 0), 1.0);
+    const char *filter = NULL;
+    const char *output = BENCHMARK_DEFAULT_OUTPUT;
+    unsigned seed = BENCHMARK_DEFAULT_SEED;
 
-    for (double x = -2.0; x < 2.0; x += 0.1)
+    for (int i = 1; i + 1 < argc; i += 2)
     {
-        for (double y = -2.0; y < 2.0; y += 0.1)
+        if (strcmp(argv[i], "--filter") == 0)
+            filter = argv[i + 1];
+        else if (strcmp(argv[i], "--seed") == 0)
+            seed = (unsigned)strtoul(argv[i + 1], NULL, 0);
+        else if (strcmp(argv[i], "--output") == 0)
+            output = argv[i + 1];
+        else
         {
-            for (double z = -2.0; z < 2.0; z += 0.1)
-            {
-                NormalAt(&cube, NewPnt3(x, y, z));
-            }
+            printf("Unknown option '%s'\n", argv[i]);
+            return 1;
         }
     }
-}
 
-int main()
-{
-    // BenchmarkMatrixEqual();
-    // BenchmarkMatrixFuzzyEqual();
-    // BenchmarkMatrixMultiply();
-    // BenchmarkMatrixInvert();
-    // BenchmarkMatrixTranspose();
-    BenchmarkMatrixTupleMultiply();
-    // BenchmarkRaySphereIntersection();
-    // BENCHMARK(DemoSphereScene(), 1, 10);
-    // BENCHMARK(DemoJsonScene(), 1, 5); //Infinite
-    //BENCHMARK(BenchmarkCubeNormalization(), 1, 5);
-
-    // BenchmarkScene();
+    GenerateInputs(seed);
+
+    BenchmarkResult results[BENCHMARK_COUNT];
+    unsigned count = 0;
+
+    printf("Dispatching to %s kernels\n", CpuTargetName(CpuTarget()));
+    printf("%-13s %-31s %10s %10s %10s %10s\n", "group", "kernel", "min ns", "median ns", "p95 ns", "median tk");
+    for (unsigned i = 0; i < BENCHMARK_COUNT; i++)
+    {
+        const Benchmark *b = &benchmarks[i];
+        if (filter != NULL && strstr(b->name, filter) == NULL && strstr(b->group, filter) == NULL)
+            continue;
+        if (b->target > DetectCpuTarget())
+            continue;
+
+        BenchmarkResult r = RunBenchmark(b);
+        printf("%-13s %-31s %10.2f %10.2f %10.2f %10.1f\n", b->group, b->name,
+               r.nanoseconds.minimum, r.nanoseconds.median, r.nanoseconds.p95, r.ticks.median);
+        results[count++] = r;
+    }
+
+    WriteResultsToJSON(results, count, seed, output);
     return 0;
 }
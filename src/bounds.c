@@ -4,6 +4,9 @@
 #include "equality.h"
 
 #include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
 
 Bounds SphereBounds()
 {
@@ -86,20 +89,28 @@ bool IsInBounds(Bounds b, Ray r)
     Tuple3 tmaxs = _mm256_max_pd(tmin_numerators, tmax_numerators);
     Tuple3 tmins = _mm256_min_pd(tmin_numerators, tmax_numerators);
 
-    __m512d partial_result = DISTRIBUTE_256(tmins, tmaxs);
-
-    double tmin = _mm512_mask_reduce_max_pd(0x8F, partial_result); // Mask 1000_1111; Exclude 'w' and elements from tmaxs
-    double tmax = _mm512_mask_reduce_min_pd(0xF8, partial_result);
+    double tmin, tmax;
+    SlabInterval(tmins, tmaxs, &tmin, &tmax);
 
     return tmax > tmin;
 }
 
-Bounds TransformBounds(Bounds b, Matrix4x4 m)
+void SlabInterval(Tuple3 tmins, Tuple3 tmaxs, double *tmin, double *tmax)
 {
-    Bounds new_bounds = {
-        .minimum_bound = NewPnt3(INFINITY, INFINITY, INFINITY),
-        .maximum_bound = NewPnt3(-INFINITY, -INFINITY, -INFINITY)};
+    /* The lanes are reduced in the same order on every CPU, so an axis the ray is parallel
+     * to, where a time is NaN, is left out the same way. The 'w' lanes are always NaN
+     */
+    __m256d entries = _mm256_max_pd(_mm256_blend_pd(_mm256_set1_pd(-INFINITY), tmaxs, 0x8), tmins);
+    __m128d entry = _mm_max_pd(_mm256_extractf128_pd(entries, 1), _mm256_castpd256_pd128(entries));
+    *tmin = _mm_max_pd(entry, _mm_permute_pd(entry, 1))[0];
 
+    __m256d exits = _mm256_min_pd(tmaxs, _mm256_blend_pd(_mm256_set1_pd(INFINITY), tmins, 0x8));
+    __m128d exit = _mm_min_pd(_mm256_extractf128_pd(exits, 1), _mm256_castpd256_pd128(exits));
+    *tmax = _mm_min_pd(exit, _mm_permute_pd(exit, 1))[0];
+}
+
+static Bounds TransformUnboundedBounds(Bounds b, Affine m, Bounds new_bounds)
+{
     Tuple3 points[8] align = {
         // 'k' must be an immediate, so this cannot be inside the loop
         _mm256_blend_pd(b.maximum_bound, b.minimum_bound, 0),
@@ -115,7 +126,42 @@ Bounds TransformBounds(Bounds b, Matrix4x4 m)
     for (int i = 0; i < 8; i++)
     {
         Tuple3 this_corner = points[i];
-        this_corner = MatrixTupleMultiplyPerserveInf(m, this_corner);
+        this_corner = AffineTupleMultiplyPreserveInf(m, this_corner);
+
+        new_bounds.maximum_bound = _mm256_max_pd(new_bounds.maximum_bound, this_corner);
+        new_bounds.minimum_bound = _mm256_min_pd(new_bounds.minimum_bound, this_corner);
+    }
+
+    return new_bounds;
+}
+
+Bounds TransformBounds(Bounds b, Affine m)
+{
+    Bounds new_bounds = {
+        .minimum_bound = NewPnt3(INFINITY, INFINITY, INFINITY),
+        .maximum_bound = NewPnt3(-INFINITY, -INFINITY, -INFINITY)};
+
+    // Unbounded shapes, like planes, need their infinities carried through one corner at a time
+    if (TupleHasInfOrNans(b.maximum_bound) || TupleHasInfOrNans(b.minimum_bound))
+    {
+        return TransformUnboundedBounds(b, m, new_bounds);
+    }
+
+    // Corner 'i' takes its minimum on each axis whose bit is set in 'i'
+    double x[8], y[8], z[8];
+    TupleBatch corners = {.components = {x, y, z}, .length = 8};
+    for (int i = 0; i < 8; i++)
+    {
+        x[i] = (i & 1) ? b.minimum_bound[0] : b.maximum_bound[0];
+        y[i] = (i & 2) ? b.minimum_bound[1] : b.maximum_bound[1];
+        z[i] = (i & 4) ? b.minimum_bound[2] : b.maximum_bound[2];
+    }
+
+    AffineTransformPoints(m, &corners, &corners);
+
+    for (int i = 0; i < 8; i++)
+    {
+        Tuple3 this_corner = NewPnt3(x[i], y[i], z[i]);
 
         new_bounds.maximum_bound = _mm256_max_pd(new_bounds.maximum_bound, this_corner);
         new_bounds.minimum_bound = _mm256_min_pd(new_bounds.minimum_bound, this_corner);
@@ -124,6 +170,217 @@ Bounds TransformBounds(Bounds b, Matrix4x4 m)
     return new_bounds;
 }
 
+void ConstructFloatBounds(FloatBounds *fb, unsigned length)
+{
+    // Padded to a whole number of blocks, so the last block can be loaded like the rest
+    size_t padded = ((length + FLOAT_BOUNDS_WIDTH - 1) / FLOAT_BOUNDS_WIDTH) * FLOAT_BOUNDS_WIDTH;
+    size_t size = padded == 0 ? FLOAT_BOUNDS_WIDTH * sizeof(float) : 6 * padded * sizeof(float);
+
+    // Each block of boxes starts a cache line, the width of an AVX-512 load
+    float *corners = aligned_alloc(FLOAT_BOUNDS_WIDTH * sizeof(float), size);
+    memset(corners, 0, size);
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        fb->minimum[axis] = corners + (size_t)axis * padded;
+        fb->maximum[axis] = corners + (size_t)(axis + 3) * padded;
+    }
+
+    fb->length = length;
+}
+
+void DeconstructFloatBounds(FloatBounds *fb)
+{
+    free(fb->minimum[0]);
+    memset(fb, 0, sizeof(FloatBounds));
+}
+
+/* The nearest float no greater than 'd' */
+static float RoundDown(double d)
+{
+    float f = (float)d;
+    return (double)f > d ? nextafterf(f, -INFINITY) : f;
+}
+
+/* The nearest float no less than 'd' */
+static float RoundUp(double d)
+{
+    float f = (float)d;
+    return (double)f < d ? nextafterf(f, INFINITY) : f;
+}
+
+void SetFloatBounds(FloatBounds *fb, unsigned index, Bounds b)
+{
+    for (int axis = 0; axis < 3; axis++)
+    {
+        fb->minimum[axis][index] = RoundDown(b.minimum_bound[axis]);
+        fb->maximum[axis][index] = RoundUp(b.maximum_bound[axis]);
+    }
+}
+
+FloatRay NewFloatRay(Ray r)
+{
+    FloatRay out;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        double inverse_direction = 1.0 / r.direction[axis];
+
+        /* Rounding the origin moves it by at most half a float's epsilon relative to its size,
+         * which moves each side of a box along the ray by that much over the direction. The
+         * extra epsilon covers rounding the slack itself to a float
+         */
+        double slack = (fabs(r.origin[axis]) * FLT_EPSILON + FLT_MIN) * fabs(inverse_direction) * (1 + FLT_EPSILON);
+
+        // Kept finite, an infinite slack would turn the sides of a box off to one side into NaNs
+        slack = fmin(slack, FLT_MAX);
+
+        out.origin[axis] = (float)r.origin[axis];
+        out.inverse_direction[axis] = (float)inverse_direction;
+        out.slack[axis] = (float)slack;
+    }
+
+    return out;
+}
+
+/* The lanes a block starting at 'first' holds boxes in */
+static __mmask16 FloatBoundsLanes(FloatBounds *fb, unsigned first)
+{
+    unsigned remaining = fb->length - first;
+    return remaining >= FLOAT_BOUNDS_WIDTH ? 0xFFFF : (__mmask16)((1u << remaining) - 1);
+}
+
+/* The same as minps and maxps, 'b' is returned if either is NaN */
+static inline float LaneMin(float a, float b)
+{
+    return a < b ? a : b;
+}
+
+static inline float LaneMax(float a, float b)
+{
+    return a > b ? a : b;
+}
+
+__mmask16 IntersectFloatBoundsScalar(FloatBounds *fb, unsigned first, FloatRay *r)
+{
+    unsigned remaining = fb->length - first;
+    unsigned count = remaining < FLOAT_BOUNDS_WIDTH ? remaining : FLOAT_BOUNDS_WIDTH;
+    __mmask16 hits = 0;
+
+    for (unsigned lane = 0; lane < count; lane++)
+    {
+        float tmin = -INFINITY;
+        float tmax = INFINITY;
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float t0 = (fb->minimum[axis][first + lane] - r->origin[axis]) * r->inverse_direction[axis];
+            float t1 = (fb->maximum[axis][first + lane] - r->origin[axis]) * r->inverse_direction[axis];
+
+            tmin = LaneMax(LaneMin(t0, t1) - r->slack[axis], tmin);
+            tmax = LaneMin(LaneMax(t0, t1) + r->slack[axis], tmax);
+        }
+
+        tmin = fmaf(-fabsf(tmin), 4 * FLT_EPSILON, tmin);
+        tmax = fmaf(fabsf(tmax), 4 * FLT_EPSILON, tmax);
+
+        hits |= (__mmask16)((tmax >= tmin) << lane);
+    }
+
+    return hits;
+}
+
+/* Tests half of a block, FLOAT_BOUNDS_WIDTH / 2 boxes starting at 'first' */
+static __mmask16 IntersectFloatBoundsHalf(FloatBounds *fb, unsigned first, FloatRay *r)
+{
+    __m256 tmin = _mm256_set1_ps(-INFINITY);
+    __m256 tmax = _mm256_set1_ps(INFINITY);
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        __m256 origin = _mm256_set1_ps(r->origin[axis]);
+        __m256 inverse_direction = _mm256_set1_ps(r->inverse_direction[axis]);
+        __m256 slack = _mm256_set1_ps(r->slack[axis]);
+
+        __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(fb->minimum[axis] + first), origin), inverse_direction);
+        __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(fb->maximum[axis] + first), origin), inverse_direction);
+
+        tmin = _mm256_max_ps(_mm256_sub_ps(_mm256_min_ps(t0, t1), slack), tmin);
+        tmax = _mm256_min_ps(_mm256_add_ps(_mm256_max_ps(t0, t1), slack), tmax);
+    }
+
+    __m256 error = _mm256_set1_ps(4 * FLT_EPSILON);
+    __m256 sign = _mm256_set1_ps(-0.0f);
+    tmin = _mm256_fnmadd_ps(_mm256_andnot_ps(sign, tmin), error, tmin);
+    tmax = _mm256_fmadd_ps(_mm256_andnot_ps(sign, tmax), error, tmax);
+
+    return (__mmask16)_mm256_movemask_ps(_mm256_cmp_ps(tmax, tmin, _CMP_GE_OQ));
+}
+
+__mmask16 IntersectFloatBoundsAvx2(FloatBounds *fb, unsigned first, FloatRay *r)
+{
+    __mmask16 hits = IntersectFloatBoundsHalf(fb, first, r);
+    hits |= (__mmask16)(IntersectFloatBoundsHalf(fb, first + FLOAT_BOUNDS_WIDTH / 2, r) << (FLOAT_BOUNDS_WIDTH / 2));
+
+    return hits & FloatBoundsLanes(fb, first);
+}
+
+AVX512_FUNCTION __mmask16 IntersectFloatBoundsAvx512(FloatBounds *fb, unsigned first, FloatRay *r)
+{
+    __m512 tmin = _mm512_set1_ps(-INFINITY);
+    __m512 tmax = _mm512_set1_ps(INFINITY);
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        __m512 origin = _mm512_set1_ps(r->origin[axis]);
+        __m512 inverse_direction = _mm512_set1_ps(r->inverse_direction[axis]);
+        __m512 slack = _mm512_set1_ps(r->slack[axis]);
+
+        __m512 t0 = _mm512_sub_ps(_mm512_load_ps(fb->minimum[axis] + first), origin);
+        __m512 t1 = _mm512_sub_ps(_mm512_load_ps(fb->maximum[axis] + first), origin);
+        t0 = _mm512_mul_ps(t0, inverse_direction);
+        t1 = _mm512_mul_ps(t1, inverse_direction);
+
+        __m512 near = _mm512_sub_ps(_mm512_min_ps(t0, t1), slack);
+        __m512 far = _mm512_add_ps(_mm512_max_ps(t0, t1), slack);
+
+        // Min and max return their second operand if either is NaN, so an axis where 0 * infinity came up is left out
+        tmin = _mm512_max_ps(near, tmin);
+        tmax = _mm512_min_ps(far, tmax);
+    }
+
+    // Widen the interval by the rounding errors of the subtractions and multiplications above
+    __m512 error = _mm512_set1_ps(4 * FLT_EPSILON);
+    tmin = _mm512_fnmadd_ps(_mm512_abs_ps(tmin), error, tmin);
+    tmax = _mm512_fmadd_ps(_mm512_abs_ps(tmax), error, tmax);
+
+    return _mm512_mask_cmp_ps_mask(FloatBoundsLanes(fb, first), tmax, tmin, _CMP_GE_OQ);
+}
+
+static __mmask16 (*intersect_float_bounds)(FloatBounds *, unsigned, FloatRay *) = IntersectFloatBoundsAvx2;
+
+void SelectBoundsKernels(CPU_TARGET target)
+{
+    switch (target)
+    {
+    case CPU_SCALAR:
+        intersect_float_bounds = IntersectFloatBoundsScalar;
+        break;
+    case CPU_AVX512:
+        intersect_float_bounds = IntersectFloatBoundsAvx512;
+        break;
+    case CPU_AVX2:
+    case CPU_TARGET_COUNT:
+        intersect_float_bounds = IntersectFloatBoundsAvx2;
+        break;
+    }
+}
+
+__mmask16 IntersectFloatBounds(FloatBounds *fb, unsigned first, FloatRay *r)
+{
+    return intersect_float_bounds(fb, first, r);
+}
+
 Tuple3 Centroid(Bounds b)
 {
     Tuple3 hwd = TupleSubtract(b.maximum_bound, b.minimum_bound);
@@ -1,6 +1,20 @@
 #include "camera.h"
 #include <math.h>
 
+/* The canvas sits one unit in front of the camera, so the unnormalized direction to
+ * canvas point (x, y) is (half_width - x * pixel_size, half_height - y * pixel_size, -1)
+ * in camera space. That is linear in 'x' and 'y', so it is carried to world space once
+ */
+static void PrecomputeRays(Camera *c)
+{
+    Affine inverse = c->inverse_view_transformation;
+
+    c->ray_origin = NewPnt3(inverse.rows[0][3], inverse.rows[1][3], inverse.rows[2][3]);
+    c->ray_corner = AffineTupleMultiply(inverse, NewVec3(c->half_width, c->half_height, -1));
+    c->ray_step_x = AffineTupleMultiply(inverse, NewVec3(-c->pixel_size, 0, 0));
+    c->ray_step_y = AffineTupleMultiply(inverse, NewVec3(0, -c->pixel_size, 0));
+}
+
 Camera NewCamera(unsigned width, unsigned height, double fov)
 {
     Camera c;
@@ -9,8 +23,8 @@ Camera NewCamera(unsigned width, unsigned height, double fov)
     c.height = height;
     c.fov = fov;
 
-    c.view_transformation = IdentityMatrix();
-    c.inverse_view_transformation = IdentityMatrix();
+    c.view_transformation = AffineIdentity();
+    c.inverse_view_transformation = AffineIdentity();
 
     double half_view = tan(fov / 2);
     double aspect_ratio = (double)width / (double)height;
@@ -27,29 +41,72 @@ Camera NewCamera(unsigned width, unsigned height, double fov)
     }
 
     c.pixel_size = (c.half_width * 2) / (double)c.width;
+    PrecomputeRays(&c);
 
     return c;
 }
 
 void CameraApplyTransformation(Camera *c, Matrix4x4 t)
 {
-    c->view_transformation = t;
-    c->inverse_view_transformation = MatrixInvert(t);
+    c->view_transformation = AffineFromMatrix(t);
+    c->inverse_view_transformation = AffineInvert(c->view_transformation);
+    PrecomputeRays(c);
 }
 
 Ray RayForPixel(Camera *c, unsigned x, unsigned y)
 {
-    double offset_x = ((double)x + 0.5) * c->pixel_size;
-    double offset_y = ((double)y + 0.5) * c->pixel_size;
+    return RayForPixelSample(c, x, y, 0.5, 0.5);
+}
+
+Ray RayForPixelSample(Camera *c, unsigned x, unsigned y, double sample_x, double sample_y)
+{
+    // One lane of CameraRayPacket(), rounded the same way
+    double canvas_x = (double)x + sample_x;
+    double canvas_y = (double)y + sample_y;
 
-    double world_x = c->half_width - offset_x;
-    double world_y = c->half_height - offset_y;
+    double dx = fma(canvas_x, c->ray_step_x[0], fma(canvas_y, c->ray_step_y[0], c->ray_corner[0]));
+    double dy = fma(canvas_x, c->ray_step_x[1], fma(canvas_y, c->ray_step_y[1], c->ray_corner[1]));
+    double dz = fma(canvas_x, c->ray_step_x[2], fma(canvas_y, c->ray_step_y[2], c->ray_corner[2]));
 
-    Tuple3 pixel_location = MatrixTupleMultiply(c->inverse_view_transformation, NewPnt3(world_x, world_y, -1));
-    Tuple3 ray_origin = MatrixTupleMultiply(c->inverse_view_transformation, NewPnt3(0, 0, 0));
-    Tuple3 ray_direction = TupleNormalize(TupleSubtract(pixel_location, ray_origin));
+    double scale = 1 / sqrt(fma(dx, dx, fma(dy, dy, dz * dz)));
 
-    Ray r = NewRay(ray_origin, ray_direction);
+    return NewRay(c->ray_origin, NewVec3(dx * scale, dy * scale, dz * scale));
+}
+
+void CameraRayPacket(Camera *c, unsigned x, unsigned y, unsigned count, const double *sample_x, const double *sample_y, RayPacket *packet)
+{
+    packet->origin = c->ray_origin;
+    packet->length = count;
 
-    return r;
+    __m256d corner_x = _mm256_set1_pd(c->ray_corner[0]);
+    __m256d corner_y = _mm256_set1_pd(c->ray_corner[1]);
+    __m256d corner_z = _mm256_set1_pd(c->ray_corner[2]);
+
+    for (unsigned i = 0; i < count; i += 4)
+    {
+        // Lanes past 'count' are computed from a zero offset and land in the packet's unused space
+        __m256i lanes = _mm256_cmpgt_epi64(_mm256_set1_epi64x(count - i), _mm256_setr_epi64x(0, 1, 2, 3));
+        __m256d offset_x = sample_x == NULL ? _mm256_set1_pd(0.5) : _mm256_maskload_pd(sample_x + i, lanes);
+        __m256d offset_y = sample_y == NULL ? _mm256_set1_pd(0.5) : _mm256_maskload_pd(sample_y + i, lanes);
+
+        __m256d canvas_x = _mm256_add_pd(_mm256_add_pd(_mm256_set1_pd((double)(x + i)), _mm256_setr_pd(0, 1, 2, 3)), offset_x);
+        __m256d canvas_y = _mm256_add_pd(_mm256_set1_pd((double)y), offset_y);
+
+        __m256d dx = _mm256_fmadd_pd(canvas_x, _mm256_set1_pd(c->ray_step_x[0]), _mm256_fmadd_pd(canvas_y, _mm256_set1_pd(c->ray_step_y[0]), corner_x));
+        __m256d dy = _mm256_fmadd_pd(canvas_x, _mm256_set1_pd(c->ray_step_x[1]), _mm256_fmadd_pd(canvas_y, _mm256_set1_pd(c->ray_step_y[1]), corner_y));
+        __m256d dz = _mm256_fmadd_pd(canvas_x, _mm256_set1_pd(c->ray_step_x[2]), _mm256_fmadd_pd(canvas_y, _mm256_set1_pd(c->ray_step_y[2]), corner_z));
+
+        // One division per ray rather than three
+        __m256d length = _mm256_sqrt_pd(_mm256_fmadd_pd(dx, dx, _mm256_fmadd_pd(dy, dy, _mm256_mul_pd(dz, dz))));
+        __m256d scale = _mm256_div_pd(_mm256_set1_pd(1), length);
+        _mm256_storeu_pd(packet->direction[0] + i, _mm256_mul_pd(dx, scale));
+        _mm256_storeu_pd(packet->direction[1] + i, _mm256_mul_pd(dy, scale));
+        _mm256_storeu_pd(packet->direction[2] + i, _mm256_mul_pd(dz, scale));
+    }
+}
+
+Ray PacketRay(RayPacket *packet, unsigned index)
+{
+    Tuple3 direction = NewVec3(packet->direction[0][index], packet->direction[1][index], packet->direction[2][index]);
+    return NewRay(packet->origin, direction);
 }
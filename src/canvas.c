@@ -1,18 +1,96 @@
 #include <string.h>
 #include <float.h>
+#include <stdbool.h>
+#include <alloca.h>
 #include "shmem.h"
 #include "canvas.h"
+#include "trace.h"
 
 void ConstructCanvas(Canvas *c, unsigned width, unsigned height)
 {
-    c->buffer = (Tuple3 *) shmalloc(width * height * sizeof(Tuple3));
+    ConstructCanvasOver(c, (Tuple3 *) shmalloc(width * height * sizeof(Tuple3)), width, height);
+    c->owns_buffer = true;
+}
+
+void ConstructCanvasOver(Canvas *c, Tuple3 *buffer, unsigned width, unsigned height)
+{
+    c->buffer = buffer;
+    c->owns_buffer = false;
     c->canvas_width = width;
     c->canvas_height = height;
+
+    c->planes = 0;
+    c->albedo = NULL;
+    c->normal = NULL;
+    c->depth = NULL;
+    c->shape_id = NULL;
+    c->steps = NULL;
 }
 
 void DeconstructCanvas(Canvas *c)
 {
-    shfree(c->buffer, c->canvas_width * c->canvas_height * sizeof(Tuple3));
+    unsigned size = c->canvas_width * c->canvas_height;
+    if (c->owns_buffer)
+    {
+        shfree(c->buffer, size * sizeof(Tuple3));
+    }
+
+    if (c->albedo != NULL)
+    {
+        shfree(c->albedo, size * sizeof(Tuple3));
+    }
+
+    if (c->normal != NULL)
+    {
+        shfree(c->normal, size * sizeof(Tuple3));
+    }
+
+    if (c->depth != NULL)
+    {
+        shfree(c->depth, size * sizeof(double));
+    }
+
+    if (c->shape_id != NULL)
+    {
+        shfree(c->shape_id, size * sizeof(unsigned));
+    }
+
+    if (c->steps != NULL)
+    {
+        shfree(c->steps, size * sizeof(unsigned));
+    }
+}
+
+void EnableCanvasPlanes(Canvas *c, unsigned planes)
+{
+    unsigned size = c->canvas_width * c->canvas_height;
+
+    if ((planes & CANVAS_ALBEDO) && c->albedo == NULL)
+    {
+        c->albedo = (Tuple3 *)shmalloc(size * sizeof(Tuple3));
+    }
+
+    if ((planes & CANVAS_NORMAL) && c->normal == NULL)
+    {
+        c->normal = (Tuple3 *)shmalloc(size * sizeof(Tuple3));
+    }
+
+    if ((planes & CANVAS_DEPTH) && c->depth == NULL)
+    {
+        c->depth = (double *)shmalloc(size * sizeof(double));
+    }
+
+    if ((planes & CANVAS_SHAPE_ID) && c->shape_id == NULL)
+    {
+        c->shape_id = (unsigned *)shmalloc(size * sizeof(unsigned));
+    }
+
+    if ((planes & CANVAS_STEPS) && c->steps == NULL)
+    {
+        c->steps = (unsigned *)shmalloc(size * sizeof(unsigned));
+    }
+
+    c->planes |= planes;
 }
 
 void WritePixel(Canvas *c, Tuple3 color, unsigned x, unsigned y)
@@ -26,8 +104,68 @@ void DirectWritePixel(Canvas *c, Tuple3 color, unsigned location)
     c->buffer[location] = color;
 }
 
+unsigned CanvasTilesAcross(Canvas *c)
+{
+    return (c->canvas_width + TILE_SIZE - 1) / TILE_SIZE;
+}
+
+unsigned CanvasTileCount(Canvas *c)
+{
+    unsigned tiles_down = (c->canvas_height + TILE_SIZE - 1) / TILE_SIZE;
+    return CanvasTilesAcross(c) * tiles_down;
+}
+
+Tile CanvasTile(Canvas *c, unsigned index)
+{
+    return FrameTile(c->canvas_width, c->canvas_height, index);
+}
+
+Tile FrameTile(unsigned width, unsigned height, unsigned index)
+{
+    unsigned tiles_across = (width + TILE_SIZE - 1) / TILE_SIZE;
+
+    Tile t;
+    t.index = index;
+    t.x = (index % tiles_across) * TILE_SIZE;
+    t.y = (index / tiles_across) * TILE_SIZE;
+    t.width = t.x + TILE_SIZE > width ? width - t.x : TILE_SIZE;
+    t.height = t.y + TILE_SIZE > height ? height - t.y : TILE_SIZE;
+
+    return t;
+}
+
+void DirectWriteSurface(Canvas *c, SurfaceSample *sample, unsigned location)
+{
+    if (c->albedo != NULL)
+    {
+        c->albedo[location] = sample->albedo;
+    }
+
+    if (c->normal != NULL)
+    {
+        c->normal[location] = sample->normal;
+    }
+
+    if (c->depth != NULL)
+    {
+        c->depth[location] = sample->depth;
+    }
+
+    if (c->shape_id != NULL)
+    {
+        c->shape_id[location] = sample->shape_id;
+    }
+
+    if (c->steps != NULL)
+    {
+        c->steps[location] = sample->steps;
+    }
+}
+
 void WriteToPPM(Canvas *c, const char *filename)
 {
+    TRACE_SCOPE("WriteToPPM", "io");
+
     FILE *fp = fopen(filename, "w");
 
     fputc('P', fp);
@@ -76,3 +214,197 @@ void WriteToPPM(Canvas *c, const char *filename)
 
     printf("Scene written to '%s'\n", filename);
 }
+
+/* Clamps a color channel to 0-1 and scales it to a byte */
+static unsigned char ColorByte(double value)
+{
+    return (unsigned char)fmax(0, fmin(value * 255, 255));
+}
+
+void PixelBytes(Canvas *c, unsigned location, unsigned char rgb[3])
+{
+    rgb[0] = ColorByte(c->buffer[location][0]);
+    rgb[1] = ColorByte(c->buffer[location][1]);
+    rgb[2] = ColorByte(c->buffer[location][2]);
+}
+
+/* Fills 'channels' with the plane's values at the given pixel, returns the number of channels */
+static int PlaneValue(Canvas *c, CANVAS_PLANE plane, unsigned i, float channels[3])
+{
+    switch (plane)
+    {
+    case CANVAS_ALBEDO:
+    case CANVAS_NORMAL:
+    {
+        Tuple3 value = plane == CANVAS_ALBEDO ? c->albedo[i] : c->normal[i];
+        channels[0] = (float)value[0];
+        channels[1] = (float)value[1];
+        channels[2] = (float)value[2];
+        return 3;
+    }
+    case CANVAS_DEPTH:
+        channels[0] = (float)c->depth[i];
+        return 1;
+    case CANVAS_SHAPE_ID:
+        channels[0] = (float)c->shape_id[i];
+        return 1;
+    case CANVAS_STEPS:
+        channels[0] = (float)c->steps[i];
+        return 1;
+    default:
+        printf("Unknown canvas plane '%d'\n", plane);
+        exit(1);
+    }
+}
+
+static bool PlaneEnabled(Canvas *c, CANVAS_PLANE plane)
+{
+    if ((c->planes & plane) == 0)
+    {
+        printf("Canvas plane '%d' is not enabled\n", plane);
+        return false;
+    }
+
+    return true;
+}
+
+void WritePlaneToPFM(Canvas *c, CANVAS_PLANE plane, const char *filename)
+{
+    TRACE_SCOPE("WritePlaneToPFM", "io");
+
+    if (!PlaneEnabled(c, plane))
+    {
+        return;
+    }
+
+    float channels[3];
+    int num_channels = PlaneValue(c, plane, 0, channels);
+
+    FILE *fp = fopen(filename, "wb");
+
+    // A negative scale marks the data as little endian
+    fprintf(fp, "%s\n%u %u\n-1.0\n", num_channels == 3 ? "PF" : "Pf", c->canvas_width, c->canvas_height);
+
+    // PFM scanlines run from the bottom of the image to the top
+    for (unsigned y = c->canvas_height; y-- > 0;)
+    {
+        for (unsigned x = 0; x < c->canvas_width; x++)
+        {
+            PlaneValue(c, plane, y * c->canvas_width + x, channels);
+            fwrite(channels, sizeof(float), (size_t)num_channels, fp);
+        }
+    }
+
+    fclose(fp);
+
+    printf("Plane written to '%s'\n", filename);
+}
+
+Tuple3 HeatmapColor(double t)
+{
+    t = fmin(1.0, fmax(0.0, t));
+
+    double red = fmin(1.0, fmax(0.0, 4.0 * t - 2.0));
+    double green = fmin(1.0, fmax(0.0, t < 0.5 ? 4.0 * t : 4.0 - 4.0 * t));
+    double blue = fmin(1.0, fmax(0.0, 2.0 - 4.0 * t));
+
+    return NewTuple3(red, green, blue, 1.0);
+}
+
+static Tuple3 IdColor(unsigned id)
+{
+    if (id == 0)
+    {
+        return NewTuple3(0, 0, 0, 1.0);
+    }
+
+    id *= 0x9e3779b1U;
+    id ^= id >> 15;
+
+    return NewTuple3((double)(id & 0xff) / 255.0, (double)((id >> 8) & 0xff) / 255.0, (double)((id >> 16) & 0xff) / 255.0, 1.0);
+}
+
+void WritePlaneToPPM(Canvas *c, CANVAS_PLANE plane, const char *filename)
+{
+    if (!PlaneEnabled(c, plane))
+    {
+        return;
+    }
+
+    unsigned size = c->canvas_width * c->canvas_height;
+
+    // Depth and step counts are scaled by the largest value in the image
+    double largest = 0;
+    for (unsigned i = 0; i < size; i++)
+    {
+        if (plane == CANVAS_DEPTH && !isinf(c->depth[i]))
+        {
+            largest = fmax(largest, c->depth[i]);
+        }
+        else if (plane == CANVAS_STEPS)
+        {
+            largest = fmax(largest, (double)c->steps[i]);
+        }
+    }
+    largest = largest == 0 ? 1 : largest;
+
+    Canvas picture;
+    ConstructCanvas(&picture, c->canvas_width, c->canvas_height);
+
+    for (unsigned i = 0; i < size; i++)
+    {
+        Tuple3 color;
+        switch (plane)
+        {
+        case CANVAS_ALBEDO:
+            color = c->albedo[i];
+            break;
+        case CANVAS_NORMAL:
+            color = TupleScalarAdd(TupleScalarMultiply(c->normal[i], 0.5), 0.5);
+            break;
+        case CANVAS_DEPTH:
+        {
+            double shade = isinf(c->depth[i]) ? 0 : 1.0 - c->depth[i] / largest;
+            color = NewTuple3(shade, shade, shade, 1.0);
+            break;
+        }
+        case CANVAS_SHAPE_ID:
+            color = IdColor(c->shape_id[i]);
+            break;
+        case CANVAS_STEPS:
+            color = HeatmapColor((double)c->steps[i] / largest);
+            break;
+        default:
+            printf("Unknown canvas plane '%d'\n", plane);
+            exit(1);
+        }
+
+        DirectWritePixel(&picture, color, i);
+    }
+
+    WriteToPPM(&picture, filename);
+    DeconstructCanvas(&picture);
+}
+
+void WriteCanvasPlanes(Canvas *c, const char *prefix)
+{
+    CANVAS_PLANE planes[] = {CANVAS_ALBEDO, CANVAS_NORMAL, CANVAS_DEPTH, CANVAS_SHAPE_ID, CANVAS_STEPS};
+    const char *names[] = {"albedo", "normal", "depth", "shape_id", "steps"};
+
+    size_t filename_size = strlen(prefix) + 32;
+    char *filename = alloca(filename_size);
+
+    for (int i = 0; i < 5; i++)
+    {
+        if ((c->planes & planes[i]) == 0)
+        {
+            continue;
+        }
+
+        snprintf(filename, filename_size, "%s_%s.pfm", prefix, names[i]);
+        WritePlaneToPFM(c, planes[i], filename);
+
+        snprintf(filename, filename_size, "%s_%s.ppm", prefix, names[i]);
+        WritePlaneToPPM(c, planes[i], filename);
+    }
+}
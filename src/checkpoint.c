@@ -0,0 +1,325 @@
+#include "checkpoint.h"
+#include "shmem.h"
+#include "trace.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* "CTCK", the first word of every checkpoint file */
+#define CHECKPOINT_MAGIC 0x4B435443u
+#define CHECKPOINT_VERSION 2u
+
+typedef enum
+{
+    CHECKPOINT_TILES,
+    CHECKPOINT_ACCUMULATOR,
+} CHECKPOINT_KIND;
+
+/* Progress of a tile, the states only ever move forwards */
+typedef enum
+{
+    TILE_PENDING,
+    /* Rendered, but not in the file yet */
+    TILE_RENDERED,
+    TILE_SAVED,
+} TILE_STATE;
+
+/* Magic, version, kind, width, height, the tile size or the number of samples, the seed,
+ * and the low and high words of the scene hash
+ */
+#define CHECKPOINT_HEADER_WORDS 9
+
+static double Seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static bool WriteHeader(FILE *fp, CHECKPOINT_KIND kind, CheckpointSettings settings, unsigned width, unsigned height, unsigned extra)
+{
+    uint32_t header[CHECKPOINT_HEADER_WORDS] = {
+        CHECKPOINT_MAGIC, CHECKPOINT_VERSION, kind, width, height, extra,
+        settings.seed, (uint32_t)settings.scene_hash, (uint32_t)(settings.scene_hash >> 32),
+    };
+
+    return fwrite(header, sizeof(header), 1, fp) == 1;
+}
+
+/* Reads the header and checks it describes the given frame, scene and seed, returns the sixth word through 'extra' */
+static bool ReadHeader(FILE *fp, CHECKPOINT_KIND kind, CheckpointSettings settings, unsigned width, unsigned height, unsigned *extra)
+{
+    uint32_t header[CHECKPOINT_HEADER_WORDS];
+    if (fread(header, sizeof(header), 1, fp) != 1)
+    {
+        return false;
+    }
+
+    *extra = header[5];
+    uint64_t scene_hash = (uint64_t)header[7] | (uint64_t)header[8] << 32;
+    return header[0] == CHECKPOINT_MAGIC && header[1] == CHECKPOINT_VERSION && header[2] == kind &&
+           header[3] == width && header[4] == height && header[6] == settings.seed && scene_hash == settings.scene_hash;
+}
+
+/* Pushes the file's contents to the disk, so a checkpoint survives the machine going down */
+static bool SyncFile(FILE *fp)
+{
+    return fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+}
+
+CheckpointSettings DefaultCheckpointSettings()
+{
+    CheckpointSettings settings = {
+        .filename = NULL,
+        .interval = 30,
+        .resume = true,
+        .scene_hash = 0,
+        .seed = 0,
+    };
+
+    return settings;
+}
+
+/* Copy the tile records in a journal onto the canvas, a record cut short ends the journal.
+ * Returns the length of the journal up to the end of the last whole record
+ */
+static long ReadTileRecords(TileCheckpoint *tc, FILE *fp)
+{
+    long length = ftell(fp);
+    float *pixels = malloc(TILE_SIZE * TILE_SIZE * 3 * sizeof(float));
+
+    uint32_t index;
+    while (fread(&index, sizeof(index), 1, fp) == 1 && index < tc->tile_count)
+    {
+        Tile t = CanvasTile(tc->canvas, index);
+        if (fread(pixels, sizeof(float) * 3, t.width * t.height, fp) != t.width * t.height)
+        {
+            break;
+        }
+
+        for (unsigned y = 0; y < t.height; y++)
+        {
+            for (unsigned x = 0; x < t.width; x++)
+            {
+                float *pixel = pixels + 3 * (y * t.width + x);
+                Tuple3 color = NewColor(0, 0, 0, 0);
+                color[0] = pixel[0];
+                color[1] = pixel[1];
+                color[2] = pixel[2];
+
+                DirectWritePixel(tc->canvas, color, (t.y + y) * tc->canvas->canvas_width + t.x + x);
+            }
+        }
+
+        tc->states[index] = TILE_SAVED;
+        length = ftell(fp);
+    }
+
+    free(pixels);
+    return length;
+}
+
+void OpenTileCheckpoint(TileCheckpoint *tc, Canvas *c, CheckpointSettings settings)
+{
+    TRACE_SCOPE("OpenTileCheckpoint", "io");
+
+    tc->filename = settings.filename;
+    tc->canvas = c;
+    tc->interval = settings.interval;
+    tc->tile_count = CanvasTileCount(c);
+    tc->states = shmalloc(tc->tile_count);
+    tc->last_save = shmalloc(sizeof(double));
+    tc->saving = shmalloc(sizeof(int));
+
+    memset(tc->states, TILE_PENDING, tc->tile_count);
+    *tc->last_save = Seconds();
+    *tc->saving = 0;
+
+    FILE *fp = settings.resume ? fopen(tc->filename, "rb") : NULL;
+    if (fp != NULL)
+    {
+        unsigned tile_size;
+        bool matches = ReadHeader(fp, CHECKPOINT_TILES, settings, c->canvas_width, c->canvas_height, &tile_size) && tile_size == TILE_SIZE;
+        long length = matches ? ReadTileRecords(tc, fp) : 0;
+
+        fclose(fp);
+
+        // Later records are appended after the ones just read, so a record cut short is dropped first
+        if (matches && truncate(tc->filename, length) == 0)
+        {
+            return;
+        }
+
+        printf("Checkpoint '%s' was written for a different frame, scene or seed, starting over\n", tc->filename);
+    }
+
+    fp = fopen(tc->filename, "wb");
+    if (fp == NULL || !WriteHeader(fp, CHECKPOINT_TILES, settings, c->canvas_width, c->canvas_height, TILE_SIZE) || !SyncFile(fp))
+    {
+        printf("Could not write checkpoint '%s'\n", tc->filename);
+    }
+
+    if (fp != NULL)
+    {
+        fclose(fp);
+    }
+}
+
+/* Append every rendered tile that is not in the file yet. Only one process at a time may call this */
+static void SaveRenderedTiles(TileCheckpoint *tc)
+{
+    TRACE_SCOPE("SaveRenderedTiles", "io");
+
+    FILE *fp = fopen(tc->filename, "ab");
+    if (fp == NULL)
+    {
+        printf("Could not write checkpoint '%s'\n", tc->filename);
+        return;
+    }
+
+    float *pixels = malloc(TILE_SIZE * TILE_SIZE * 3 * sizeof(float));
+
+    for (unsigned i = 0; i < tc->tile_count; i++)
+    {
+        // Pairs with the release in FinishTile(), so the tile's pixels are visible
+        if (__atomic_load_n(&tc->states[i], __ATOMIC_ACQUIRE) != TILE_RENDERED)
+        {
+            continue;
+        }
+
+        Tile t = CanvasTile(tc->canvas, i);
+        for (unsigned y = 0; y < t.height; y++)
+        {
+            for (unsigned x = 0; x < t.width; x++)
+            {
+                Tuple3 color = tc->canvas->buffer[(t.y + y) * tc->canvas->canvas_width + t.x + x];
+                float *pixel = pixels + 3 * (y * t.width + x);
+                pixel[0] = (float)color[0];
+                pixel[1] = (float)color[1];
+                pixel[2] = (float)color[2];
+            }
+        }
+
+        uint32_t index = i;
+        fwrite(&index, sizeof(index), 1, fp);
+        fwrite(pixels, sizeof(float) * 3, t.width * t.height, fp);
+        tc->states[i] = TILE_SAVED;
+    }
+
+    SyncFile(fp);
+    fclose(fp);
+    free(pixels);
+
+    *tc->last_save = Seconds();
+}
+
+void FinishTile(TileCheckpoint *tc, Tile t)
+{
+    __atomic_store_n(&tc->states[t.index], TILE_RENDERED, __ATOMIC_RELEASE);
+
+    if (Seconds() - *tc->last_save < tc->interval)
+    {
+        return;
+    }
+
+    // Whoever gets here first writes for everyone, the others carry on rendering
+    int idle = 0;
+    if (__atomic_compare_exchange_n(tc->saving, &idle, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+        SaveRenderedTiles(tc);
+        __atomic_store_n(tc->saving, 0, __ATOMIC_RELEASE);
+    }
+}
+
+bool TileFinished(TileCheckpoint *tc, unsigned index)
+{
+    return index < tc->tile_count && tc->states[index] != TILE_PENDING;
+}
+
+unsigned FinishedTileCount(TileCheckpoint *tc)
+{
+    unsigned finished = 0;
+    for (unsigned i = 0; i < tc->tile_count; i++)
+    {
+        finished += TileFinished(tc, i);
+    }
+
+    return finished;
+}
+
+void CloseTileCheckpoint(TileCheckpoint *tc)
+{
+    SaveRenderedTiles(tc);
+
+    shfree(tc->states, tc->tile_count);
+    shfree(tc->last_save, sizeof(double));
+    shfree(tc->saving, sizeof(int));
+}
+
+bool SaveAccumulator(Accumulator *a, CheckpointSettings settings)
+{
+    TRACE_SCOPE("SaveAccumulator", "io");
+
+    // Written beside the old checkpoint and renamed over it, so one of the two is always whole
+    char *temporary = malloc(strlen(settings.filename) + 5);
+    sprintf(temporary, "%s.tmp", settings.filename);
+
+    size_t pixels = (size_t)a->width * a->height;
+    FILE *fp = fopen(temporary, "wb");
+    bool written = fp != NULL &&
+                   WriteHeader(fp, CHECKPOINT_ACCUMULATOR, settings, a->width, a->height, a->samples) &&
+                   fwrite(a->color, sizeof(float) * 3, pixels, fp) == pixels &&
+                   fwrite(a->luminance_squares, sizeof(float), pixels, fp) == pixels &&
+                   SyncFile(fp);
+
+    if (fp != NULL)
+    {
+        fclose(fp);
+    }
+
+    written = written && rename(temporary, settings.filename) == 0;
+    if (!written)
+    {
+        printf("Could not write checkpoint '%s'\n", settings.filename);
+        remove(temporary);
+    }
+
+    free(temporary);
+    return written;
+}
+
+bool LoadAccumulator(Accumulator *a, CheckpointSettings settings)
+{
+    TRACE_SCOPE("LoadAccumulator", "io");
+
+    FILE *fp = fopen(settings.filename, "rb");
+    if (fp == NULL)
+    {
+        return false;
+    }
+
+    size_t pixels = (size_t)a->width * a->height;
+    float *color = malloc(pixels * 3 * sizeof(float));
+    float *luminance_squares = malloc(pixels * sizeof(float));
+
+    unsigned samples;
+    bool read = ReadHeader(fp, CHECKPOINT_ACCUMULATOR, settings, a->width, a->height, &samples) &&
+                fread(color, sizeof(float) * 3, pixels, fp) == pixels &&
+                fread(luminance_squares, sizeof(float), pixels, fp) == pixels;
+    fclose(fp);
+
+    if (read)
+    {
+        memcpy(a->color, color, pixels * 3 * sizeof(float));
+        memcpy(a->luminance_squares, luminance_squares, pixels * sizeof(float));
+        a->samples = samples;
+    }
+
+    free(color);
+    free(luminance_squares);
+    return read;
+}
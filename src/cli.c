@@ -0,0 +1,348 @@
+#include "scene.h"
+#include "canvas.h"
+#include "server.h"
+#include "distributed.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void Usage()
+{
+    printf("Usage: tracer <scene.json> <output.ppm> [options]\n");
+    printf("       tracer --serve <socket> [cache size]  Render requests sent to a Unix domain socket, see RunRenderServer()\n");
+    printf("       tracer --request <socket> <request.json> <output.ppm>  Send a request to a render server\n");
+    printf("       tracer --coordinate <address> <scene.json> <output.ppm>  Render on the workers that connect to the address\n");
+    printf("       tracer --work <address> [frames]  Render tiles for a coordinator, for every frame if no count is given\n");
+    printf("  --region x,y,width,height  Render only this rectangle of the camera's frame\n");
+    printf("  --tiles i,j,...            Render only these tiles of the frame, see FrameTile()\n");
+    printf("  --crop                     Write a canvas the size of the region, rather than the whole frame\n");
+    printf("  --checkpoint file          Record finished tiles in this file, and skip the tiles it already holds\n");
+    printf("  --checkpoint-interval s    The fewest seconds between two writes of the checkpoint, 30 by default\n");
+    printf("  --no-resume                Start the checkpoint over, rather than continuing from it\n");
+    printf("Options override the scene file's \"region\"\n");
+    printf("A scene file with \"cameras\" is rendered from each of them, to output_0.ppm, output_1.ppm and so on.\n");
+    printf("Regions and checkpoints only apply to scene files with a single camera, they are refused otherwise\n");
+    exit(1);
+}
+
+static void ParseRegion(RenderRegion *r, const char *text)
+{
+    int x, y, width, height;
+    if (sscanf(text, "%d,%d,%d,%d", &x, &y, &width, &height) != 4 || x < 0 || y < 0 || width <= 0 || height <= 0)
+    {
+        printf("Could not read region '%s'\n", text);
+        Usage();
+    }
+
+    r->x = (unsigned)x;
+    r->y = (unsigned)y;
+    r->width = (unsigned)width;
+    r->height = (unsigned)height;
+}
+
+static void ParseTiles(RenderRegion *r, const char *text)
+{
+    free(r->tiles);
+
+    r->tile_count = 1;
+    for (const char *c = text; *c != '\0'; c++)
+    {
+        r->tile_count += *c == ',';
+    }
+
+    r->tiles = malloc(r->tile_count * sizeof(unsigned));
+    const char *next = text;
+    for (unsigned i = 0; i < r->tile_count; i++)
+    {
+        char *end;
+        long tile = strtol(next, &end, 10);
+        if (end == next || tile < 0 || (*end != ',' && *end != '\0'))
+        {
+            printf("Could not read tiles '%s'\n", text);
+            Usage();
+        }
+
+        r->tiles[i] = (unsigned)tile;
+        next = end + 1;
+    }
+}
+
+/* The contents of a file with a '\0' after them, to be freed by the caller. NULL if it could not be read */
+static char *ReadText(const char *filename)
+{
+    FILE *fp = fopen(filename, "rb");
+    if (fp == NULL)
+    {
+        return NULL;
+    }
+
+    fseek(fp, 0L, SEEK_END);
+    long size = ftell(fp);
+    rewind(fp);
+
+    char *text = calloc((size_t)size + 1, 1);
+    fread(text, 1, (size_t)size, fp);
+    fclose(fp);
+
+    return text;
+}
+
+static int Serve(int argc, char **argv)
+{
+    ServerSettings settings = DefaultServerSettings();
+    settings.socket_path = argv[2];
+    if (argc > 3 && (settings.cache_size = (unsigned)atoi(argv[3])) == 0)
+    {
+        printf("Could not read cache size '%s'\n", argv[3]);
+        Usage();
+    }
+
+    RunRenderServer(settings);
+    return 0;
+}
+
+static int Request(int argc, char **argv)
+{
+    if (argc != 5)
+    {
+        Usage();
+    }
+
+    char *request = ReadText(argv[3]);
+    if (request == NULL)
+    {
+        printf("Could not read request '%s'\n", argv[3]);
+        return 1;
+    }
+
+    Canvas canvas;
+    ServerReply reply;
+    bool rendered = RequestServerRender(argv[2], request, &canvas, &reply);
+    free(request);
+
+    if (!rendered)
+    {
+        return 1;
+    }
+
+    printf("Scene %016llx%s, %u tile(s) in %f seconds\n", (unsigned long long)reply.scene_hash,
+           reply.cached ? " (already loaded)" : "", reply.tiles, reply.seconds);
+
+    WriteToPPM(&canvas, argv[4]);
+    DeconstructCanvas(&canvas);
+    return 0;
+}
+
+static int Coordinate(int argc, char **argv)
+{
+    if (argc != 5)
+    {
+        Usage();
+    }
+
+    char *json = ReadText(argv[3]);
+    if (json == NULL)
+    {
+        printf("Could not read scene '%s'\n", argv[3]);
+        return 1;
+    }
+
+    // Only the camera's size is needed here, the workers read the scene
+    Scene s;
+    ReadSceneJson(&s, json);
+
+    Canvas canvas;
+    ConstructCanvas(&canvas, s.camera.width, s.camera.height);
+    DeconstructScene(&s);
+
+    CoordinatorSettings settings = DefaultCoordinatorSettings();
+    settings.address = argv[2];
+    DistributedReport report = RenderSceneDistributed(json, &canvas, settings);
+    free(json);
+
+    WriteToPPM(&canvas, argv[4]);
+    DeconstructCanvas(&canvas);
+    return report.complete ? 0 : 1;
+}
+
+static int Work(int argc, char **argv)
+{
+    int frames = argc > 3 ? atoi(argv[3]) : 0;
+    if (argc > 4 || frames < 0 || (argc > 3 && frames == 0))
+    {
+        Usage();
+    }
+
+    SceneCache cache;
+    ConstructSceneCache(&cache, DefaultServerSettings().cache_size);
+
+    WorkerSettings settings = DefaultWorkerSettings();
+    settings.address = argv[2];
+
+    // Keep working on frames, the cache means each scene is only read once
+    int rendered = 0;
+    while ((frames == 0 || rendered < frames) && RunRenderWorker(&cache, settings))
+    {
+        rendered++;
+    }
+
+    DeconstructSceneCache(&cache);
+    return rendered > 0 ? 0 : 1;
+}
+
+/* 'output' with the view's number before its extension, "frame.ppm" becomes "frame_3.ppm" */
+static void ViewFilename(char *filename, size_t size, const char *output, unsigned view)
+{
+    const char *extension = strrchr(output, '.');
+    int stem = extension != NULL && strchr(extension, '/') == NULL ? (int)(extension - output) : (int)strlen(output);
+    snprintf(filename, size, "%.*s_%u%s", stem, output, view, output + stem);
+}
+
+static int RenderViews(Scene *s, const char *output)
+{
+    Canvas *canvases = malloc(s->camera_count * sizeof(Canvas));
+    for (unsigned i = 0; i < s->camera_count; i++)
+    {
+        ConstructCanvas(&canvases[i], s->cameras[i].width, s->cameras[i].height);
+    }
+
+    RenderSceneViews(s, s->cameras, canvases, s->camera_count);
+
+    for (unsigned i = 0; i < s->camera_count; i++)
+    {
+        char filename[4096];
+        ViewFilename(filename, sizeof(filename), output, i);
+        WriteToPPM(&canvases[i], filename);
+        DeconstructCanvas(&canvases[i]);
+    }
+
+    free(canvases);
+    DeconstructScene(s);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc >= 3 && strcmp(argv[1], "--serve") == 0)
+    {
+        return Serve(argc, argv);
+    }
+
+    if (argc >= 3 && strcmp(argv[1], "--request") == 0)
+    {
+        return Request(argc, argv);
+    }
+
+    if (argc >= 3 && strcmp(argv[1], "--coordinate") == 0)
+    {
+        return Coordinate(argc, argv);
+    }
+
+    if (argc >= 3 && strcmp(argv[1], "--work") == 0)
+    {
+        return Work(argc, argv);
+    }
+
+    if (argc < 3)
+    {
+        Usage();
+    }
+
+    Scene s;
+    ReadScene(&s, argv[1]);
+
+    CheckpointSettings checkpoint = DefaultCheckpointSettings();
+
+    // The last option given. Every option changes how a single camera's frame is rendered
+    const char *frame_option = NULL;
+
+    for (int i = 3; i < argc; i++)
+    {
+        frame_option = argv[i];
+        if (strcmp(argv[i], "--region") == 0 && i + 1 < argc)
+        {
+            ParseRegion(&s.region, argv[++i]);
+        }
+        else if (strcmp(argv[i], "--tiles") == 0 && i + 1 < argc)
+        {
+            ParseTiles(&s.region, argv[++i]);
+        }
+        else if (strcmp(argv[i], "--crop") == 0)
+        {
+            s.region.output = REGION_CROPPED;
+        }
+        else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc)
+        {
+            checkpoint.filename = argv[++i];
+        }
+        else if (strcmp(argv[i], "--checkpoint-interval") == 0 && i + 1 < argc)
+        {
+            char *end;
+            checkpoint.interval = strtod(argv[++i], &end);
+            if (*end != '\0' || checkpoint.interval < 0)
+            {
+                printf("Could not read interval '%s'\n", argv[i]);
+                Usage();
+            }
+        }
+        else if (strcmp(argv[i], "--no-resume") == 0)
+        {
+            checkpoint.resume = false;
+        }
+        else
+        {
+            printf("Unknown option '%s'\n", argv[i]);
+            Usage();
+        }
+    }
+
+    if (s.camera_count > 0 && frame_option != NULL)
+    {
+        printf("'%s' does not apply to a scene file with \"cameras\"\n", frame_option);
+        Usage();
+    }
+
+    if (s.camera_count > 0)
+    {
+        return RenderViews(&s, argv[2]);
+    }
+
+    Canvas canvas;
+    if (s.region.output == REGION_CROPPED)
+    {
+        RenderRegion clipped = ClipRegion(&s.camera, s.region);
+        ConstructCanvas(&canvas, clipped.width, clipped.height);
+    }
+    else
+    {
+        ConstructCanvas(&canvas, s.camera.width, s.camera.height);
+    }
+
+    // A cropped canvas' tiles are not the frame's, so only whole frame canvases are checkpointed
+    TileCheckpoint tc;
+    if (checkpoint.filename != NULL && s.region.output == REGION_IN_PLACE)
+    {
+        checkpoint.scene_hash = s.hash;
+        checkpoint.seed = s.sampler.seed;
+        OpenTileCheckpoint(&tc, &canvas, checkpoint);
+        printf("%u tile(s) already in '%s'\n", FinishedTileCount(&tc), checkpoint.filename);
+        s.checkpoint = &tc;
+    }
+    else if (checkpoint.filename != NULL)
+    {
+        printf("Checkpoints are not written for cropped regions\n");
+    }
+
+    RenderSceneRegion(&s, &canvas, s.region);
+    WriteToPPM(&canvas, argv[2]);
+
+    if (s.checkpoint != NULL)
+    {
+        CloseTileCheckpoint(&tc);
+    }
+
+    DeconstructCanvas(&canvas);
+    DeconstructScene(&s);
+    return 0;
+}
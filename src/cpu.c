@@ -0,0 +1,78 @@
+#include "cpu.h"
+#include "intersection.h"
+#include "bounds.h"
+#include "matrix.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static CPU_TARGET current_target = CPU_AVX2;
+
+/* Compiled for the oldest x86-64 CPUs, so that it can run before anything built for AVX2 */
+#define BASELINE_FUNCTION __attribute__((target("arch=x86-64")))
+
+BASELINE_FUNCTION CPU_TARGET DetectCpuTarget()
+{
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        return CPU_AVX512;
+    }
+    else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+        return CPU_AVX2;
+    }
+
+    return CPU_SCALAR;
+}
+
+CPU_TARGET CpuTarget()
+{
+    return current_target;
+}
+
+bool SetCpuTarget(CPU_TARGET target)
+{
+    if (target >= CPU_TARGET_COUNT || target > DetectCpuTarget())
+    {
+        return false;
+    }
+
+    SelectIntersectionKernels(target);
+    SelectBoundsKernels(target);
+    SelectMatrixKernels(target);
+    current_target = target;
+    return true;
+}
+
+const char *CpuTargetName(CPU_TARGET target)
+{
+    switch (target)
+    {
+    case CPU_SCALAR:
+        return "scalar";
+    case CPU_AVX2:
+        return "avx2";
+    case CPU_AVX512:
+        return "avx512";
+    case CPU_TARGET_COUNT:
+        break;
+    }
+
+    return "unknown";
+}
+
+/* Runs before the other constructors, which already use AVX2 */
+BASELINE_FUNCTION void __attribute__((constructor(101))) InitializeCpuTarget()
+{
+    CPU_TARGET target = DetectCpuTarget();
+
+    if (target == CPU_SCALAR)
+    {
+        fputs("This CPU does not support AVX2 and FMA, which the tracer requires\n", stderr);
+        exit(1);
+    }
+
+    SetCpuTarget(target);
+}
@@ -4,6 +4,11 @@
 #include "material.h"
 #include "shape.h"
 #include "intersection.h"
+#include "path_tracer.h"
+#include "denoise.h"
+#include "stats.h"
+#include "trace.h"
+#include "profile.h"
 
 #include <math.h>
 #include <time.h>
@@ -11,7 +16,7 @@
 
 void AssignDefaultTestMaterial(Material *m)
 {
-    m->pattern = NewSolidPattern(NewColor(255, 255, 255, 255));
+    m->pattern = AddPattern(NewSolidPattern(NewColor(255, 255, 255, 255)));
     m->ambient_reflection = 0.1;
     m->diffuse_reflection = 0.9;
     m->specular_reflection = 0.9;
@@ -42,24 +47,22 @@ void DemoCanvas()
 
 void DemoSphereScene()
 {
-    Material m;
+    Material m = NewMaterial(NewColor(255, 0, 128, 255));
     AssignDefaultTestMaterial(&m);
-    m.pattern = NewSolidPattern(NewColor(255, 0, 128, 255));
+    m.pattern = AddPattern(NewSolidPattern(NewColor(255, 0, 128, 255)));
 
-    Light l;
-    l.origin = NewPnt3(1000, 2000, -2000);
-    l.color = NewColor(255, 255, 255, 255);
+    Light l = NewLight(NewPnt3(1000, 2000, -2000));
 
     Canvas c;
     ConstructCanvas(&c, 800, 600);
 
     Shape s = NewSphere(NewPnt3(0, 0, 2), 500);
-    s.material = m;
+    SetShapeMaterial(&s, m);
 
     Shape s2 = NewSphere(NewPnt3(1, 1, -5), 50);
-    m.pattern = NewSolidPattern(NewColor(0, 255, 128, 255));
+    m.pattern = AddPattern(NewSolidPattern(NewColor(0, 255, 128, 255)));
 
-    s2.material = m;
+    SetShapeMaterial(&s2, m);
 
     Camera ca = NewCamera(800, 600, 3.1415 / 3);
     CameraApplyTransformation(&ca, ViewMatrix(NewPnt3(0, 0, -600), NewPnt3(0, 0, 0), NewVec3(0, -1, 0)));
@@ -88,18 +91,24 @@ void DemoPlane()
     ConstructScene(&s, c, l);
 
     Shape sphere2 = NewSphere(NewPnt3(-0.5, 40, 100), 50);
-    AssignDefaultTestMaterial(&(sphere2.material));
-    sphere2.material.pattern = NewSolidPattern(NewColor(0, 0, 255, 255));
-    sphere2.material.general_reflection = 0.5;
+    Material m = *ShapeMaterial(&sphere2);
+    AssignDefaultTestMaterial(&m);
+    m.pattern = AddPattern(NewSolidPattern(NewColor(0, 0, 255, 255)));
+    m.general_reflection = 0.5;
+    SetShapeMaterial(&sphere2, m);
     AddShape(&s, sphere2);
 
     Shape sphere = NewSphere(NewPnt3(0, 100, 175), 20);
-    AssignDefaultTestMaterial(&(sphere.material));
-    sphere.material.pattern = NewSolidPattern(NewColor(0, 255, 128, 255));
+    m = *ShapeMaterial(&sphere);
+    AssignDefaultTestMaterial(&m);
+    m.pattern = AddPattern(NewSolidPattern(NewColor(0, 255, 128, 255)));
+    SetShapeMaterial(&sphere, m);
     AddShape(&s, sphere);
 
     Shape plane = NewPlane(NewPnt3(0, -10, 0), NewVec3(0, 1, 0));
-    AssignDefaultTestMaterial(&(plane.material));
+    m = *ShapeMaterial(&plane);
+    AssignDefaultTestMaterial(&m);
+    SetShapeMaterial(&plane, m);
     AddShape(&s, plane);
 
     Canvas canvas;
@@ -142,21 +151,10 @@ void DemoUnthreaded()
     DeconstructScene(&s);
 }
 
-double prng()
+/* Uniform on (-66.22, 66.22), from a fixed seed so the scene is the same every run */
+double prng(Sampler *sampler)
 {
-    static double seed = 1.4;
-    double m = 66.22;
-    double a = m * 25.1231234;
-    double b = m / 234.234;
-
-    seed = fmod(a * seed + b, m);
-
-    if (fmod(seed, 10) < 5)
-    {
-        seed *= -1.0;
-    }
-
-    return seed;
+    return (SampleNext1D(sampler) * 2 - 1) * 66.22;
 }
 
 #define NUM_RAND_SHAPES 128
@@ -169,12 +167,14 @@ void BusyScene()
     Scene s;
     ConstructScene(&s, c, l);
 
+    Sampler sampler = NewSampler(INDEPENDENT_SAMPLER, 1, 14);
+
     for (int j = 0; j < NUM_RAND_SHAPES; j++)
     {
-        Tuple3 center = NewPnt3(prng(), prng(), prng());
-        Shape sphere = NewSphere(center, prng() / 5);
+        Tuple3 center = NewPnt3(prng(&sampler), prng(&sampler), prng(&sampler));
+        Shape sphere = NewSphere(center, prng(&sampler) / 5);
 
-        ApplyTransformation(&sphere, RotationMatrix(prng(), prng(), prng()));
+        ApplyTransformation(&sphere, RotationMatrix(prng(&sampler), prng(&sampler), prng(&sampler)));
 
         AddShape(&s, sphere);
     }
@@ -222,10 +222,12 @@ void DemoTeapot()
     ReadObj(&s, "scenes/teapot.obj");
 
     Shape floor = NewPlane(NewPnt3(0, 0, 0), NewVec3(0, 1, 0));
-    floor.material.pattern = NewPattern(
+    Material floor_material = *ShapeMaterial(&floor);
+    floor_material.pattern = AddPattern(NewPattern(
         NewColor(0xDB, 0x60, 0x79, 0xFF),
         NewColor(0x92, 0xbb, 0xf7, 0xFF),
-        CHECKERED);
+        CHECKERED));
+    SetShapeMaterial(&floor, floor_material);
     
     AddShape(&s, floor);
 
@@ -238,6 +240,160 @@ void DemoTeapot()
     DeconstructScene(&s);
 }
 
+void DemoAreaLight()
+{
+    Light l = NewRectangleLight(NewPnt3(-10, 10, -10), NewVec3(4, 0, 0), NewVec3(0, 4, 0), 16);
+    Camera c = NewCamera(1920, 1080, 1.047);
+    CameraApplyTransformation(&c, ViewMatrix(NewPnt3(-2.0, 6.0, -10), NewPnt3(0, 0, 0), NewVec3(0, 1, 0)));
+
+    Scene s;
+    ConstructScene(&s, c, l);
+
+    Shape sphere = NewSphere(NewPnt3(0, 1, 0), 1);
+    AddShape(&s, sphere);
+
+    Shape floor = NewPlane(NewPnt3(0, 0, 0), NewVec3(0, 1, 0));
+    AddShape(&s, floor);
+
+    Canvas canvas;
+    ConstructCanvas(&canvas, s.camera.width, s.camera.height);
+
+    RenderScene(&s, &canvas);
+    WriteToPPM(&canvas, "./renderings/area_light.ppm");
+
+    DeconstructCanvas(&canvas);
+    DeconstructScene(&s);
+}
+
+void DemoPathTracer()
+{
+    Scene s;
+    ReadScene(&s, "./scenes/three_spheres.json");
+
+    Canvas canvas;
+    ConstructCanvas(&canvas, s.camera.width, s.camera.height);
+
+    Accumulator a;
+    ConstructAccumulator(&a, s.camera.width, s.camera.height);
+
+    ProgressiveSettings settings = DefaultProgressiveSettings();
+    settings.target_noise = 0.05;
+    settings.publish_interval = 4;
+    settings.publish_filename = "./renderings/three_spheres_path_traced.ppm";
+
+    RenderSceneProgressive(&s, &canvas, &a, settings);
+    WriteToPPM(&canvas, settings.publish_filename);
+
+    DeconstructAccumulator(&a);
+    DeconstructCanvas(&canvas);
+    DeconstructScene(&s);
+}
+
+void DemoBudgetedRender()
+{
+    Scene s;
+    ReadScene(&s, "./scenes/three_spheres.json");
+
+    Canvas canvas;
+    ConstructCanvas(&canvas, s.camera.width, s.camera.height);
+
+    BudgetSettings settings = DefaultBudgetSettings();
+    settings.budget = 5.0;
+
+    RenderSceneBudgeted(&s, &canvas, settings);
+    WriteToPPM(&canvas, "./renderings/three_spheres_budgeted.ppm");
+
+    DeconstructCanvas(&canvas);
+    DeconstructScene(&s);
+}
+
+void DemoDenoise()
+{
+    Scene s;
+    ReadScene(&s, "./scenes/three_spheres.json");
+
+    Canvas canvas;
+    ConstructCanvas(&canvas, s.camera.width, s.camera.height);
+    EnableCanvasPlanes(&canvas, CANVAS_ALBEDO | CANVAS_NORMAL | CANVAS_DEPTH);
+
+    Accumulator a;
+    ConstructAccumulator(&a, s.camera.width, s.camera.height);
+
+    ProgressiveSettings settings = DefaultProgressiveSettings();
+    settings.max_samples = 8;
+
+    RenderSceneProgressive(&s, &canvas, &a, settings);
+    WriteToPPM(&canvas, "./renderings/three_spheres_noisy.ppm");
+
+    DenoiseCanvas(&canvas, DefaultDenoiseSettings());
+    WriteToPPM(&canvas, "./renderings/three_spheres_denoised.ppm");
+
+    DeconstructAccumulator(&a);
+    DeconstructCanvas(&canvas);
+    DeconstructScene(&s);
+}
+
+void DemoRenderStats()
+{
+    Scene s;
+    ReadScene(&s, "./scenes/three_spheres.json");
+
+    Canvas canvas;
+    ConstructCanvas(&canvas, s.camera.width, s.camera.height);
+
+    FrameStats stats;
+    ConstructFrameStats(&stats, &canvas);
+    s.stats = &stats;
+
+    RenderScene(&s, &canvas);
+
+    PrintFrameStats(&stats);
+    WriteFrameStatsToJSON(&stats, "./renderings/three_spheres_stats.json");
+    WriteFrameStatsHeatmap(&stats, STAT_NODE_VISITS, "./renderings/three_spheres_node_visits.ppm");
+
+    DeconstructFrameStats(&stats);
+    DeconstructCanvas(&canvas);
+    DeconstructScene(&s);
+}
+
+void DemoTrace()
+{
+    StartTrace(TRACE_DEFAULT_CAPACITY);
+
+    Scene s;
+    ReadScene(&s, "./scenes/three_spheres.json");
+
+    Canvas canvas;
+    ConstructCanvas(&canvas, s.camera.width, s.camera.height);
+
+    RenderScene(&s, &canvas);
+    WriteToPPM(&canvas, "./renderings/three_spheres.ppm");
+
+    DeconstructCanvas(&canvas);
+    DeconstructScene(&s);
+
+    StopTrace("./renderings/three_spheres_trace.json");
+}
+
+void DemoProfile()
+{
+    StartProfile(PROFILE_DEFAULT_CAPACITY);
+
+    Scene s;
+    ReadScene(&s, "./scenes/three_spheres.json");
+
+    Canvas canvas;
+    ConstructCanvas(&canvas, s.camera.width, s.camera.height);
+
+    RenderScene(&s, &canvas);
+    WriteToPPM(&canvas, "./renderings/three_spheres.ppm");
+
+    DeconstructCanvas(&canvas);
+    DeconstructScene(&s);
+
+    StopProfile("./renderings/three_spheres_profile.json");
+}
+
 int main()
 {
     DemoJsonScene();
@@ -0,0 +1,185 @@
+#include <math.h>
+#include <immintrin.h>
+
+#include "denoise.h"
+#include "parallel.h"
+#include "shmem.h"
+#include "trace.h"
+
+/* Added to the albedo before it is divided out, so dark surfaces do not blow up */
+#define DEMODULATE_EPSILON 0.01
+
+/* Weights of the 5 tap B3 spline, applied along both axes */
+static const double kernel_weights[5] = {1.0 / 16.0, 1.0 / 4.0, 3.0 / 8.0, 1.0 / 4.0, 1.0 / 16.0};
+
+DenoiseSettings DefaultDenoiseSettings()
+{
+    DenoiseSettings settings = {
+        .iterations = 5,
+        .sigma_color = 1.0,
+        .sigma_normal = 64.0,
+        .sigma_depth = 0.05,
+        .demodulate_albedo = true,
+    };
+
+    return settings;
+}
+
+typedef struct
+{
+    Canvas *canvas;
+    Tuple3 *input;
+    Tuple3 *output;
+    DenoiseSettings settings;
+    int step;
+    double inverse_color_variance;
+} DenoiseContext;
+
+/* Squared distance between two colors, ignoring the alpha channel */
+static inline double ColorDistanceSquared(Tuple3 a, Tuple3 b)
+{
+    __m256d difference = _mm256_sub_pd(a, b);
+    difference = _mm256_mul_pd(difference, difference);
+    return difference[0] + difference[1] + difference[2];
+}
+
+static inline double NormalWeight(Canvas *c, double sigma_normal, unsigned p, unsigned q)
+{
+    if (c->normal == NULL)
+    {
+        return 1.0;
+    }
+
+    // Pixels that missed every shape have no normal, and only blend with each other
+    bool p_missed = TupleDotProduct(c->normal[p], c->normal[p]) == 0;
+    bool q_missed = TupleDotProduct(c->normal[q], c->normal[q]) == 0;
+    if (p_missed || q_missed)
+    {
+        return p_missed && q_missed ? 1.0 : 0.0;
+    }
+
+    double cosine = TupleDotProduct(c->normal[p], c->normal[q]);
+    return pow(fmax(0.0, cosine), sigma_normal);
+}
+
+static inline double DepthWeight(Canvas *c, double sigma_depth, int step, unsigned p, unsigned q)
+{
+    if (c->depth == NULL)
+    {
+        return 1.0;
+    }
+
+    double depth_p = c->depth[p];
+    double depth_q = c->depth[q];
+
+    // The background only blends with itself
+    if (isinf(depth_p) || isinf(depth_q))
+    {
+        return isinf(depth_p) && isinf(depth_q) ? 1.0 : 0.0;
+    }
+
+    // Slanted surfaces change depth with distance, so allow more change for wider steps
+    return exp(-fabs(depth_p - depth_q) / (sigma_depth * depth_p * step + 1e-9));
+}
+
+void DenoiseSection(void *context, unsigned start, unsigned end)
+{
+    DenoiseContext *ctx = context;
+    Canvas *c = ctx->canvas;
+
+    int width = (int)c->canvas_width;
+    int height = (int)c->canvas_height;
+
+    for (unsigned p = start; p < end; p++)
+    {
+        int x = (int)(p % c->canvas_width);
+        int y = (int)(p / c->canvas_width);
+
+        Tuple3 center = ctx->input[p];
+        __m256d sum = _mm256_setzero_pd();
+        double weight_sum = 0;
+
+        for (int j = -2; j <= 2; j++)
+        {
+            int qy = y + j * ctx->step;
+            if (qy < 0 || qy >= height)
+            {
+                continue;
+            }
+
+            for (int i = -2; i <= 2; i++)
+            {
+                int qx = x + i * ctx->step;
+                if (qx < 0 || qx >= width)
+                {
+                    continue;
+                }
+
+                unsigned q = (unsigned)(qy * width + qx);
+                Tuple3 neighbour = ctx->input[q];
+
+                double weight = kernel_weights[i + 2] * kernel_weights[j + 2];
+                weight *= exp(-ColorDistanceSquared(center, neighbour) * ctx->inverse_color_variance);
+                weight *= NormalWeight(c, ctx->settings.sigma_normal, p, q);
+                weight *= DepthWeight(c, ctx->settings.sigma_depth, ctx->step, p, q);
+
+                sum = _mm256_fmadd_pd(_mm256_set1_pd(weight), neighbour, sum);
+                weight_sum += weight;
+            }
+        }
+
+        // The center tap always has a weight of at least (3/8)^2, so this never divides by zero
+        ctx->output[p] = TupleScalarDivide(sum, weight_sum);
+    }
+}
+
+static Tuple3 DemodulateOffset()
+{
+    return _mm256_set1_pd(DEMODULATE_EPSILON);
+}
+
+void DenoiseCanvas(Canvas *c, DenoiseSettings settings)
+{
+    TRACE_SCOPE("DenoiseCanvas", "phase");
+
+    unsigned size = c->canvas_width * c->canvas_height;
+    bool demodulate = settings.demodulate_albedo && c->albedo != NULL;
+
+    Tuple3 *input = (Tuple3 *)shmalloc(size * sizeof(Tuple3));
+    Tuple3 *output = (Tuple3 *)shmalloc(size * sizeof(Tuple3));
+
+    for (unsigned i = 0; i < size; i++)
+    {
+        input[i] = demodulate ? TupleDivide(c->buffer[i], TupleAdd(c->albedo[i], DemodulateOffset())) : c->buffer[i];
+    }
+
+    DenoiseContext ctx = {
+        .canvas = c,
+        .settings = settings,
+    };
+
+    for (unsigned k = 0; k < settings.iterations; k++)
+    {
+        TRACE_SCOPE_ARGUMENT("denoise pass", "phase", k);
+        double sigma_color = settings.sigma_color / (double)(1u << k);
+
+        ctx.input = input;
+        ctx.output = output;
+        ctx.step = 1 << k;
+        ctx.inverse_color_variance = 1.0 / (sigma_color * sigma_color);
+
+        ParallelForSections(size, DenoiseSection, &ctx);
+
+        Tuple3 *swap = input;
+        input = output;
+        output = swap;
+    }
+
+    for (unsigned i = 0; i < size; i++)
+    {
+        c->buffer[i] = demodulate ? TupleMultiply(input[i], TupleAdd(c->albedo[i], DemodulateOffset())) : input[i];
+    }
+
+    shfree(input, size * sizeof(Tuple3));
+    shfree(output, size * sizeof(Tuple3));
+}
@@ -0,0 +1,590 @@
+#include "distributed.h"
+#include "net.h"
+#include "trace.h"
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+/* Seconds a worker may take to send the rest of a message it has started */
+#define MESSAGE_TIMEOUT 10
+
+/* The most workers given the same tile at once, counting the one that has it first */
+#define MAX_TILE_COPIES 2
+
+/* Progress of a tile, a tile only goes back to waiting if every worker it was given to fails */
+typedef enum
+{
+    TILE_WAITING,
+    TILE_ISSUED,
+    TILE_RECEIVED,
+} TILE_PROGRESS;
+
+typedef struct
+{
+    int fd;
+
+    /** The tiles the worker has been given and not returned */
+    unsigned *issued;
+    unsigned issued_count;
+
+    /** Set once the worker has the scene loaded */
+    bool ready;
+} Worker;
+
+typedef struct
+{
+    Canvas *canvas;
+    CoordinatorSettings settings;
+
+    const char *scene_json;
+    uint64_t hash;
+
+    unsigned tile_count;
+
+    /** One TILE_PROGRESS per tile */
+    unsigned char *progress;
+
+    /** How many workers have each tile */
+    unsigned *copies;
+
+    /** Tiles whose workers failed, given out before 'next_tile' */
+    unsigned *returned;
+    unsigned returned_count;
+
+    /** Tiles before this one have been given out at least once */
+    unsigned next_tile;
+
+    unsigned received;
+
+    Worker *workers;
+    unsigned worker_count;
+
+    DistributedReport report;
+} Coordinator;
+
+static double Seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+CoordinatorSettings DefaultCoordinatorSettings()
+{
+    CoordinatorSettings settings = {
+        .address = "127.0.0.1:7878",
+        .tiles_in_flight = 2,
+        .timeout = 60,
+    };
+
+    return settings;
+}
+
+WorkerSettings DefaultWorkerSettings()
+{
+    WorkerSettings settings = {
+        .address = "127.0.0.1:7878",
+        .connect_timeout = 10,
+        .max_tiles = 0,
+    };
+
+    return settings;
+}
+
+size_t CompressTile(Canvas *c, Tile t, unsigned char *out)
+{
+    unsigned char *next = out;
+    unsigned char run[3];
+    unsigned run_length = 0;
+
+    for (unsigned y = t.y; y < t.y + t.height; y++)
+    {
+        for (unsigned x = t.x; x < t.x + t.width; x++)
+        {
+            unsigned char rgb[3];
+            PixelBytes(c, y * c->canvas_width + x, rgb);
+
+            if (run_length > 0 && run_length < 255 && memcmp(rgb, run, 3) == 0)
+            {
+                run_length++;
+                continue;
+            }
+
+            if (run_length > 0)
+            {
+                *next++ = (unsigned char)run_length;
+                memcpy(next, run, 3);
+                next += 3;
+            }
+
+            memcpy(run, rgb, 3);
+            run_length = 1;
+        }
+    }
+
+    if (run_length > 0)
+    {
+        *next++ = (unsigned char)run_length;
+        memcpy(next, run, 3);
+        next += 3;
+    }
+
+    return (size_t)(next - out);
+}
+
+bool DecompressTile(const unsigned char *in, size_t length, Canvas *c, Tile t)
+{
+    unsigned pixel = 0, pixels = t.width * t.height;
+
+    for (size_t i = 0; i + 4 <= length; i += 4)
+    {
+        Tuple3 color = NewColor(in[i + 1], in[i + 2], in[i + 3], 0);
+        for (unsigned j = 0; j < in[i] && pixel < pixels; j++, pixel++)
+        {
+            WritePixel(c, color, t.x + pixel % t.width, t.y + pixel / t.width);
+        }
+    }
+
+    return pixel == pixels && length % 4 == 0;
+}
+
+/* Pick a tile for the worker: one a failed worker had, then the next one never given
+ * out, then one another worker is still rendering. Returns false if none is left
+ */
+static bool NextTile(Coordinator *co, Worker *w, unsigned *tile)
+{
+    while (co->returned_count > 0)
+    {
+        *tile = co->returned[--co->returned_count];
+        if (co->progress[*tile] == TILE_WAITING)
+        {
+            return true;
+        }
+    }
+
+    if (co->next_tile < co->tile_count)
+    {
+        *tile = co->next_tile++;
+        return true;
+    }
+
+    // The tile with the fewest workers, that this worker does not have
+    bool found = false;
+    for (unsigned i = 0; i < co->tile_count; i++)
+    {
+        bool has = false;
+        for (unsigned j = 0; j < w->issued_count; j++)
+        {
+            has = has || w->issued[j] == i;
+        }
+
+        if (co->progress[i] == TILE_ISSUED && !has && co->copies[i] < MAX_TILE_COPIES && (!found || co->copies[i] < co->copies[*tile]))
+        {
+            *tile = i;
+            found = true;
+        }
+    }
+
+    return found;
+}
+
+/* Give the worker tiles until it has settings.tiles_in_flight. Returns false if it could not be sent them */
+static bool IssueTiles(Coordinator *co, Worker *w)
+{
+    unsigned tile = 0;
+    while (w->issued_count < co->settings.tiles_in_flight && NextTile(co, w, &tile))
+    {
+        uint32_t index = tile;
+        w->issued[w->issued_count++] = tile;
+        co->progress[tile] = TILE_ISSUED;
+        co->copies[tile]++;
+
+        if (!SendMessage(w->fd, WORK_TILE, &index, sizeof(index)))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Disconnect a worker, the tiles no other worker has are given out again */
+static void DropWorker(Coordinator *co, unsigned index)
+{
+    Worker *w = &co->workers[index];
+
+    for (unsigned i = 0; i < w->issued_count; i++)
+    {
+        unsigned tile = w->issued[i];
+        co->copies[tile]--;
+
+        if (co->progress[tile] == TILE_ISSUED && co->copies[tile] == 0)
+        {
+            co->progress[tile] = TILE_WAITING;
+            co->returned[co->returned_count++] = tile;
+            co->report.reissued_tiles++;
+        }
+    }
+
+    close(w->fd);
+    free(w->issued);
+
+    co->workers[index] = co->workers[--co->worker_count];
+}
+
+/* Give the tiles failed workers returned to workers with room for more. A worker only asks for
+ * tiles when it sends a result, so one left idle because every tile was taken would never get them.
+ * Workers that cannot be sent tiles are dropped in turn, returning theirs
+ */
+static void ReissueTiles(Coordinator *co)
+{
+    bool dropped = true;
+    while (dropped && co->returned_count > 0)
+    {
+        dropped = false;
+        for (unsigned i = co->worker_count; i > 0; i--)
+        {
+            Worker *w = &co->workers[i - 1];
+            if (w->ready && w->issued_count < co->settings.tiles_in_flight && !IssueTiles(co, w))
+            {
+                DropWorker(co, i - 1);
+                dropped = true;
+            }
+        }
+    }
+}
+
+static void AcceptWorker(Coordinator *co, int listener)
+{
+    int fd = accept(listener, NULL, NULL);
+    if (fd < 0)
+    {
+        return;
+    }
+
+    // A worker that stops halfway through a message is treated as failed, rather than stalling the frame
+    struct timeval timeout = {.tv_sec = MESSAGE_TIMEOUT, .tv_usec = 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    unsigned char hello[sizeof(uint64_t) + 2 * sizeof(uint32_t)];
+    uint32_t size[2] = {co->canvas->canvas_width, co->canvas->canvas_height};
+    memcpy(hello, &co->hash, sizeof(uint64_t));
+    memcpy(hello + sizeof(uint64_t), size, sizeof(size));
+
+    if (!SendMessage(fd, WORK_HELLO, hello, sizeof(hello)))
+    {
+        close(fd);
+        return;
+    }
+
+    co->workers = realloc(co->workers, (co->worker_count + 1) * sizeof(Worker));
+    co->workers[co->worker_count++] = (Worker){
+        .fd = fd,
+        .issued = malloc(co->settings.tiles_in_flight * sizeof(unsigned)),
+        .issued_count = 0,
+        .ready = false,
+    };
+
+    co->report.workers++;
+}
+
+static bool ReceiveResult(Coordinator *co, Worker *w, const unsigned char *payload, uint32_t length)
+{
+    uint32_t index;
+    if (length < sizeof(index))
+    {
+        return false;
+    }
+
+    memcpy(&index, payload, sizeof(index));
+
+    unsigned slot = w->issued_count;
+    for (unsigned i = 0; i < w->issued_count; i++)
+    {
+        slot = w->issued[i] == index ? i : slot;
+    }
+
+    if (slot == w->issued_count)
+    {
+        return false;
+    }
+
+    w->issued[slot] = w->issued[--w->issued_count];
+    co->copies[index]--;
+
+    // Another worker may have returned the same tile first
+    if (co->progress[index] == TILE_RECEIVED)
+    {
+        return true;
+    }
+
+    Tile t = CanvasTile(co->canvas, index);
+    if (!DecompressTile(payload + sizeof(index), length - sizeof(index), co->canvas, t))
+    {
+        return false;
+    }
+
+    co->progress[index] = TILE_RECEIVED;
+    co->received++;
+    co->report.compressed_bytes += length - sizeof(index);
+    co->report.raw_bytes += t.width * t.height * 3;
+
+    return true;
+}
+
+/* Handle the next message from a worker. Returns false if the worker failed */
+static bool HandleWorker(Coordinator *co, Worker *w)
+{
+    uint32_t type, length;
+    unsigned char *payload = ReceiveMessage(w->fd, &type, &length);
+    if (payload == NULL)
+    {
+        return false;
+    }
+
+    bool ok = true;
+    switch ((WORK_MESSAGE)type)
+    {
+    case WORK_NEED_SCENE:
+        ok = !w->ready && SendMessage(w->fd, WORK_SCENE, co->scene_json, strlen(co->scene_json));
+        break;
+    case WORK_READY:
+        ok = !w->ready;
+        w->ready = true;
+        ok = ok && IssueTiles(co, w);
+        break;
+    case WORK_RESULT:
+        ok = w->ready && ReceiveResult(co, w, payload, length) && IssueTiles(co, w);
+        break;
+    case WORK_HELLO:
+    case WORK_SCENE:
+    case WORK_TILE:
+    case WORK_FINISHED:
+    default:
+        ok = false;
+        break;
+    }
+
+    free(payload);
+    return ok;
+}
+
+DistributedReport RenderSceneDistributed(const char *scene_json, Canvas *c, CoordinatorSettings settings)
+{
+    TRACE_SCOPE("RenderSceneDistributed", "phase");
+
+    double start = Seconds();
+    unsigned tile_count = CanvasTileCount(c);
+    settings.tiles_in_flight = settings.tiles_in_flight > 0 ? settings.tiles_in_flight : 1;
+
+    Coordinator co = {
+        .canvas = c,
+        .settings = settings,
+        .scene_json = scene_json,
+        .hash = HashSceneJson(scene_json),
+        .tile_count = tile_count,
+        .progress = calloc(tile_count, sizeof(unsigned char)),
+        .copies = calloc(tile_count, sizeof(unsigned)),
+        .returned = malloc(tile_count * sizeof(unsigned)),
+        .returned_count = 0,
+        .next_tile = 0,
+        .received = 0,
+        .workers = NULL,
+        .worker_count = 0,
+        .report = {0},
+    };
+
+    int listener = ListenOn(settings.address);
+    struct pollfd *fds = NULL;
+
+    while (listener >= 0 && co.received < tile_count)
+    {
+        fds = realloc(fds, (co.worker_count + 1) * sizeof(struct pollfd));
+        fds[0] = (struct pollfd){.fd = listener, .events = POLLIN};
+        for (unsigned i = 0; i < co.worker_count; i++)
+        {
+            fds[i + 1] = (struct pollfd){.fd = co.workers[i].fd, .events = POLLIN};
+        }
+
+        unsigned worker_count = co.worker_count;
+        int ready = poll(fds, worker_count + 1, (int)(settings.timeout * 1000));
+        if (ready == 0)
+        {
+            printf("No worker replied for %f seconds, %u of %u tile(s) are missing\n", settings.timeout, tile_count - co.received, tile_count);
+            break;
+        }
+
+        // Backwards, a dropped worker is replaced by the last one, which has already been handled
+        bool dropped = false;
+        for (unsigned i = worker_count; i > 0; i--)
+        {
+            if (fds[i].revents != 0 && !HandleWorker(&co, &co.workers[i - 1]))
+            {
+                DropWorker(&co, i - 1);
+                dropped = true;
+            }
+        }
+
+        if (dropped)
+        {
+            ReissueTiles(&co);
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            AcceptWorker(&co, listener);
+        }
+    }
+
+    for (unsigned i = 0; i < co.worker_count; i++)
+    {
+        SendMessage(co.workers[i].fd, WORK_FINISHED, NULL, 0);
+        close(co.workers[i].fd);
+        free(co.workers[i].issued);
+    }
+
+    if (listener >= 0)
+    {
+        StopListening(settings.address, listener);
+    }
+
+    co.report.complete = co.received == tile_count;
+    co.report.seconds = Seconds() - start;
+
+    printf("Rendered %u tile(s) on %u worker(s) in %f seconds, %u reissued, %lu of %lu byte(s) after compression\n",
+           co.received, co.report.workers, co.report.seconds, co.report.reissued_tiles, co.report.compressed_bytes, co.report.raw_bytes);
+
+    free(fds);
+    free(co.workers);
+    free(co.progress);
+    free(co.copies);
+    free(co.returned);
+
+    return co.report;
+}
+
+/* Keep trying to connect until the timeout, the coordinator may not be listening yet */
+static int ConnectToCoordinator(WorkerSettings settings)
+{
+    double give_up = Seconds() + settings.connect_timeout;
+
+    int fd;
+    while ((fd = ConnectTo(settings.address)) < 0 && Seconds() < give_up)
+    {
+        usleep(10000);
+    }
+
+    if (fd < 0)
+    {
+        printf("Could not connect to '%s'\n", settings.address);
+    }
+
+    return fd;
+}
+
+/* Get the coordinator's scene into the cache. Returns NULL if the coordinator went away */
+static Scene *WorkerScene(SceneCache *cache, int fd, unsigned *width, unsigned *height)
+{
+    uint32_t type, length;
+    unsigned char *hello = ReceiveMessage(fd, &type, &length);
+    if (hello == NULL || type != WORK_HELLO || length != sizeof(uint64_t) + 2 * sizeof(uint32_t))
+    {
+        free(hello);
+        return NULL;
+    }
+
+    uint64_t hash;
+    uint32_t size[2];
+    memcpy(&hash, hello, sizeof(hash));
+    memcpy(size, hello + sizeof(hash), sizeof(size));
+    free(hello);
+
+    *width = size[0];
+    *height = size[1];
+
+    Scene *s = FindCachedScene(cache, hash);
+    if (s == NULL && SendMessage(fd, WORK_NEED_SCENE, NULL, 0))
+    {
+        unsigned char *json = ReceiveMessage(fd, &type, &length);
+        if (json != NULL && type == WORK_SCENE)
+        {
+            bool cached;
+            s = CacheScene(cache, (char *)json, &cached);
+        }
+
+        free(json);
+    }
+
+    if (s != NULL && (s->camera.width != *width || s->camera.height != *height))
+    {
+        printf("The scene's camera is not the size of the coordinator's canvas\n");
+        return NULL;
+    }
+
+    return s;
+}
+
+bool RunRenderWorker(SceneCache *cache, WorkerSettings settings)
+{
+    TRACE_SCOPE("RunRenderWorker", "phase");
+
+    int fd = ConnectToCoordinator(settings);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    unsigned width, height;
+    Scene *s = WorkerScene(cache, fd, &width, &height);
+    if (s == NULL || !SendMessage(fd, WORK_READY, NULL, 0))
+    {
+        close(fd);
+        return false;
+    }
+
+    Canvas canvas;
+    ConstructCanvas(&canvas, TILE_SIZE, TILE_SIZE);
+    unsigned char *result = malloc(sizeof(uint32_t) + TILE_SIZE * TILE_SIZE * 4);
+
+    unsigned rendered = 0;
+    bool finished = false;
+
+    uint32_t type, length;
+    unsigned char *payload;
+    while (!finished && (payload = ReceiveMessage(fd, &type, &length)) != NULL)
+    {
+        finished = type == WORK_FINISHED;
+
+        uint32_t index;
+        bool valid = type == WORK_TILE && length == sizeof(index) && (settings.max_tiles == 0 || rendered < settings.max_tiles);
+        if (valid)
+        {
+            memcpy(&index, payload, sizeof(index));
+            Tile t = FrameTile(width, height, index);
+
+            RenderSceneTileCropped(s, &canvas, t);
+            rendered++;
+
+            memcpy(result, &index, sizeof(index));
+            size_t compressed = CompressTile(&canvas, (Tile){.index = index, .x = 0, .y = 0, .width = t.width, .height = t.height}, result + sizeof(index));
+            valid = SendMessage(fd, WORK_RESULT, result, sizeof(index) + compressed);
+        }
+
+        free(payload);
+        if (!valid && !finished)
+        {
+            break;
+        }
+    }
+
+    free(result);
+    DeconstructCanvas(&canvas);
+    close(fd);
+
+    return finished;
+}
@@ -1,6 +1,7 @@
 #include "shape.h"
 #include "intersection.h"
 #include "equality.h"
+#include "stats.h"
 
 #include <stdio.h>
 #include <math.h>
@@ -22,11 +23,9 @@ Intersection NewIntersection(Shape *s, Ray r)
     return i;
 }
 
-Intersection IntersectPlane(Shape *s, Ray r)
+/* Ray-shape tests in object space, each fills in the intersection's 'count' and 'ray_times' */
+static void PlaneTimes(Ray r, Intersection *result)
 {
-    Intersection result = NewIntersection(s, r);
-    r = RayTransform(r, s->inverse_transform);
-
     /* Because the ray has been transformed into "shape space"
      * then we can assume that the plane is on the x=0. As a result
      * a y value near zero indcates the ray is either on the plane, or
@@ -34,20 +33,15 @@ Intersection IntersectPlane(Shape *s, Ray r)
      */
     if (FloatEquality(r.direction[1], 0))
     {
-        return result;
+        return;
     }
 
-    result.count = 1;
-    result.ray_times[0] = -r.origin[1] / r.direction[1];
-
-    return result;
+    result->count = 1;
+    result->ray_times[0] = -r.origin[1] / r.direction[1];
 }
 
-Intersection IntersectSphere(Shape *s, Ray r)
+static void SphereTimes(Ray r, Intersection *result)
 {
-    Intersection result = NewIntersection(s, r);
-    r = RayTransform(r, s->inverse_transform);
-
     Tuple3 sphere_to_ray = TupleSubtract(r.origin, NewPnt3(0, 0, 0));
     double a = TupleDotProduct(r.direction, r.direction);
     double b = 2 * TupleDotProduct(r.direction, sphere_to_ray);
@@ -56,32 +50,27 @@ Intersection IntersectSphere(Shape *s, Ray r)
 
     if (discriminant < 0)
     {
-        return result;
+        return;
     }
     else if (discriminant == 0)
     {
-        result.count = 1;
-        result.ray_times[0] = -b / (a * 2);
+        result->count = 1;
+        result->ray_times[0] = -b / (a * 2);
     }
     else
     {
-        result.count = 2;
+        result->count = 2;
 
         double a_2 = a * 2;
         double d_sqrt = sqrt(discriminant);
 
-        result.ray_times[0] = (-b - d_sqrt) / a_2;
-        result.ray_times[1] = (-b + d_sqrt) / a_2;
+        result->ray_times[0] = (-b - d_sqrt) / a_2;
+        result->ray_times[1] = (-b + d_sqrt) / a_2;
     }
-
-    return result;
 }
 
-Intersection IntersectCube(Shape *s, Ray r)
+static void CubeTimes(Ray r, Intersection *result)
 {
-    Intersection result = NewIntersection(s, r);
-    r = RayTransform(r, s->inverse_transform);
-
     Tuple3 tmin_numerators = TupleSubtract(_mm256_set1_pd(-1.0), r.origin);
     Tuple3 tmax_numerators = TupleSubtract(_mm256_set1_pd(1.0), r.origin);
 
@@ -91,29 +80,22 @@ Intersection IntersectCube(Shape *s, Ray r)
     Tuple3 tmaxs = _mm256_max_pd(tmin_numerators, tmax_numerators);
     Tuple3 tmins = _mm256_min_pd(tmin_numerators, tmax_numerators);
 
-    __m512d partial_result = DISTRIBUTE_256(tmins, tmaxs);
-
-    double tmin = _mm512_mask_reduce_max_pd(0x8F, partial_result); // Mask 1000_1111; Exclude 'w' and elements from tmaxs
-    double tmax = _mm512_mask_reduce_min_pd(0xF8, partial_result);
+    double tmin, tmax;
+    SlabInterval(tmins, tmaxs, &tmin, &tmax);
 
-    result.ray_times[0] = tmin;
-    result.ray_times[1] = tmax;
-    result.count = tmin > tmax ? 0 : 2;
-
-    return result;
+    result->ray_times[0] = tmin;
+    result->ray_times[1] = tmax;
+    result->count = tmin > tmax ? 0 : 2;
 }
 
-Intersection IntersectTriangle(Shape *s, Ray r)
+static void TriangleTimes(Ray r, Intersection *result)
 {
-    Intersection result = NewIntersection(s, r);
-    r = RayTransform(r, s->inverse_transform);
-
     Tuple3 dir_cross_e2 = TupleCrossProduct(r.direction, UNIT_TRI_E2);
     double det = TupleDotProduct(UNIT_TRI_E1, dir_cross_e2);
 
     if (fabs(det) < EQUALITY_EPSILON)
     {
-        return result;
+        return;
     }
 
     double f = 1.0 / det;
@@ -122,45 +104,75 @@ Intersection IntersectTriangle(Shape *s, Ray r)
 
     if (u < 0 || u > 1) 
     {
-        return result;
+        return;
     }
 
     Tuple3 origin_cross_e1 = TupleCrossProduct(p1_to_origin, UNIT_TRI_E1);
     double v = f * TupleDotProduct(r.direction, origin_cross_e1);
     if (v < 0 || u + v > 1)
     {
-        return result;
+        return;
     }
 
-    result.count = 1;
-    result.ray_times[0] = f * TupleDotProduct(UNIT_TRI_E2, origin_cross_e1);
+    result->count = 1;
+    result->ray_times[0] = f * TupleDotProduct(UNIT_TRI_E2, origin_cross_e1);
+}
 
+Intersection IntersectPlane(Shape *s, Ray r)
+{
+    Intersection result = NewIntersection(s, r);
+    PlaneTimes(RayTransform(r, s->inverse_transform), &result);
     return result;
 }
 
-Intersection Intersect(Shape *s, Ray r)
+Intersection IntersectSphere(Shape *s, Ray r)
+{
+    Intersection result = NewIntersection(s, r);
+    SphereTimes(RayTransform(r, s->inverse_transform), &result);
+    return result;
+}
+
+Intersection IntersectCube(Shape *s, Ray r)
+{
+    Intersection result = NewIntersection(s, r);
+    CubeTimes(RayTransform(r, s->inverse_transform), &result);
+    return result;
+}
+
+Intersection IntersectTriangle(Shape *s, Ray r)
 {
-    Intersection result;
+    Intersection result = NewIntersection(s, r);
+    TriangleTimes(RayTransform(r, s->inverse_transform), &result);
+    return result;
+}
 
-    switch (s->type)
+Intersection IntersectTransformed(SHAPE_TYPE type, Affine *inverse_transform, Ray r)
+{
+    Intersection result = NewIntersection(NULL, r);
+    Ray object_ray = RayTransform(r, *inverse_transform);
+
+    switch (type)
     {
     case SPHERE:
-        result = IntersectSphere(s, r);
+        SphereTimes(object_ray, &result);
         break;
     case PLANE:
-        result = IntersectPlane(s, r);
+        PlaneTimes(object_ray, &result);
         break;
     case CUBE:
-        result = IntersectCube(s, r);
+        CubeTimes(object_ray, &result);
         break;
     case TRIANGLE:
-        result = IntersectTriangle(s, r);
+        TriangleTimes(object_ray, &result);
         break;
     default:
-        printf("Cannot intersect shape of type '%d'\n", s->type);
+        printf("Cannot intersect shape of type '%d'\n", type);
         exit(1);
     }
 
+    STAT_ADD(STAT_PRIMITIVE_TESTS, 1);
+    STAT_ADD(STAT_PRIMITIVE_HITS, result.count != 0);
+
     if (result.ray_times[0] > result.ray_times[1])
     {
         double tmp = result.ray_times[1];
@@ -171,6 +183,422 @@ Intersection Intersect(Shape *s, Ray r)
     return result;
 }
 
+Intersection Intersect(Shape *s, Ray r)
+{
+    Intersection result = IntersectTransformed(s->type, &s->inverse_transform, r);
+    result.shape_ptr = s;
+    return result;
+}
+
+/* How far a sphere's transformation may be from a similarity before it is treated as an ellipsoid */
+#define SIMILARITY_TOLERANCE 1e-9
+
+bool PackSphere(SphereBlock *block, unsigned lane, Affine *transformation)
+{
+    // Columns of the linear part, a similarity's are perpendicular and of equal length
+    Tuple3 axes[3];
+    for (int i = 0; i < 3; i++)
+    {
+        axes[i] = NewVec3(transformation->rows[0][i], transformation->rows[1][i], transformation->rows[2][i]);
+    }
+
+    double radius_squared = TupleDotProduct(axes[0], axes[0]);
+    double tolerance = SIMILARITY_TOLERANCE * radius_squared;
+
+    if (fabs(TupleDotProduct(axes[1], axes[1]) - radius_squared) > tolerance ||
+        fabs(TupleDotProduct(axes[2], axes[2]) - radius_squared) > tolerance ||
+        fabs(TupleDotProduct(axes[0], axes[1])) > tolerance ||
+        fabs(TupleDotProduct(axes[0], axes[2])) > tolerance ||
+        fabs(TupleDotProduct(axes[1], axes[2])) > tolerance)
+    {
+        return false;
+    }
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        block->center[axis][lane] = transformation->rows[axis][3];
+    }
+    block->radius_squared[lane] = radius_squared;
+
+    return true;
+}
+
+void PackTriangle(TriangleBlock *block, unsigned lane, Affine *transformation)
+{
+    Tuple3 p1 = AffineTupleMultiply(*transformation, UNIT_TRI_P1);
+    Tuple3 e1 = AffineTupleMultiply(*transformation, UNIT_TRI_E1);
+    Tuple3 e2 = AffineTupleMultiply(*transformation, UNIT_TRI_E2);
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        block->p1[axis][lane] = p1[axis];
+        block->e1[axis][lane] = e1[axis];
+        block->e2[axis][lane] = e2[axis];
+    }
+
+    /* The determinant in world space is the one TriangleTimes() finds in object space,
+     * scaled by the determinant of the transformation's linear part
+     */
+    Tuple3 x = NewVec3(transformation->rows[0][0], transformation->rows[1][0], transformation->rows[2][0]);
+    Tuple3 y = NewVec3(transformation->rows[0][1], transformation->rows[1][1], transformation->rows[2][1]);
+    Tuple3 z = NewVec3(transformation->rows[0][2], transformation->rows[1][2], transformation->rows[2][2]);
+    block->epsilon[lane] = EQUALITY_EPSILON * fabs(TupleDotProduct(x, TupleCrossProduct(y, z)));
+}
+
+__mmask8 IntersectSphereBlockScalar(SphereBlock *block, __mmask8 lanes, Ray r, double near[SHAPE_BLOCK_WIDTH], double far[SHAPE_BLOCK_WIDTH])
+{
+    double a = TupleDotProduct(r.direction, r.direction);
+    __mmask8 hits = 0;
+
+    for (unsigned lane = 0; lane < SHAPE_BLOCK_WIDTH; lane++)
+    {
+        if (!((lanes >> lane) & 1))
+        {
+            continue;
+        }
+
+        double to_ray_x = r.origin[0] - block->center[0][lane];
+        double to_ray_y = r.origin[1] - block->center[1][lane];
+        double to_ray_z = r.origin[2] - block->center[2][lane];
+
+        // Rounded step for step like the vector variants, fma() where they fuse
+        double b = r.direction[0] * to_ray_x;
+        b = fma(r.direction[1], to_ray_y, b);
+        b = fma(r.direction[2], to_ray_z, b);
+        b = b + b;
+
+        double c = to_ray_x * to_ray_x;
+        c = fma(to_ray_y, to_ray_y, c);
+        c = fma(to_ray_z, to_ray_z, c);
+        c = c - block->radius_squared[lane];
+
+        double discriminant = fma(-(4 * a), c, b * b);
+        if (!(discriminant >= 0))
+        {
+            continue;
+        }
+
+        double d_sqrt = sqrt(discriminant);
+        double negative_b = 0 - b;
+
+        near[lane] = (negative_b - d_sqrt) / (a * 2);
+        far[lane] = discriminant == 0 ? DBL_MAX : (negative_b + d_sqrt) / (a * 2);
+        hits |= (__mmask8)(1 << lane);
+    }
+
+    return hits;
+}
+
+/* Intersects the four spheres in the lanes starting at 'first' */
+static __mmask8 IntersectSphereHalf(SphereBlock *block, unsigned first, Ray r, double a, double *near, double *far)
+{
+    __m256d to_ray_x = _mm256_sub_pd(_mm256_set1_pd(r.origin[0]), _mm256_loadu_pd(block->center[0] + first));
+    __m256d to_ray_y = _mm256_sub_pd(_mm256_set1_pd(r.origin[1]), _mm256_loadu_pd(block->center[1] + first));
+    __m256d to_ray_z = _mm256_sub_pd(_mm256_set1_pd(r.origin[2]), _mm256_loadu_pd(block->center[2] + first));
+
+    __m256d b = _mm256_mul_pd(_mm256_set1_pd(r.direction[0]), to_ray_x);
+    b = _mm256_fmadd_pd(_mm256_set1_pd(r.direction[1]), to_ray_y, b);
+    b = _mm256_fmadd_pd(_mm256_set1_pd(r.direction[2]), to_ray_z, b);
+    b = _mm256_add_pd(b, b);
+
+    __m256d c = _mm256_mul_pd(to_ray_x, to_ray_x);
+    c = _mm256_fmadd_pd(to_ray_y, to_ray_y, c);
+    c = _mm256_fmadd_pd(to_ray_z, to_ray_z, c);
+    c = _mm256_sub_pd(c, _mm256_loadu_pd(block->radius_squared + first));
+
+    __m256d discriminant = _mm256_fnmadd_pd(_mm256_set1_pd(4 * a), c, _mm256_mul_pd(b, b));
+    __m256d hits = _mm256_cmp_pd(discriminant, _mm256_setzero_pd(), _CMP_GE_OQ);
+    __m256d touches = _mm256_cmp_pd(discriminant, _mm256_setzero_pd(), _CMP_EQ_OQ);
+
+    __m256d d_sqrt = _mm256_sqrt_pd(_mm256_max_pd(discriminant, _mm256_setzero_pd()));
+    __m256d a_2 = _mm256_set1_pd(a * 2);
+    __m256d negative_b = _mm256_sub_pd(_mm256_setzero_pd(), b);
+
+    _mm256_storeu_pd(near + first, _mm256_div_pd(_mm256_sub_pd(negative_b, d_sqrt), a_2));
+    _mm256_storeu_pd(far + first, _mm256_blendv_pd(_mm256_div_pd(_mm256_add_pd(negative_b, d_sqrt), a_2), _mm256_set1_pd(DBL_MAX), touches));
+
+    return (__mmask8)_mm256_movemask_pd(hits);
+}
+
+__mmask8 IntersectSphereBlockAvx2(SphereBlock *block, __mmask8 lanes, Ray r, double near[SHAPE_BLOCK_WIDTH], double far[SHAPE_BLOCK_WIDTH])
+{
+    double a = TupleDotProduct(r.direction, r.direction);
+
+    __mmask8 hits = IntersectSphereHalf(block, 0, r, a, near, far);
+    hits |= (__mmask8)(IntersectSphereHalf(block, SHAPE_BLOCK_WIDTH / 2, r, a, near, far) << (SHAPE_BLOCK_WIDTH / 2));
+
+    return hits & lanes;
+}
+
+AVX512_FUNCTION __mmask8 IntersectSphereBlockAvx512(SphereBlock *block, __mmask8 lanes, Ray r, double near[SHAPE_BLOCK_WIDTH], double far[SHAPE_BLOCK_WIDTH])
+{
+    __m512d to_ray_x = _mm512_sub_pd(_mm512_set1_pd(r.origin[0]), _mm512_loadu_pd(block->center[0]));
+    __m512d to_ray_y = _mm512_sub_pd(_mm512_set1_pd(r.origin[1]), _mm512_loadu_pd(block->center[1]));
+    __m512d to_ray_z = _mm512_sub_pd(_mm512_set1_pd(r.origin[2]), _mm512_loadu_pd(block->center[2]));
+
+    double a = TupleDotProduct(r.direction, r.direction);
+
+    __m512d b = _mm512_mul_pd(_mm512_set1_pd(r.direction[0]), to_ray_x);
+    b = _mm512_fmadd_pd(_mm512_set1_pd(r.direction[1]), to_ray_y, b);
+    b = _mm512_fmadd_pd(_mm512_set1_pd(r.direction[2]), to_ray_z, b);
+    b = _mm512_add_pd(b, b);
+
+    __m512d c = _mm512_mul_pd(to_ray_x, to_ray_x);
+    c = _mm512_fmadd_pd(to_ray_y, to_ray_y, c);
+    c = _mm512_fmadd_pd(to_ray_z, to_ray_z, c);
+    c = _mm512_sub_pd(c, _mm512_loadu_pd(block->radius_squared));
+
+    __m512d discriminant = _mm512_fnmadd_pd(_mm512_set1_pd(4 * a), c, _mm512_mul_pd(b, b));
+    __mmask8 hits = _mm512_mask_cmp_pd_mask(lanes, discriminant, _mm512_setzero_pd(), _CMP_GE_OQ);
+    __mmask8 touches = _mm512_mask_cmp_pd_mask(hits, discriminant, _mm512_setzero_pd(), _CMP_EQ_OQ);
+
+    __m512d d_sqrt = _mm512_sqrt_pd(_mm512_max_pd(discriminant, _mm512_setzero_pd()));
+    __m512d a_2 = _mm512_set1_pd(a * 2);
+    __m512d negative_b = _mm512_sub_pd(_mm512_setzero_pd(), b);
+
+    _mm512_storeu_pd(near, _mm512_div_pd(_mm512_sub_pd(negative_b, d_sqrt), a_2));
+    _mm512_storeu_pd(far, _mm512_mask_blend_pd(touches, _mm512_div_pd(_mm512_add_pd(negative_b, d_sqrt), a_2), _mm512_set1_pd(DBL_MAX)));
+
+    return hits;
+}
+
+__mmask8 IntersectTriangleBlockScalar(TriangleBlock *block, __mmask8 lanes, Ray r, double times[SHAPE_BLOCK_WIDTH])
+{
+    double dx = r.direction[0];
+    double dy = r.direction[1];
+    double dz = r.direction[2];
+    __mmask8 hits = 0;
+
+    for (unsigned lane = 0; lane < SHAPE_BLOCK_WIDTH; lane++)
+    {
+        if (!((lanes >> lane) & 1))
+        {
+            continue;
+        }
+
+        double e1_x = block->e1[0][lane], e1_y = block->e1[1][lane], e1_z = block->e1[2][lane];
+        double e2_x = block->e2[0][lane], e2_y = block->e2[1][lane], e2_z = block->e2[2][lane];
+
+        double dir_cross_e2_x = fma(dy, e2_z, -(dz * e2_y));
+        double dir_cross_e2_y = fma(dz, e2_x, -(dx * e2_z));
+        double dir_cross_e2_z = fma(dx, e2_y, -(dy * e2_x));
+
+        double det = e1_x * dir_cross_e2_x;
+        det = fma(e1_y, dir_cross_e2_y, det);
+        det = fma(e1_z, dir_cross_e2_z, det);
+
+        if (!(fabs(det) >= block->epsilon[lane]))
+        {
+            continue;
+        }
+
+        double f = 1.0 / det;
+
+        double p1_to_origin_x = r.origin[0] - block->p1[0][lane];
+        double p1_to_origin_y = r.origin[1] - block->p1[1][lane];
+        double p1_to_origin_z = r.origin[2] - block->p1[2][lane];
+
+        double u = p1_to_origin_x * dir_cross_e2_x;
+        u = fma(p1_to_origin_y, dir_cross_e2_y, u);
+        u = fma(p1_to_origin_z, dir_cross_e2_z, u);
+        u = f * u;
+
+        if (!(u >= 0 && u <= 1))
+        {
+            continue;
+        }
+
+        double origin_cross_e1_x = fma(p1_to_origin_y, e1_z, -(p1_to_origin_z * e1_y));
+        double origin_cross_e1_y = fma(p1_to_origin_z, e1_x, -(p1_to_origin_x * e1_z));
+        double origin_cross_e1_z = fma(p1_to_origin_x, e1_y, -(p1_to_origin_y * e1_x));
+
+        double v = dx * origin_cross_e1_x;
+        v = fma(dy, origin_cross_e1_y, v);
+        v = fma(dz, origin_cross_e1_z, v);
+        v = f * v;
+
+        if (!(v >= 0 && u + v <= 1))
+        {
+            continue;
+        }
+
+        double t = block->e2[0][lane] * origin_cross_e1_x;
+        t = fma(block->e2[1][lane], origin_cross_e1_y, t);
+        t = fma(block->e2[2][lane], origin_cross_e1_z, t);
+
+        times[lane] = f * t;
+        hits |= (__mmask8)(1 << lane);
+    }
+
+    return hits;
+}
+
+/* Intersects the four triangles in the lanes starting at 'first' */
+static __mmask8 IntersectTriangleHalf(TriangleBlock *block, unsigned first, Ray r, double *times)
+{
+    __m256d dx = _mm256_set1_pd(r.direction[0]);
+    __m256d dy = _mm256_set1_pd(r.direction[1]);
+    __m256d dz = _mm256_set1_pd(r.direction[2]);
+
+    __m256d e1_x = _mm256_loadu_pd(block->e1[0] + first);
+    __m256d e1_y = _mm256_loadu_pd(block->e1[1] + first);
+    __m256d e1_z = _mm256_loadu_pd(block->e1[2] + first);
+    __m256d e2_x = _mm256_loadu_pd(block->e2[0] + first);
+    __m256d e2_y = _mm256_loadu_pd(block->e2[1] + first);
+    __m256d e2_z = _mm256_loadu_pd(block->e2[2] + first);
+
+    __m256d dir_cross_e2_x = _mm256_fmsub_pd(dy, e2_z, _mm256_mul_pd(dz, e2_y));
+    __m256d dir_cross_e2_y = _mm256_fmsub_pd(dz, e2_x, _mm256_mul_pd(dx, e2_z));
+    __m256d dir_cross_e2_z = _mm256_fmsub_pd(dx, e2_y, _mm256_mul_pd(dy, e2_x));
+
+    __m256d det = _mm256_mul_pd(e1_x, dir_cross_e2_x);
+    det = _mm256_fmadd_pd(e1_y, dir_cross_e2_y, det);
+    det = _mm256_fmadd_pd(e1_z, dir_cross_e2_z, det);
+
+    __m256d abs_det = _mm256_andnot_pd(_mm256_set1_pd(-0.0), det);
+    __m256d hits = _mm256_cmp_pd(abs_det, _mm256_loadu_pd(block->epsilon + first), _CMP_GE_OQ);
+    __m256d f = _mm256_div_pd(_mm256_set1_pd(1.0), det);
+
+    __m256d p1_to_origin_x = _mm256_sub_pd(_mm256_set1_pd(r.origin[0]), _mm256_loadu_pd(block->p1[0] + first));
+    __m256d p1_to_origin_y = _mm256_sub_pd(_mm256_set1_pd(r.origin[1]), _mm256_loadu_pd(block->p1[1] + first));
+    __m256d p1_to_origin_z = _mm256_sub_pd(_mm256_set1_pd(r.origin[2]), _mm256_loadu_pd(block->p1[2] + first));
+
+    __m256d u = _mm256_mul_pd(p1_to_origin_x, dir_cross_e2_x);
+    u = _mm256_fmadd_pd(p1_to_origin_y, dir_cross_e2_y, u);
+    u = _mm256_fmadd_pd(p1_to_origin_z, dir_cross_e2_z, u);
+    u = _mm256_mul_pd(f, u);
+
+    hits = _mm256_and_pd(hits, _mm256_cmp_pd(u, _mm256_setzero_pd(), _CMP_GE_OQ));
+    hits = _mm256_and_pd(hits, _mm256_cmp_pd(u, _mm256_set1_pd(1.0), _CMP_LE_OQ));
+
+    __m256d origin_cross_e1_x = _mm256_fmsub_pd(p1_to_origin_y, e1_z, _mm256_mul_pd(p1_to_origin_z, e1_y));
+    __m256d origin_cross_e1_y = _mm256_fmsub_pd(p1_to_origin_z, e1_x, _mm256_mul_pd(p1_to_origin_x, e1_z));
+    __m256d origin_cross_e1_z = _mm256_fmsub_pd(p1_to_origin_x, e1_y, _mm256_mul_pd(p1_to_origin_y, e1_x));
+
+    __m256d v = _mm256_mul_pd(dx, origin_cross_e1_x);
+    v = _mm256_fmadd_pd(dy, origin_cross_e1_y, v);
+    v = _mm256_fmadd_pd(dz, origin_cross_e1_z, v);
+    v = _mm256_mul_pd(f, v);
+
+    hits = _mm256_and_pd(hits, _mm256_cmp_pd(v, _mm256_setzero_pd(), _CMP_GE_OQ));
+    hits = _mm256_and_pd(hits, _mm256_cmp_pd(_mm256_add_pd(u, v), _mm256_set1_pd(1.0), _CMP_LE_OQ));
+
+    __m256d t = _mm256_mul_pd(e2_x, origin_cross_e1_x);
+    t = _mm256_fmadd_pd(e2_y, origin_cross_e1_y, t);
+    t = _mm256_fmadd_pd(e2_z, origin_cross_e1_z, t);
+    _mm256_storeu_pd(times + first, _mm256_mul_pd(f, t));
+
+    return (__mmask8)_mm256_movemask_pd(hits);
+}
+
+__mmask8 IntersectTriangleBlockAvx2(TriangleBlock *block, __mmask8 lanes, Ray r, double times[SHAPE_BLOCK_WIDTH])
+{
+    __mmask8 hits = IntersectTriangleHalf(block, 0, r, times);
+    hits |= (__mmask8)(IntersectTriangleHalf(block, SHAPE_BLOCK_WIDTH / 2, r, times) << (SHAPE_BLOCK_WIDTH / 2));
+
+    return hits & lanes;
+}
+
+AVX512_FUNCTION __mmask8 IntersectTriangleBlockAvx512(TriangleBlock *block, __mmask8 lanes, Ray r, double times[SHAPE_BLOCK_WIDTH])
+{
+    __m512d dx = _mm512_set1_pd(r.direction[0]);
+    __m512d dy = _mm512_set1_pd(r.direction[1]);
+    __m512d dz = _mm512_set1_pd(r.direction[2]);
+
+    __m512d e1_x = _mm512_loadu_pd(block->e1[0]);
+    __m512d e1_y = _mm512_loadu_pd(block->e1[1]);
+    __m512d e1_z = _mm512_loadu_pd(block->e1[2]);
+    __m512d e2_x = _mm512_loadu_pd(block->e2[0]);
+    __m512d e2_y = _mm512_loadu_pd(block->e2[1]);
+    __m512d e2_z = _mm512_loadu_pd(block->e2[2]);
+
+    // Möller-Trumbore, the same steps as TriangleTimes() eight triangles at a time
+    __m512d dir_cross_e2_x = _mm512_fmsub_pd(dy, e2_z, _mm512_mul_pd(dz, e2_y));
+    __m512d dir_cross_e2_y = _mm512_fmsub_pd(dz, e2_x, _mm512_mul_pd(dx, e2_z));
+    __m512d dir_cross_e2_z = _mm512_fmsub_pd(dx, e2_y, _mm512_mul_pd(dy, e2_x));
+
+    __m512d det = _mm512_mul_pd(e1_x, dir_cross_e2_x);
+    det = _mm512_fmadd_pd(e1_y, dir_cross_e2_y, det);
+    det = _mm512_fmadd_pd(e1_z, dir_cross_e2_z, det);
+
+    __mmask8 hits = _mm512_mask_cmp_pd_mask(lanes, _mm512_abs_pd(det), _mm512_loadu_pd(block->epsilon), _CMP_GE_OQ);
+    __m512d f = _mm512_div_pd(_mm512_set1_pd(1.0), det);
+
+    __m512d p1_to_origin_x = _mm512_sub_pd(_mm512_set1_pd(r.origin[0]), _mm512_loadu_pd(block->p1[0]));
+    __m512d p1_to_origin_y = _mm512_sub_pd(_mm512_set1_pd(r.origin[1]), _mm512_loadu_pd(block->p1[1]));
+    __m512d p1_to_origin_z = _mm512_sub_pd(_mm512_set1_pd(r.origin[2]), _mm512_loadu_pd(block->p1[2]));
+
+    __m512d u = _mm512_mul_pd(p1_to_origin_x, dir_cross_e2_x);
+    u = _mm512_fmadd_pd(p1_to_origin_y, dir_cross_e2_y, u);
+    u = _mm512_fmadd_pd(p1_to_origin_z, dir_cross_e2_z, u);
+    u = _mm512_mul_pd(f, u);
+
+    hits = _mm512_mask_cmp_pd_mask(hits, u, _mm512_setzero_pd(), _CMP_GE_OQ);
+    hits = _mm512_mask_cmp_pd_mask(hits, u, _mm512_set1_pd(1.0), _CMP_LE_OQ);
+
+    __m512d origin_cross_e1_x = _mm512_fmsub_pd(p1_to_origin_y, e1_z, _mm512_mul_pd(p1_to_origin_z, e1_y));
+    __m512d origin_cross_e1_y = _mm512_fmsub_pd(p1_to_origin_z, e1_x, _mm512_mul_pd(p1_to_origin_x, e1_z));
+    __m512d origin_cross_e1_z = _mm512_fmsub_pd(p1_to_origin_x, e1_y, _mm512_mul_pd(p1_to_origin_y, e1_x));
+
+    __m512d v = _mm512_mul_pd(dx, origin_cross_e1_x);
+    v = _mm512_fmadd_pd(dy, origin_cross_e1_y, v);
+    v = _mm512_fmadd_pd(dz, origin_cross_e1_z, v);
+    v = _mm512_mul_pd(f, v);
+
+    hits = _mm512_mask_cmp_pd_mask(hits, v, _mm512_setzero_pd(), _CMP_GE_OQ);
+    hits = _mm512_mask_cmp_pd_mask(hits, _mm512_add_pd(u, v), _mm512_set1_pd(1.0), _CMP_LE_OQ);
+
+    __m512d t = _mm512_mul_pd(e2_x, origin_cross_e1_x);
+    t = _mm512_fmadd_pd(e2_y, origin_cross_e1_y, t);
+    t = _mm512_fmadd_pd(e2_z, origin_cross_e1_z, t);
+    _mm512_storeu_pd(times, _mm512_mul_pd(f, t));
+
+    return hits;
+}
+
+static __mmask8 (*intersect_sphere_block)(SphereBlock *, __mmask8, Ray, double *, double *) = IntersectSphereBlockAvx2;
+static __mmask8 (*intersect_triangle_block)(TriangleBlock *, __mmask8, Ray, double *) = IntersectTriangleBlockAvx2;
+
+void SelectIntersectionKernels(CPU_TARGET target)
+{
+    switch (target)
+    {
+    case CPU_SCALAR:
+        intersect_sphere_block = IntersectSphereBlockScalar;
+        intersect_triangle_block = IntersectTriangleBlockScalar;
+        break;
+    case CPU_AVX512:
+        intersect_sphere_block = IntersectSphereBlockAvx512;
+        intersect_triangle_block = IntersectTriangleBlockAvx512;
+        break;
+    case CPU_AVX2:
+    case CPU_TARGET_COUNT:
+        intersect_sphere_block = IntersectSphereBlockAvx2;
+        intersect_triangle_block = IntersectTriangleBlockAvx2;
+        break;
+    }
+}
+
+__mmask8 IntersectSphereBlock(SphereBlock *block, __mmask8 lanes, Ray r, double near[SHAPE_BLOCK_WIDTH], double far[SHAPE_BLOCK_WIDTH])
+{
+    __mmask8 hits = intersect_sphere_block(block, lanes, r, near, far);
+
+    STAT_ADD(STAT_PRIMITIVE_TESTS, __builtin_popcount(lanes));
+    STAT_ADD(STAT_PRIMITIVE_HITS, __builtin_popcount(hits));
+
+    return hits;
+}
+
+__mmask8 IntersectTriangleBlock(TriangleBlock *block, __mmask8 lanes, Ray r, double times[SHAPE_BLOCK_WIDTH])
+{
+    __mmask8 hits = intersect_triangle_block(block, lanes, r, times);
+
+    STAT_ADD(STAT_PRIMITIVE_TESTS, __builtin_popcount(lanes));
+    STAT_ADD(STAT_PRIMITIVE_HITS, __builtin_popcount(hits));
+
+    return hits;
+}
+
 bool CompareIntersections(Intersection *i1, Intersection *i2)
 {
     return i1->count > 0 && i2->count > 0 && i1->ray_times[0] < i2->ray_times[0];
@@ -1,9 +1,130 @@
 #include "light.h"
 
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
 Light NewLight(Tuple3 origin)
 {
     Light l;
     l.origin = origin;
     l.color = NewColor(255, 255, 255, 255);
+    l.u = NewVec3(0, 0, 0);
+    l.v = NewVec3(0, 0, 0);
+    l.radius = 0;
+    l.samples = 1;
+    l.type = POINT_LIGHT;
+    l.sampling = SOBOL_SAMPLER;
     return l;
 }
+
+Light NewRectangleLight(Tuple3 center, Tuple3 u, Tuple3 v, unsigned samples)
+{
+    Light l = NewLight(center);
+    l.type = RECTANGLE_LIGHT;
+    l.u = u;
+    l.v = v;
+    l.samples = samples == 0 ? 1 : samples;
+    return l;
+}
+
+Light NewDiskLight(Tuple3 center, Tuple3 normal, double radius, unsigned samples)
+{
+    Light l = NewLight(center);
+    l.type = DISK_LIGHT;
+    l.radius = radius;
+    l.samples = samples == 0 ? 1 : samples;
+
+    // Build two axes in the disk's plane, using whichever world axis is least parallel to the normal
+    normal = TupleNormalize(normal);
+    Tuple3 helper = fabs(normal[0]) < 0.9 ? NewVec3(1, 0, 0) : NewVec3(0, 1, 0);
+    Tuple3 u = TupleNormalize(TupleCrossProduct(normal, helper));
+    Tuple3 v = TupleCrossProduct(normal, u);
+
+    l.u = TupleScalarMultiply(u, radius);
+    l.v = TupleScalarMultiply(v, radius);
+    return l;
+}
+
+Light NewSphereLight(Tuple3 center, double radius, unsigned samples)
+{
+    Light l = NewLight(center);
+    l.type = SPHERE_LIGHT;
+    l.radius = radius;
+    l.samples = samples == 0 ? 1 : samples;
+    return l;
+}
+
+Tuple3 LightSamplePoint(Light *l, Tuple3 location, double u, double v)
+{
+    switch (l->type)
+    {
+    case POINT_LIGHT:
+        return l->origin;
+    case RECTANGLE_LIGHT:
+    {
+        Tuple3 along_u = TupleScalarMultiply(l->u, u - 0.5);
+        Tuple3 along_v = TupleScalarMultiply(l->v, v - 0.5);
+        return TupleAdd(l->origin, TupleAdd(along_u, along_v));
+    }
+    case DISK_LIGHT:
+    {
+        // Shirley-Chiu concentric mapping, keeps the square's stratification intact on the disk
+        double a = 2 * u - 1;
+        double b = 2 * v - 1;
+        double r = 0;
+        double phi = 0;
+
+        if (a * a > b * b)
+        {
+            r = a;
+            phi = (M_PI / 4) * (b / a);
+        }
+        else if (b != 0)
+        {
+            r = b;
+            phi = (M_PI / 2) - (M_PI / 4) * (a / b);
+        }
+
+        Tuple3 along_u = TupleScalarMultiply(l->u, r * cos(phi));
+        Tuple3 along_v = TupleScalarMultiply(l->v, r * sin(phi));
+        return TupleAdd(l->origin, TupleAdd(along_u, along_v));
+    }
+    case SPHERE_LIGHT:
+    {
+        double z = 1 - 2 * u;
+        double r = sqrt(fmax(0, 1 - z * z));
+        double phi = 2 * M_PI * v;
+        Tuple3 normal = NewVec3(r * cos(phi), r * sin(phi), z);
+
+        // Only the hemisphere facing the location can be seen from it
+        if (TupleDotProduct(normal, TupleSubtract(location, l->origin)) < 0)
+        {
+            normal = TupleNegate(normal);
+        }
+
+        return TupleAdd(l->origin, TupleScalarMultiply(normal, l->radius));
+    }
+    default:
+        printf("Unknown light type '%d'\n", l->type);
+        exit(1);
+    }
+}
+
+void LightSampleCoordinates(Light *l, unsigned index, unsigned seed, double *u, double *v)
+{
+    if (l->samples <= ADAPTIVE_SHADOW_SAMPLES)
+    {
+        SampleSequence2D(l->sampling, index, l->samples, seed, u, v);
+    }
+    else if (index < ADAPTIVE_SHADOW_SAMPLES)
+    {
+        // One stratified round, a sample in each quadrant
+        SampleSequence2D(STRATIFIED_SAMPLER, index, ADAPTIVE_SHADOW_SAMPLES, seed, u, v);
+    }
+    else
+    {
+        // The rest are a separate set of the light's own samples, jittered independently of the first round
+        SampleSequence2D(l->sampling, index - ADAPTIVE_SHADOW_SAMPLES, l->samples - ADAPTIVE_SHADOW_SAMPLES, ~seed, u, v);
+    }
+}
@@ -1,9 +1,17 @@
 #include "material.h"
+#include "table.h"
+
+/* Every material in use, shapes store an index into this table */
+static Table material_table;
+static bool material_table_constructed = false;
+
+/* The table AddMaterial() and MaterialAt() use, NULL for 'material_table' */
+static Table *materials = NULL;
 
 Material NewMaterial(Tuple3 color)
 {
     Material m;
-    m.pattern = NewSolidPattern(color);
+    m.pattern = AddPattern(NewSolidPattern(color));
     m.ambient_reflection = 0.1;
     m.diffuse_reflection = 0.9;
     m.specular_reflection = 0.9;
@@ -15,3 +23,42 @@ Material NewMaterial(Tuple3 color)
 
     return m;
 }
+
+unsigned AddMaterial(Material m)
+{
+    if (materials == NULL && !material_table_constructed)
+    {
+        ConstructTable(&material_table, sizeof(Material));
+        material_table_constructed = true;
+    }
+
+    return TableInsert(materials != NULL ? materials : &material_table, &m);
+}
+
+Material *MaterialAt(unsigned index)
+{
+    return TableIndex(materials != NULL ? materials : &material_table, index);
+}
+
+Pattern *MaterialPattern(Material *m)
+{
+    return PatternAt(m->pattern);
+}
+
+void ConstructMaterialTables(MaterialTables *t)
+{
+    ConstructTable(&t->materials, sizeof(Material));
+    ConstructTable(&t->patterns, sizeof(Pattern));
+}
+
+void DeconstructMaterialTables(MaterialTables *t)
+{
+    DeconstructTable(&t->materials);
+    DeconstructTable(&t->patterns);
+}
+
+void UseMaterialTables(MaterialTables *t)
+{
+    materials = t != NULL ? &t->materials : NULL;
+    UsePatternTable(t != NULL ? &t->patterns : NULL);
+}
@@ -6,27 +6,28 @@
 
 bool MatrixEqual(Matrix4x4 m1, Matrix4x4 m2)
 {
-    __mmask8 cmp0 = _mm512_cmp_pd_mask(m1.chunks[0], m2.chunks[0], _CMP_EQ_OQ);
-    __mmask8 cmp1 = _mm512_cmp_pd_mask(m1.chunks[1], m2.chunks[1], _CMP_EQ_OQ);
+    __m256d cmp = _mm256_cmp_pd(m1.contents[0], m2.contents[0], _CMP_EQ_OQ);
+    for (int i = 1; i < 4; i++)
+    {
+        cmp = _mm256_and_pd(cmp, _mm256_cmp_pd(m1.contents[i], m2.contents[i], _CMP_EQ_OQ));
+    }
 
-    return cmp1 == 0xff && cmp0 == 0xff;
+    return _mm256_movemask_pd(cmp) == 0xf;
 }
 
 bool MatrixFuzzyEqual(Matrix4x4 m1, Matrix4x4 m2)
 {
-    __m512d diff0 = _mm512_sub_pd(m1.chunks[0], m2.chunks[0]);
-    __m512d diff1 = _mm512_sub_pd(m1.chunks[1], m2.chunks[1]);
-
-    __m512d abs0 = _mm512_abs_pd(diff0);
-    __m512d abs1 = _mm512_abs_pd(diff1);
-
-    __m512d epsilon = _mm512_set1_pd(EQUALITY_EPSILON);
+    __m256d sign = _mm256_set1_pd(-0.0);
+    __m256d epsilon = _mm256_set1_pd(EQUALITY_EPSILON);
+    __m256d cmp = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
 
-    __mmask8 cmp0 = _mm512_cmp_pd_mask(abs0, epsilon, _CMP_LT_OQ);
-    __mmask8 cmp1 = _mm512_cmp_pd_mask(abs1, epsilon, _CMP_LT_OQ);
-
-    return cmp1 == 0xff && cmp0 == 0xff;
+    for (int i = 0; i < 4; i++)
+    {
+        __m256d abs_diff = _mm256_andnot_pd(sign, _mm256_sub_pd(m1.contents[i], m2.contents[i]));
+        cmp = _mm256_and_pd(cmp, _mm256_cmp_pd(abs_diff, epsilon, _CMP_LT_OQ));
+    }
 
+    return _mm256_movemask_pd(cmp) == 0xf;
 }
 
 static inline __m256d matrixMultHelper(int a, Matrix4x4 m1, Matrix4x4 m2)
@@ -52,11 +53,13 @@ Matrix4x4 MatrixMultiply(Matrix4x4 m1, Matrix4x4 m2)
 
 Matrix4x4 MatrixScalarMultiply(Matrix4x4 m1, double f1)
 {
-    __m512d scale = _mm512_set1_pd(f1);
+    __m256d scale = _mm256_set1_pd(f1);
 
     Matrix4x4 m2;
-    m2.chunks[0] = _mm512_mul_pd(m1.chunks[0], scale);
-    m2.chunks[1] = _mm512_mul_pd(m1.chunks[1], scale);
+    for (int i = 0; i < 4; i++)
+    {
+        m2.contents[i] = _mm256_mul_pd(m1.contents[i], scale);
+    }
 
     return m2;
 }
@@ -65,25 +68,25 @@ Matrix4x4 MatrixScalarMultiply(Matrix4x4 m1, double f1)
 Matrix4x4 MatrixAdd(Matrix4x4 m1, Matrix4x4 m2)
 {
     Matrix4x4 out;
-    out.chunks[0] = _mm512_add_pd(m1.chunks[0], m2.chunks[0]);
-    out.chunks[1] = _mm512_add_pd(m1.chunks[1], m2.chunks[1]);
+    for (int i = 0; i < 4; i++)
+    {
+        out.contents[i] = _mm256_add_pd(m1.contents[i], m2.contents[i]);
+    }
 
     return out;
 }
 
 Tuple3 MatrixTupleMultiply(Matrix4x4 m1, Tuple3 t1)
 {
-    __m512d factor = DISTRIBUTE_256(t1, t1);
-    __m512d r0 = _mm512_mul_pd(m1.chunks[0], factor);
-    __m512d r1 = _mm512_mul_pd(m1.chunks[1], factor);
-
-    Tuple3 out;
-    out[0] = r0[0] + r0[1] + r0[2] + r0[3];
-    out[1] = r0[4] + r0[5] + r0[6] + r0[7];
-    out[2] = r1[0] + r1[1] + r1[2] + r1[3];
-    out[3] = r1[4] + r1[5] + r1[6] + r1[7];
+    Matrix4x4 products;
+    for (int i = 0; i < 4; i++)
+    {
+        products.contents[i] = _mm256_mul_pd(m1.contents[i], t1);
+    }
 
-    return out;
+    // Summed left to right, each column of the transpose holds one row's products
+    products = MatrixTranspose(products);
+    return _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(products.contents[0], products.contents[1]), products.contents[2]), products.contents[3]);
 }
 
 Tuple3 MatrixTupleMultiplyPerserveInf(Matrix4x4 m1, Tuple3 t1)
@@ -319,3 +322,218 @@ Matrix4x4 RectifyMatrix(Matrix4x4 m)
 
     return m;
 }
+
+Affine AffineFromMatrix(Matrix4x4 m)
+{
+    Affine out;
+    out.rows[0] = m.contents[0];
+    out.rows[1] = m.contents[1];
+    out.rows[2] = m.contents[2];
+    return out;
+}
+
+Matrix4x4 AffineToMatrix(Affine a)
+{
+    Matrix4x4 out;
+    out.contents[0] = a.rows[0];
+    out.contents[1] = a.rows[1];
+    out.contents[2] = a.rows[2];
+    out.contents[3] = _mm256_set_pd(1, 0, 0, 0);
+    return out;
+}
+
+bool MatrixIsAffine(Matrix4x4 m)
+{
+    __m256d cmp = _mm256_cmp_pd(m.contents[3], _mm256_set_pd(1, 0, 0, 0), _CMP_EQ_OQ);
+    return _mm256_movemask_pd(cmp) == 0xf;
+}
+
+Affine AffineIdentity()
+{
+    return AffineFromMatrix(IdentityMatrix());
+}
+
+static inline __m256d affineMultHelper(int a, Affine a1, Affine a2)
+{
+    __m256d s0 = _mm256_mul_pd(_mm256_set1_pd(a1.rows[a][0]), a2.rows[0]);
+    __m256d s1 = _mm256_mul_pd(_mm256_set1_pd(a1.rows[a][1]), a2.rows[1]);
+    __m256d s2 = _mm256_mul_pd(_mm256_set1_pd(a1.rows[a][2]), a2.rows[2]);
+
+    // The last row of 'a2' is [0 0 0 1], so a1's translation only lands in 'w'
+    __m256d s3 = _mm256_blend_pd(_mm256_setzero_pd(), _mm256_set1_pd(a1.rows[a][3]), 0x8);
+
+    return _mm256_add_pd(s0, _mm256_add_pd(s1, _mm256_add_pd(s2, s3)));
+}
+
+Affine AffineMultiply(Affine a1, Affine a2)
+{
+    Affine out;
+    out.rows[0] = affineMultHelper(0, a1, a2);
+    out.rows[1] = affineMultHelper(1, a1, a2);
+    out.rows[2] = affineMultHelper(2, a1, a2);
+
+    return out;
+}
+
+Affine AffineInvert(Affine a)
+{
+    // Columns of the linear part, and the translation, with the constant last row in 'w'
+    Matrix4x4 columns = MatrixTranspose(AffineToMatrix(a));
+
+    /* The rows of the linear part's inverse are the cross products of its columns
+     * over its determinant, the columns' 'w' is 0 so the rows' is too
+     */
+    Tuple3 r0 = TupleCrossProduct(columns.contents[1], columns.contents[2]);
+    Tuple3 r1 = TupleCrossProduct(columns.contents[2], columns.contents[0]);
+    Tuple3 r2 = TupleCrossProduct(columns.contents[0], columns.contents[1]);
+    __m256d inverse_determinant = _mm256_set1_pd(1.0 / TupleDotProduct(columns.contents[0], r0));
+
+    Affine out;
+    out.rows[0] = _mm256_mul_pd(r0, inverse_determinant);
+    out.rows[1] = _mm256_mul_pd(r1, inverse_determinant);
+    out.rows[2] = _mm256_mul_pd(r2, inverse_determinant);
+
+    // Then undo the translation
+    Tuple3 translation = _mm256_blend_pd(columns.contents[3], _mm256_setzero_pd(), 0x8);
+    translation = TupleNegate(AffineTupleMultiply(out, translation));
+
+    out.rows[0] = _mm256_blend_pd(out.rows[0], _mm256_set1_pd(translation[0]), 0x8);
+    out.rows[1] = _mm256_blend_pd(out.rows[1], _mm256_set1_pd(translation[1]), 0x8);
+    out.rows[2] = _mm256_blend_pd(out.rows[2], _mm256_set1_pd(translation[2]), 0x8);
+
+    return out;
+}
+
+Tuple3 AffineTupleMultiply(Affine a, Tuple3 t1)
+{
+    __m256d r0 = _mm256_mul_pd(a.rows[0], t1);
+    __m256d r1 = _mm256_mul_pd(a.rows[1], t1);
+    __m256d r2 = _mm256_mul_pd(a.rows[2], t1);
+
+    // Pairwise sums, then the low and high halves of each row are added together
+    __m256d sums01 = _mm256_hadd_pd(r0, r1);
+    __m256d sums2 = _mm256_hadd_pd(r2, _mm256_setzero_pd());
+
+    __m256d low = _mm256_permute2f128_pd(sums01, sums2, 0x20);
+    __m256d high = _mm256_permute2f128_pd(sums01, sums2, 0x31);
+
+    // The last row is [0 0 0 1], so 'w' is unchanged
+    return _mm256_blend_pd(_mm256_add_pd(low, high), t1, 0x8);
+}
+
+Tuple3 AffineTupleMultiplyPreserveInf(Affine a, Tuple3 t1)
+{
+    Tuple3 out;
+    out[0] = TupleDotProductPreserveInf(a.rows[0], t1);
+    out[1] = TupleDotProductPreserveInf(a.rows[1], t1);
+    out[2] = TupleDotProductPreserveInf(a.rows[2], t1);
+    out[3] = t1[3];
+
+    return out;
+}
+
+Tuple3 AffineTransposeMultiply(Affine a, Tuple3 v)
+{
+    Tuple3 out = _mm256_mul_pd(_mm256_set1_pd(v[0]), a.rows[0]);
+    out = _mm256_fmadd_pd(_mm256_set1_pd(v[1]), a.rows[1], out);
+    out = _mm256_fmadd_pd(_mm256_set1_pd(v[2]), a.rows[2], out);
+    out[3] = 0;
+
+    return out;
+}
+
+/* Each component is the sum of the products in order, fused, and then the translation,
+ * so that normals round exactly as in AffineTransposeMultiply()
+ */
+void TransformTupleBatchScalar(double m[3][4], TupleBatch *in, TupleBatch *out)
+{
+    for (unsigned i = 0; i < in->length; i++)
+    {
+        double x = in->components[0][i];
+        double y = in->components[1][i];
+        double z = in->components[2][i];
+
+        for (int row = 0; row < 3; row++)
+        {
+            double sum = fma(m[row][2], z, fma(m[row][1], y, m[row][0] * x));
+            out->components[row][i] = sum + m[row][3];
+        }
+    }
+}
+
+void TransformTupleBatchAvx2(double m[3][4], TupleBatch *in, TupleBatch *out)
+{
+    for (unsigned i = 0; i < in->length; i += 4)
+    {
+        // The last few tuples are loaded and stored with a mask
+        unsigned remaining = in->length - i;
+        __m256i lanes = _mm256_cmpgt_epi64(_mm256_set1_epi64x(remaining), _mm256_setr_epi64x(0, 1, 2, 3));
+
+        __m256d x = _mm256_maskload_pd(in->components[0] + i, lanes);
+        __m256d y = _mm256_maskload_pd(in->components[1] + i, lanes);
+        __m256d z = _mm256_maskload_pd(in->components[2] + i, lanes);
+
+        for (int row = 0; row < 3; row++)
+        {
+            __m256d sum = _mm256_mul_pd(_mm256_set1_pd(m[row][0]), x);
+            sum = _mm256_fmadd_pd(_mm256_set1_pd(m[row][1]), y, sum);
+            sum = _mm256_fmadd_pd(_mm256_set1_pd(m[row][2]), z, sum);
+            sum = _mm256_add_pd(sum, _mm256_set1_pd(m[row][3]));
+
+            _mm256_maskstore_pd(out->components[row] + i, lanes, sum);
+        }
+    }
+}
+
+AVX512_FUNCTION void TransformTupleBatchAvx512(double m[3][4], TupleBatch *in, TupleBatch *out)
+{
+    for (unsigned i = 0; i < in->length; i += 8)
+    {
+        unsigned remaining = in->length - i;
+        __mmask8 lanes = remaining >= 8 ? 0xFF : (__mmask8)((1u << remaining) - 1);
+
+        __m512d x = _mm512_maskz_loadu_pd(lanes, in->components[0] + i);
+        __m512d y = _mm512_maskz_loadu_pd(lanes, in->components[1] + i);
+        __m512d z = _mm512_maskz_loadu_pd(lanes, in->components[2] + i);
+
+        for (int row = 0; row < 3; row++)
+        {
+            __m512d sum = _mm512_mul_pd(_mm512_set1_pd(m[row][0]), x);
+            sum = _mm512_fmadd_pd(_mm512_set1_pd(m[row][1]), y, sum);
+            sum = _mm512_fmadd_pd(_mm512_set1_pd(m[row][2]), z, sum);
+            sum = _mm512_add_pd(sum, _mm512_set1_pd(m[row][3]));
+
+            _mm512_mask_storeu_pd(out->components[row] + i, lanes, sum);
+        }
+    }
+}
+
+static void (*transform_tuple_batch)(double[3][4], TupleBatch *, TupleBatch *) = TransformTupleBatchAvx2;
+
+void SelectMatrixKernels(CPU_TARGET target)
+{
+    switch (target)
+    {
+    case CPU_SCALAR:
+        transform_tuple_batch = TransformTupleBatchScalar;
+        break;
+    case CPU_AVX512:
+        transform_tuple_batch = TransformTupleBatchAvx512;
+        break;
+    case CPU_AVX2:
+    case CPU_TARGET_COUNT:
+        transform_tuple_batch = TransformTupleBatchAvx2;
+        break;
+    }
+}
+
+void AffineTransformPoints(Affine a, TupleBatch *in, TupleBatch *out)
+{
+    double m[3][4];
+    for (int row = 0; row < 3; row++)
+    {
+        _mm256_storeu_pd(m[row], a.rows[row]);
+    }
+
+    transform_tuple_batch(m, in, out);
+}
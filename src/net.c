@@ -0,0 +1,253 @@
+#include "net.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// The tree is built with -fpack-struct, struct addrinfo must keep the layout getaddrinfo() fills in
+#pragma pack(push, 8)
+#include <netdb.h>
+#pragma pack(pop)
+
+/* The largest message accepted, so a corrupt header does not allocate gigabytes */
+#define MAX_MESSAGE_LENGTH (256u << 20)
+
+static bool IsUnixAddress(const char *address)
+{
+    return strchr(address, '/') != NULL;
+}
+
+/* Split "host:port" into a TCP address. Returns NULL if it can not be resolved */
+static struct addrinfo *ResolveTcpAddress(const char *address, bool passive)
+{
+    const char *colon = strrchr(address, ':');
+    if (colon == NULL)
+    {
+        return NULL;
+    }
+
+    char host[256];
+    size_t host_length = (size_t)(colon - address);
+    if (host_length >= sizeof(host))
+    {
+        return NULL;
+    }
+
+    memcpy(host, address, host_length);
+    host[host_length] = '\0';
+
+    struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM,
+        .ai_flags = passive ? AI_PASSIVE : 0,
+    };
+
+    struct addrinfo *result;
+    if (getaddrinfo(host_length > 0 ? host : NULL, colon + 1, &hints, &result) != 0)
+    {
+        return NULL;
+    }
+
+    return result;
+}
+
+static bool UnixAddress(struct sockaddr_un *unix_address, const char *path)
+{
+    memset(unix_address, 0, sizeof(struct sockaddr_un));
+    unix_address->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(unix_address->sun_path))
+    {
+        return false;
+    }
+
+    strcpy(unix_address->sun_path, path);
+    return true;
+}
+
+int ListenOn(const char *address)
+{
+    int fd = -1;
+
+    if (IsUnixAddress(address))
+    {
+        struct sockaddr_un unix_address;
+        if (UnixAddress(&unix_address, address))
+        {
+            unlink(address);
+            fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        }
+
+        if (fd >= 0 && bind(fd, (struct sockaddr *)&unix_address, sizeof(unix_address)) != 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    else
+    {
+        struct addrinfo *tcp_address = ResolveTcpAddress(address, true);
+        if (tcp_address != NULL)
+        {
+            fd = socket(tcp_address->ai_family, SOCK_STREAM, 0);
+
+            int reuse = 1;
+            if (fd >= 0)
+            {
+                setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+            }
+
+            if (fd >= 0 && bind(fd, tcp_address->ai_addr, tcp_address->ai_addrlen) != 0)
+            {
+                close(fd);
+                fd = -1;
+            }
+
+            freeaddrinfo(tcp_address);
+        }
+    }
+
+    if (fd >= 0 && listen(fd, 64) != 0)
+    {
+        close(fd);
+        fd = -1;
+    }
+
+    if (fd < 0)
+    {
+        printf("Could not listen on '%s'\n", address);
+    }
+
+    return fd;
+}
+
+void StopListening(const char *address, int fd)
+{
+    close(fd);
+    if (IsUnixAddress(address))
+    {
+        unlink(address);
+    }
+}
+
+int ConnectTo(const char *address)
+{
+    int fd = -1;
+
+    if (IsUnixAddress(address))
+    {
+        struct sockaddr_un unix_address;
+        if (UnixAddress(&unix_address, address))
+        {
+            fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        }
+
+        if (fd >= 0 && connect(fd, (struct sockaddr *)&unix_address, sizeof(unix_address)) != 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    else
+    {
+        struct addrinfo *tcp_address = ResolveTcpAddress(address, false);
+        if (tcp_address != NULL)
+        {
+            fd = socket(tcp_address->ai_family, SOCK_STREAM, 0);
+            if (fd >= 0 && connect(fd, tcp_address->ai_addr, tcp_address->ai_addrlen) != 0)
+            {
+                close(fd);
+                fd = -1;
+            }
+
+            freeaddrinfo(tcp_address);
+        }
+
+        // Messages are small and answered one at a time, so they should not wait to be batched
+        int no_delay = 1;
+        if (fd >= 0)
+        {
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+        }
+    }
+
+    return fd;
+}
+
+bool SendAll(int fd, const void *data, size_t length)
+{
+    const char *next = data;
+    while (length > 0)
+    {
+        ssize_t sent = send(fd, next, length, MSG_NOSIGNAL);
+        if (sent <= 0)
+        {
+            return false;
+        }
+
+        next += sent;
+        length -= (size_t)sent;
+    }
+
+    return true;
+}
+
+bool ReceiveAll(int fd, void *data, size_t length)
+{
+    char *next = data;
+    while (length > 0)
+    {
+        ssize_t received = recv(fd, next, length, 0);
+        if (received <= 0)
+        {
+            return false;
+        }
+
+        next += received;
+        length -= (size_t)received;
+    }
+
+    return true;
+}
+
+void WriteMessageHeader(unsigned char *message, uint32_t type, size_t length)
+{
+    uint32_t header[2] = {type, (uint32_t)length};
+    memcpy(message, header, sizeof(header));
+}
+
+bool SendMessage(int fd, uint32_t type, const void *payload, size_t length)
+{
+    unsigned char *message = malloc(MESSAGE_HEADER_SIZE + length);
+    WriteMessageHeader(message, type, length);
+    memcpy(message + MESSAGE_HEADER_SIZE, payload, length);
+
+    bool sent = SendAll(fd, message, MESSAGE_HEADER_SIZE + length);
+    free(message);
+    return sent;
+}
+
+unsigned char *ReceiveMessage(int fd, uint32_t *type, uint32_t *length)
+{
+    uint32_t header[2];
+    if (!ReceiveAll(fd, header, sizeof(header)) || header[1] > MAX_MESSAGE_LENGTH)
+    {
+        return NULL;
+    }
+
+    unsigned char *payload = malloc(header[1] + 1);
+    if (!ReceiveAll(fd, payload, header[1]))
+    {
+        free(payload);
+        return NULL;
+    }
+
+    payload[header[1]] = '\0';
+    *type = header[0];
+    *length = header[1];
+    return payload;
+}
@@ -17,22 +17,27 @@ Tuple3 TriangleNormalAt(Shape *s, Tuple3 p)
 
 Tuple3 CubeNormalAt(Shape *s, Tuple3 p)
 {
-    __m512d abs_vals_512 = _mm512_abs_pd(DISTRIBUTE_256(p, p));
+    Tuple3 abs_vals = _mm256_andnot_pd(_mm256_set1_pd(-0.0), p);
 
-    double cmax = _mm512_mask_reduce_max_pd(0x77, abs_vals_512);
-    Tuple3 abs_vals = _mm512_extractf64x4_pd(abs_vals_512, 1);
+    // The largest of x, y and z, 'w' is zeroed so it cannot win
+    __m256d abs_xyz = _mm256_blend_pd(abs_vals, _mm256_setzero_pd(), 0x8);
+    __m128d halves_max = _mm_max_pd(_mm256_castpd256_pd128(abs_xyz), _mm256_extractf128_pd(abs_xyz, 1));
+    double cmax = _mm_max_pd(halves_max, _mm_permute_pd(halves_max, 1))[0];
 
-    __mmask8 cmp_max = _mm256_cmp_pd_mask(abs_vals, _mm256_set1_pd(cmax), _CMP_EQ_OQ);
-    int num_trailing_zeros = __builtin_ctz(cmp_max);
-    __mmask8 mov_mask = (__mmask8)(1 << num_trailing_zeros);
+    unsigned cmp_max = (unsigned)_mm256_movemask_pd(_mm256_cmp_pd(abs_vals, _mm256_set1_pd(cmax), _CMP_EQ_OQ));
+    long long first_max = cmp_max & (~cmp_max + 1);
 
-    Tuple3 result = _mm256_mask_mov_pd(_mm256_set1_pd(0.0), mov_mask, p);
+    // Keep only the first lane holding the largest component
+    __m256i lane_bits = _mm256_set_epi64x(8, 4, 2, 1);
+    __m256i mov_mask = _mm256_cmpeq_epi64(_mm256_and_si256(_mm256_set1_epi64x(first_max), lane_bits), lane_bits);
+
+    Tuple3 result = _mm256_and_pd(p, _mm256_castsi256_pd(mov_mask));
     return result;
 }
 
 Tuple3 NormalAt(Shape *s, Tuple3 pnt)
 {
-    pnt = MatrixTupleMultiply(s->inverse_transform, pnt);
+    pnt = AffineTupleMultiply(s->inverse_transform, pnt);
     Tuple3 result;
 
     switch (s->type)
@@ -54,7 +59,6 @@ Tuple3 NormalAt(Shape *s, Tuple3 pnt)
         break;
     }
 
-    result = MatrixTupleMultiply(MatrixTranspose(s->inverse_transform), result);
-    result[3] = 0;
+    result = AffineTransposeMultiply(s->inverse_transform, result);
     return TupleNormalize(result);
 }
@@ -0,0 +1,139 @@
+#include "parallel.h"
+#include "set.h"
+#include "shmem.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/sysinfo.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static void WaitForChildren(Set *pids)
+{
+    for (unsigned pid_index = 0; pid_index < pids->length; pid_index++)
+    {
+        int cur_pid;
+        CopyOut(pids, pid_index, &cur_pid);
+        if (cur_pid <= 0)
+        {
+            continue;
+        }
+
+        int exit_status;
+        waitpid(cur_pid, &exit_status, WUNTRACED);
+    }
+}
+
+void ParallelForSections(unsigned length, SectionFunction fn, void *context)
+{
+    if (length == 0)
+    {
+        return;
+    }
+
+    unsigned num_procs = (unsigned)get_nprocs();
+    unsigned section_size = (length + num_procs - 1) / num_procs;
+
+    Set pids;
+    ConstructSet(&pids, sizeof(int));
+
+    fflush(NULL); // Otherwise, every child would print the parent's buffered output again on exit
+
+    for (unsigned start = 0; start < length; start += section_size)
+    {
+        unsigned end = start + section_size > length ? length : start + section_size;
+
+        int pid = fork();
+        if (pid == 0)
+        { // Child handles its section
+            {
+                TRACE_SCOPE_ARGUMENT("section", "parallel", start);
+                fn(context, start, end);
+            }
+
+            exit(0);
+        }
+        else
+        {
+            AppendValue(&pids, &pid); // Parent keeps track of child
+        }
+    }
+
+    WaitForChildren(&pids);
+    DeconstructSet(&pids);
+}
+
+void ParallelForDynamic(unsigned length, SectionFunction fn, void *context)
+{
+    ParallelJob job;
+    StartParallelForDynamic(&job, length, fn, context);
+    FinishParallelJob(&job);
+}
+
+void StartParallelForDynamic(ParallelJob *job, unsigned length, SectionFunction fn, void *context)
+{
+    ConstructSet(&job->pids, sizeof(int));
+
+    // Children take the next unclaimed item from this shared counter until none are left
+    job->next_item = shmalloc(sizeof(unsigned));
+    *job->next_item = 0;
+    job->length = length;
+
+    unsigned num_procs = (unsigned)get_nprocs();
+    num_procs = num_procs > length ? length : num_procs;
+
+    fflush(NULL);
+
+    for (unsigned i = 0; i < num_procs; i++)
+    {
+        int pid = fork();
+        if (pid == 0)
+        {
+            {
+                TRACE_SCOPE("worker", "parallel");
+
+                unsigned item;
+                while ((item = __atomic_fetch_add(job->next_item, 1, __ATOMIC_RELAXED)) < length)
+                {
+                    fn(context, item, item + 1);
+                }
+            }
+
+            exit(0);
+        }
+        else
+        {
+            AppendValue(&job->pids, &pid);
+        }
+    }
+}
+
+bool ParallelJobDone(ParallelJob *job)
+{
+    for (unsigned pid_index = 0; pid_index < job->pids.length; pid_index++)
+    {
+        int *cur_pid = Index(&job->pids, pid_index);
+        if (*cur_pid > 0 && waitpid(*cur_pid, NULL, WNOHANG) == 0)
+        {
+            return false;
+        }
+
+        *cur_pid = 0; // Reaped, so it is not waited for again
+    }
+
+    return true;
+}
+
+void CancelParallelJob(ParallelJob *job)
+{
+    // Every claim from now on is past the last item
+    __atomic_store_n(job->next_item, job->length, __ATOMIC_RELAXED);
+}
+
+void FinishParallelJob(ParallelJob *job)
+{
+    WaitForChildren(&job->pids);
+    DeconstructSet(&job->pids);
+    shfree(job->next_item, sizeof(unsigned));
+}
@@ -0,0 +1,654 @@
+#include <math.h>
+#include <stdlib.h>
+#include <float.h>
+#include <limits.h>
+#include <time.h>
+
+#include "path_tracer.h"
+#include "parallel.h"
+#include "trace.h"
+#include "intersection.h"
+#include "equality.h"
+#include "shape.h"
+#include "shmem.h"
+
+#define BLACK NewColor(0, 0, 0, 0)
+
+/* Paths are only terminated by russian roulette after this many bounces */
+#define ROULETTE_DEPTH 3
+
+ProgressiveSettings DefaultProgressiveSettings()
+{
+    ProgressiveSettings settings = {
+        .max_samples = 64,
+        .max_depth = 8,
+        .target_noise = 0.0,
+        .publish_interval = 0,
+        .publish_filename = NULL,
+        .checkpoint = DefaultCheckpointSettings(),
+    };
+
+    return settings;
+}
+
+BudgetSettings DefaultBudgetSettings()
+{
+    BudgetSettings settings = {
+        .budget = 1.0,
+        .preview_depth = 2,
+        .preview_scale = 4,
+        .max_depth = 8,
+        .max_samples = 256,
+        .round_samples = 4,
+        .target_noise = 0.0,
+    };
+
+    return settings;
+}
+
+static double MaxChannel(Tuple3 color)
+{
+    return fmax(color[0], fmax(color[1], color[2]));
+}
+
+/* Rotate a direction given relative to the 'z' axis so that it is relative to 'normal' instead */
+static Tuple3 OrientToNormal(Tuple3 local, Tuple3 normal)
+{
+    Tuple3 helper = fabs(normal[0]) < 0.9 ? NewVec3(1, 0, 0) : NewVec3(0, 1, 0);
+    Tuple3 tangent = TupleNormalize(TupleCrossProduct(helper, normal));
+    Tuple3 bitangent = TupleCrossProduct(normal, tangent);
+
+    Tuple3 world = TupleScalarMultiply(tangent, local[0]);
+    world = TupleAdd(world, TupleScalarMultiply(bitangent, local[1]));
+    world = TupleAdd(world, TupleScalarMultiply(normal, local[2]));
+    world[3] = 0;
+
+    return world;
+}
+
+static Tuple3 CosineSampleHemisphere(Tuple3 normal, Sampler *sampler)
+{
+    double u, v;
+    SampleNext2D(sampler, &u, &v);
+
+    double r = sqrt(u);
+    double phi = 2 * M_PI * v;
+
+    return OrientToNormal(NewVec3(r * cos(phi), r * sin(phi), sqrt(fmax(0, 1 - u))), normal);
+}
+
+/* Unlike ColorForLimited(), paths need to see hits from inside of a shape (ray_times[1]),
+ * so that refracted paths can leave the shape again
+ */
+static bool NearestHit(Scene *s, Ray r, Shape **shape, double *time)
+{
+    Set intersections;
+    ConstructSet(&intersections, sizeof(Intersection));
+    IntersectScene(s, r, &intersections);
+
+    *time = INFINITY;
+    for (unsigned long i = 0; i < intersections.length; i++)
+    {
+        Intersection *this_intersection = Index(&intersections, i);
+        for (int j = 0; j < this_intersection->count; j++)
+        {
+            double t = this_intersection->ray_times[j];
+            if (t > EQUALITY_EPSILON && t < *time)
+            {
+                *time = t;
+                *shape = this_intersection->shape_ptr;
+            }
+        }
+    }
+
+    DeconstructSet(&intersections);
+    return *time != INFINITY;
+}
+
+/* Same lighting model as PhongShader(), minus the ambient term, which is
+ * replaced by the path's indirect bounces
+ */
+static Tuple3 DirectLight(Scene *s, Material *m, Tuple3 albedo, Tuple3 over_pos, Tuple3 normal, Tuple3 eyev, Sampler *sampler)
+{
+    double u, v;
+    SampleNext2D(sampler, &u, &v);
+    Tuple3 target = LightSamplePoint(&s->light, over_pos, u, v);
+
+    Tuple3 light_vector = TupleNormalize(TupleSubtract(target, over_pos));
+    double light_dot_normal = TupleDotProduct(light_vector, normal);
+
+    if (light_dot_normal <= 0 || IsOccluded(s, over_pos, target))
+    {
+        return BLACK;
+    }
+
+    Tuple3 effective_color = TupleMultiply(albedo, s->light.color);
+    Tuple3 diffuse = TupleScalarMultiply(effective_color, m->diffuse_reflection * light_dot_normal);
+
+    Tuple3 reflect_vector = TupleReflect(TupleNegate(light_vector), normal);
+    double reflect_dot_eye = TupleDotProduct(reflect_vector, eyev);
+    if (reflect_dot_eye <= 0)
+    {
+        return diffuse;
+    }
+
+    double factor = pow(reflect_dot_eye, m->shininess);
+    return TupleAdd(diffuse, TupleScalarMultiply(s->light.color, m->specular_reflection * factor));
+}
+
+Tuple3 PathTrace(Scene *s, Ray r, int max_depth, Sampler *sampler, SurfaceSample *surface)
+{
+    if (surface != NULL)
+    {
+        surface->albedo = BLACK;
+        surface->normal = NewVec3(0, 0, 0);
+        surface->depth = INFINITY;
+        surface->shape_id = 0;
+    }
+
+    Tuple3 radiance = BLACK;
+    Tuple3 throughput = NewTuple3(1, 1, 1, 0);
+
+    for (int depth = 0; depth < max_depth; depth++)
+    {
+        Shape *shape = NULL;
+        double time;
+        if (!NearestHit(s, r, &shape, &time))
+        {
+            break;
+        }
+
+        Tuple3 pos = RayPosition(r, time);
+        Tuple3 outward_normal = NormalAt(shape, pos);
+        bool entering = TupleDotProduct(r.direction, outward_normal) < 0;
+        Tuple3 normal = entering ? outward_normal : TupleNegate(outward_normal);
+
+        Tuple3 offset_normal = TupleScalarMultiply(normal, EQUALITY_EPSILON);
+        Tuple3 over_pos = TupleAdd(pos, offset_normal);
+        Tuple3 under_pos = TupleSubtract(pos, offset_normal);
+
+        Material *m = ShapeMaterial(shape);
+        Tuple3 albedo = PatternColorAt(shape, pos);
+        Tuple3 eyev = TupleNegate(r.direction);
+
+        if (depth == 0 && surface != NULL)
+        {
+            surface->albedo = albedo;
+            surface->normal = normal;
+            surface->depth = time * TupleMagnitude(r.direction);
+            surface->shape_id = shape->id;
+        }
+
+        Tuple3 direct = DirectLight(s, m, albedo, over_pos, normal, eyev, sampler);
+        radiance = TupleAdd(radiance, TupleMultiply(throughput, direct));
+
+        // Pick the next bounce in proportion to how much light each part of the material carries
+        double diffuse_weight = m->diffuse_reflection * MaxChannel(albedo);
+        double mirror_weight = m->general_reflection;
+        double transmit_weight = m->transparency;
+        double total_weight = diffuse_weight + mirror_weight + transmit_weight;
+        double scale = fmax(1.0, total_weight);
+
+        if (depth >= ROULETTE_DEPTH)
+        {
+            double survival = fmin(0.95, MaxChannel(throughput));
+            if (SampleNext1D(sampler) >= survival)
+            {
+                break;
+            }
+
+            throughput = TupleScalarMultiply(throughput, 1.0 / survival);
+        }
+
+        double choice = SampleNext1D(sampler) * scale;
+        if (choice < diffuse_weight)
+        {
+            Tuple3 weight = TupleScalarMultiply(albedo, m->diffuse_reflection * scale / diffuse_weight);
+            throughput = TupleMultiply(throughput, weight);
+            r = NewRay(over_pos, CosineSampleHemisphere(normal, sampler));
+        }
+        else if (choice < diffuse_weight + mirror_weight)
+        {
+            throughput = TupleScalarMultiply(throughput, scale);
+            r = NewRay(over_pos, TupleReflect(r.direction, normal));
+        }
+        else if (choice < total_weight)
+        {
+            throughput = TupleScalarMultiply(throughput, scale);
+
+            double n_ratio = entering ? 1.0 / m->refractive_index : m->refractive_index;
+            double cos_i = TupleDotProduct(eyev, normal);
+            double sin2_t = (n_ratio * n_ratio) * (1 - (cos_i * cos_i));
+
+            // Schlick's approximation decides between reflection and refraction
+            double r0 = (1 - n_ratio) / (1 + n_ratio);
+            r0 = r0 * r0;
+            double reflectance = sin2_t > 1.0 ? 1.0 : r0 + (1 - r0) * pow(1 - cos_i, 5);
+
+            if (SampleNext1D(sampler) < reflectance)
+            {
+                r = NewRay(over_pos, TupleReflect(r.direction, normal));
+            }
+            else
+            {
+                double cos_t = sqrt(1.0 - sin2_t);
+                Tuple3 eyev_alt = TupleScalarMultiply(eyev, n_ratio);
+                Tuple3 norm_alt = TupleScalarMultiply(normal, n_ratio * cos_i - cos_t);
+                r = NewRay(under_pos, TupleNormalize(TupleSubtract(norm_alt, eyev_alt)));
+            }
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    if (TupleHasInfOrNans(radiance))
+    {
+        return BLACK;
+    }
+
+    return radiance;
+}
+
+typedef struct
+{
+    Scene *scene;
+    Accumulator *accumulator;
+    Canvas *canvas;
+    Sampler sampler;
+    int max_depth;
+} PathTraceContext;
+
+/* Add one sample to every pixel on [start..end), 'sample' is the sample's index in each pixel's sequence */
+static void PathTracePixels(PathTraceContext *ctx, unsigned start, unsigned end, unsigned sample, bool fill_planes)
+{
+    Accumulator *a = ctx->accumulator;
+
+    for (unsigned first = start; first < end;)
+    {
+        unsigned x = first % a->width;
+        unsigned y = first / a->width;
+
+        // A packet never runs past the end of a row
+        unsigned count = end - first;
+        count = count < a->width - x ? count : a->width - x;
+        count = count < RAY_PACKET_WIDTH ? count : RAY_PACKET_WIDTH;
+
+        /* The camera's sample is drawn first for every pixel in the packet, so the rays can
+         * be generated together. Each pixel's sampler then carries on where it left off
+         */
+        double sample_x[RAY_PACKET_WIDTH], sample_y[RAY_PACKET_WIDTH];
+        Sampler samplers[RAY_PACKET_WIDTH];
+        for (unsigned j = 0; j < count; j++)
+        {
+            StartPixelSample(&ctx->sampler, x + j, y, sample);
+            SampleNext2D(&ctx->sampler, &sample_x[j], &sample_y[j]);
+            samplers[j] = ctx->sampler;
+        }
+
+        RayPacket packet;
+        CameraRayPacket(&ctx->scene->camera, x, y, count, sample_x, sample_y, &packet);
+
+        for (unsigned j = 0; j < count; j++)
+        {
+            unsigned i = first + j;
+            ctx->sampler = samplers[j];
+
+            SurfaceSample first_hit;
+            SurfaceSample *surface = fill_planes ? &first_hit : NULL;
+
+            unsigned long steps = TraversalSteps();
+            AccumulateSample(a, i, PathTrace(ctx->scene, PacketRay(&packet, j), ctx->max_depth, &ctx->sampler, surface));
+            if (surface != NULL)
+            {
+                surface->steps = (unsigned)(TraversalSteps() - steps);
+                DirectWriteSurface(ctx->canvas, surface, i);
+            }
+        }
+
+        first += count;
+    }
+}
+
+void PathTraceSection(void *context, unsigned start, unsigned end)
+{
+    PathTraceContext *ctx = context;
+    Accumulator *a = ctx->accumulator;
+
+    // Each pass is the next sample of every pixel, the first pass also fills the canvas' auxiliary planes
+    PathTracePixels(ctx, start, end, a->samples, a->samples == 0 && ctx->canvas->planes != 0);
+}
+
+static double Seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+ProgressiveReport RenderSceneProgressive(Scene *s, Canvas *c, Accumulator *a, ProgressiveSettings settings)
+{
+    TRACE_SCOPE("RenderSceneProgressive", "phase");
+
+    UpdateSceneBVH(s);
+
+    PathTraceContext ctx = {
+        .scene = s,
+        .accumulator = a,
+        .canvas = c,
+        .sampler = NewSampler(s->sampler.type, settings.max_samples, s->sampler.seed),
+        .max_depth = settings.max_depth,
+    };
+
+    // The samples are taken in order, so carrying on from a checkpoint saved for this scene file
+    // and seed gives the same image as not stopping
+    CheckpointSettings checkpoint = settings.checkpoint;
+    checkpoint.scene_hash = s->hash;
+    checkpoint.seed = ctx.sampler.seed;
+    if (checkpoint.filename != NULL && checkpoint.resume && LoadAccumulator(a, checkpoint))
+    {
+        printf("Resuming from %u sample(s) per pixel in '%s'\n", a->samples, checkpoint.filename);
+        ResolveAccumulator(a, c);
+    }
+
+    ProgressiveReport report = {
+        .samples = a->samples,
+        .noise = AccumulatorNoise(a),
+        .seconds = 0,
+        .converged = false,
+    };
+
+    double start = Seconds();
+    double last_checkpoint = start;
+
+    while (a->samples < settings.max_samples)
+    {
+        TRACE_SCOPE_ARGUMENT("path trace pass", "phase", a->samples);
+
+        ParallelForSections(a->width * a->height, PathTraceSection, &ctx);
+        a->samples++;
+
+        ResolveAccumulator(a, c);
+        report.noise = AccumulatorNoise(a);
+
+        if (settings.publish_interval != 0 && a->samples % settings.publish_interval == 0 && settings.publish_filename != NULL)
+        {
+            WriteToPPM(c, settings.publish_filename);
+        }
+
+        if (checkpoint.filename != NULL && Seconds() - last_checkpoint >= checkpoint.interval)
+        {
+            SaveAccumulator(a, checkpoint);
+            last_checkpoint = Seconds();
+        }
+
+        if (settings.target_noise > 0 && report.noise <= settings.target_noise)
+        {
+            report.converged = true;
+            break;
+        }
+    }
+
+    ResolveAccumulator(a, c);
+    if (checkpoint.filename != NULL)
+    {
+        SaveAccumulator(a, checkpoint);
+    }
+
+    report.samples = a->samples;
+    report.seconds = Seconds() - start;
+
+    printf("Path traced %u sample(s) per pixel in %f seconds, noise %f", report.samples, report.seconds, report.noise);
+    printf(report.converged ? " (target %f reached)\n" : " (target %f not reached)\n", settings.target_noise);
+
+    return report;
+}
+
+typedef struct
+{
+    PathTraceContext path;
+
+    /** The tiles to work on this round, indices into the canvas' tiles */
+    unsigned *tiles;
+
+    /** Samples per pixel in every tile, 0 until a tile is refined past the first pass. Shared memory */
+    unsigned *samples;
+
+    BudgetSettings settings;
+    double deadline;
+    bool preview;
+} BudgetContext;
+
+/* Add one sample to every pixel of the tile */
+static void PathTraceTile(PathTraceContext *ctx, Tile t, unsigned sample, bool fill_planes)
+{
+    unsigned width = ctx->accumulator->width;
+    for (unsigned y = t.y; y < t.y + t.height; y++)
+    {
+        PathTracePixels(ctx, y * width + t.x, y * width + t.x + t.width, sample, fill_planes);
+    }
+}
+
+/* Trace one shallow path per block of pixels, and fill the block with its color */
+static void PreviewTile(BudgetContext *ctx, Tile t)
+{
+    Scene *s = ctx->path.scene;
+    Canvas *c = ctx->path.canvas;
+    Sampler *sampler = &ctx->path.sampler;
+    unsigned scale = ctx->settings.preview_scale > 0 ? ctx->settings.preview_scale : 1;
+
+    for (unsigned block_y = t.y; block_y < t.y + t.height; block_y += scale)
+    {
+        for (unsigned block_x = t.x; block_x < t.x + t.width; block_x += scale)
+        {
+            unsigned width = t.x + t.width - block_x < scale ? t.x + t.width - block_x : scale;
+            unsigned height = t.y + t.height - block_y < scale ? t.y + t.height - block_y : scale;
+            unsigned x = block_x + width / 2;
+            unsigned y = block_y + height / 2;
+
+            double sample_x, sample_y;
+            StartPixelSample(sampler, x, y, 0);
+            SampleNext2D(sampler, &sample_x, &sample_y);
+
+            SurfaceSample first_hit;
+            SurfaceSample *surface = c->planes != 0 ? &first_hit : NULL;
+
+            unsigned long steps = TraversalSteps();
+            Tuple3 color = PathTrace(s, RayForPixelSample(&s->camera, x, y, sample_x, sample_y), ctx->settings.preview_depth, sampler, surface);
+            if (surface != NULL)
+            {
+                surface->steps = (unsigned)(TraversalSteps() - steps);
+            }
+
+            for (unsigned j = block_y; j < block_y + height; j++)
+            {
+                for (unsigned i = block_x; i < block_x + width; i++)
+                {
+                    DirectWritePixel(c, color, j * c->canvas_width + i);
+                    if (surface != NULL)
+                    {
+                        DirectWriteSurface(c, surface, j * c->canvas_width + i);
+                    }
+                }
+            }
+        }
+    }
+}
+
+static void BudgetTileSection(void *context, unsigned start, unsigned end)
+{
+    BudgetContext *ctx = context;
+
+    for (unsigned i = start; i < end; i++)
+    {
+        unsigned index = ctx->tiles[i];
+        Tile t = CanvasTile(ctx->path.canvas, index);
+        TRACE_SCOPE_ARGUMENT("tile", "tile", index);
+
+        // The first pass only writes to the canvas, its shallow paths would darken the accumulated samples
+        if (ctx->preview)
+        {
+            PreviewTile(ctx, t);
+            continue;
+        }
+
+        for (unsigned k = 0; k < ctx->settings.round_samples && ctx->samples[index] < ctx->settings.max_samples; k++)
+        {
+            if (Seconds() >= ctx->deadline)
+            {
+                return;
+            }
+
+            PathTraceTile(&ctx->path, t, ctx->samples[index], false);
+            ctx->samples[index]++;
+        }
+    }
+}
+
+typedef struct
+{
+    unsigned index;
+    double error;
+} TileError;
+
+/* Highest error first, ties in tile order */
+static int CompareTileErrors(const void *a, const void *b)
+{
+    const TileError *ta = a;
+    const TileError *tb = b;
+
+    if (ta->error != tb->error)
+    {
+        return ta->error > tb->error ? -1 : 1;
+    }
+
+    return (ta->index > tb->index) - (ta->index < tb->index);
+}
+
+/* Estimated error of a tile, INFINITY until it has two samples */
+static double EstimateTileError(BudgetContext *ctx, Tile t)
+{
+    return AccumulatorTileNoise(ctx->path.accumulator, t, ctx->samples[t.index]);
+}
+
+/* Whether a tile needs no more samples */
+static bool TileDone(BudgetContext *ctx, Tile t, double error)
+{
+    return ctx->samples[t.index] >= ctx->settings.max_samples || (ctx->settings.target_noise > 0 && error <= ctx->settings.target_noise);
+}
+
+BudgetReport RenderSceneBudgeted(Scene *s, Canvas *c, BudgetSettings settings)
+{
+    TRACE_SCOPE("RenderSceneBudgeted", "phase");
+
+    double start = Seconds();
+    UpdateSceneBVH(s);
+
+    Accumulator a;
+    ConstructAccumulator(&a, c->canvas_width, c->canvas_height);
+
+    unsigned tile_count = CanvasTileCount(c);
+    BudgetContext ctx = {
+        .path = {
+            .scene = s,
+            .accumulator = &a,
+            .canvas = c,
+            .sampler = NewSampler(s->sampler.type, settings.max_samples, s->sampler.seed),
+            .max_depth = settings.max_depth,
+        },
+        .tiles = malloc(tile_count * sizeof(unsigned)),
+        .samples = shmalloc(tile_count * sizeof(unsigned)),
+        .settings = settings,
+        .deadline = start + settings.budget,
+        .preview = true,
+    };
+
+    for (unsigned i = 0; i < tile_count; i++)
+    {
+        ctx.tiles[i] = i;
+    }
+
+    {
+        TRACE_SCOPE("preview pass", "phase");
+        ParallelForDynamic(tile_count, BudgetTileSection, &ctx);
+    }
+
+    ctx.preview = false;
+    TileError *errors = malloc(tile_count * sizeof(TileError));
+    bool converged = false;
+
+    while (!converged && Seconds() < ctx.deadline)
+    {
+        TRACE_SCOPE("refinement round", "phase");
+
+        unsigned open = 0;
+        for (unsigned i = 0; i < tile_count; i++)
+        {
+            Tile t = CanvasTile(c, i);
+            double error = EstimateTileError(&ctx, t);
+            if (!TileDone(&ctx, t, error))
+            {
+                errors[open++] = (TileError){.index = i, .error = error};
+            }
+        }
+
+        converged = open == 0;
+        qsort(errors, open, sizeof(TileError), CompareTileErrors);
+
+        // The noisiest quarter of the tiles that are left, so the errors are compared again soon
+        unsigned chosen = open / 4 > 0 ? open / 4 : open;
+        for (unsigned i = 0; i < chosen; i++)
+        {
+            ctx.tiles[i] = errors[i].index;
+        }
+
+        ParallelForDynamic(chosen, BudgetTileSection, &ctx);
+
+        for (unsigned i = 0; i < chosen; i++)
+        {
+            unsigned index = ctx.tiles[i];
+            if (ctx.samples[index] > 0)
+            {
+                ResolveAccumulatorTile(&a, c, CanvasTile(c, index), ctx.samples[index]);
+            }
+        }
+    }
+
+    BudgetReport report = {
+        .refined_tiles = 0,
+        .tile_count = tile_count,
+        .min_samples = UINT_MAX,
+        .mean_samples = 0,
+        .noise = 0,
+        .seconds = Seconds() - start,
+        .converged = true,
+    };
+
+    for (unsigned i = 0; i < tile_count; i++)
+    {
+        Tile t = CanvasTile(c, i);
+        double pixels = (double)(t.width * t.height);
+
+        double error = EstimateTileError(&ctx, t);
+        report.converged = report.converged && TileDone(&ctx, t, error);
+        report.refined_tiles += ctx.samples[i] > 0;
+        report.min_samples = ctx.samples[i] < report.min_samples ? ctx.samples[i] : report.min_samples;
+        report.mean_samples += ctx.samples[i] * pixels;
+        report.noise += error * pixels;
+    }
+
+    double pixels = (double)(c->canvas_width * c->canvas_height);
+    report.mean_samples /= pixels;
+    report.noise /= pixels;
+
+    printf("Path traced %u of %u tile(s) past the first pass in %f seconds, %u to %f sample(s) per pixel, noise %f\n",
+           report.refined_tiles, report.tile_count, report.seconds, report.min_samples, report.mean_samples, report.noise);
+
+    free(errors);
+    free(ctx.tiles);
+    shfree(ctx.samples, tile_count * sizeof(unsigned));
+    DeconstructAccumulator(&a);
+
+    return report;
+}
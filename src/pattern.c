@@ -1,9 +1,17 @@
 #include "shape.h"
 #include "pattern.h"
 #include "equality.h"
+#include "table.h"
 #include <math.h>
 #include <stdio.h>
 
+/* Every pattern in use, materials store an index into this table */
+static Table pattern_table;
+static bool pattern_table_constructed = false;
+
+/* The table AddPattern() and PatternAt() use, NULL for 'pattern_table' */
+static Table *patterns = NULL;
+
 Tuple3 StripedPatternAt(Tuple3 position, Pattern p)
 {
     return fmod(floor(position[0]), 2) == 0 ? p.color_a : p.color_b;
@@ -31,30 +39,29 @@ Tuple3 GradientPatternAt(Tuple3 position, Pattern p)
 
 Tuple3 PatternColorAt(Shape *s, Tuple3 pos_orig)
 {
-
-    Pattern p = s->material.pattern;
-    if (p.type == SOLID)
+    Pattern *p = MaterialPattern(ShapeMaterial(s));
+    if (p->type == SOLID)
     {
-        return p.color_a;
+        return p->color_a;
     }
 
-    Tuple3 position = MatrixTupleMultiply(s->inverse_transform, pos_orig);
-    position = MatrixTupleMultiply(s->material.pattern.inverse_transform, position);
+    Tuple3 position = AffineTupleMultiply(s->inverse_transform, pos_orig);
+    position = AffineTupleMultiply(p->inverse_transform, position);
 
     #pragma GCC diagnostic ignored "-Wswitch-enum"
-    switch (p.type)
+    switch (p->type)
     {
     case STRIPED:
-        return StripedPatternAt(position, p);
+        return StripedPatternAt(position, *p);
         break;
     case RINGED:
-        return RingedPatternAt(position, p);
+        return RingedPatternAt(position, *p);
         break;
     case CHECKERED:
-        return CheckeredPatternAt(position, p);
+        return CheckeredPatternAt(position, *p);
         break;
     case GRADIENT:
-        return GradientPatternAt(position, p);
+        return GradientPatternAt(position, *p);
         break;
     default:
         printf("Unknown pattern\n");
@@ -80,7 +87,7 @@ Pattern NewPattern(Tuple3 color_a, Tuple3 color_b, PATTERN_TYPE type)
         .color_a = color_a,
         .color_b = color_b,
         .type = type,
-        .transform = IdentityMatrix()};
+        .transform = AffineIdentity()};
 
     Matrix4x4 translation = TranslationMatrix(0, 0.025, 0); //Nudge it, it gets weird around 0
     TransformPattern(&p, translation); 
@@ -90,6 +97,27 @@ Pattern NewPattern(Tuple3 color_a, Tuple3 color_b, PATTERN_TYPE type)
 
 void TransformPattern(Pattern *p, Matrix4x4 m)
 {
-    p->transform = MatrixMultiply(p->transform, m);
-    p->inverse_transform = MatrixInvert(m);
+    p->transform = AffineMultiply(p->transform, AffineFromMatrix(m));
+    p->inverse_transform = AffineInvert(p->transform);
+}
+
+unsigned AddPattern(Pattern p)
+{
+    if (patterns == NULL && !pattern_table_constructed)
+    {
+        ConstructTable(&pattern_table, sizeof(Pattern));
+        pattern_table_constructed = true;
+    }
+
+    return TableInsert(patterns != NULL ? patterns : &pattern_table, &p);
+}
+
+Pattern *PatternAt(unsigned index)
+{
+    return TableIndex(patterns != NULL ? patterns : &pattern_table, index);
+}
+
+void UsePatternTable(Table *t)
+{
+    patterns = t;
 }
@@ -0,0 +1,415 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "profile.h"
+#include "shmem.h"
+#include "tree.h"
+
+/* Names are copied into the sample, so samples can be reported after the process that recorded them exits */
+#define PROFILE_NAME_LENGTH 32
+
+/* Distinct phase names summarised by StopProfile(), later names are folded into the last */
+#define PROFILE_MAX_PHASES 64
+
+typedef struct
+{
+    char name[PROFILE_NAME_LENGTH];
+    char category[PROFILE_NAME_LENGTH];
+    long argument;
+    int pid;
+    CounterSample delta;
+} ProfileSample;
+
+typedef struct
+{
+    const char *name;
+    const char *category;
+    unsigned long calls;
+    CounterSample total;
+} PhaseSummary;
+
+static const char *counter_names[COUNTER_COUNT] = {
+    "cycles",
+    "instructions",
+    "l1d_misses",
+    "llc_misses",
+    "branch_misses",
+};
+
+/* perf_event_attr type and config for each HARDWARE_COUNTER */
+static const struct
+{
+    unsigned type;
+    unsigned long config;
+} counter_events[COUNTER_COUNT] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+/* Counters belong to the process that opened them, a forked child opens its own */
+static int counter_fds[COUNTER_COUNT];
+static int counter_errors[COUNTER_COUNT];
+static int counter_pid = 0;
+static unsigned long counter_ray_base = 0;
+static bool exit_handler_registered = false;
+
+/* Shared memory, so samples recorded by child processes reach the parent */
+static ProfileSample *profile_samples = NULL;
+static unsigned *profile_sample_count = NULL;
+static unsigned profile_capacity = 0;
+static int profile_pid = 0;
+
+/* Rays traced by child processes that have exited. The counters are inherited, the
+ * ray count is not, this keeps a phase's rays in step with its cycles and misses
+ */
+static unsigned long *profile_child_rays = NULL;
+
+const char *HardwareCounterName(HARDWARE_COUNTER counter)
+{
+    return counter < COUNTER_COUNT ? counter_names[counter] : "unknown";
+}
+
+static void CloseCounters()
+{
+    for (int i = 0; i < COUNTER_COUNT; i++)
+    {
+        if (counter_fds[i] >= 0)
+        {
+            close(counter_fds[i]);
+        }
+        counter_fds[i] = -1;
+    }
+    counter_pid = 0;
+}
+
+static void ReportChildRays()
+{
+    if (profile_child_rays != NULL && counter_pid == getpid() && counter_pid != profile_pid)
+    {
+        __atomic_fetch_add(profile_child_rays, TracedRays() - counter_ray_base, __ATOMIC_RELAXED);
+    }
+}
+
+static void OpenCounters()
+{
+    // Descriptors inherited from the parent would read the parent's counters
+    if (counter_pid != 0)
+    {
+        CloseCounters();
+    }
+
+    for (int i = 0; i < COUNTER_COUNT; i++)
+    {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = counter_events[i].type;
+        attr.config = counter_events[i].config;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        // Children's counts are added to this process' counters when they exit
+        attr.inherit = 1;
+
+        counter_fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        counter_errors[i] = counter_fds[i] < 0 ? errno : 0;
+    }
+
+    counter_pid = getpid();
+    counter_ray_base = TracedRays();
+
+    if (profile_child_rays != NULL && counter_pid != profile_pid && !exit_handler_registered)
+    {
+        atexit(ReportChildRays);
+        exit_handler_registered = true;
+    }
+}
+
+CounterSample ReadCounters()
+{
+    if (counter_pid != getpid())
+    {
+        OpenCounters();
+    }
+
+    CounterSample sample = {
+        .rays = TracedRays(),
+        .available = 0,
+    };
+
+    if (profile_child_rays != NULL && counter_pid == profile_pid)
+    {
+        sample.rays += __atomic_load_n(profile_child_rays, __ATOMIC_RELAXED);
+    }
+
+    for (int i = 0; i < COUNTER_COUNT; i++)
+    {
+        unsigned long values[3]; // value, time enabled, time running
+        sample.counts[i] = 0;
+
+        if (counter_fds[i] < 0 || read(counter_fds[i], values, sizeof(values)) != sizeof(values))
+        {
+            continue;
+        }
+
+        // The kernel time slices counters when there are more than the PMU has registers
+        if (values[2] != 0 && values[2] < values[1])
+        {
+            values[0] = (unsigned long)((double)values[0] * ((double)values[1] / (double)values[2]));
+        }
+
+        sample.counts[i] = values[0];
+        sample.available |= 1u << i;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    sample.nanoseconds = (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+
+    return sample;
+}
+
+void StartProfile(unsigned capacity)
+{
+    if (profile_samples != NULL)
+    {
+        return;
+    }
+
+    profile_capacity = capacity == 0 ? PROFILE_DEFAULT_CAPACITY : capacity;
+    profile_samples = (ProfileSample *)shmalloc(profile_capacity * sizeof(ProfileSample));
+    profile_sample_count = (unsigned *)shmalloc(sizeof(unsigned));
+    *profile_sample_count = 0;
+    profile_child_rays = (unsigned long *)shmalloc(sizeof(unsigned long));
+    *profile_child_rays = 0;
+    profile_pid = getpid();
+
+    OpenCounters();
+}
+
+bool ProfileEnabled()
+{
+    return profile_samples != NULL;
+}
+
+void RecordProfileSample(const char *name, const char *category, long argument, CounterSample *start)
+{
+    if (profile_samples == NULL)
+    {
+        return;
+    }
+
+    CounterSample end = ReadCounters();
+
+    unsigned index = __atomic_fetch_add(profile_sample_count, 1, __ATOMIC_RELAXED);
+    if (index >= profile_capacity)
+    {
+        return;
+    }
+
+    ProfileSample *sample = &profile_samples[index];
+    strncpy(sample->name, name, PROFILE_NAME_LENGTH - 1);
+    sample->name[PROFILE_NAME_LENGTH - 1] = '\0';
+    strncpy(sample->category, category, PROFILE_NAME_LENGTH - 1);
+    sample->category[PROFILE_NAME_LENGTH - 1] = '\0';
+    sample->argument = argument;
+    sample->pid = getpid();
+
+    // A scope that started before this process opened its counters has nothing to compare against
+    sample->delta.available = start->available & end.available;
+    for (int i = 0; i < COUNTER_COUNT; i++)
+    {
+        sample->delta.counts[i] = end.counts[i] - start->counts[i];
+    }
+    sample->delta.rays = end.rays - start->rays;
+    sample->delta.nanoseconds = end.nanoseconds - start->nanoseconds;
+}
+
+static void AddCounterSample(CounterSample *destination, CounterSample *source, bool first)
+{
+    destination->available = first ? source->available : destination->available & source->available;
+    for (int i = 0; i < COUNTER_COUNT; i++)
+    {
+        destination->counts[i] += source->counts[i];
+    }
+    destination->rays += source->rays;
+    destination->nanoseconds += source->nanoseconds;
+}
+
+static bool Available(CounterSample *s, HARDWARE_COUNTER counter)
+{
+    return (s->available >> counter) & 1;
+}
+
+/* Writes 'value' as a number, or null when it could not be measured */
+static void WriteOptional(FILE *fp, const char *name, bool valid, double value)
+{
+    if (valid)
+    {
+        fprintf(fp, ", \"%s\": %.4f", name, value);
+    }
+    else
+    {
+        fprintf(fp, ", \"%s\": null", name);
+    }
+}
+
+static void WriteCounterSample(FILE *fp, CounterSample *s)
+{
+    fprintf(fp, "\"milliseconds\": %.3f, \"rays\": %lu", s->nanoseconds * 1e-6, s->rays);
+
+    for (int i = 0; i < COUNTER_COUNT; i++)
+    {
+        WriteOptional(fp, counter_names[i], Available(s, (HARDWARE_COUNTER)i), (double)s->counts[i]);
+    }
+
+    double rays = (double)s->rays;
+    WriteOptional(fp, "ipc", Available(s, COUNTER_CYCLES) && Available(s, COUNTER_INSTRUCTIONS) && s->counts[COUNTER_CYCLES] != 0,
+                  (double)s->counts[COUNTER_INSTRUCTIONS] / (double)s->counts[COUNTER_CYCLES]);
+    WriteOptional(fp, "l1d_misses_per_ray", Available(s, COUNTER_L1D_MISSES) && rays != 0, (double)s->counts[COUNTER_L1D_MISSES] / rays);
+    WriteOptional(fp, "llc_misses_per_ray", Available(s, COUNTER_LLC_MISSES) && rays != 0, (double)s->counts[COUNTER_LLC_MISSES] / rays);
+    WriteOptional(fp, "branch_misses_per_ray", Available(s, COUNTER_BRANCH_MISSES) && rays != 0, (double)s->counts[COUNTER_BRANCH_MISSES] / rays);
+}
+
+/* Prints a ratio, or '-' when it could not be measured */
+static void PrintRatio(bool valid, double numerator, double denominator)
+{
+    if (valid && denominator != 0)
+    {
+        printf(" %9.3f", numerator / denominator);
+    }
+    else
+    {
+        printf(" %9s", "-");
+    }
+}
+
+static void PrintPhaseSummary(PhaseSummary *p)
+{
+    CounterSample *s = &p->total;
+    printf("%-24s %7lu %10.2f %10lu", p->name, p->calls, s->nanoseconds * 1e-6, s->rays);
+    PrintRatio(Available(s, COUNTER_CYCLES) && Available(s, COUNTER_INSTRUCTIONS),
+               (double)s->counts[COUNTER_INSTRUCTIONS], (double)s->counts[COUNTER_CYCLES]);
+    PrintRatio(Available(s, COUNTER_L1D_MISSES), (double)s->counts[COUNTER_L1D_MISSES], (double)s->rays);
+    PrintRatio(Available(s, COUNTER_LLC_MISSES), (double)s->counts[COUNTER_LLC_MISSES], (double)s->rays);
+    PrintRatio(Available(s, COUNTER_BRANCH_MISSES), (double)s->counts[COUNTER_BRANCH_MISSES], (double)s->rays);
+    printf("\n");
+}
+
+void StopProfile(const char *filename)
+{
+    if (profile_samples == NULL)
+    {
+        return;
+    }
+
+    unsigned recorded = *profile_sample_count;
+    unsigned count = recorded > profile_capacity ? profile_capacity : recorded;
+
+    // Tiles are reported one by one, everything else is summed by name
+    PhaseSummary phases[PROFILE_MAX_PHASES];
+    unsigned phase_count = 0;
+    for (unsigned i = 0; i < count; i++)
+    {
+        ProfileSample *sample = &profile_samples[i];
+        if (strcmp(sample->category, "tile") == 0)
+        {
+            continue;
+        }
+
+        unsigned p = 0;
+        while (p < phase_count && strcmp(phases[p].name, sample->name) != 0)
+        {
+            p++;
+        }
+
+        if (p == phase_count)
+        {
+            p = phase_count < PROFILE_MAX_PHASES ? phase_count++ : PROFILE_MAX_PHASES - 1;
+            memset(&phases[p], 0, sizeof(PhaseSummary));
+            phases[p].name = sample->name;
+            phases[p].category = sample->category;
+        }
+
+        AddCounterSample(&phases[p].total, &sample->delta, phases[p].calls == 0);
+        phases[p].calls++;
+    }
+
+    printf("%-24s %7s %10s %10s %9s %9s %9s %9s\n", "phase", "calls", "ms", "rays", "ipc", "l1d/ray", "llc/ray", "br/ray");
+    for (unsigned p = 0; p < phase_count; p++)
+    {
+        PrintPhaseSummary(&phases[p]);
+    }
+
+    for (int i = 0; i < COUNTER_COUNT; i++)
+    {
+        if (counter_fds[i] < 0)
+        {
+            printf("Counter '%s' unavailable: %s\n", counter_names[i], strerror(counter_errors[i]));
+        }
+    }
+
+    FILE *fp = fopen(filename, "w");
+    if (fp == NULL)
+    {
+        printf("Could not open '%s'\n", filename);
+    }
+    else
+    {
+        fprintf(fp, "{\n  \"counters\": {");
+        for (int i = 0; i < COUNTER_COUNT; i++)
+        {
+            fprintf(fp, "%s\"%s\": %s", i == 0 ? "" : ", ", counter_names[i], counter_fds[i] < 0 ? "false" : "true");
+        }
+
+        fprintf(fp, "},\n  \"phases\": [\n");
+        for (unsigned p = 0; p < phase_count; p++)
+        {
+            fprintf(fp, "    {\"name\": \"%s\", \"category\": \"%s\", \"calls\": %lu, ", phases[p].name, phases[p].category, phases[p].calls);
+            WriteCounterSample(fp, &phases[p].total);
+            fprintf(fp, p + 1 == phase_count ? "}\n" : "},\n");
+        }
+
+        fprintf(fp, "  ],\n  \"tiles\": [");
+        bool first = true;
+        for (unsigned i = 0; i < count; i++)
+        {
+            ProfileSample *sample = &profile_samples[i];
+            if (strcmp(sample->category, "tile") != 0)
+            {
+                continue;
+            }
+
+            fprintf(fp, "%s\n    {\"index\": %ld, \"pid\": %d, ", first ? "" : ",", sample->argument, sample->pid);
+            WriteCounterSample(fp, &sample->delta);
+            fputc('}', fp);
+            first = false;
+        }
+
+        fprintf(fp, "\n  ]\n}\n");
+        fclose(fp);
+
+        printf("Profile with %u sample(s) written to '%s'\n", count, filename);
+        if (recorded > count)
+        {
+            printf("%u profile sample(s) did not fit and were dropped\n", recorded - count);
+        }
+    }
+
+    CloseCounters();
+    shfree(profile_samples, profile_capacity * sizeof(ProfileSample));
+    shfree(profile_sample_count, sizeof(unsigned));
+    shfree(profile_child_rays, sizeof(unsigned long));
+    profile_samples = NULL;
+    profile_sample_count = NULL;
+    profile_child_rays = NULL;
+}
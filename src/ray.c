@@ -5,10 +5,10 @@ Tuple3 RayPosition(Ray r, double pos)
     return TupleAdd(r.origin, TupleScalarMultiply(r.direction, pos));
 }
 
-Ray RayTransform(Ray r, Matrix4x4 transformation)
+Ray RayTransform(Ray r, Affine transformation)
 {
-    r.origin = MatrixTupleMultiply(transformation, r.origin);
-    r.direction = MatrixTupleMultiply(transformation, r.direction);
+    r.origin = AffineTupleMultiply(transformation, r.origin);
+    r.direction = AffineTupleMultiply(transformation, r.direction);
     return r;
 }
 
@@ -4,6 +4,7 @@
 
 #include "scene.h"
 #include "read_file.h"
+#include "trace.h"
 
 bool IsDoublePart(char* c)
 {
@@ -32,6 +33,8 @@ void ReadDoubles(Set *output, char *file_contents, unsigned long *index)
 
 void ReadObj(Scene *s, const char *filename)
 {
+    TRACE_SCOPE("ReadObj", "io");
+
     char *file_contents;
     unsigned long file_length;
     READ_FILE(file_contents, file_length, filename);
@@ -2,6 +2,7 @@
 #include "shape.h"
 #include "material.h"
 #include "read_file.h"
+#include "trace.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -75,11 +76,8 @@ void GetPoint(Tuple3 *output, cJSON *json, const char *name)
     (*output)[3] = 1;
 }
 
-void GetCamera(Camera *c, cJSON *json)
+static void GetCameraData(Camera *c, cJSON *camera_data)
 {
-    cJSON *camera_data = cJSON_GetObjectItem(json, "camera");
-    FatalDataCheck(camera_data, "Camera data not found");
-
     Tuple3 from = NewTuple3(0, 0, 0, 0);
     GetPoint(&from, camera_data, "from");
 
@@ -105,12 +103,247 @@ void GetCamera(Camera *c, cJSON *json)
     memcpy(c, &local_camera, sizeof(Camera));
 }
 
+void GetCamera(Camera *c, cJSON *json)
+{
+    cJSON *camera_data = cJSON_GetObjectItem(json, "camera");
+    FatalDataCheck(camera_data, "Camera data not found");
+
+    GetCameraData(c, camera_data);
+}
+
+/* The "cameras" list, each in the same form as "camera". The first is also the scene's camera unless it has a "camera" */
+static void GetCameras(Scene *s, cJSON *json)
+{
+    s->cameras = NULL;
+    s->camera_count = 0;
+
+    cJSON *cameras = cJSON_GetObjectItem(json, "cameras");
+    if (cameras == NULL)
+    {
+        GetCamera(&s->camera, json);
+        return;
+    }
+
+    if (!cJSON_IsArray(cameras) || cJSON_GetArraySize(cameras) == 0)
+    {
+        printf("Error: \"cameras\" must be a list of at least one camera\n");
+        exit(1);
+    }
+
+    s->camera_count = (unsigned)cJSON_GetArraySize(cameras);
+    s->cameras = malloc(s->camera_count * sizeof(Camera));
+    for (unsigned i = 0; i < s->camera_count; i++)
+    {
+        cJSON *camera_data = cJSON_GetArrayItem(cameras, (int)i);
+        FatalDataCheck(camera_data, "Camera data not found");
+        GetCameraData(&s->cameras[i], camera_data);
+    }
+
+    if (cJSON_HasObjectItem(json, "camera"))
+    {
+        GetCamera(&s->camera, json);
+    }
+    else
+    {
+        s->camera = s->cameras[0];
+    }
+}
+
+void GetSamplerType(SAMPLER_TYPE *type, cJSON *json, const char *name)
+{
+    cJSON *type_json = cJSON_GetObjectItem(json, name);
+    if (type_json == NULL)
+    {
+        return;
+    }
+
+    char *type_name = cJSON_GetStringValue(type_json);
+    FatalDataCheck(type_name, "Could not get sampler type information");
+    if (strncmp(type_name, "independent", 11) == 0)
+    {
+        *type = INDEPENDENT_SAMPLER;
+    }
+    else if (strncmp(type_name, "stratified", 10) == 0)
+    {
+        *type = STRATIFIED_SAMPLER;
+    }
+    else if (strncmp(type_name, "sobol", 5) == 0)
+    {
+        *type = SOBOL_SAMPLER;
+    }
+    else if (strncmp(type_name, "blue_noise", 10) == 0)
+    {
+        *type = BLUE_NOISE_SAMPLER;
+    }
+    else
+    {
+        printf("Unkown sampler type '%s'\n", type_name);
+        exit(1);
+    }
+}
+
+void GetSampler(Sampler *sampler, cJSON *json)
+{
+    *sampler = NewSampler(SOBOL_SAMPLER, 1, 0);
+
+    cJSON *sampler_data = cJSON_GetObjectItem(json, "sampler");
+    if (sampler_data == NULL)
+    {
+        return;
+    }
+
+    GetSamplerType(&sampler->type, sampler_data, "type");
+
+    if (cJSON_GetObjectItem(sampler_data, "samples") != NULL)
+    {
+        int samples;
+        GetIntegerScalar(&samples, sampler_data, "samples");
+        sampler->samples_per_pixel = samples < 1 ? 1 : (unsigned)samples;
+    }
+
+    if (cJSON_GetObjectItem(sampler_data, "seed") != NULL)
+    {
+        int seed;
+        GetIntegerScalar(&seed, sampler_data, "seed");
+        *sampler = NewSampler(sampler->type, sampler->samples_per_pixel, (unsigned)seed);
+    }
+}
+
+void GetTraversalPrecision(TRAVERSAL_PRECISION *precision, cJSON *json)
+{
+    cJSON *precision_json = cJSON_GetObjectItem(json, "traversal_precision");
+    if (precision_json == NULL)
+    {
+        return;
+    }
+
+    char *precision_name = cJSON_GetStringValue(precision_json);
+    FatalDataCheck(precision_name, "Could not get traversal precision");
+    if (strncmp(precision_name, "double", 6) == 0)
+    {
+        *precision = DOUBLE_PRECISION_TRAVERSAL;
+    }
+    else if (strncmp(precision_name, "single", 6) == 0)
+    {
+        *precision = SINGLE_PRECISION_TRAVERSAL;
+    }
+    else
+    {
+        printf("Unknown traversal precision '%s'\n", precision_name);
+        exit(1);
+    }
+}
+
+void GetRegion(RenderRegion *r, Camera *c, cJSON *json)
+{
+    *r = FullFrameRegion(c);
+
+    cJSON *region_json = cJSON_GetObjectItem(json, "region");
+    if (region_json == NULL)
+    {
+        return;
+    }
+
+    // The rectangle defaults to the whole frame, so a list of tiles can be given alone
+    if (cJSON_GetObjectItem(region_json, "x") != NULL)
+    {
+        int x, y, width, height;
+        GetIntegerScalar(&x, region_json, "x");
+        GetIntegerScalar(&y, region_json, "y");
+        GetIntegerScalar(&width, region_json, "width");
+        GetIntegerScalar(&height, region_json, "height");
+
+        if (x < 0 || y < 0 || width <= 0 || height <= 0)
+        {
+            printf("Region must have a non-negative corner and a positive size\n");
+            exit(1);
+        }
+
+        r->x = (unsigned)x;
+        r->y = (unsigned)y;
+        r->width = (unsigned)width;
+        r->height = (unsigned)height;
+    }
+
+    cJSON *tiles_json = cJSON_GetObjectItem(region_json, "tiles");
+    if (tiles_json != NULL)
+    {
+        r->tile_count = (unsigned)cJSON_GetArraySize(tiles_json);
+        r->tiles = malloc(r->tile_count * sizeof(unsigned));
+
+        for (unsigned i = 0; i < r->tile_count; i++)
+        {
+            double tile;
+            GetFloatListItem(&tile, tiles_json, (int)i);
+            r->tiles[i] = (unsigned)tile;
+        }
+    }
+
+    if (cJSON_IsTrue(cJSON_GetObjectItem(region_json, "crop")))
+    {
+        r->output = REGION_CROPPED;
+    }
+}
+
 void GetLight(Light *l, cJSON *json)
 {
     cJSON *light_data = cJSON_GetObjectItem(json, "light");
     FatalDataCheck(light_data, "Light data not found");
 
-    GetPoint(&l->origin, light_data, "origin");
+    Tuple3 origin = NewTuple3(0, 0, 0, 0);
+    GetPoint(&origin, light_data, "origin");
+
+    cJSON *light_type_json = cJSON_GetObjectItem(light_data, "type");
+    char *light_type_name = light_type_json == NULL ? "point" : cJSON_GetStringValue(light_type_json);
+    FatalDataCheck(light_type_name, "Could not get light type information");
+
+    if (strncmp(light_type_name, "point", 5) == 0)
+    {
+        *l = NewLight(origin);
+    }
+    else
+    {
+        // A negative count would otherwise wrap around to billions of shadow rays per hit
+        int sample_count;
+        GetIntegerScalar(&sample_count, light_data, "samples");
+        unsigned samples = sample_count < 1 ? 1 : (unsigned)sample_count;
+
+        if (strncmp(light_type_name, "rectangle", 9) == 0)
+        {
+            Tuple3 u = NewTuple3(0, 0, 0, 0);
+            GetVector(&u, light_data, "u");
+
+            Tuple3 v = NewTuple3(0, 0, 0, 0);
+            GetVector(&v, light_data, "v");
+
+            *l = NewRectangleLight(origin, u, v, samples);
+        }
+        else if (strncmp(light_type_name, "disk", 4) == 0)
+        {
+            Tuple3 normal = NewTuple3(0, 0, 0, 0);
+            GetVector(&normal, light_data, "normal");
+
+            double radius;
+            GetFloatScalar(&radius, light_data, "radius");
+
+            *l = NewDiskLight(origin, normal, radius, samples);
+        }
+        else if (strncmp(light_type_name, "sphere", 6) == 0)
+        {
+            double radius;
+            GetFloatScalar(&radius, light_data, "radius");
+
+            *l = NewSphereLight(origin, radius, samples);
+        }
+        else
+        {
+            printf("Unkown light type '%s'\n", light_type_name);
+            exit(1);
+        }
+
+        GetSamplerType(&l->sampling, light_data, "sampling");
+    }
+
     GetPoint(&l->color, light_data, "color");
 }
 
@@ -170,11 +403,20 @@ void GetMatrix(Matrix4x4 *m, cJSON *json)
     }
 }
 
-void GetShapeTransform(Matrix4x4 *transform, cJSON *json)
+void GetShapeTransform(Affine *transform, cJSON *json)
 {
     cJSON *shape_transform_json = cJSON_GetObjectItem(json, "transform");
     FatalDataCheck(shape_transform_json, "Shape transform not found");
-    GetMatrix(transform, shape_transform_json);
+
+    Matrix4x4 m;
+    GetMatrix(&m, shape_transform_json);
+    if (!MatrixIsAffine(m))
+    {
+        printf("Expected the transform's last row to be [0, 0, 0, 1]\n");
+        exit(1);
+    }
+
+    *transform = AffineFromMatrix(m);
 }
 
 void GetPattern(Material *m, cJSON *json)
@@ -182,11 +424,15 @@ void GetPattern(Material *m, cJSON *json)
     cJSON *pattern_json = cJSON_GetObjectItem(json, "pattern");
     FatalDataCheck(pattern_json, "Shape pattern required");
 
-    GetPoint(&(m->pattern.color_a), pattern_json, "color_a");
-    GetPoint(&(m->pattern.color_b), pattern_json, "color_b");
-    GetShapeTransform(&(m->pattern.transform), pattern_json);
+    // Zeroed, so identical patterns compare equal and share one table entry
+    Pattern p;
+    memset(&p, 0, sizeof(Pattern));
 
-    m->pattern.inverse_transform = MatrixInvert(m->pattern.transform);
+    GetPoint(&(p.color_a), pattern_json, "color_a");
+    GetPoint(&(p.color_b), pattern_json, "color_b");
+    GetShapeTransform(&(p.transform), pattern_json);
+
+    p.inverse_transform = AffineInvert(p.transform);
 
     cJSON *pattern_type_json = cJSON_GetObjectItem(pattern_json, "type");
     FatalDataCheck(pattern_type_json, "Pattern tag not found");
@@ -195,29 +441,31 @@ void GetPattern(Material *m, cJSON *json)
     FatalDataCheck(pattern_name, "Could get pattern type");
     if (strncmp(pattern_name, "solid", 5) == 0)
     {
-        m->pattern.type = SOLID;
+        p.type = SOLID;
     }
     else if (strncmp(pattern_name, "striped", 7) == 0)
     {
-        m->pattern.type = STRIPED;
+        p.type = STRIPED;
     }
     else if (strncmp(pattern_name, "checkered", 9) == 0)
     {
-        m->pattern.type = CHECKERED;
+        p.type = CHECKERED;
     }
     else if (strncmp(pattern_name, "ringed", 6) == 0)
     {
-        m->pattern.type = RINGED;
+        p.type = RINGED;
     }
     else if (strncmp(pattern_name, "gradient", 8) == 0)
     {
-        m->pattern.type = GRADIENT;
+        p.type = GRADIENT;
     }
     else
     {
         printf("Unkown pattern '%s'\n", pattern_name);
         exit(1);
     }
+
+    m->pattern = AddPattern(p);
 }
 
 void GetMaterial(Material *m, cJSON *json)
@@ -252,6 +500,8 @@ void GetMaterial(Material *m, cJSON *json)
 
 void GetShapes(Tree *shapes, cJSON *json)
 {
+    TRACE_SCOPE("GetShapes", "phase");
+
     ConstructTree(shapes);
 
     cJSON *shapes_list = cJSON_GetObjectItem(json, "shapes");
@@ -269,26 +519,58 @@ void GetShapes(Tree *shapes, cJSON *json)
         GetShapeType(&this_shape.type, this_shape_json);
 
         GetShapeTransform(&this_shape.transformation, this_shape_json);
-        this_shape.inverse_transform = MatrixInvert(this_shape.transformation);
+        this_shape.inverse_transform = AffineInvert(this_shape.transformation);
+        UpdateShapeBounds(&this_shape);
 
-        GetMaterial(&this_shape.material, this_shape_json);
+        Material material;
+        memset(&material, 0, sizeof(Material));
+        GetMaterial(&material, this_shape_json);
+        SetShapeMaterial(&this_shape, material);
 
         AddShapeToTree(shapes, &this_shape);
     }
 }
 
-void ReadScene(Scene *s, const char *file)
+uint64_t HashSceneJson(const char *json)
 {
-    char *file_contents;
-    unsigned long file_size;
-    READ_FILE(file_contents, file_size, file);
+    uint64_t hash = 0xcbf29ce484222325u;
+    for (const unsigned char *c = (const unsigned char *)json; *c != '\0'; c++)
+    {
+        hash ^= *c;
+        hash *= 0x100000001b3u;
+    }
 
-    cJSON *json = cJSON_Parse(file_contents);
+    return hash;
+}
+
+void ReadSceneJson(Scene *s, const char *contents)
+{
+    cJSON *json = cJSON_Parse(contents);
     FatalDataCheck(json, "Could not parse json");
 
-    GetCamera(&s->camera, json);
+    GetCameras(s, json);
     GetLight(&s->light, json);
+    GetSampler(&s->sampler, json);
+    s->stats = NULL;
+    s->checkpoint = NULL;
+    s->tile_done = NULL;
+    s->tile_done_context = NULL;
+    s->bvh_current = false;
+    s->hash = HashSceneJson(contents);
     GetShapes(&s->shapes, json);
+    GetTraversalPrecision(&s->shapes.precision, json);
+    GetRegion(&s->region, &s->camera, json);
 
     cJSON_Delete(json);
 }
+
+void ReadScene(Scene *s, const char *file)
+{
+    TRACE_SCOPE("ReadScene", "io");
+
+    char *file_contents;
+    unsigned long file_size;
+    READ_FILE(file_contents, file_size, file);
+
+    ReadSceneJson(s, file_contents);
+}
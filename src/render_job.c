@@ -0,0 +1,157 @@
+#include "render_job.h"
+#include "shmem.h"
+#include "stats.h"
+#include "trace.h"
+
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+/* How long NextFinishedTile() sleeps between looks at the queue, far shorter than a tile takes */
+#define WAIT_MICROSECONDS 200
+
+static double Seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static unsigned long QueueSize(unsigned tile_count)
+{
+    return sizeof(TileQueue) + tile_count * sizeof(QueuedTile);
+}
+
+static void RenderJobHelper(void *context, unsigned start, unsigned end)
+{
+    RenderJob *job = context;
+    for (unsigned i = start; i < end; i++)
+    {
+        Tile t = CanvasTile(job->canvas, i);
+        RenderSceneTile(job->scene, job->canvas, t);
+
+        QueuedTile *slot = &job->queue->slots[__atomic_fetch_add(&job->queue->claimed, 1, __ATOMIC_RELAXED)];
+        slot->tile = t;
+        __atomic_store_n(&slot->ready, 1, __ATOMIC_RELEASE);
+    }
+}
+
+void StartRender(RenderJob *job, Scene *s, Canvas *c)
+{
+    TRACE_SCOPE("StartRender", "phase");
+
+    UpdateSceneBVH(s);
+    if (s->stats != NULL)
+    {
+        ResetFrameStats(s->stats);
+    }
+
+    job->scene = s;
+    job->canvas = c;
+    job->tile_count = CanvasTileCount(c);
+    job->taken = 0;
+    job->start = Seconds();
+    job->cancelled = false;
+
+    job->queue = shmalloc(QueueSize(job->tile_count));
+    job->queue->claimed = 0;
+
+    StartParallelForDynamic(&job->workers, job->tile_count, RenderJobHelper, job);
+}
+
+bool NextFinishedTile(RenderJob *job, Tile *t, bool wait)
+{
+    while (job->taken < job->tile_count)
+    {
+        QueuedTile *slot = &job->queue->slots[job->taken];
+        if (__atomic_load_n(&slot->ready, __ATOMIC_ACQUIRE))
+        {
+            *t = slot->tile;
+            job->taken++;
+            return true;
+        }
+
+        if (!wait)
+        {
+            return false;
+        }
+
+        // Once the workers have exited every tile they finished is published, so look once more
+        if (ParallelJobDone(&job->workers))
+        {
+            if (!__atomic_load_n(&slot->ready, __ATOMIC_ACQUIRE))
+            {
+                return false;
+            }
+
+            continue;
+        }
+
+        usleep(WAIT_MICROSECONDS);
+    }
+
+    return false;
+}
+
+RenderProgress GetRenderProgress(RenderJob *job)
+{
+    RenderProgress progress = {
+        .finished_tiles = __atomic_load_n(&job->queue->claimed, __ATOMIC_RELAXED),
+        .tile_count = job->tile_count,
+        .seconds = Seconds() - job->start,
+    };
+
+    unsigned remaining = job->tile_count - progress.finished_tiles;
+    if (remaining == 0 || job->cancelled)
+    {
+        progress.remaining_seconds = 0;
+    }
+    else if (progress.finished_tiles == 0)
+    {
+        progress.remaining_seconds = INFINITY;
+    }
+    else
+    {
+        progress.remaining_seconds = progress.seconds * remaining / progress.finished_tiles;
+    }
+
+    return progress;
+}
+
+void CancelRender(RenderJob *job)
+{
+    job->cancelled = true;
+    CancelParallelJob(&job->workers);
+}
+
+bool FinishRender(RenderJob *job)
+{
+    FinishParallelJob(&job->workers);
+
+    bool complete = __atomic_load_n(&job->queue->claimed, __ATOMIC_RELAXED) == job->tile_count;
+    shfree(job->queue, QueueSize(job->tile_count));
+
+    // Stats for part of a frame are still summed, they cover the tiles that were rendered
+    if (job->scene->stats != NULL)
+    {
+        SumFrameStats(job->scene->stats);
+    }
+
+    return complete;
+}
+
+void RenderSceneStreaming(Scene *s, Canvas *c, TileFunction fn, void *context)
+{
+    TRACE_SCOPE("RenderSceneStreaming", "phase");
+
+    RenderJob job;
+    StartRender(&job, s, c);
+
+    Tile t;
+    while (NextFinishedTile(&job, &t, true))
+    {
+        fn(context, c, t);
+    }
+
+    FinishRender(&job);
+}
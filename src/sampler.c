@@ -0,0 +1,200 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "sampler.h"
+
+/* Weights of Roberts' R2 sequence, used for the blue noise like per-pixel dither */
+#define R2_ALPHA_1 0.7548776662466927
+#define R2_ALPHA_2 0.5698402909980532
+
+unsigned SamplerHash(unsigned x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+static unsigned HashCombine(unsigned seed, unsigned value)
+{
+    return SamplerHash(seed ^ (value + 0x9e3779b9U + (seed << 6) + (seed >> 2)));
+}
+
+static double UnsignedToUnit(unsigned x)
+{
+    return (double)x / 4294967296.0;
+}
+
+static unsigned ReverseBits(unsigned i)
+{
+    i = (i << 16) | (i >> 16);
+    i = ((i & 0x00ff00ffU) << 8) | ((i & 0xff00ff00U) >> 8);
+    i = ((i & 0x0f0f0f0fU) << 4) | ((i & 0xf0f0f0f0U) >> 4);
+    i = ((i & 0x33333333U) << 2) | ((i & 0xccccccccU) >> 2);
+    i = ((i & 0x55555555U) << 1) | ((i & 0xaaaaaaaaU) >> 1);
+    return i;
+}
+
+static unsigned SobolSecondDimension(unsigned i)
+{
+    unsigned result = 0;
+    for (unsigned v = 1U << 31; i != 0; i >>= 1, v ^= v >> 1)
+    {
+        if (i & 1)
+        {
+            result ^= v;
+        }
+    }
+
+    return result;
+}
+
+/* Owen scrambling, as a hash in the bit reversed domain.
+ * See Burley, "Practical Hash-based Owen Scrambling" (2020)
+ */
+static unsigned LaineKarrasPermutation(unsigned x, unsigned seed)
+{
+    x += seed;
+    x ^= x * 0x6c50b47cU;
+    x ^= x * 0xb82f1e52U;
+    x ^= x * 0xc7afe638U;
+    x ^= x * 0x8d22f6e6U;
+    return x;
+}
+
+static unsigned NestedUniformScramble(unsigned x, unsigned seed)
+{
+    return ReverseBits(LaineKarrasPermutation(ReverseBits(x), seed));
+}
+
+static unsigned GreatestCommonDivisor(unsigned a, unsigned b)
+{
+    while (b != 0)
+    {
+        unsigned t = a % b;
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+/* Strata are visited with a golden ratio stride, so that the first few samples
+ * are spread across the whole domain (area lights rely on this to stop early)
+ */
+static unsigned StratumForSample(unsigned index, unsigned count, unsigned seed)
+{
+    unsigned stride = (unsigned)(count * 0.6180339887) | 1;
+    while (GreatestCommonDivisor(stride, count) != 1)
+    {
+        stride++;
+    }
+
+    return (unsigned)(((unsigned long)index * stride + seed) % count);
+}
+
+void SampleSequence2D(SAMPLER_TYPE type, unsigned index, unsigned count, unsigned seed, double *u, double *v)
+{
+    count = count == 0 ? 1 : count;
+
+    switch (type)
+    {
+    case INDEPENDENT_SAMPLER:
+    {
+        unsigned hash = HashCombine(seed, index);
+        *u = UnsignedToUnit(hash);
+        *v = UnsignedToUnit(SamplerHash(hash));
+        break;
+    }
+    case STRATIFIED_SAMPLER:
+    {
+        // Samples past 'count' start a new, differently jittered, round of strata
+        unsigned round_seed = HashCombine(seed, index / count);
+
+        // Rows of 'columns' strata, and a last row holding the rest stretched across the whole width.
+        // Each row is as tall as its share of the strata, so every stratum has the same area
+        unsigned columns = (unsigned)ceil(sqrt((double)count));
+        unsigned full_rows = count / columns;
+        unsigned stratum = StratumForSample(index % count, count, round_seed);
+
+        unsigned row = stratum / columns;
+        unsigned row_strata = row < full_rows ? columns : count - full_rows * columns;
+
+        unsigned jitter = HashCombine(round_seed, index % count);
+        *u = ((double)(stratum % columns) + UnsignedToUnit(jitter)) / (double)row_strata;
+        *v = ((double)(row * columns) + UnsignedToUnit(SamplerHash(jitter)) * (double)row_strata) / (double)count;
+        break;
+    }
+    case SOBOL_SAMPLER:
+    case BLUE_NOISE_SAMPLER:
+    {
+        unsigned shuffled_index = NestedUniformScramble(index, HashCombine(seed, 0));
+        *u = UnsignedToUnit(NestedUniformScramble(ReverseBits(shuffled_index), HashCombine(seed, 1)));
+        *v = UnsignedToUnit(NestedUniformScramble(SobolSecondDimension(shuffled_index), HashCombine(seed, 2)));
+        break;
+    }
+    default:
+        printf("Unknown sampler type '%d'\n", type);
+        exit(1);
+    }
+}
+
+Sampler NewSampler(SAMPLER_TYPE type, unsigned samples_per_pixel, unsigned seed)
+{
+    Sampler s;
+    s.type = type;
+    s.samples_per_pixel = samples_per_pixel == 0 ? 1 : samples_per_pixel;
+    s.seed = seed;
+
+    StartPixelSample(&s, 0, 0, 0);
+    return s;
+}
+
+void StartPixelSample(Sampler *s, unsigned x, unsigned y, unsigned sample_index)
+{
+    s->x = x;
+    s->y = y;
+    s->sample_index = sample_index;
+    s->dimension = 0;
+    s->pixel_seed = HashCombine(HashCombine(s->seed, x), y);
+}
+
+void SampleNext2D(Sampler *s, double *u, double *v)
+{
+    unsigned dimension = s->dimension;
+    s->dimension += 2;
+
+    if (s->type != BLUE_NOISE_SAMPLER)
+    {
+        SampleSequence2D(s->type, s->sample_index, s->samples_per_pixel, HashCombine(s->pixel_seed, dimension), u, v);
+        return;
+    }
+
+    // Every pixel shares one point set, neighbouring pixels are offset by very different amounts
+    SampleSequence2D(SOBOL_SAMPLER, s->sample_index, s->samples_per_pixel, HashCombine(s->seed, dimension), u, v);
+
+    double dimension_offset = UnsignedToUnit(HashCombine(s->seed, dimension));
+    double dither_u = (double)s->x * R2_ALPHA_1 + (double)s->y * R2_ALPHA_2 + dimension_offset;
+    double dither_v = (double)s->x * R2_ALPHA_2 + (double)s->y * R2_ALPHA_1 + dimension_offset;
+
+    *u = fmod(*u + dither_u, 1.0);
+    *v = fmod(*v + dither_v, 1.0);
+}
+
+double SampleNext1D(Sampler *s)
+{
+    double u, v;
+    SampleNext2D(s, &u, &v);
+    return u;
+}
+
+unsigned SampleNextSeed(Sampler *s)
+{
+    unsigned dimension = s->dimension;
+    s->dimension += 2;
+
+    return HashCombine(s->pixel_seed ^ HashCombine(s->sample_index, 0x5eed), dimension);
+}
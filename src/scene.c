@@ -3,28 +3,41 @@
 #include "equality.h"
 #include "material.h"
 #include "shape.h"
+#include "parallel.h"
+#include "trace.h"
+#include "pattern.h"
 
 #include <string.h>
-#include <sys/sysinfo.h>
-#include <sys/wait.h>
-#include <unistd.h>
 #include <float.h>
 
 void ConstructScene(Scene *s, Camera c, Light l)
 {
     s->camera = c;
     s->light = l;
+    s->sampler = NewSampler(SOBOL_SAMPLER, 1, 0);
+    s->stats = NULL;
+    s->region = FullFrameRegion(&s->camera);
+    s->cameras = NULL;
+    s->camera_count = 0;
+    s->checkpoint = NULL;
+    s->tile_done = NULL;
+    s->tile_done_context = NULL;
+    s->bvh_current = false;
+    s->hash = 0;
     ConstructTree(&(s->shapes));
 }
 
 void DeconstructScene(Scene *s)
 {
     DeconstructTree(&s->shapes);
+    free(s->region.tiles);
+    free(s->cameras);
 }
 
 void AddShape(Scene *s, Shape sp)
 {
     AddShapeToTree(&s->shapes, &sp);
+    s->bvh_current = false;
 }
 
 void SetSceneCamera(Scene *s, Camera c)
@@ -34,14 +47,18 @@ void SetSceneCamera(Scene *s, Camera c)
 
 void ReplaceTree(Scene *s, Tree *t)
 {
+    TRACE_SCOPE("ReplaceTree", "phase");
+
     ReconstructTree(&s->shapes);
     CloneTree(&s->shapes, t);
     CalculateBounds(&s->shapes);
 }
 
-bool IsInShadow(Scene *s, Tuple3 location)
+bool IsOccluded(Scene *s, Tuple3 location, Tuple3 target)
 {
-    Tuple3 pnt_light_vec = TupleSubtract(s->light.origin, location);
+    STAT_ADD(STAT_SHADOW_RAYS, 1);
+
+    Tuple3 pnt_light_vec = TupleSubtract(target, location);
 
     double distance = TupleMagnitude(pnt_light_vec);
     Tuple3 direction = TupleNormalize(pnt_light_vec);
@@ -66,35 +83,155 @@ bool IsInShadow(Scene *s, Tuple3 location)
     return false;
 }
 
+bool IsInShadow(Scene *s, Tuple3 location)
+{
+    return IsOccluded(s, location, s->light.origin);
+}
+
+double LightVisibility(Scene *s, Tuple3 location)
+{
+    Light *l = &s->light;
+    if (l->type == POINT_LIGHT)
+    {
+        return IsInShadow(s, location) ? 0.0 : 1.0;
+    }
+
+    // Decorrelates the shadow ray pattern between pixels, samples and bounces
+    unsigned seed = SampleNextSeed(&s->sampler);
+    unsigned lit = 0;
+    unsigned taken = 0;
+
+    for (; taken < l->samples; taken++)
+    {
+        // Stop early if the first few samples agree, the location is either fully lit or fully occluded
+        if (taken == ADAPTIVE_SHADOW_SAMPLES && (lit == 0 || lit == taken))
+        {
+            break;
+        }
+
+        double u, v;
+        LightSampleCoordinates(l, taken, seed, &u, &v);
+        Tuple3 target = LightSamplePoint(l, location, u, v);
+
+        if (!IsOccluded(s, location, target))
+        {
+            lit++;
+        }
+    }
+
+    return (double)lit / (double)taken;
+}
+
 void IntersectScene(Scene *s, Ray r, Set *intersection_set)
 {
     IntersectTree(&s->shapes, r, intersection_set);
 }
 
-void RenderSceneSection(
-    Scene *s,
-    Canvas *c,
-    unsigned start, unsigned end,
-    unsigned canvas_width)
+/* One ray through the center of each pixel, the rays are generated a packet at a time */
+static void RenderSpanCenters(Scene *s, Canvas *c, unsigned x, unsigned y, unsigned count, unsigned offset)
 {
-    for (unsigned i = start; i < end; i++)
+    SurfaceSample first_hit;
+    SurfaceSample *surface = c->planes == 0 ? NULL : &first_hit;
+
+    for (unsigned first = 0; first < count; first += RAY_PACKET_WIDTH)
     {
-        unsigned x = i % canvas_width;
-        unsigned y = (i - x) / canvas_width;
+        unsigned length = count - first < RAY_PACKET_WIDTH ? count - first : RAY_PACKET_WIDTH;
+
+        RayPacket packet;
+        CameraRayPacket(&s->camera, x + first, y, length, NULL, NULL, &packet);
 
-        Ray r = RayForPixel(&s->camera, x, y);
-        Tuple3 color = ColorFor(s, r);
-        DirectWritePixel(c, color, i);
+        for (unsigned j = 0; j < length; j++)
+        {
+            unsigned i = offset + first + j;
+            unsigned long steps = TraversalSteps();
+
+            StartPixelSample(&s->sampler, x + first + j, y, 0);
+            DirectWritePixel(c, ColorForSurface(s, PacketRay(&packet, j), RECURSION_LIMIT, surface), i);
+            if (surface != NULL)
+            {
+                surface->steps = (unsigned)(TraversalSteps() - steps);
+                DirectWriteSurface(c, surface, i);
+            }
+        }
+    }
+}
+
+/* Render the camera's pixels ('x'..'x' + 'count', 'y'), writing them to the canvas from 'offset' on */
+static void RenderSceneSpan(Scene *s, Canvas *c, unsigned x, unsigned y, unsigned count, unsigned offset)
+{
+    Sampler *sampler = &s->sampler;
+    if (sampler->samples_per_pixel <= 1)
+    {
+        RenderSpanCenters(s, c, x, y, count, offset);
+        return;
+    }
+
+    for (unsigned j = 0; j < count; j++)
+    {
+        unsigned i = offset + j;
+
+        // Auxiliary planes are only filled in when the canvas asks for them
+        SurfaceSample first_hit;
+        SurfaceSample *surface = c->planes == 0 ? NULL : &first_hit;
+        unsigned long steps = TraversalSteps();
+
+        Tuple3 color = NewColor(0, 0, 0, 0);
+        SurfaceSample average = {.albedo = NewColor(0, 0, 0, 0), .normal = NewVec3(0, 0, 0), .depth = INFINITY, .shape_id = 0};
+
+        for (unsigned sample = 0; sample < sampler->samples_per_pixel; sample++)
+        {
+            StartPixelSample(sampler, x + j, y, sample);
+
+            double sample_x, sample_y;
+            SampleNext2D(sampler, &sample_x, &sample_y);
+
+            Ray r = RayForPixelSample(&s->camera, x + j, y, sample_x, sample_y);
+            color = TupleAdd(color, ColorForSurface(s, r, RECURSION_LIMIT, surface));
+
+            if (surface != NULL)
+            {
+                average.albedo = TupleAdd(average.albedo, surface->albedo);
+                average.normal = TupleAdd(average.normal, surface->normal);
+                // The nearest sample decides which shape the pixel belongs to
+                if (surface->depth < average.depth)
+                {
+                    average.depth = surface->depth;
+                    average.shape_id = surface->shape_id;
+                }
+            }
+        }
+
+        double scale = 1.0 / sampler->samples_per_pixel;
+        DirectWritePixel(c, TupleScalarMultiply(color, scale), i);
+
+        if (surface != NULL)
+        {
+            average.albedo = TupleScalarMultiply(average.albedo, scale);
+            if (TupleMagnitude(average.normal) > 0)
+            {
+                average.normal = TupleNormalize(average.normal);
+            }
+
+            average.steps = (unsigned)(TraversalSteps() - steps);
+            DirectWriteSurface(c, &average, i);
+        }
     }
 }
 
 Tuple3 ColorFor(Scene *s, Ray r)
 {
-    return ColorForLimited(s, r, 8);
+    return ColorForLimited(s, r, RECURSION_LIMIT);
 }
 
 Tuple3 ColorForLimited(Scene *s, Ray r, int limit)
 {
+    return ColorForSurface(s, r, limit, NULL);
+}
+
+Tuple3 ColorForSurface(Scene *s, Ray r, int limit, SurfaceSample *surface)
+{
+    STAT_ADD(STAT_SHADE_CALLS, 1);
+    STAT_MAX(STAT_MAX_RECURSION_DEPTH, RECURSION_LIMIT - limit);
 
     Set intersections;
     ConstructSet(&intersections, sizeof(Intersection));
@@ -102,6 +239,7 @@ Tuple3 ColorForLimited(Scene *s, Ray r, int limit)
 
     double curDepth = FLT_MAX;
     Tuple3 curColor = NewColor(0, 0, 0, 0);
+    Intersection *nearest = NULL;
 
     for (unsigned j = 0; j < intersections.length; j++)
     {
@@ -120,7 +258,25 @@ Tuple3 ColorForLimited(Scene *s, Ray r, int limit)
         }
 
         curDepth = depth;
-        curColor = this_intersection->shape_ptr->material.shader(s, &intersections, j, limit);
+        curColor = ShapeMaterial(this_intersection->shape_ptr)->shader(s, &intersections, j, limit);
+        nearest = this_intersection;
+    }
+
+    if (surface != NULL)
+    {
+        surface->albedo = NewColor(0, 0, 0, 0);
+        surface->normal = NewVec3(0, 0, 0);
+        surface->depth = INFINITY;
+        surface->shape_id = 0;
+
+        if (nearest != NULL)
+        {
+            Tuple3 pos = RayPosition(nearest->ray, nearest->ray_times[0]);
+            surface->albedo = PatternColorAt(nearest->shape_ptr, pos);
+            surface->normal = NormalAt(nearest->shape_ptr, pos);
+            surface->depth = curDepth;
+            surface->shape_id = nearest->shape_ptr->id;
+        }
     }
 
     DeconstructSet(&intersections);
@@ -129,8 +285,13 @@ Tuple3 ColorForLimited(Scene *s, Ray r, int limit)
 
 void GenerateSceneBVH(Scene *s)
 {
+    TRACE_SCOPE("GenerateSceneBVH", "phase");
+
+    NumberShapes(&s->shapes);
+
     Tree bvh;
     ConstructTree(&bvh);
+    bvh.precision = s->shapes.precision;
 
     GenerateBVH(&bvh, &s->shapes);
     ReplaceTree(s, &bvh);
@@ -138,54 +299,300 @@ void GenerateSceneBVH(Scene *s)
     CalculateBounds(&s->shapes);
 
     DeconstructTree(&bvh);
+    s->bvh_current = true;
 }
 
-void RenderScene(Scene *s, Canvas *c)
+void UpdateSceneBVH(Scene *s)
+{
+    if (!s->bvh_current)
+    {
+        GenerateSceneBVH(s);
+    }
+}
+
+/* Render a tile of the camera's frame, onto a canvas whose top left pixel is the frame's ('origin_x', 'origin_y') */
+static void RenderTileAt(Scene *s, Canvas *c, Tile t, unsigned origin_x, unsigned origin_y)
+{
+    // A checkpoint only records the canvas it was opened for, and a cropped canvas' tiles are not the frame's
+    bool recorded = s->checkpoint != NULL && s->checkpoint->canvas == c && origin_x == 0 && origin_y == 0 &&
+                    c->canvas_width == s->camera.width && c->canvas_height == s->camera.height;
+    TileCheckpoint *checkpoint = recorded ? s->checkpoint : NULL;
+    if (checkpoint != NULL && TileFinished(checkpoint, t.index))
+    {
+        return;
+    }
+
+    TRACE_SCOPE_ARGUMENT("tile", "tile", t.index);
+
+    if (s->stats != NULL)
+    {
+        ResetRenderStats(&process_stats);
+    }
+
+    for (unsigned y = t.y; y < t.y + t.height; y++)
+    {
+        unsigned row_start = (y - origin_y) * c->canvas_width + (t.x - origin_x);
+        RenderSceneSpan(s, c, t.x, y, t.width, row_start);
+    }
+
+    if (s->stats != NULL)
+    {
+        RecordTileStats(s->stats, t);
+    }
+
+    // A tile cut down by a region is not finished yet
+    Tile whole = CanvasTile(c, t.index);
+    if (checkpoint != NULL && t.width == whole.width && t.height == whole.height)
+    {
+        FinishTile(checkpoint, t);
+    }
+
+    if (s->tile_done != NULL)
+    {
+        t.x -= origin_x;
+        t.y -= origin_y;
+        s->tile_done(s->tile_done_context, c, t);
+    }
+}
+
+void RenderSceneTile(Scene *s, Canvas *c, Tile t)
 {
-    GenerateSceneBVH(s);
+    RenderTileAt(s, c, t, 0, 0);
+}
+
+void RenderSceneTileCropped(Scene *s, Canvas *c, Tile t)
+{
+    RenderTileAt(s, c, t, t.x, t.y);
+}
+
+typedef struct
+{
+    Scene *scene;
+    Canvas *canvas;
+} RenderContext;
 
-    unsigned canvas_size = (c->canvas_height * c->canvas_width);
-    unsigned chunk_size = canvas_size / (unsigned)get_nprocs();
-    unsigned num_chunks = canvas_size / chunk_size;
+void RenderSceneTileHelper(void *context, unsigned start, unsigned end)
+{
+    RenderContext *ctx = context;
+    for (unsigned i = start; i < end; i++)
+    {
+        RenderSceneTile(ctx->scene, ctx->canvas, CanvasTile(ctx->canvas, i));
+    }
+}
 
-    Set pids;
-    ConstructSet(&pids, sizeof(int));
+typedef struct
+{
+    Scene *scene;
+    Canvas *canvas;
+    RenderRegion region;
+
+    /* The frame's tiles the region's rectangle touches, a block 'tiles_across' wide starting at 'first_tile' */
+    unsigned first_tile;
+    unsigned tiles_across;
+} RegionContext;
+
+/* The frame's 'index'th tile, cut down to the part inside the region. Empty if they do not overlap */
+static Tile RegionTile(RegionContext *ctx, unsigned index)
+{
+    Camera *camera = &ctx->scene->camera;
+    RenderRegion *r = &ctx->region;
+
+    Tile t = FrameTile(camera->width, camera->height, index);
+    unsigned right = t.x + t.width < r->x + r->width ? t.x + t.width : r->x + r->width;
+    unsigned bottom = t.y + t.height < r->y + r->height ? t.y + t.height : r->y + r->height;
+
+    t.x = t.x > r->x ? t.x : r->x;
+    t.y = t.y > r->y ? t.y : r->y;
+    t.width = right > t.x ? right - t.x : 0;
+    t.height = bottom > t.y ? bottom - t.y : 0;
+
+    return t;
+}
+
+void RenderSceneRegionHelper(void *context, unsigned start, unsigned end)
+{
+    RegionContext *ctx = context;
+    unsigned frame_tiles_across = (ctx->scene->camera.width + TILE_SIZE - 1) / TILE_SIZE;
 
-    for (unsigned cur_chunk = 0; cur_chunk < num_chunks; cur_chunk++)
+    for (unsigned i = start; i < end; i++)
     {
-        unsigned cur_chunk_start = cur_chunk * chunk_size;
-        unsigned cur_chunk_end = cur_chunk_start + chunk_size;
+        unsigned index = ctx->region.tiles != NULL
+                             ? ctx->region.tiles[i]
+                             : ctx->first_tile + (i / ctx->tiles_across) * frame_tiles_across + i % ctx->tiles_across;
+
+        Tile t = RegionTile(ctx, index);
+        if (t.width == 0 || t.height == 0)
+        {
+            continue;
+        }
 
-        int pid = fork();
-        if (pid == 0)
-        { // Child renders its section
-            RenderSceneSection(s, c, cur_chunk_start, cur_chunk_end, c->canvas_width);
-            exit(0);
+        if (ctx->region.output == REGION_CROPPED)
+        {
+            RenderTileAt(ctx->scene, ctx->canvas, t, ctx->region.x, ctx->region.y);
         }
         else
         {
-            AppendValue(&pids, &pid); // Parent keeps track of child
+            RenderTileAt(ctx->scene, ctx->canvas, t, 0, 0);
         }
     }
+}
 
-    for (unsigned pid_index = 0; pid_index < pids.length; pid_index++)
+static void BeginFrameStats(Scene *s)
+{
+    if (s->stats != NULL)
     {
-        int cur_pid;
-        CopyOut(&pids, pid_index, &cur_pid);
+        ResetFrameStats(s->stats);
+    }
+}
 
-        int exit_status;
-        waitpid(cur_pid, &exit_status, WUNTRACED);
+static void EndFrameStats(Scene *s)
+{
+    if (s->stats != NULL)
+    {
+        SumFrameStats(s->stats);
     }
+}
+
+void RenderScene(Scene *s, Canvas *c)
+{
+    TRACE_SCOPE("RenderScene", "phase");
 
-    unsigned leftovers_start = num_chunks * chunk_size;
-    if (leftovers_start != canvas_size)
+    UpdateSceneBVH(s);
+    BeginFrameStats(s);
+
+    RenderContext ctx = {
+        .scene = s,
+        .canvas = c,
+    };
+
+    ParallelForDynamic(CanvasTileCount(c), RenderSceneTileHelper, &ctx);
+    EndFrameStats(s);
+}
+
+typedef struct
+{
+    Scene *scene;
+    Camera *cameras;
+    Canvas *canvases;
+    unsigned count;
+
+    /* The first item of each view, every tile of view i comes before those of view i + 1 */
+    unsigned *first_tile;
+} ViewsContext;
+
+void RenderSceneViewsHelper(void *context, unsigned start, unsigned end)
+{
+    ViewsContext *ctx = context;
+    for (unsigned i = start; i < end; i++)
     {
-        RenderSceneSection(s, c, leftovers_start, canvas_size + 1, c->canvas_width);
+        unsigned v = 0;
+        while (v + 1 < ctx->count && ctx->first_tile[v + 1] <= i)
+        {
+            v++;
+        }
+
+        // A view of the scene, sharing its BVH
+        Scene view = *ctx->scene;
+        view.camera = ctx->cameras[v];
+
+        Canvas *c = &ctx->canvases[v];
+        RenderSceneTile(&view, c, CanvasTile(c, i - ctx->first_tile[v]));
     }
 }
 
+void RenderSceneViews(Scene *s, Camera *cameras, Canvas *canvases, unsigned count)
+{
+    TRACE_SCOPE("RenderSceneViews", "phase");
+
+    UpdateSceneBVH(s);
+
+    FrameStats *stats = s->stats;
+    s->stats = NULL;
+
+    ViewsContext ctx = {
+        .scene = s,
+        .cameras = cameras,
+        .canvases = canvases,
+        .count = count,
+        .first_tile = malloc((count + 1) * sizeof(unsigned)),
+    };
+
+    ctx.first_tile[0] = 0;
+    for (unsigned v = 0; v < count; v++)
+    {
+        ctx.first_tile[v + 1] = ctx.first_tile[v] + CanvasTileCount(&canvases[v]);
+    }
+
+    ParallelForDynamic(ctx.first_tile[count], RenderSceneViewsHelper, &ctx);
+
+    free(ctx.first_tile);
+    s->stats = stats;
+}
+
 void RenderSceneUnthreaded(Scene *s, Canvas *c)
 {
-    GenerateSceneBVH(s);
-    RenderSceneSection(s, c, 0, c->canvas_height * c->canvas_width - 1, c->canvas_width);
+    TRACE_SCOPE("RenderSceneUnthreaded", "phase");
+
+    UpdateSceneBVH(s);
+    BeginFrameStats(s);
+
+    for (unsigned i = 0; i < CanvasTileCount(c); i++)
+    {
+        RenderSceneTile(s, c, CanvasTile(c, i));
+    }
+
+    EndFrameStats(s);
+}
+
+RenderRegion FullFrameRegion(Camera *c)
+{
+    RenderRegion r = {
+        .x = 0,
+        .y = 0,
+        .width = c->width,
+        .height = c->height,
+        .tiles = NULL,
+        .tile_count = 0,
+        .output = REGION_IN_PLACE,
+    };
+
+    return r;
+}
+
+RenderRegion ClipRegion(Camera *c, RenderRegion r)
+{
+    r.x = r.x < c->width ? r.x : c->width;
+    r.y = r.y < c->height ? r.y : c->height;
+    r.width = r.width < c->width - r.x ? r.width : c->width - r.x;
+    r.height = r.height < c->height - r.y ? r.height : c->height - r.y;
+
+    return r;
+}
+
+void RenderSceneRegion(Scene *s, Canvas *c, RenderRegion r)
+{
+    TRACE_SCOPE("RenderSceneRegion", "phase");
+
+    r = ClipRegion(&s->camera, r);
+    if (r.width == 0 || r.height == 0)
+    {
+        return;
+    }
+
+    UpdateSceneBVH(s);
+    BeginFrameStats(s);
+
+    RegionContext ctx = {
+        .scene = s,
+        .canvas = c,
+        .region = r,
+        .first_tile = (r.y / TILE_SIZE) * ((s->camera.width + TILE_SIZE - 1) / TILE_SIZE) + r.x / TILE_SIZE,
+        .tiles_across = (r.x + r.width - 1) / TILE_SIZE - r.x / TILE_SIZE + 1,
+    };
+
+    unsigned tiles_down = (r.y + r.height - 1) / TILE_SIZE - r.y / TILE_SIZE + 1;
+    unsigned tile_count = r.tiles != NULL ? r.tile_count : ctx.tiles_across * tiles_down;
+
+    ParallelForDynamic(tile_count, RenderSceneRegionHelper, &ctx);
+    EndFrameStats(s);
 }
@@ -0,0 +1,585 @@
+#include "server.h"
+#include "net.h"
+#include "shmem.h"
+#include "trace.h"
+
+#include <math.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <cjson/cJSON.h>
+
+/* From read_scene.c, they stop the process if the JSON is malformed */
+void GetCamera(Camera *c, cJSON *json);
+void GetRegion(RenderRegion *r, Camera *c, cJSON *json);
+
+/* Index, x, y, width and height at the start of a SERVER_TILE message */
+#define TILE_HEADER_SIZE (5 * sizeof(uint32_t))
+
+/* Hash, width, height and whether the scene was cached */
+#define FRAME_SIZE (sizeof(uint64_t) + 3 * sizeof(uint32_t))
+
+static double Seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+ServerSettings DefaultServerSettings()
+{
+    ServerSettings settings = {
+        .socket_path = "/tmp/ctracer.sock",
+        .cache_size = 8,
+        .request_timeout = 10,
+    };
+
+    return settings;
+}
+
+void ConstructSceneCache(SceneCache *cache, unsigned capacity)
+{
+    cache->capacity = capacity > 0 ? capacity : 1;
+    cache->entries = calloc(cache->capacity, sizeof(CachedScene));
+    cache->clock = 0;
+}
+
+void DeconstructSceneCache(SceneCache *cache)
+{
+    for (unsigned i = 0; i < cache->capacity; i++)
+    {
+        if (cache->entries[i].loaded)
+        {
+            DeconstructScene(&cache->entries[i].scene);
+            DeconstructMaterialTables(&cache->entries[i].tables);
+        }
+    }
+
+    free(cache->entries);
+    UseMaterialTables(NULL);
+}
+
+Scene *FindCachedScene(SceneCache *cache, uint64_t hash)
+{
+    for (unsigned i = 0; i < cache->capacity; i++)
+    {
+        CachedScene *entry = &cache->entries[i];
+        if (entry->loaded && entry->hash == hash)
+        {
+            entry->last_used = ++cache->clock;
+            UseMaterialTables(&entry->tables);
+            return &entry->scene;
+        }
+    }
+
+    return NULL;
+}
+
+Scene *CacheScene(SceneCache *cache, const char *json, bool *cached)
+{
+    uint64_t hash = HashSceneJson(json);
+
+    Scene *found = FindCachedScene(cache, hash);
+    *cached = found != NULL;
+    if (found != NULL)
+    {
+        return found;
+    }
+
+    // An empty entry, otherwise the least recently used one
+    CachedScene *entry = &cache->entries[0];
+    for (unsigned i = 0; i < cache->capacity && entry->loaded; i++)
+    {
+        CachedScene *candidate = &cache->entries[i];
+        entry = !candidate->loaded || candidate->last_used < entry->last_used ? candidate : entry;
+    }
+
+    if (entry->loaded)
+    {
+        DeconstructScene(&entry->scene);
+        DeconstructMaterialTables(&entry->tables);
+    }
+
+    // The scene's materials go into its own tables, so they are freed along with it
+    ConstructMaterialTables(&entry->tables);
+    UseMaterialTables(&entry->tables);
+    ReadSceneJson(&entry->scene, json);
+    GenerateSceneBVH(&entry->scene);
+
+    entry->hash = hash;
+    entry->last_used = ++cache->clock;
+    entry->loaded = true;
+
+    return &entry->scene;
+}
+
+static void SendError(int fd, const char *error)
+{
+    printf("Request failed: %s\n", error);
+    SendMessage(fd, SERVER_ERROR, error, strlen(error));
+}
+
+typedef struct
+{
+    int fd;
+
+    /** Set while a process is writing to the socket, so messages are not interleaved. Shared memory */
+    int *lock;
+
+    /** Set once a send fails or times out, later tiles are not sent. Shared memory */
+    int *failed;
+} TileStream;
+
+/* Send a finished tile to the client, called in the child process that rendered it */
+static void StreamTile(void *context, Canvas *c, Tile t)
+{
+    TileStream *stream = context;
+
+    size_t length = TILE_HEADER_SIZE + (size_t)t.width * t.height * 3;
+    unsigned char *message = malloc(MESSAGE_HEADER_SIZE + length);
+    WriteMessageHeader(message, SERVER_TILE, length);
+
+    uint32_t tile[5] = {t.index, t.x, t.y, t.width, t.height};
+    memcpy(message + MESSAGE_HEADER_SIZE, tile, sizeof(tile));
+
+    unsigned char *pixel = message + MESSAGE_HEADER_SIZE + TILE_HEADER_SIZE;
+    for (unsigned y = t.y; y < t.y + t.height; y++)
+    {
+        for (unsigned x = t.x; x < t.x + t.width; x++, pixel += 3)
+        {
+            PixelBytes(c, y * c->canvas_width + x, pixel);
+        }
+    }
+
+    int idle = 0;
+    while (!__atomic_compare_exchange_n(stream->lock, &idle, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+        idle = 0;
+        sched_yield();
+    }
+
+    // A client that stopped reading costs one send timeout, not one for every tile
+    if (!*stream->failed && !SendAll(stream->fd, message, MESSAGE_HEADER_SIZE + length))
+    {
+        *stream->failed = 1;
+    }
+
+    __atomic_store_n(stream->lock, 0, __ATOMIC_RELEASE);
+
+    free(message);
+}
+
+/* Everything a request will read from its scene file, when not NULL, and its overrides */
+static void ParseRequest(const char *scene_json, cJSON *request)
+{
+    Scene s;
+    if (scene_json != NULL)
+    {
+        ReadSceneJson(&s, scene_json);
+    }
+
+    if (request == NULL)
+    {
+        return;
+    }
+
+    Camera camera = NewCamera(1, 1, 1);
+    if (cJSON_HasObjectItem(request, "camera"))
+    {
+        GetCamera(&camera, request);
+    }
+
+    RenderRegion region;
+    if (cJSON_HasObjectItem(request, "region"))
+    {
+        GetRegion(&region, &camera, request);
+    }
+}
+
+/* The scene reader stops the process on malformed JSON, so it is tried out in a child process first */
+static bool RequestParses(const char *scene_json, cJSON *request)
+{
+    fflush(NULL);
+
+    int pid = fork();
+    if (pid == 0)
+    {
+        ParseRequest(scene_json, request);
+        exit(0);
+    }
+
+    int status;
+    return pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static char *ReadWholeFile(const char *filename)
+{
+    FILE *fp = fopen(filename, "rb");
+    if (fp == NULL)
+    {
+        return NULL;
+    }
+
+    fseek(fp, 0L, SEEK_END);
+    long size = ftell(fp);
+    rewind(fp);
+
+    char *contents = malloc((size_t)size + 1);
+    size_t read = fread(contents, 1, (size_t)size, fp);
+    contents[read] = '\0';
+    fclose(fp);
+
+    return contents;
+}
+
+/* Find the request's scene, loading it if needed. Returns NULL after replying with an error */
+static Scene *RequestScene(SceneCache *cache, int fd, cJSON *request, uint64_t *hash, bool *cached)
+{
+    const char *hash_text = cJSON_GetStringValue(cJSON_GetObjectItem(request, "scene_hash"));
+    if (hash_text != NULL)
+    {
+        *hash = strtoull(hash_text, NULL, 16);
+        *cached = true;
+
+        Scene *s = FindCachedScene(cache, *hash);
+        if (s == NULL)
+        {
+            SendError(fd, "The scene with that hash is not loaded");
+        }
+
+        return s;
+    }
+
+    const char *filename = cJSON_GetStringValue(cJSON_GetObjectItem(request, "scene"));
+    if (filename == NULL)
+    {
+        SendError(fd, "The request names neither a \"scene\" nor a \"scene_hash\"");
+        return NULL;
+    }
+
+    char *json = ReadWholeFile(filename);
+    if (json == NULL)
+    {
+        SendError(fd, "Could not open the scene file");
+        return NULL;
+    }
+
+    *hash = HashSceneJson(json);
+
+    Scene *s = NULL;
+    if (FindCachedScene(cache, *hash) == NULL && !RequestParses(json, NULL))
+    {
+        SendError(fd, "Could not read the scene file");
+    }
+    else
+    {
+        s = CacheScene(cache, json, cached);
+    }
+
+    free(json);
+    return s;
+}
+
+static void ServeRequest(SceneCache *cache, int fd, cJSON *request)
+{
+    TRACE_SCOPE("ServeRequest", "io");
+    double start = Seconds();
+
+    uint64_t hash;
+    bool cached = false;
+    Scene *s = RequestScene(cache, fd, request, &hash, &cached);
+    if (s == NULL)
+    {
+        return;
+    }
+
+    bool overrides = cJSON_HasObjectItem(request, "camera") || cJSON_HasObjectItem(request, "region");
+    if (overrides && !RequestParses(NULL, request))
+    {
+        SendError(fd, "Could not read the request's camera or region");
+        return;
+    }
+
+    // A view of the cached scene, sharing its BVH
+    Scene view = *s;
+    if (cJSON_HasObjectItem(request, "camera"))
+    {
+        GetCamera(&view.camera, request);
+        view.region = FullFrameRegion(&view.camera);
+    }
+
+    if (cJSON_HasObjectItem(request, "region"))
+    {
+        GetRegion(&view.region, &view.camera, request);
+    }
+
+    Canvas canvas;
+    RenderRegion clipped = ClipRegion(&view.camera, view.region);
+    if (view.region.output == REGION_CROPPED)
+    {
+        ConstructCanvas(&canvas, clipped.width, clipped.height);
+    }
+    else
+    {
+        ConstructCanvas(&canvas, view.camera.width, view.camera.height);
+    }
+
+    unsigned char frame[FRAME_SIZE];
+    uint32_t size[3] = {canvas.canvas_width, canvas.canvas_height, cached};
+    memcpy(frame, &hash, sizeof(hash));
+    memcpy(frame + sizeof(hash), size, sizeof(size));
+
+    TileStream stream = {
+        .fd = fd,
+        .lock = shmalloc(sizeof(int)),
+        .failed = shmalloc(sizeof(int)),
+    };
+    *stream.lock = 0;
+    *stream.failed = 0;
+
+    view.stats = NULL;
+    view.checkpoint = NULL;
+    view.tile_done = StreamTile;
+    view.tile_done_context = &stream;
+
+    if (SendMessage(fd, SERVER_FRAME, frame, sizeof(frame)))
+    {
+        RenderSceneRegion(&view, &canvas, view.region);
+
+        double seconds = Seconds() - start;
+        if (!*stream.failed)
+        {
+            SendMessage(fd, SERVER_DONE, &seconds, sizeof(seconds));
+        }
+    }
+
+    if (view.region.tiles != s->region.tiles)
+    {
+        free(view.region.tiles);
+    }
+
+    shfree(stream.lock, sizeof(int));
+    shfree(stream.failed, sizeof(int));
+    DeconstructCanvas(&canvas);
+}
+
+/* Read everything the client sends, until it shuts down its side of the connection.
+ * Returns NULL if the connection failed or the client had not finished within 'timeout' seconds
+ */
+static char *ReadRequest(int fd, double timeout)
+{
+    size_t capacity = 4096, length = 0;
+    char *text = malloc(capacity);
+
+    // One deadline for the whole request, so a client sending a byte at a time cannot hold the server
+    double deadline = Seconds() + timeout;
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+
+    ssize_t received = -1;
+    while (Seconds() < deadline && poll(&pfd, 1, (int)ceil((deadline - Seconds()) * 1000)) > 0 &&
+           (received = recv(fd, text + length, capacity - length - 1, 0)) > 0)
+    {
+        length += (size_t)received;
+        if (length + 1 == capacity)
+        {
+            capacity *= 2;
+            text = realloc(text, capacity);
+        }
+    }
+
+    if (received != 0)
+    {
+        free(text);
+        return NULL;
+    }
+
+    text[length] = '\0';
+    return text;
+}
+
+void RunRenderServer(ServerSettings settings)
+{
+    int server = ListenOn(settings.socket_path);
+    if (server < 0)
+    {
+        return;
+    }
+
+    SceneCache cache;
+    ConstructSceneCache(&cache, settings.cache_size);
+
+    printf("Listening on '%s'\n", settings.socket_path);
+    fflush(stdout);
+
+    bool stop = false;
+    while (!stop)
+    {
+        int client = accept(server, NULL, NULL);
+        if (client < 0)
+        {
+            continue;
+        }
+
+        // Replies are sent with the same limit, so a client that stops reading cannot stall the render processes
+        struct timeval timeout = {
+            .tv_sec = (time_t)settings.request_timeout,
+            .tv_usec = (suseconds_t)((settings.request_timeout - floor(settings.request_timeout)) * 1e6),
+        };
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        char *text = ReadRequest(client, settings.request_timeout);
+        cJSON *request = text != NULL ? cJSON_Parse(text) : NULL;
+
+        if (text == NULL)
+        {
+            SendError(client, "The whole request was not received in time");
+        }
+        else if (request == NULL || !cJSON_IsObject(request))
+        {
+            SendError(client, "The request is not a JSON object");
+        }
+        else if (cJSON_IsTrue(cJSON_GetObjectItem(request, "shutdown")) && !cJSON_HasObjectItem(request, "scene") &&
+                 !cJSON_HasObjectItem(request, "scene_hash"))
+        {
+            double seconds = 0;
+            SendMessage(client, SERVER_DONE, &seconds, sizeof(seconds));
+        }
+        else
+        {
+            ServeRequest(&cache, client, request);
+        }
+
+        stop = request != NULL && cJSON_IsTrue(cJSON_GetObjectItem(request, "shutdown"));
+
+        cJSON_Delete(request);
+        free(text);
+        close(client);
+    }
+
+    DeconstructSceneCache(&cache);
+    StopListening(settings.socket_path, server);
+}
+
+/* Connect to the server and send it a whole request. Returns the connection, or -1 */
+static int SendRequest(const char *socket_path, const char *request)
+{
+    int fd = ConnectTo(socket_path);
+    if (fd < 0)
+    {
+        printf("Could not connect to '%s'\n", socket_path);
+        return -1;
+    }
+
+    SendAll(fd, request, strlen(request));
+    shutdown(fd, SHUT_WR);
+    return fd;
+}
+
+bool StopRenderServer(const char *socket_path)
+{
+    int fd = SendRequest(socket_path, "{\"shutdown\": true}");
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    uint32_t type, length;
+    unsigned char *payload = ReceiveMessage(fd, &type, &length);
+    bool stopped = payload != NULL && type == SERVER_DONE;
+
+    free(payload);
+    close(fd);
+
+    return stopped;
+}
+
+bool RequestServerRender(const char *socket_path, const char *request, Canvas *c, ServerReply *reply)
+{
+    int fd = SendRequest(socket_path, request);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    memset(reply, 0, sizeof(ServerReply));
+    bool has_canvas = false, done = false, failed = false;
+
+    uint32_t type, length;
+    unsigned char *payload;
+    while (!done && !failed && (payload = ReceiveMessage(fd, &type, &length)) != NULL)
+    {
+        if (type == SERVER_FRAME && length == FRAME_SIZE && !has_canvas)
+        {
+            uint32_t size[3];
+            memcpy(&reply->scene_hash, payload, sizeof(uint64_t));
+            memcpy(size, payload + sizeof(uint64_t), sizeof(size));
+
+            ConstructCanvas(c, size[0], size[1]);
+            reply->cached = size[2] != 0;
+            has_canvas = true;
+        }
+        else if (type == SERVER_TILE && length >= TILE_HEADER_SIZE && has_canvas)
+        {
+            uint32_t tile[5];
+            memcpy(tile, payload, sizeof(tile));
+
+            // Tiles that do not fit the canvas are not written
+            bool fits = tile[1] + tile[3] <= c->canvas_width && tile[2] + tile[4] <= c->canvas_height &&
+                        length == TILE_HEADER_SIZE + (size_t)tile[3] * tile[4] * 3;
+
+            unsigned char *pixel = payload + TILE_HEADER_SIZE;
+            for (unsigned y = 0; fits && y < tile[4]; y++)
+            {
+                for (unsigned x = 0; x < tile[3]; x++, pixel += 3)
+                {
+                    Tuple3 color = NewColor(pixel[0], pixel[1], pixel[2], 0);
+                    WritePixel(c, color, tile[1] + x, tile[2] + y);
+                }
+            }
+
+            reply->tiles += fits;
+        }
+        else if (type == SERVER_DONE && length == sizeof(double))
+        {
+            memcpy(&reply->seconds, payload, sizeof(double));
+            done = true;
+        }
+        else if (type == SERVER_ERROR)
+        {
+            printf("Render server error: %s\n", payload);
+            failed = true;
+        }
+        else
+        {
+            printf("Unexpected message from the render server\n");
+            failed = true;
+        }
+
+        free(payload);
+    }
+
+    close(fd);
+
+    if (done && has_canvas)
+    {
+        return true;
+    }
+
+    if (has_canvas)
+    {
+        DeconstructCanvas(c);
+    }
+
+    if (!failed)
+    {
+        printf("The render server did not send a whole frame\n");
+    }
+
+    return false;
+}
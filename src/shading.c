@@ -44,7 +44,7 @@ void CalculateRefractionRatio(Set *intersections, unsigned long idx, double *n)
             }
             else
             {
-                n[0] = last_added->material.refractive_index;
+                n[0] = ShapeMaterial(last_added)->refractive_index;
             }
         }
 
@@ -60,7 +60,7 @@ void CalculateRefractionRatio(Set *intersections, unsigned long idx, double *n)
             }
             else
             {
-                n[1] = last_added->material.refractive_index;
+                n[1] = ShapeMaterial(last_added)->refractive_index;
             }
 
             break;
@@ -89,10 +89,10 @@ Tuple3 PhongShader(Scene *s, Set *intersections, unsigned long idx, int limit)
     Tuple3 over_pos = TupleAdd(pos, offset_normal); // move the position out a little to handle floating point errors
     Tuple3 under_pos = TupleSubtract(pos, offset_normal);
 
-    Material material = i->shape_ptr->material;
+    Material *material = ShapeMaterial(i->shape_ptr);
     Tuple3 color = PatternColorAt(i->shape_ptr, pos);
     Tuple3 effective_color = TupleMultiply(color, s->light.color);
-    Tuple3 ambient = TupleScalarMultiply(effective_color, material.ambient_reflection);
+    Tuple3 ambient = TupleScalarMultiply(effective_color, material->ambient_reflection);
 
     Tuple3 diffuse;
     Tuple3 specular;
@@ -100,7 +100,9 @@ Tuple3 PhongShader(Scene *s, Set *intersections, unsigned long idx, int limit)
     Tuple3 light_pos_vector = TupleNormalize(TupleSubtract(s->light.origin, over_pos));
     double light_dot_normal = TupleDotProduct(light_pos_vector, normal); // Measure of light to surface angle
 
-    if (light_dot_normal < 0.0 || IsInShadow(s, over_pos))
+    double visibility = light_dot_normal < 0.0 ? 0.0 : LightVisibility(s, over_pos);
+
+    if (visibility == 0.0)
     {
         diffuse = BLACK;
         specular = BLACK;
@@ -108,7 +110,7 @@ Tuple3 PhongShader(Scene *s, Set *intersections, unsigned long idx, int limit)
     else
     {
 
-        diffuse = TupleScalarMultiply(effective_color, material.diffuse_reflection * light_dot_normal);
+        diffuse = TupleScalarMultiply(effective_color, material->diffuse_reflection * light_dot_normal * visibility);
 
         Tuple3 reflect_vector = TupleReflect(TupleNegate(light_pos_vector), normal);
         double reflect_dot_eye = TupleDotProduct(reflect_vector, eyev);
@@ -119,21 +121,21 @@ Tuple3 PhongShader(Scene *s, Set *intersections, unsigned long idx, int limit)
         }
         else
         {
-            double factor = pow(reflect_dot_eye, material.shininess);
-            specular = TupleScalarMultiply(s->light.color, material.specular_reflection * factor);
+            double factor = pow(reflect_dot_eye, material->shininess);
+            specular = TupleScalarMultiply(s->light.color, material->specular_reflection * factor * visibility);
         }
     }
 
     Tuple3 general_reflection = BLACK;
-    if (material.general_reflection != 0)
+    if (material->general_reflection != 0)
     {
         Tuple3 reflectv = TupleReflect(i->ray.direction, normal);
         general_reflection = ColorForLimited(s, NewRay(over_pos, reflectv), limit - 1);
-        general_reflection = TupleScalarMultiply(general_reflection, material.general_reflection);
+        general_reflection = TupleScalarMultiply(general_reflection, material->general_reflection);
     }
 
     Tuple3 refraction_color = BLACK;
-    if (i->shape_ptr->material.transparency > EQUALITY_EPSILON)
+    if (material->transparency > EQUALITY_EPSILON)
     {
         double *n = alloca(2 * sizeof(double));
         CalculateRefractionRatio(intersections, idx, n);
@@ -153,10 +155,10 @@ Tuple3 PhongShader(Scene *s, Set *intersections, unsigned long idx, int limit)
             Ray refract_ray = NewRay(under_pos, direction);
             refraction_color = ColorForLimited(s, refract_ray, limit - 1);
 
-            refraction_color = TupleScalarMultiply(refraction_color, material.transparency);
+            refraction_color = TupleScalarMultiply(refraction_color, material->transparency);
         }
 
-        if (material.general_reflection > 0 && material.transparency > 0)
+        if (material->general_reflection > 0 && material->transparency > 0)
         {
             double cos = cos_i;
             double reflectance;
@@ -8,15 +8,17 @@
 Shape NewSphere(Tuple3 cp, double radius)
 {
     Shape s;
-    s.material = NewMaterial(NewTuple3(0.8, 1.0, 0.6, 1.0));
+    SetShapeMaterial(&s, NewMaterial(NewTuple3(0.8, 1.0, 0.6, 1.0)));
     s.type = SPHERE;
+    s.id = 0;
 
     Matrix4x4 center_point_translation = TranslationMatrix(cp[0], cp[1], cp[2]);
     Tuple3 radius_vector = TupleScalarMultiply(NewVec3(1, 1, 1), radius);
     Matrix4x4 radius_scaling = ScalingMatrix(radius_vector[0], radius_vector[1], radius_vector[2]);
 
-    s.transformation = MatrixMultiply(center_point_translation, radius_scaling);
-    s.inverse_transform = MatrixInvert(s.transformation);
+    s.transformation = AffineFromMatrix(MatrixMultiply(center_point_translation, radius_scaling));
+    s.inverse_transform = AffineInvert(s.transformation);
+    UpdateShapeBounds(&s);
 
     return s;
 }
@@ -24,8 +26,9 @@ Shape NewSphere(Tuple3 cp, double radius)
 Shape NewPlane(Tuple3 pnt, Tuple3 normal)
 {
     Shape s;
-    s.material = NewMaterial(NewTuple3(1.0, 0.8, 0.6, 1.0));
+    SetShapeMaterial(&s, NewMaterial(NewTuple3(1.0, 0.8, 0.6, 1.0)));
     s.type = PLANE;
+    s.id = 0;
 
     Matrix4x4 translation = TranslationMatrix(pnt[0], pnt[1], pnt[2]);
 
@@ -42,10 +45,9 @@ Shape NewPlane(Tuple3 pnt, Tuple3 normal)
     rotation = MatrixTranspose(rotation);
     rotation = MatrixInvert(rotation);
 
-    s.transformation = MatrixMultiply(IdentityMatrix(), translation);
-    s.transformation = MatrixMultiply(s.transformation, rotation);
-
-    s.inverse_transform = MatrixInvert(s.transformation);
+    s.transformation = AffineFromMatrix(MatrixMultiply(translation, rotation));
+    s.inverse_transform = AffineInvert(s.transformation);
+    UpdateShapeBounds(&s);
 
     return s;
 }
@@ -53,15 +55,17 @@ Shape NewPlane(Tuple3 pnt, Tuple3 normal)
 Shape NewCube(Tuple3 location, double size)
 {
     Shape s;
-    s.material = NewMaterial(NewTuple3(1.0, 0.8, 0.6, 1.0));
+    SetShapeMaterial(&s, NewMaterial(NewTuple3(1.0, 0.8, 0.6, 1.0)));
     s.type = CUBE;
+    s.id = 0;
 
     Matrix4x4 center_point_translation = TranslationMatrix(location[0], location[1], location[2]);
     Tuple3 size_vector = TupleScalarMultiply(NewVec3(1, 1, 1), size);
     Matrix4x4 size_matrix = ScalingMatrix(size_vector[0], size_vector[1], size_vector[2]);
 
-    s.transformation = MatrixMultiply(center_point_translation, size_matrix);
-    s.inverse_transform = MatrixInvert(s.transformation);
+    s.transformation = AffineFromMatrix(MatrixMultiply(center_point_translation, size_matrix));
+    s.inverse_transform = AffineInvert(s.transformation);
+    UpdateShapeBounds(&s);
 
     return s;
 }
@@ -104,8 +108,9 @@ void __attribute__ ((constructor)) InitializeUnitTriangle() {
 Shape NewTriangle(Tuple3 p1, Tuple3 p2, Tuple3 p3)
 {
     Shape s;
-    s.material = NewMaterial(NewTuple3(0.0, 0.8, 0.6, 1.0));
+    SetShapeMaterial(&s, NewMaterial(NewTuple3(0.0, 0.8, 0.6, 1.0)));
     s.type = TRIANGLE;
+    s.id = 0;
 
     Tuple3 f1 = TupleSubtract(p2, p1);
     Tuple3 f2 = TupleSubtract(p3, p1);
@@ -130,29 +135,43 @@ Shape NewTriangle(Tuple3 p1, Tuple3 p2, Tuple3 p3)
     M.contents[1][3] = m3[1];
     M.contents[2][3] = m3[2];
 
-    s.transformation = RectifyMatrix(M);
-    s.inverse_transform = MatrixInvert(s.transformation);
+    s.transformation = AffineFromMatrix(RectifyMatrix(M));
+    s.inverse_transform = AffineInvert(s.transformation);
+    UpdateShapeBounds(&s);
 
     return s;
 }
 
+Material *ShapeMaterial(Shape *s)
+{
+    return MaterialAt(s->material);
+}
+
+void SetShapeMaterial(Shape *s, Material m)
+{
+    s->material = AddMaterial(m);
+}
+
 void ApplyTransformation(Shape *s, Matrix4x4 t)
 {
-    s->transformation = MatrixMultiply(s->transformation, t);
-    s->inverse_transform = MatrixInvert(s->transformation);
+    s->transformation = AffineMultiply(s->transformation, AffineFromMatrix(t));
+    s->inverse_transform = AffineInvert(s->transformation);
+    UpdateShapeBounds(s);
+}
+
+void UpdateShapeBounds(Shape *s)
+{
+    s->bounds = ShapeBounds(s);
+    s->centroid = Centroid(s->bounds);
 }
 
 bool CompareShapes(Shape* s1, Shape* s2)
 {
-    Tuple3 c1 = Centroid(ShapeBounds(s1));
-    Tuple3 c2 = Centroid(ShapeBounds(s2));
-    return TupleLessThan(c1,  c2);
+    return TupleLessThan(s1->centroid, s2->centroid);
 }
 
 
 double ShapeDistance(Shape *s1, Shape *s2) 
 {
-    Tuple3 c1 = Centroid(ShapeBounds(s1));
-    Tuple3 c2 = Centroid(ShapeBounds(s2));
-    return TupleMagnitude(TupleSubtract(c1, c2));
+    return TupleMagnitude(TupleSubtract(s1->centroid, s2->centroid));
 }
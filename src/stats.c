@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "stats.h"
+#include "shmem.h"
+
+RenderStats process_stats;
+
+static const char *stat_names[STAT_COUNT] = {
+    "rays",
+    "node_visits",
+    "box_tests",
+    "primitive_tests",
+    "primitive_hits",
+    "shadow_rays",
+    "shade_calls",
+    "hit_list_length",
+    "max_hit_list_length",
+    "max_recursion_depth",
+};
+
+const char *RenderStatName(RENDER_STAT stat)
+{
+    return stat < STAT_COUNT ? stat_names[stat] : "unknown";
+}
+
+static bool IsMaximumStat(RENDER_STAT stat)
+{
+    return stat == STAT_MAX_HIT_LIST_LENGTH || stat == STAT_MAX_RECURSION_DEPTH;
+}
+
+void ResetRenderStats(RenderStats *stats)
+{
+    memset(stats, 0, sizeof(RenderStats));
+}
+
+void MergeRenderStats(RenderStats *destination, RenderStats *source)
+{
+    for (int i = 0; i < STAT_COUNT; i++)
+    {
+        if (IsMaximumStat((RENDER_STAT)i))
+        {
+            if (source->counters[i] > destination->counters[i])
+            {
+                destination->counters[i] = source->counters[i];
+            }
+        }
+        else
+        {
+            destination->counters[i] += source->counters[i];
+        }
+    }
+}
+
+void ConstructFrameStats(FrameStats *f, Canvas *c)
+{
+    f->canvas = c;
+    f->tile_count = CanvasTileCount(c);
+    f->tiles = (RenderStats *)shmalloc(f->tile_count * sizeof(RenderStats));
+    ResetFrameStats(f);
+}
+
+void DeconstructFrameStats(FrameStats *f)
+{
+    shfree(f->tiles, f->tile_count * sizeof(RenderStats));
+}
+
+void ResetFrameStats(FrameStats *f)
+{
+    ResetRenderStats(&f->frame);
+    for (unsigned i = 0; i < f->tile_count; i++)
+    {
+        ResetRenderStats(&f->tiles[i]);
+    }
+}
+
+void RecordTileStats(FrameStats *f, Tile t)
+{
+    f->tiles[t.index] = process_stats;
+}
+
+void SumFrameStats(FrameStats *f)
+{
+    ResetRenderStats(&f->frame);
+    for (unsigned i = 0; i < f->tile_count; i++)
+    {
+        MergeRenderStats(&f->frame, &f->tiles[i]);
+    }
+}
+
+static double Ratio(unsigned long a, unsigned long b)
+{
+    return b == 0 ? 0.0 : (double)a / (double)b;
+}
+
+void PrintFrameStats(FrameStats *f)
+{
+#ifndef RENDER_STATS
+    printf("Render stats are disabled, rebuild with RENDER_STATS defined to collect them\n");
+#endif
+
+    unsigned long *counters = f->frame.counters;
+    for (int i = 0; i < STAT_COUNT; i++)
+    {
+        printf("%-20s %lu\n", stat_names[i], counters[i]);
+    }
+
+    printf("%-20s %f\n", "nodes_per_ray", Ratio(counters[STAT_NODE_VISITS], counters[STAT_RAYS]));
+    printf("%-20s %f\n", "primitives_per_ray", Ratio(counters[STAT_PRIMITIVE_TESTS], counters[STAT_RAYS]));
+    printf("%-20s %f\n", "hits_per_ray", Ratio(counters[STAT_HIT_LIST_LENGTH], counters[STAT_RAYS]));
+}
+
+static void WriteStatsObject(FILE *fp, RenderStats *stats)
+{
+    for (int i = 0; i < STAT_COUNT; i++)
+    {
+        fprintf(fp, "%s\"%s\": %lu", i == 0 ? "" : ", ", stat_names[i], stats->counters[i]);
+    }
+}
+
+void WriteFrameStatsToJSON(FrameStats *f, const char *filename)
+{
+    FILE *fp = fopen(filename, "w");
+    if (fp == NULL)
+    {
+        printf("Could not open '%s'\n", filename);
+        return;
+    }
+
+    fprintf(fp, "{\n  \"frame\": {");
+    WriteStatsObject(fp, &f->frame);
+    fprintf(fp, "},\n  \"tiles\": [\n");
+
+    for (unsigned i = 0; i < f->tile_count; i++)
+    {
+        Tile t = CanvasTile(f->canvas, i);
+        fprintf(fp, "    {\"x\": %u, \"y\": %u, \"width\": %u, \"height\": %u, ", t.x, t.y, t.width, t.height);
+        WriteStatsObject(fp, &f->tiles[i]);
+        fprintf(fp, i + 1 == f->tile_count ? "}\n" : "},\n");
+    }
+
+    fprintf(fp, "  ]\n}\n");
+    fclose(fp);
+
+    printf("Render stats written to '%s'\n", filename);
+}
+
+void WriteFrameStatsHeatmap(FrameStats *f, RENDER_STAT stat, const char *filename)
+{
+    unsigned long lowest = (unsigned long)-1;
+    unsigned long highest = 0;
+    for (unsigned i = 0; i < f->tile_count; i++)
+    {
+        unsigned long value = f->tiles[i].counters[stat];
+        lowest = value < lowest ? value : lowest;
+        highest = value > highest ? value : highest;
+    }
+
+    double range = highest > lowest ? (double)(highest - lowest) : 1.0;
+
+    Canvas picture;
+    ConstructCanvas(&picture, f->canvas->canvas_width, f->canvas->canvas_height);
+
+    for (unsigned i = 0; i < f->tile_count; i++)
+    {
+        Tile t = CanvasTile(f->canvas, i);
+        Tuple3 color = HeatmapColor((double)(f->tiles[i].counters[stat] - lowest) / range);
+
+        for (unsigned y = t.y; y < t.y + t.height; y++)
+        {
+            for (unsigned x = t.x; x < t.x + t.width; x++)
+            {
+                WritePixel(&picture, color, x, y);
+            }
+        }
+    }
+
+    WriteToPPM(&picture, filename);
+    DeconstructCanvas(&picture);
+}
@@ -0,0 +1,90 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "table.h"
+
+#define TABLE_DEFAULT_BUCKETS 16
+
+/* FNV-1a */
+static unsigned long HashBytes(void *value, unsigned length)
+{
+    unsigned char *bytes = value;
+    unsigned long hash = 14695981039346656037ul;
+    for (unsigned i = 0; i < length; i++)
+    {
+        hash = (hash ^ bytes[i]) * 1099511628211ul;
+    }
+
+    return hash;
+}
+
+static unsigned *FindBucket(Table *t, void *value, unsigned long hash)
+{
+    unsigned mask = t->bucket_count - 1;
+    for (unsigned b = (unsigned)hash & mask;; b = (b + 1) & mask)
+    {
+        unsigned *bucket = &t->buckets[b];
+        if (*bucket == 0 || memcmp(Index(&t->values, *bucket - 1), value, t->values.data_width) == 0)
+        {
+            return bucket;
+        }
+    }
+}
+
+static void GrowBuckets(Table *t)
+{
+    free(t->buckets);
+    t->bucket_count *= 2;
+    t->buckets = calloc(t->bucket_count, sizeof(unsigned));
+
+    for (unsigned long i = 0; i < t->values.length; i++)
+    {
+        void *value = Index(&t->values, i);
+        *FindBucket(t, value, HashBytes(value, t->values.data_width)) = (unsigned)i + 1;
+    }
+}
+
+void ConstructTable(Table *t, unsigned data_width)
+{
+    ConstructSet(&t->values, data_width);
+    t->bucket_count = TABLE_DEFAULT_BUCKETS;
+    t->buckets = calloc(t->bucket_count, sizeof(unsigned));
+}
+
+void DeconstructTable(Table *t)
+{
+    DeconstructSet(&t->values);
+    free(t->buckets);
+    t->buckets = NULL;
+    t->bucket_count = 0;
+}
+
+unsigned TableInsert(Table *t, void *value)
+{
+    unsigned *bucket = FindBucket(t, value, HashBytes(value, t->values.data_width));
+    if (*bucket != 0)
+    {
+        return *bucket - 1;
+    }
+
+    unsigned index = (unsigned)AppendValue(&t->values, value);
+    *bucket = index + 1;
+
+    // Keep at most half the buckets full, so probe sequences stay short
+    if (t->values.length * 2 > t->bucket_count)
+    {
+        GrowBuckets(t);
+    }
+
+    return index;
+}
+
+void *TableIndex(Table *t, unsigned index)
+{
+    return Index(&t->values, index);
+}
+
+unsigned TableLength(Table *t)
+{
+    return (unsigned)t->values.length;
+}
@@ -1,5 +1,11 @@
 #include <stdio.h>
 #include <math.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
 
 #include "tuple.h"
 #include "tree.h"
@@ -13,6 +19,18 @@
 #include "intersection.h"
 #include "set.h"
 #include "bounds.h"
+#include "accumulator.h"
+#include "path_tracer.h"
+#include "denoise.h"
+#include "trace.h"
+#include "profile.h"
+#include "read_file.h"
+#include "server.h"
+#include "net.h"
+#include "distributed.h"
+#include "render_job.h"
+
+#include <cjson/cJSON.h>
 
 static int num_failed;
 static int num_passed;
@@ -243,6 +261,34 @@ void TestMatrixVectorMultiply()
     }
 }
 
+void TestAffine()
+{
+    Matrix4x4 m1 = MatrixMultiply(TranslationMatrix(1, -2, 3), MatrixMultiply(RotationMatrix(0.3, -1.1, 2.0), ScalingMatrix(2, 0.5, 3)));
+    Matrix4x4 m2 = MatrixMultiply(ShearingMatrix(1, 0, 0.5, 0, 0, 2), TranslationMatrix(-4, 0, 1));
+    Affine a1 = AffineFromMatrix(m1);
+    Affine a2 = AffineFromMatrix(m2);
+
+    TEST(MatrixIsAffine(m1) && !MatrixIsAffine(ZeroMatrix()), "Affine, recognized");
+    TEST(MatrixEqual(AffineToMatrix(a1), m1), "Affine, round trip");
+    TEST(MatrixFuzzyEqual(AffineToMatrix(AffineInvert(a1)), MatrixInvert(m1)), "Affine, inversion");
+    TEST(MatrixFuzzyEqual(AffineToMatrix(AffineInvert(a2)), MatrixInvert(m2)), "Affine, inversion with shearing");
+    TEST(MatrixFuzzyEqual(AffineToMatrix(AffineMultiply(a1, a2)), MatrixMultiply(m1, m2)), "Affine, multiplication");
+
+    Tuple3 p = NewPnt3(19, 28, -37);
+    Tuple3 v = NewVec3(-1, 0.5, 4);
+    TEST(TupleFuzzyEqual(AffineTupleMultiply(a1, p), MatrixTupleMultiply(m1, p)), "Affine, point multiplication");
+    TEST(TupleFuzzyEqual(AffineTupleMultiply(a1, v), MatrixTupleMultiply(m1, v)), "Affine, vector multiplication");
+
+    Tuple3 transposed = MatrixTupleMultiply(MatrixTranspose(m1), v);
+    transposed[3] = 0;
+    TEST(TupleFuzzyEqual(AffineTransposeMultiply(a1, v), transposed), "Affine, transpose multiplication");
+
+    Tuple3 corner = NewPnt3(-INFINITY, 1, 2);
+    Tuple3 moved = MatrixTupleMultiplyPerserveInf(m2, corner);
+    moved[3] = 1; // The full matrix also spreads the infinity into 'w'
+    TEST(TupleEqual(AffineTupleMultiplyPreserveInf(a2, corner), moved), "Affine, preserves infinities");
+}
+
 void TestTupleEqual()
 {
     if (!TupleEqual(NewVec3(1, 2, 3), NewVec3(1, 2, 3)) || TupleEqual(NewVec3(1, 2, 3), NewVec3(3, 2, 1)))
@@ -530,7 +576,7 @@ void TestRayTransform()
     };
 
     Matrix4x4 scaling = ScalingMatrix(2, 3, 4);
-    Ray r2 = RayTransform(r, scaling);
+    Ray r2 = RayTransform(r, AffineFromMatrix(scaling));
 
     if (!TupleFuzzyEqual(r2.direction, NewVec3(0, 3, 0)) || !TupleFuzzyEqual(r2.origin, NewPnt3(2, 6, 12)))
     {
@@ -556,8 +602,8 @@ void SphereNormal()
         Pass("Sphere Normal");
     }
 
-    s.transformation = TranslationMatrix(0, 1, 0);
-    s.inverse_transform = MatrixInvert(s.transformation);
+    s.transformation = AffineFromMatrix(TranslationMatrix(0, 1, 0));
+    s.inverse_transform = AffineInvert(s.transformation);
 
     Tuple3 n = NormalAt(&s, NewPnt3(0, 1.70711, -0.70711));
     Tuple3 expected_out = NewVec3(0, 0.70711, -0.70711);
@@ -573,8 +619,8 @@ void SphereNormal()
         Pass("Sphere Normal, Translation");
     }
 
-    s.transformation = MatrixMultiply(ScalingMatrix(1, 0.5, 1), RotationZMatrix((double)M_PI / 5.0));
-    s.inverse_transform = MatrixInvert(s.transformation);
+    s.transformation = AffineFromMatrix(MatrixMultiply(ScalingMatrix(1, 0.5, 1), RotationZMatrix((double)M_PI / 5.0)));
+    s.inverse_transform = AffineInvert(s.transformation);
 
     n = NormalAt(&s, NewPnt3(0, sqrt(2) / 2, -sqrt(2) / 2));
     expected_out = TupleNormalize(NewVec3(0.0, 0.97014, -0.24254));
@@ -633,7 +679,7 @@ void TestSphereGeometry()
 
 void AssignDefaultTestMaterial(Material *m)
 {
-    m->pattern = NewSolidPattern(NewColor(255, 255, 255, 255));
+    m->pattern = AddPattern(NewSolidPattern(NewColor(255, 255, 255, 255)));
     m->ambient_reflection = 0.1;
     m->diffuse_reflection = 0.9;
     m->specular_reflection = 0.9;
@@ -668,8 +714,10 @@ void ConstructDefaultScene(Scene *s)
     ConstructScene(s, c, l);
 
     Shape s1 = NewSphere(NewPnt3(0, 0, 0), 1.0);
-    s1.material.diffuse_reflection = 0.7;
-    s1.material.specular_reflection = 0.2;
+    Material m = *ShapeMaterial(&s1);
+    m.diffuse_reflection = 0.7;
+    m.specular_reflection = 0.2;
+    SetShapeMaterial(&s1, m);
 
     Shape s2 = NewSphere(NewPnt3(0, 0, 0), 0.5);
 
@@ -686,8 +734,9 @@ void TestReflection()
     ConstructDefaultScene(&reflective_scene);
 
     Shape new_plane = NewPlane(NewPnt3(0, -1, 0), NewVec3(0, 1, 0));
-    new_plane.material = NewMaterial(NewColor(255, 255, 255, 255));
-    new_plane.material.general_reflection = 0.5;
+    Material m = NewMaterial(NewColor(255, 255, 255, 255));
+    m.general_reflection = 0.5;
+    SetShapeMaterial(&new_plane, m);
     ApplyTransformation(&new_plane, TranslationMatrix(0, -1, 0));
     AddShape(&reflective_scene, new_plane);
 
@@ -871,6 +920,52 @@ void TestCamera()
     }
 }
 
+void TestRayPackets()
+{
+    Camera c = NewCamera(201, 101, (double)M_PI_2);
+    CameraApplyTransformation(&c, MatrixMultiply(RotationYMatrix((double)M_PI_4), TranslationMatrix(0, -2, 5)));
+
+    // Not a whole number of vectors, with a different location in each pixel
+    enum { COUNT = 37 };
+    double sample_x[COUNT], sample_y[COUNT];
+    for (unsigned i = 0; i < COUNT; i++)
+    {
+        sample_x[i] = (i % 5) * 0.2;
+        sample_y[i] = 0.95 - (i % 7) * 0.15;
+    }
+
+    RayPacket centers, jittered;
+    CameraRayPacket(&c, 150, 20, COUNT, NULL, NULL, &centers);
+    CameraRayPacket(&c, 150, 20, COUNT, sample_x, sample_y, &jittered);
+
+    // Each ray, found the long way: through a point on the canvas, carried to world space
+    bool centers_match = centers.length == COUNT, jittered_match = jittered.length == COUNT;
+    for (unsigned i = 0; i < COUNT; i++)
+    {
+        Tuple3 origin = AffineTupleMultiply(c.inverse_view_transformation, NewPnt3(0, 0, 0));
+        double center_x = c.half_width - (150 + i + 0.5) * c.pixel_size;
+        double center_y = c.half_height - (20 + 0.5) * c.pixel_size;
+        double sample_world_x = c.half_width - (150 + i + sample_x[i]) * c.pixel_size;
+        double sample_world_y = c.half_height - (20 + sample_y[i]) * c.pixel_size;
+
+        Tuple3 center = AffineTupleMultiply(c.inverse_view_transformation, NewPnt3(center_x, center_y, -1));
+        Tuple3 sample = AffineTupleMultiply(c.inverse_view_transformation, NewPnt3(sample_world_x, sample_world_y, -1));
+
+        Ray r = PacketRay(&centers, i);
+        centers_match = centers_match && TupleFuzzyEqual(r.origin, origin) && TupleFuzzyEqual(r.direction, TupleNormalize(TupleSubtract(center, origin)));
+
+        r = PacketRay(&jittered, i);
+        jittered_match = jittered_match && TupleFuzzyEqual(r.origin, origin) && TupleFuzzyEqual(r.direction, TupleNormalize(TupleSubtract(sample, origin)));
+    }
+
+    TEST(centers_match, "Ray packet, rays through pixel centers");
+    TEST(jittered_match, "Ray packet, rays through sample locations");
+
+    Ray r = RayForPixelSample(&c, 160, 20, sample_x[10], sample_y[10]);
+    Ray packet_ray = PacketRay(&jittered, 10);
+    TEST(TupleEqual(r.origin, packet_ray.origin) && TupleEqual(r.direction, packet_ray.direction), "Ray packet, matches a single ray");
+}
+
 void TestShadow()
 {
 
@@ -916,6 +1011,75 @@ void TestShadow()
     DeconstructScene(&sc);
 }
 
+void TestAreaLight()
+{
+    Light rect = NewRectangleLight(NewPnt3(0, 10, 0), NewVec3(2, 0, 0), NewVec3(0, 0, 2), 16);
+
+    bool inside = true;
+    for (unsigned i = 0; i < rect.samples; i++)
+    {
+        double u, v;
+        LightSampleCoordinates(&rect, i, 7, &u, &v);
+        Tuple3 p = LightSamplePoint(&rect, NewPnt3(0, 0, 0), u, v);
+        inside = inside && u >= 0 && u < 1 && v >= 0 && v < 1;
+        inside = inside && fabs(p[0]) <= 1 && fabs(p[2]) <= 1 && FloatEquality(p[1], 10);
+    }
+    TEST(inside, "Area light, rectangle samples lie on the light");
+
+    // The samples taken before LightVisibility() can stop early see every quadrant of the light
+    bool quadrants = true;
+    for (unsigned seed = 0; seed < 64; seed++)
+    {
+        bool seen[4] = {false};
+        for (unsigned i = 0; i < ADAPTIVE_SHADOW_SAMPLES; i++)
+        {
+            double u, v;
+            LightSampleCoordinates(&rect, i, seed, &u, &v);
+            seen[(v >= 0.5) * 2 + (u >= 0.5)] = true;
+        }
+        quadrants = quadrants && seen[0] && seen[1] && seen[2] && seen[3];
+    }
+    TEST(quadrants, "Area light, early samples cover every quadrant");
+
+    Light disk = NewDiskLight(NewPnt3(0, 10, 0), NewVec3(0, -1, 0), 1.5, 16);
+    disk.sampling = STRATIFIED_SAMPLER;
+
+    inside = true;
+    for (unsigned i = 0; i < disk.samples; i++)
+    {
+        double u, v;
+        LightSampleCoordinates(&disk, i, 3, &u, &v);
+        Tuple3 offset = TupleSubtract(LightSamplePoint(&disk, NewPnt3(0, 0, 0), u, v), disk.origin);
+        inside = inside && TupleMagnitude(offset) <= 1.5 + EQUALITY_EPSILON && FloatEquality(offset[1], 0);
+    }
+    TEST(inside, "Area light, disk samples lie on the light");
+
+    Light sphere = NewSphereLight(NewPnt3(0, 10, 0), 2, 4);
+    Tuple3 facing = LightSamplePoint(&sphere, NewPnt3(0, 0, 0), 0.1, 0.3);
+    TEST(FloatEquality(TupleMagnitude(TupleSubtract(facing, sphere.origin)), 2) && facing[1] <= 10,
+         "Area light, sphere samples face the location");
+
+    Scene sc;
+    Camera c;
+    ConstructScene(&sc, c, rect);
+    AddShape(&sc, NewSphere(NewPnt3(0, 5, 0), 0.25));
+    CalculateBounds(&sc.shapes);
+
+    TEST(LightVisibility(&sc, NewPnt3(20, 0, 0)) == 1.0, "Area light, fully lit");
+
+    sc.light = NewRectangleLight(NewPnt3(0, 10, 0), NewVec3(0.1, 0, 0), NewVec3(0, 0, 0.1), 16);
+    TEST(LightVisibility(&sc, NewPnt3(0, 0, 0)) == 0.0, "Area light, fully occluded");
+
+    sc.light = rect;
+    double penumbra = LightVisibility(&sc, NewPnt3(0.5, 0, 0));
+    TEST(penumbra > 0.0 && penumbra < 1.0, "Area light, penumbra is partially lit");
+
+    sc.light = NewLight(NewPnt3(0, 10, 0));
+    TEST(LightVisibility(&sc, NewPnt3(0, 0, 0)) == 0.0, "Area light, point light visibility");
+
+    DeconstructScene(&sc);
+}
+
 void TestPlane()
 {
 
@@ -965,6 +1129,9 @@ void TestPlane()
     TEST(FloatEquality(1.0, result.ray_times[0]), "Plane Intersection, Intersecting from above");
 }
 
+/* From read_scene.c */
+void GetLight(Light *l, cJSON *json);
+
 void TestSceneReading()
 {
     Scene s;
@@ -974,7 +1141,7 @@ void TestSceneReading()
     TEST(s.camera.height == 2160, "Reading json, camera height");
     TEST(s.camera.fov == 1.047, "Reading json, camera fov");
     Matrix4x4 expected_camera_transform = ViewMatrix(NewPnt3(0, 1.5, -5), NewPnt3(0, 1, 0), NewVec3(0, 1, 0));
-    TEST(MatrixFuzzyEqual(expected_camera_transform, s.camera.view_transformation), "Reading json, camera transform");
+    TEST(MatrixFuzzyEqual(expected_camera_transform, AffineToMatrix(s.camera.view_transformation)), "Reading json, camera transform");
 
     TEST(TupleEqual(s.light.origin, NewPnt3(-10, 10, -10)), "Reading json, light origin");
     TEST(TupleEqual(s.light.color, NewColor(255, 255, 255, 255)), "Reading json, light color");
@@ -988,21 +1155,28 @@ void TestSceneReading()
             {0, 0.33, 0, 0.33f},
             {0, 0, 0.33, -0.75f},
             {0, 0, 0, 1.0f}}};
-    TEST(MatrixFuzzyEqual(s1_expected, s1->transformation), "Reading json, shape transformation");
-    TEST(MatrixFuzzyEqual(MatrixInvert(s1_expected), s1->inverse_transform), "Reading json, inverse transformation");
+    TEST(MatrixFuzzyEqual(s1_expected, AffineToMatrix(s1->transformation)), "Reading json, shape transformation");
+    TEST(MatrixFuzzyEqual(MatrixInvert(s1_expected), AffineToMatrix(s1->inverse_transform)), "Reading json, inverse transformation");
     TEST(s.shapes.start.shapes.length == 4, "Reading json, shape list length");
 
-    TEST(FloatEquality(s1->material.ambient_reflection, 0.1), "Reading json, ambient reflection");
-    TEST(FloatEquality(s1->material.diffuse_reflection, 0.9), "Reading json, diffuse reflection");
-    TEST(FloatEquality(s1->material.specular_reflection, 0.9), "Reading json, specular reflection");
-    TEST(FloatEquality(s1->material.refractive_index, 1.0), "Reading json, refractive index");
-    TEST(FloatEquality(s1->material.transparency, 0.0), "Reading json, transparency");
-    TEST(s1->material.general_reflection == 0.0, "Reading json, general reflection");
-    TEST(s1->material.shininess == 200, "Reading json, material shininess");
+    TEST(FloatEquality(ShapeMaterial(s1)->ambient_reflection, 0.1), "Reading json, ambient reflection");
+    TEST(FloatEquality(ShapeMaterial(s1)->diffuse_reflection, 0.9), "Reading json, diffuse reflection");
+    TEST(FloatEquality(ShapeMaterial(s1)->specular_reflection, 0.9), "Reading json, specular reflection");
+    TEST(FloatEquality(ShapeMaterial(s1)->refractive_index, 1.0), "Reading json, refractive index");
+    TEST(FloatEquality(ShapeMaterial(s1)->transparency, 0.0), "Reading json, transparency");
+    TEST(ShapeMaterial(s1)->general_reflection == 0.0, "Reading json, general reflection");
+    TEST(ShapeMaterial(s1)->shininess == 200, "Reading json, material shininess");
 
-    TEST(PhongShader == s1->material.shader, "Reading json, shader function");
+    TEST(PhongShader == ShapeMaterial(s1)->shader, "Reading json, shader function");
 
     DeconstructScene(&s);
+
+    cJSON *light_json = cJSON_Parse("{\"light\": {\"type\": \"sphere\", \"origin\": [0, 5, 0], \"radius\": 1, "
+                                    "\"samples\": -4, \"color\": [255, 255, 255]}}");
+    Light l;
+    GetLight(&l, light_json);
+    TEST(l.samples == 1, "Reading json, light samples below 1 are clamped");
+    cJSON_Delete(light_json);
 }
 
 void TestStripePattern()
@@ -1012,7 +1186,9 @@ void TestStripePattern()
 
     Pattern p1 = NewPattern(white, black, STRIPED);
     Shape s1 = NewSphere(NewPnt3(0, 0, 0), 1.0);
-    s1.material.pattern = p1;
+    Material m = *ShapeMaterial(&s1);
+    m.pattern = AddPattern(p1);
+    SetShapeMaterial(&s1, m);
 
     Tuple3 r1 = PatternColorAt(&s1, NewPnt3(0, 0, 0));
     TEST(TupleFuzzyEqual(white, r1), "Stripe pattern, white stripe")
@@ -1027,6 +1203,26 @@ void TestStripePattern()
     TEST(TupleFuzzyEqual(black, r4), "Stripe pattern, alters in x axis");
 }
 
+void TestMaterialTable()
+{
+    Material m1 = NewMaterial(NewColor(12, 34, 56, 255));
+    Material m2 = NewMaterial(NewColor(12, 34, 56, 255));
+    TEST(m1.pattern == m2.pattern, "Material table, identical patterns shared");
+    TEST(AddMaterial(m1) == AddMaterial(m2), "Material table, identical materials shared");
+
+    m2.shininess = 10;
+    TEST(AddMaterial(m1) != AddMaterial(m2), "Material table, different materials kept apart");
+    TEST(MaterialAt(AddMaterial(m2))->shininess == 10, "Material table, lookup by index");
+
+    Shape s1 = NewSphere(NewPnt3(0, 0, 0), 1.0);
+    Shape s2 = NewSphere(NewPnt3(1, 2, 3), 2.0);
+    TEST(s1.material == s2.material, "Material table, default material shared");
+
+    SetShapeMaterial(&s2, m2);
+    TEST(s1.material != s2.material && ShapeMaterial(&s2)->shininess == 10, "Material table, shape material set");
+    TEST(sizeof(s1.material) == sizeof(unsigned), "Material table, material not embedded in shape");
+}
+
 void TestScalarSubtract()
 {
     Tuple3 t1 = NewTuple3(2, 3, 4, 5);
@@ -1083,14 +1279,20 @@ void TestRefraction()
 
     Shape floor = NewPlane(NewPnt3(0, 0, 0), NewVec3(0, 1, 0));
     ApplyTransformation(&floor, TranslationMatrix(0, -1, 0));
-    floor.material.transparency = 0.5;
-    floor.material.refractive_index = 1.5;
+    Material m = *ShapeMaterial(&floor);
+    m.transparency = 0.5;
+    m.refractive_index = 1.5;
+    SetShapeMaterial(&floor, m);
     AddShape(&s, floor);
 
     Shape ball = NewSphere(NewPnt3(0, 0, 0), 1.0);
     ApplyTransformation(&ball, TranslationMatrix(0, -3.5, -0.5));
-    ball.material.pattern.color_a = NewTuple3(1, 0, 0, 1);
-    ball.material.ambient_reflection = 0.5;
+    m = *ShapeMaterial(&ball);
+    Pattern red = *MaterialPattern(&m);
+    red.color_a = NewTuple3(1, 0, 0, 1);
+    m.pattern = AddPattern(red);
+    m.ambient_reflection = 0.5;
+    SetShapeMaterial(&ball, m);
     AddShape(&s, ball);
 
     CalculateBounds(&s.shapes);
@@ -1107,8 +1309,10 @@ void TestRefraction()
     Scene s2;
     ConstructDefaultScene(&s2);
     Shape *shape_1 = Index(&s2.shapes.start.shapes, 0);
-    shape_1->material.transparency = 1.0;
-    shape_1->material.refractive_index = 1.5;
+    m = *ShapeMaterial(shape_1);
+    m.transparency = 1.0;
+    m.refractive_index = 1.5;
+    SetShapeMaterial(shape_1, m);
 
     CalculateBounds(&s2.shapes);
 
@@ -1120,8 +1324,10 @@ void TestRefraction()
 Shape NewGlassSphere()
 {
     Shape sphere = NewSphere(NewPnt3(0, 0, 0), 1.0);
-    sphere.material.transparency = 1.0;
-    sphere.material.refractive_index = 1.5;
+    Material m = *ShapeMaterial(&sphere);
+    m.transparency = 1.0;
+    m.refractive_index = 1.5;
+    SetShapeMaterial(&sphere, m);
 
     return sphere;
 }
@@ -1137,17 +1343,23 @@ void TestCalculateRefraction()
 
     Shape sphere_a = NewGlassSphere();
     ApplyTransformation(&sphere_a, ScalingMatrix(2, 2, 2));
-    sphere_a.material.refractive_index = 1.5;
+    Material material_a = *ShapeMaterial(&sphere_a);
+    material_a.refractive_index = 1.5;
+    SetShapeMaterial(&sphere_a, material_a);
     AddShape(&s, sphere_a);
 
     Shape sphere_b = NewGlassSphere();
     ApplyTransformation(&sphere_b, TranslationMatrix(0, 0, -0.25));
-    sphere_b.material.refractive_index = 2.0;
+    Material material_b = *ShapeMaterial(&sphere_b);
+    material_b.refractive_index = 2.0;
+    SetShapeMaterial(&sphere_b, material_b);
     AddShape(&s, sphere_b);
 
     Shape sphere_c = NewGlassSphere();
     ApplyTransformation(&sphere_c, TranslationMatrix(0, 0, 0.25));
-    sphere_c.material.refractive_index = 2.5;
+    Material material_c = *ShapeMaterial(&sphere_c);
+    material_c.refractive_index = 2.5;
+    SetShapeMaterial(&sphere_c, material_c);
     AddShape(&s, sphere_c);
 
     GenerateSceneBVH(&s);
@@ -1271,26 +1483,27 @@ void TestTree()
 
     Shape *res_plane = Index(child_shapes, 0);
     TEST(res_plane->type == plane.type, "Tree test, shape 1 type");
-    TEST(MatrixEqual(res_plane->transformation, plane.transformation), "Tree test, shape 1 transform");
+    TEST(MatrixEqual(AffineToMatrix(res_plane->transformation), AffineToMatrix(plane.transformation)), "Tree test, shape 1 transform");
 
     Shape *res_cube = Index(child_shapes, 1);
     TEST(res_cube->type == cube.type, "Tree test, shape 2 type");
-    TEST(MatrixEqual(res_cube->transformation, cube.transformation), "Tree test, shape 2 transform");
+    TEST(MatrixEqual(AffineToMatrix(res_cube->transformation), AffineToMatrix(cube.transformation)), "Tree test, shape 2 transform");
 
     Shape *res_sphere = Index(&parent.start.shapes, 0);
     TEST(res_sphere->type == sphere.type, "Tree test, shape 3 type");
-    TEST(MatrixEqual(res_sphere->transformation, sphere.transformation), "Tree test, shape 3 transform");
+    TEST(MatrixEqual(AffineToMatrix(res_sphere->transformation), AffineToMatrix(sphere.transformation)), "Tree test, shape 3 transform");
 
     Matrix4x4 test_transform = TranslationMatrix(1, 2, 3);
     PropagateTransform(&parent, test_transform);
 
-    TEST(MatrixFuzzyEqual(res_plane->transformation, test_transform), "Tree test, transformation propagation");
+    TEST(MatrixFuzzyEqual(AffineToMatrix(res_plane->transformation), test_transform), "Tree test, transformation propagation");
 
     Material new_material = NewMaterial(NewColor(255, 123, 221, 255));
     PropagateMaterial(&parent, new_material);
 
-    TEST(TupleEqual(new_material.pattern.color_a, res_cube->material.pattern.color_a), "Tree test, material propagation");
-    TEST(TupleEqual(new_material.pattern.color_b, res_cube->material.pattern.color_b), "Tree test, material propagation");
+    TEST(TupleEqual(MaterialPattern(&new_material)->color_a, MaterialPattern(ShapeMaterial(res_cube))->color_a), "Tree test, material propagation");
+    TEST(TupleEqual(MaterialPattern(&new_material)->color_b, MaterialPattern(ShapeMaterial(res_cube))->color_b), "Tree test, material propagation");
+    TEST(res_cube->material == res_plane->material && res_plane->material == res_sphere->material, "Tree test, propagated material shared");
 
     DeconstructTree(&parent);
 }
@@ -1336,7 +1549,7 @@ void TestBounds()
         .maximum_bound = NewPnt3(1, 1, 1)};
 
     Matrix4x4 bt = MatrixMultiply(RotationXMatrix(M_PI / 4.0), RotationYMatrix(M_PI / 4.0));
-    Bounds result = TransformBounds(b2, bt);
+    Bounds result = TransformBounds(b2, AffineFromMatrix(bt));
 
     Tuple3 exp_min = NewPnt3(-1.414214, -1.707107, -1.707107);
     Tuple3 exp_max = NewPnt3(1.414214, 1.707107, 1.707107);
@@ -1344,6 +1557,318 @@ void TestBounds()
     TEST(TupleFuzzyEqual(exp_min, result.minimum_bound) &&
              TupleFuzzyEqual(exp_max, result.maximum_bound),
          "formation");
+
+    ApplyTransformation(&cube, TranslationMatrix(1, 1, 1));
+    Bounds moved = ShapeBounds(&cube);
+    TEST(TupleFuzzyEqual(cube.bounds.minimum_bound, moved.minimum_bound) &&
+             TupleFuzzyEqual(cube.bounds.maximum_bound, moved.maximum_bound) &&
+             TupleFuzzyEqual(cube.centroid, Centroid(moved)),
+         "Cached bounds, updated by transformation");
+
+    // Single precision boxes must hit at least everything the double precision ones do
+    Sampler sampler = NewSampler(INDEPENDENT_SAMPLER, 1, 7);
+    FloatBounds float_bounds;
+    ConstructFloatBounds(&float_bounds, 20);
+
+    Bounds boxes[20];
+    for (unsigned i = 0; i < 20; i++)
+    {
+        Tuple3 corner = NewPnt3(SampleNext1D(&sampler) * 20 - 10, SampleNext1D(&sampler) * 20 - 10, SampleNext1D(&sampler) * 20 - 10);
+        boxes[i].minimum_bound = corner;
+        boxes[i].maximum_bound = TupleAdd(corner, NewVec3(SampleNext1D(&sampler) / 3, SampleNext1D(&sampler) / 3, 1e-7));
+        SetFloatBounds(&float_bounds, i, boxes[i]);
+    }
+
+    bool conservative = true;
+    unsigned double_hits = 0;
+    for (int i = 0; i < 2000; i++)
+    {
+        Tuple3 origin = NewPnt3(SampleNext1D(&sampler) * 40 - 20, SampleNext1D(&sampler) * 40 - 20, SampleNext1D(&sampler) * 40 - 20);
+        Tuple3 target = Centroid(boxes[i % 20]);
+        target = TupleAdd(target, NewVec3(SampleNext1D(&sampler) * 0.3 - 0.15, SampleNext1D(&sampler) * 0.3 - 0.15, 0));
+
+        Ray r = NewRay(origin, TupleNormalize(TupleSubtract(target, origin)));
+        FloatRay float_ray = NewFloatRay(r);
+        unsigned hits = (unsigned)IntersectFloatBounds(&float_bounds, 0, &float_ray) |
+                        ((unsigned)IntersectFloatBounds(&float_bounds, FLOAT_BOUNDS_WIDTH, &float_ray) << FLOAT_BOUNDS_WIDTH);
+
+        for (unsigned j = 0; j < 20; j++)
+        {
+            bool hit = IsInBounds(boxes[j], r);
+            double_hits += hit;
+            conservative = conservative && (!hit || (hits & (1u << j)));
+        }
+    }
+    TEST(conservative && double_hits > 500, "Single precision bounds, conservative");
+
+    Ray axis_ray = NewRay(NewPnt3(0, 0, 0), NewVec3(0, 0, 1));
+    FloatRay float_axis_ray = NewFloatRay(axis_ray);
+    Bounds ahead = {.minimum_bound = NewPnt3(-1, -1, 5), .maximum_bound = NewPnt3(1, 1, 6)};
+    Bounds aside = {.minimum_bound = NewPnt3(2, 2, 5), .maximum_bound = NewPnt3(3, 3, 6)};
+    SetFloatBounds(&float_bounds, 0, ahead);
+    SetFloatBounds(&float_bounds, 1, aside);
+    __mmask16 axis_hits = IntersectFloatBounds(&float_bounds, 0, &float_axis_ray);
+    TEST((axis_hits & 1) && !(axis_hits & 2), "Single precision bounds, ray along an axis");
+
+    DeconstructFloatBounds(&float_bounds);
+}
+
+void TestSinglePrecisionTraversal()
+{
+    Tree shapes;
+    ConstructTree(&shapes);
+
+    for (int i = 0; i < 300; i++)
+    {
+        double x = (i % 10) - 5;
+        double y = ((i / 10) % 10) - 5;
+        double z = (i / 100) * 3;
+
+        Shape s = i % 2 == 0 ? NewSphere(NewPnt3(x, y, z), 0.4) : NewTriangle(NewPnt3(x, y, z), NewPnt3(x + 0.8, y, z), NewPnt3(x, y + 0.8, z + 0.5));
+        AddShapeToTree(&shapes, &s);
+    }
+    Shape floor = NewPlane(NewPnt3(0, -6, 0), NewVec3(0, 1, 0));
+    AddShapeToTree(&shapes, &floor);
+
+    Tree bvh;
+    ConstructTree(&bvh);
+    GenerateBVH(&bvh, &shapes);
+    CalculateBounds(&bvh);
+
+    TEST(bvh.start.child_bounds.length == bvh.start.children.length && bvh.start.children.length > FLOAT_BOUNDS_WIDTH / 2,
+         "Single precision traversal, child bounds built");
+
+    bool same = true;
+    unsigned long total_hits = 0;
+    for (int i = 0; i < 400; i++)
+    {
+        Ray r = NewRay(NewPnt3(0.05 * (i % 20) - 0.5, 0.05 * (i / 20) - 0.5, -10),
+                       TupleNormalize(NewVec3(0.03 * (i % 20) - 0.3, 0.03 * (i / 20) - 0.4, 1)));
+
+        Set single, reference;
+        ConstructSet(&single, sizeof(Intersection));
+        ConstructSet(&reference, sizeof(Intersection));
+
+        bvh.precision = DOUBLE_PRECISION_TRAVERSAL;
+        IntersectTree(&bvh, r, &reference);
+        bvh.precision = SINGLE_PRECISION_TRAVERSAL;
+        IntersectTree(&bvh, r, &single);
+
+        same = same && single.length == reference.length;
+        for (unsigned long j = 0; same && j < single.length; j++)
+        {
+            Intersection *a = Index(&single, j);
+            Intersection *b = Index(&reference, j);
+            same = a->shape_ptr == b->shape_ptr && a->ray_times[0] == b->ray_times[0];
+        }
+        total_hits += reference.length;
+
+        DeconstructSet(&single);
+        DeconstructSet(&reference);
+    }
+    TEST(same && total_hits > 400, "Single precision traversal, same hits as double precision");
+
+    DeconstructTree(&bvh);
+    DeconstructTree(&shapes);
+}
+
+void TestCpuDispatch()
+{
+    CPU_TARGET best = DetectCpuTarget();
+    TEST(CpuTarget() == best && best >= CPU_AVX2, "CPU dispatch, widest target selected at startup");
+    TEST(!SetCpuTarget(CPU_TARGET_COUNT) && CpuTarget() == best, "CPU dispatch, unsupported target refused");
+
+    SphereBlock spheres;
+    TriangleBlock triangles;
+    memset(&spheres, 0, sizeof(SphereBlock));
+    memset(&triangles, 0, sizeof(TriangleBlock));
+
+    for (unsigned lane = 0; lane < SHAPE_BLOCK_WIDTH; lane++)
+    {
+        Shape sphere = NewSphere(NewPnt3(lane * 0.3 - 1, (lane % 3) * 0.4 - 0.4, lane * 0.5), 0.2 + lane * 0.05);
+        Shape triangle = NewTriangle(NewPnt3(lane * 0.3 - 1, -0.5, lane), NewPnt3(lane * 0.3, -0.5, lane), NewPnt3(lane * 0.3 - 1, 0.7, lane + 0.4));
+        PackSphere(&spheres, lane, &sphere.transformation);
+        PackTriangle(&triangles, lane, &triangle.transformation);
+    }
+
+    FloatBounds boxes;
+    ConstructFloatBounds(&boxes, FLOAT_BOUNDS_WIDTH + 5);
+    for (unsigned i = 0; i < boxes.length; i++)
+    {
+        Bounds b = {
+            .minimum_bound = NewPnt3(i * 0.2 - 2, (i % 4) * 0.3 - 0.6, i * 0.25),
+            .maximum_bound = NewPnt3(i * 0.2 - 1.7, (i % 4) * 0.3 - 0.2, i * 0.25 + 0.5),
+        };
+        SetFloatBounds(&boxes, i, b);
+    }
+
+    // Every variant must agree with the scalar one, lane for lane and bit for bit
+    bool same[CPU_TARGET_COUNT] = {true, true, true};
+    unsigned long hits[3] = {0};
+
+    for (int i = 0; i < 500; i++)
+    {
+        Ray r = NewRay(NewPnt3(0.01 * (i % 25) - 0.1, 0.01 * (i / 25) - 0.1, -5),
+                       TupleNormalize(NewVec3(0.02 * (i % 25) - 0.25, 0.02 * (i / 25) - 0.2, 1)));
+        FloatRay fr = NewFloatRay(r);
+        __mmask8 lanes = i % 2 == 0 ? 0xFF : 0x3F;
+
+        double near[SHAPE_BLOCK_WIDTH], far[SHAPE_BLOCK_WIDTH], times[SHAPE_BLOCK_WIDTH];
+        __mmask8 sphere_hits = IntersectSphereBlockScalar(&spheres, lanes, r, near, far);
+        __mmask8 triangle_hits = IntersectTriangleBlockScalar(&triangles, lanes, r, times);
+        __mmask16 box_hits[2] = {IntersectFloatBoundsScalar(&boxes, 0, &fr), IntersectFloatBoundsScalar(&boxes, FLOAT_BOUNDS_WIDTH, &fr)};
+        hits[0] += (unsigned long)__builtin_popcount(sphere_hits);
+        hits[1] += (unsigned long)__builtin_popcount(triangle_hits);
+        hits[2] += (unsigned long)(__builtin_popcount(box_hits[0]) + __builtin_popcount(box_hits[1]));
+
+        for (CPU_TARGET target = CPU_AVX2; target <= best; target++)
+        {
+            SetCpuTarget(target);
+
+            double variant_near[SHAPE_BLOCK_WIDTH], variant_far[SHAPE_BLOCK_WIDTH], variant_times[SHAPE_BLOCK_WIDTH];
+            same[target] = same[target] && IntersectSphereBlock(&spheres, lanes, r, variant_near, variant_far) == sphere_hits;
+            same[target] = same[target] && IntersectTriangleBlock(&triangles, lanes, r, variant_times) == triangle_hits;
+            same[target] = same[target] && IntersectFloatBounds(&boxes, 0, &fr) == box_hits[0];
+            same[target] = same[target] && IntersectFloatBounds(&boxes, FLOAT_BOUNDS_WIDTH, &fr) == box_hits[1];
+
+            for (unsigned lane = 0; lane < SHAPE_BLOCK_WIDTH; lane++)
+            {
+                if ((sphere_hits >> lane) & 1)
+                {
+                    same[target] = same[target] && variant_near[lane] == near[lane] && variant_far[lane] == far[lane];
+                }
+                if ((triangle_hits >> lane) & 1)
+                {
+                    same[target] = same[target] && variant_times[lane] == times[lane];
+                }
+            }
+        }
+    }
+
+    SetCpuTarget(best);
+
+    TEST(hits[0] > 50 && hits[1] > 50 && hits[2] > 50, "CPU dispatch, rays hit the blocks");
+    TEST(same[CPU_AVX2], "CPU dispatch, AVX2 kernels match scalar kernels");
+    TEST(best < CPU_AVX512 || same[CPU_AVX512], "CPU dispatch, AVX-512 kernels match scalar kernels");
+
+    DeconstructFloatBounds(&boxes);
+}
+
+void TestBatchTransforms()
+{
+    Affine m = AffineFromMatrix(MatrixMultiply(TranslationMatrix(1, -2, 3), MatrixMultiply(RotationYMatrix(0.7), ScalingMatrix(2, 0.5, 3))));
+
+    // Not a whole number of vectors, so the masked tails are used
+    enum { COUNT = 13 };
+    double x[COUNT], y[COUNT], z[COUNT];
+    TupleBatch points = {.components = {x, y, z}, .length = COUNT};
+
+    bool points_match = true;
+    Tuple3 results[CPU_TARGET_COUNT][COUNT];
+
+    CPU_TARGET best = DetectCpuTarget();
+    for (CPU_TARGET target = CPU_SCALAR; target <= best; target++)
+    {
+        SetCpuTarget(target);
+
+        for (unsigned i = 0; i < COUNT; i++)
+        {
+            x[i] = i * 0.5 - 3;
+            y[i] = (i % 4) * 1.5;
+            z[i] = 7 - i * 0.25;
+        }
+
+        AffineTransformPoints(m, &points, &points);
+
+        for (unsigned i = 0; i < COUNT; i++)
+        {
+            results[target][i] = NewVec3(x[i], y[i], z[i]);
+        }
+    }
+
+    SetCpuTarget(best);
+
+    for (unsigned i = 0; i < COUNT; i++)
+    {
+        Tuple3 point = AffineTupleMultiply(m, NewPnt3(i * 0.5 - 3, (i % 4) * 1.5, 7 - i * 0.25));
+        point[3] = 0;
+        points_match = points_match && TupleFuzzyEqual(results[CPU_SCALAR][i], point);
+    }
+
+    TEST(points_match, "Batch transform, points are translated");
+    TEST(memcmp(results[CPU_SCALAR], results[CPU_AVX2], sizeof(results[CPU_SCALAR])) == 0, "Batch transform, AVX2 kernel matches scalar kernel");
+    TEST(best < CPU_AVX512 || memcmp(results[CPU_SCALAR], results[CPU_AVX512], sizeof(results[CPU_SCALAR])) == 0, "Batch transform, AVX-512 kernel matches scalar kernel");
+}
+
+void TestPackedShapes()
+{
+    Tree t;
+    ConstructTree(&t);
+
+    Shape shapes[] = {
+        NewSphere(NewPnt3(0, 0, 0), 1.0),
+        NewCube(NewPnt3(0, 0, 3), 1.0),
+        NewPlane(NewPnt3(0, -2, 0), NewVec3(0, 1, 0)),
+        NewSphere(NewPnt3(0, 0, 6), 0.5),
+        NewTriangle(NewPnt3(-1, -1, 8), NewPnt3(1, -1, 8), NewPnt3(0, 1, 8)),
+        NewSphere(NewPnt3(0.5, 0, 10), 1.0),
+    };
+
+    // Stretched into an ellipsoid, so it cannot go in a sphere block
+    ApplyTransformation(&shapes[5], ScalingMatrix(1, 0.5, 1));
+
+    for (unsigned i = 0; i < sizeof(shapes) / sizeof(Shape); i++)
+    {
+        AddShapeToTree(&t, &shapes[i]);
+    }
+
+    // Enough triangles for more than one block
+    for (int i = 0; i < 10; i++)
+    {
+        Shape triangle = NewTriangle(NewPnt3(-1 + 0.1 * i, -1, 12 + i), NewPnt3(1, -1 + 0.1 * i, 12 + i), NewPnt3(0, 1, 12.5 + i));
+        AddShapeToTree(&t, &triangle);
+    }
+
+    CalculateBounds(&t);
+    TEST(t.start.packed_length == 16 && t.start.columns[SPHERE].length == 1 && t.start.columns[CUBE].length == 1 &&
+             t.start.columns[PLANE].length == 1 && t.start.columns[TRIANGLE].length == 0,
+         "Packed shapes, split by type");
+    TEST(t.start.sphere_blocks.length == 2 && t.start.triangle_blocks.length == 11, "Packed shapes, spheres and triangles in blocks");
+
+    // The same rays through the packed columns and through the full shapes must agree
+    bool same = true;
+    for (int i = 0; i < 16; i++)
+    {
+        Ray r = NewRay(NewPnt3(0.1 * i - 0.8, 0.05 * i - 0.4, -5), NewVec3(0, -0.02 * i, 1));
+
+        Set packed, unpacked;
+        ConstructSet(&packed, sizeof(Intersection));
+        ConstructSet(&unpacked, sizeof(Intersection));
+
+        IntersectTree(&t, r, &packed);
+        t.start.packed_length = 0;
+        IntersectTree(&t, r, &unpacked);
+        t.start.packed_length = t.start.shapes.length;
+
+        same = same && packed.length == unpacked.length;
+        for (unsigned long j = 0; same && j < packed.length; j++)
+        {
+            Intersection *a = Index(&packed, j);
+            Intersection *b = Index(&unpacked, j);
+            same = a->shape_ptr == b->shape_ptr && a->count == b->count && FloatEquality(a->ray_times[0], b->ray_times[0]) &&
+                   (a->count == 1 || FloatEquality(a->ray_times[1], b->ray_times[1]));
+        }
+
+        DeconstructSet(&packed);
+        DeconstructSet(&unpacked);
+    }
+    TEST(same, "Packed shapes, same hits as unpacked shapes");
+
+    PropagateTransform(&t, TranslationMatrix(0, 1, 0));
+    TEST(t.start.packed_length == 0 && t.start.columns[SPHERE].length == 0 && t.start.triangle_blocks.length == 0,
+         "Packed shapes, dropped by transformation");
+
+    DeconstructTree(&t);
 }
 
 void DemoUnthreaded()
@@ -1467,63 +1992,1266 @@ void TestReadObj() {
     DeconstructScene(&s);
 }
 
-int DoTests()
+void TestAccumulator()
 {
-    num_failed = 0;
-    num_passed = 0;
+    Accumulator a;
+    ConstructAccumulator(&a, 2, 1);
+    TEST(AccumulatorNoise(&a) == INFINITY, "Accumulator, noise without samples");
+
+    AccumulateSample(&a, 0, NewTuple3(1.0, 0.5, 0.0, 0));
+    AccumulateSample(&a, 1, NewTuple3(0.5, 0.5, 0.5, 0));
+    a.samples++;
+    AccumulateSample(&a, 0, NewTuple3(0.0, 0.5, 1.0, 0));
+    AccumulateSample(&a, 1, NewTuple3(0.5, 0.5, 0.5, 0));
+    a.samples++;
+
+    Canvas c;
+    ConstructCanvas(&c, 2, 1);
+    ResolveAccumulator(&a, &c);
+
+    Tuple3 expected = NewTuple3(0.5, 0.5, 0.5, 0);
+    TEST(TupleFuzzyEqual(c.buffer[0], expected) && TupleFuzzyEqual(c.buffer[1], expected), "Accumulator, resolve averages samples");
+    TEST(AccumulatorNoise(&a) > 0, "Accumulator, noisy pixels");
+
+    DeconstructCanvas(&c);
+    DeconstructAccumulator(&a);
+}
 
-    TestScalarSubtract();
-    TestScalarAdd();
-    TestCrossProduct();
-    TestVectorReflect();
+void TestPathTracer()
+{
+    Camera c = NewCamera(16, 8, 1.047);
+    CameraApplyTransformation(&c, ViewMatrix(NewPnt3(0, 0, -5), NewPnt3(0, 0, 0), NewVec3(0, 1, 0)));
 
-    TestSet();
-    TestMatrixEqual();
-    TestMatrixMultiply();
-    TestMatrixTranspose();
-    TestMatrixInvert();
-    TestMatrixVectorMultiply();
-    TestTupleEqual();
-    TestScalarMultiply();
-    TestScalarDivide();
-    TestTupleNegate();
-    TestTupleMagnitude();
-    TestTupleDotProduct();
-    TestTupleNormalize();
-    TestTupleMultiply();
-    TestTupleDivide();
-    TestTupleAdd();
-    TestTupleSubtract();
+    Scene s;
+    ConstructScene(&s, c, NewLight(NewPnt3(-10, 10, -10)));
+    AddShape(&s, NewSphere(NewPnt3(0, 0, 0), 1.0));
+    GenerateSceneBVH(&s);
 
-    TestRay();
-    TestRaySphereIntersection();
-    TestRayTransform();
-    SphereNormal();
-    TestSphereGeometry();
-    TestSceneCreation();
-    TestScene();
-    TestViewMatrix();
-    TestCamera();
-    TestShadow();
-    TestPlane();
-    TestReflection();
+    Sampler sampler_a = NewSampler(SOBOL_SAMPLER, 8, 42);
+    Sampler sampler_b = NewSampler(SOBOL_SAMPLER, 8, 42);
+    Tuple3 miss = PathTrace(&s, NewRay(NewPnt3(0, 0, -5), NewVec3(0, 1, 0)), 8, &sampler_a, NULL);
+    TEST(TupleFuzzyEqual(miss, NewColor(0, 0, 0, 0)), "Path tracer, ray misses the scene");
 
-    TestSceneReading();
-    TestStripePattern();
-    TestRefraction();
-    TestCalculateRefraction();
-    TestCubeIntersection();
-    TestCubeNormal();
+    Ray r = NewRay(NewPnt3(0, 0, -5), NewVec3(0, 0, 1));
+    StartPixelSample(&sampler_a, 3, 2, 1);
+    Tuple3 hit_a = PathTrace(&s, r, 8, &sampler_a, NULL);
+    StartPixelSample(&sampler_a, 3, 2, 1);
+    hit_a = PathTrace(&s, r, 8, &sampler_a, NULL);
+    StartPixelSample(&sampler_b, 3, 2, 1);
+    Tuple3 hit_b = PathTrace(&s, r, 8, &sampler_b, NULL);
+    TEST(MaxComponent(hit_a) > 0, "Path tracer, lit surface");
+    TEST(TupleEqual(hit_a, hit_b), "Path tracer, deterministic for a given seed");
 
-    TestTree();
-    TestBounds();
-    TestPlaneScene();
+    Canvas canvas;
+    ConstructCanvas(&canvas, 16, 8);
+    Accumulator a;
+    ConstructAccumulator(&a, 16, 8);
 
-    TestTupleHasNans();
-    TestTupleHasInf();
+    ProgressiveSettings settings = DefaultProgressiveSettings();
+    settings.max_samples = 4;
+    ProgressiveReport report = RenderSceneProgressive(&s, &canvas, &a, settings);
 
-    TestTriangle();
-    TestReadObj();
+    TEST(report.samples == 4 && a.samples == 4, "Progressive render, sample count");
+    TEST(MaxComponent(canvas.buffer[8 * 4 + 8]) > 0, "Progressive render, image is resolved to the canvas");
+
+    settings.max_samples = 6;
+    report = RenderSceneProgressive(&s, &canvas, &a, settings);
+    TEST(report.samples == 6, "Progressive render, resumes from accumulated samples");
+
+    DeconstructAccumulator(&a);
+    DeconstructCanvas(&canvas);
+    DeconstructScene(&s);
+}
+
+void TestBudgetedRender()
+{
+    Camera c = NewCamera(70, 50, 1.047);
+    CameraApplyTransformation(&c, ViewMatrix(NewPnt3(0, 0, -5), NewPnt3(0, 0, 0), NewVec3(0, 1, 0)));
+
+    Scene s;
+    ConstructScene(&s, c, NewLight(NewPnt3(-10, 10, -10)));
+    AddShape(&s, NewSphere(NewPnt3(0, 0, 0), 1.0));
+
+    Canvas preview, refined, progressive;
+    ConstructCanvas(&preview, 70, 50);
+    ConstructCanvas(&refined, 70, 50);
+    ConstructCanvas(&progressive, 70, 50);
+
+    // No time past the first pass
+    BudgetSettings settings = DefaultBudgetSettings();
+    settings.budget = 0;
+    BudgetReport report = RenderSceneBudgeted(&s, &preview, settings);
+
+    TEST(report.refined_tiles == 0 && report.min_samples == 0 && !report.converged, "Budgeted render, first pass only");
+    TEST(MaxComponent(preview.buffer[25 * 70 + 35]) > 0, "Budgeted render, first pass is a complete image");
+
+    settings.budget = 60;
+    settings.max_samples = 4;
+    report = RenderSceneBudgeted(&s, &refined, settings);
+
+    TEST(report.converged && report.refined_tiles == 6 && report.min_samples == 4 && FloatEquality(report.mean_samples, 4),
+         "Budgeted render, every tile refined");
+    TEST(report.noise < INFINITY, "Budgeted render, noise estimated");
+
+    // Refined tiles take the same samples as a progressive render
+    Accumulator a;
+    ConstructAccumulator(&a, 70, 50);
+    ProgressiveSettings progressive_settings = DefaultProgressiveSettings();
+    progressive_settings.max_samples = 4;
+    RenderSceneProgressive(&s, &progressive, &a, progressive_settings);
+
+    bool matches = true;
+    for (unsigned i = 0; i < 70 * 50; i++)
+    {
+        matches = matches && TupleEqual(refined.buffer[i], progressive.buffer[i]);
+    }
+
+    TEST(matches, "Budgeted render, matches a progressive render once refined");
+
+    DeconstructAccumulator(&a);
+    DeconstructCanvas(&preview);
+    DeconstructCanvas(&refined);
+    DeconstructCanvas(&progressive);
+    DeconstructScene(&s);
+}
+
+void TestDenoise()
+{
+    Canvas c;
+    ConstructCanvas(&c, 32, 32);
+
+    // Alternating noise around 0.5 gray
+    for (unsigned i = 0; i < 32 * 32; i++)
+    {
+        double value = ((i + i / 32) % 2 == 0) ? 0.4 : 0.6;
+        DirectWritePixel(&c, NewTuple3(value, value, value, 0), i);
+    }
+
+    DenoiseCanvas(&c, DefaultDenoiseSettings());
+
+    bool smooth = true;
+    for (unsigned i = 0; i < 32 * 32; i++)
+    {
+        smooth = smooth && fabs(c.buffer[i][0] - 0.5) < 0.02;
+    }
+    TEST(smooth, "Denoise, noise is removed from a flat image");
+
+    // A black and a white wall, the denoiser should not blur them together
+    EnableCanvasPlanes(&c, CANVAS_ALBEDO | CANVAS_NORMAL | CANVAS_DEPTH);
+    for (unsigned i = 0; i < 32 * 32; i++)
+    {
+        bool left = i % 32 < 16;
+        double noise = ((i + i / 32) % 2 == 0) ? -0.05 : 0.05;
+        double value = (left ? 0.1 : 0.9) + noise;
+
+        SurfaceSample surface = {
+            .albedo = NewTuple3(1, 1, 1, 0),
+            .normal = left ? NewVec3(1, 0, 0) : NewVec3(0, 0, -1),
+            .depth = left ? 5.0 : 10.0,
+        };
+
+        DirectWritePixel(&c, NewTuple3(value, value, value, 0), i);
+        DirectWriteSurface(&c, &surface, i);
+    }
+
+    DenoiseCanvas(&c, DefaultDenoiseSettings());
+    TEST(fabs(c.buffer[16 * 32 + 15][0] - 0.1) < 0.03 && fabs(c.buffer[16 * 32 + 16][0] - 0.9) < 0.03,
+         "Denoise, edges in the auxiliary planes are kept");
+
+    DeconstructCanvas(&c);
+
+    Camera camera = NewCamera(16, 8, 1.047);
+    CameraApplyTransformation(&camera, ViewMatrix(NewPnt3(0, 0, -5), NewPnt3(0, 0, 0), NewVec3(0, 1, 0)));
+
+    Scene s;
+    ConstructScene(&s, camera, NewLight(NewPnt3(-10, 10, -10)));
+    AddShape(&s, NewSphere(NewPnt3(0, 0, 0), 1.0));
+
+    ConstructCanvas(&c, 16, 8);
+    EnableCanvasPlanes(&c, CANVAS_ALL_PLANES);
+    RenderScene(&s, &c);
+
+    unsigned center = 4 * 16 + 8;
+    TEST(fabs(c.depth[center] - 4.0) < 0.1 && isinf(c.depth[0]), "Render, depth plane");
+    TEST(c.normal[center][2] < -0.9 && TupleEqual(c.normal[0], NewVec3(0, 0, 0)), "Render, normal plane");
+    TEST(TupleFuzzyEqual(c.albedo[center], NewTuple3(0.8, 1.0, 0.6, 1.0)), "Render, albedo plane");
+    TEST(c.shape_id[center] == 1 && c.shape_id[0] == 0, "Render, shape id plane");
+    TEST(c.steps[center] > c.steps[0] && c.steps[0] > 0, "Render, traversal steps plane");
+
+    WritePlaneToPFM(&c, CANVAS_DEPTH, "./renderings/test_depth.pfm");
+    FILE *fp = fopen("./renderings/test_depth.pfm", "rb");
+    char header[16] = {0};
+    unsigned width = 0, height = 0;
+    int fields = fscanf(fp, "%2s %u %u", header, &width, &height);
+    fseek(fp, -(long)(16 * sizeof(float)), SEEK_END);
+    float bottom_row[16];
+    size_t floats_read = fread(bottom_row, sizeof(float), 16, fp);
+    fclose(fp);
+    remove("./renderings/test_depth.pfm");
+
+    // The last scanline in the file is the top row of the image
+    TEST(fields == 3 && strcmp(header, "Pf") == 0 && width == 16 && height == 8 && floats_read == 16 && isinf(bottom_row[0]),
+         "Render, depth plane written as PFM");
+
+    DeconstructCanvas(&c);
+    DeconstructScene(&s);
+}
+
+void TestRenderStats()
+{
+    Camera camera = NewCamera(40, 40, 1.047);
+    CameraApplyTransformation(&camera, ViewMatrix(NewPnt3(0, 0, -5), NewPnt3(0, 0, 0), NewVec3(0, 1, 0)));
+
+    Scene s;
+    ConstructScene(&s, camera, NewLight(NewPnt3(-10, 10, -10)));
+    AddShape(&s, NewSphere(NewPnt3(0, 0, 0), 1.0));
+
+    Canvas c;
+    ConstructCanvas(&c, 40, 40);
+    TEST(CanvasTileCount(&c) == 4 && CanvasTile(&c, 3).x == 32 && CanvasTile(&c, 3).width == 8, "Canvas, tiles");
+
+    FrameStats stats;
+    ConstructFrameStats(&stats, &c);
+    s.stats = &stats;
+    RenderScene(&s, &c);
+
+    unsigned long *frame = stats.frame.counters;
+    TEST(frame[STAT_SHADE_CALLS] == 40 * 40, "Render stats, one shading call per pixel");
+    TEST(frame[STAT_RAYS] == frame[STAT_SHADE_CALLS] + frame[STAT_SHADOW_RAYS], "Render stats, every ray is counted");
+    TEST(frame[STAT_PRIMITIVE_HITS] > 0 && frame[STAT_PRIMITIVE_HITS] <= frame[STAT_PRIMITIVE_TESTS], "Render stats, primitive tests");
+    TEST(frame[STAT_MAX_RECURSION_DEPTH] == 0 && frame[STAT_MAX_HIT_LIST_LENGTH] == 1, "Render stats, maximums");
+
+    // The BVH of a single sphere is a root and a leaf, shapes tested in the leaf are not nodes
+    TEST(frame[STAT_NODE_VISITS] > 0 && frame[STAT_NODE_VISITS] <= 2 * frame[STAT_RAYS], "Render stats, node visits only count nodes");
+
+    unsigned long tile_rays = 0;
+    for (unsigned i = 0; i < stats.tile_count; i++)
+    {
+        tile_rays += stats.tiles[i].counters[STAT_RAYS];
+    }
+    TEST(tile_rays == frame[STAT_RAYS] && stats.tiles[0].counters[STAT_RAYS] > stats.tiles[3].counters[STAT_RAYS],
+         "Render stats, per tile counters");
+
+    RenderScene(&s, &c);
+    TEST(frame[STAT_SHADE_CALLS] == 40 * 40, "Render stats, reset between frames");
+
+    DeconstructFrameStats(&stats);
+    DeconstructCanvas(&c);
+    DeconstructScene(&s);
+}
+
+void TestRenderRegion()
+{
+    Camera camera = NewCamera(70, 50, 1.047);
+    CameraApplyTransformation(&camera, ViewMatrix(NewPnt3(0, 0, -5), NewPnt3(0, 0, 0), NewVec3(0, 1, 0)));
+
+    Scene s;
+    ConstructScene(&s, camera, NewLight(NewPnt3(-10, 10, -10)));
+    AddShape(&s, NewSphere(NewPnt3(0, 0, 0), 1.0));
+
+    Canvas full, in_place, cropped, tiled;
+    ConstructCanvas(&full, 70, 50);
+    ConstructCanvas(&in_place, 70, 50);
+    ConstructCanvas(&cropped, 27, 21);
+    ConstructCanvas(&tiled, 70, 50);
+
+    // Pixels a region leaves alone keep this color
+    Tuple3 untouched = NewTuple3(-1, -1, -1, -1);
+    for (unsigned i = 0; i < 70 * 50; i++)
+    {
+        DirectWritePixel(&in_place, untouched, i);
+        DirectWritePixel(&tiled, untouched, i);
+    }
+
+    RenderScene(&s, &full);
+
+    // Crosses tile boundaries on both axes
+    RenderRegion r = {.x = 20, .y = 25, .width = 27, .height = 21, .tiles = NULL, .tile_count = 0, .output = REGION_IN_PLACE};
+    RenderSceneRegion(&s, &in_place, r);
+
+    r.output = REGION_CROPPED;
+    RenderSceneRegion(&s, &cropped, r);
+
+    unsigned tiles[] = {1, 5, 40};
+    RenderRegion tile_list = FullFrameRegion(&s.camera);
+    tile_list.tiles = tiles;
+    tile_list.tile_count = 3;
+    RenderSceneRegion(&s, &tiled, tile_list);
+
+    bool in_place_match = true, cropped_match = true, tiles_match = true;
+    for (unsigned y = 0; y < 50; y++)
+    {
+        for (unsigned x = 0; x < 70; x++)
+        {
+            Tuple3 expected = full.buffer[y * 70 + x];
+            bool inside = x >= 20 && x < 47 && y >= 25 && y < 46;
+            in_place_match = in_place_match && TupleEqual(in_place.buffer[y * 70 + x], inside ? expected : untouched);
+            if (inside)
+            {
+                cropped_match = cropped_match && TupleEqual(cropped.buffer[(y - 25) * 27 + (x - 20)], expected);
+            }
+
+            // Tiles 1 and 5 of the 3 x 2 grid, tile 40 is outside of the frame
+            bool in_tile = (x >= 32 && x < 64 && y < 32) || (x >= 64 && y >= 32);
+            tiles_match = tiles_match && TupleEqual(tiled.buffer[y * 70 + x], in_tile ? expected : untouched);
+        }
+    }
+
+    TEST(in_place_match, "Render region, in place");
+    TEST(cropped_match, "Render region, cropped");
+    TEST(tiles_match, "Render region, list of tiles");
+
+    RenderRegion clipped = ClipRegion(&s.camera, (RenderRegion){.x = 60, .y = 10, .width = 100, .height = 100});
+    TEST(clipped.x == 60 && clipped.width == 10 && clipped.y == 10 && clipped.height == 40, "Render region, clipped to the frame");
+
+    DeconstructCanvas(&full);
+    DeconstructCanvas(&in_place);
+    DeconstructCanvas(&cropped);
+    DeconstructCanvas(&tiled);
+    DeconstructScene(&s);
+}
+
+void TestCheckpoint()
+{
+    Camera camera = NewCamera(70, 50, 1.047);
+    CameraApplyTransformation(&camera, ViewMatrix(NewPnt3(0, 0, -5), NewPnt3(0, 0, 0), NewVec3(0, 1, 0)));
+
+    Scene s;
+    ConstructScene(&s, camera, NewLight(NewPnt3(-10, 10, -10)));
+    AddShape(&s, NewSphere(NewPnt3(0, 0, 0), 1.0));
+
+    Canvas rendered, resumed;
+    ConstructCanvas(&rendered, 70, 50);
+    ConstructCanvas(&resumed, 70, 50);
+
+    CheckpointSettings settings = DefaultCheckpointSettings();
+    settings.filename = "./renderings/test_checkpoint.ckpt";
+    settings.interval = 0;
+    settings.resume = false;
+
+    TileCheckpoint tc;
+    OpenTileCheckpoint(&tc, &rendered, settings);
+    s.checkpoint = &tc;
+    RenderScene(&s, &rendered);
+    TEST(FinishedTileCount(&tc) == 6, "Checkpoint, every tile rendered is recorded");
+    CloseTileCheckpoint(&tc);
+
+    settings.resume = true;
+    OpenTileCheckpoint(&tc, &resumed, settings);
+    TEST(FinishedTileCount(&tc) == 6, "Checkpoint, resume finds every tile");
+
+    bool pixels_match = true;
+    for (unsigned i = 0; i < 70 * 50; i++)
+    {
+        Tuple3 expected = rendered.buffer[i];
+        Tuple3 actual = resumed.buffer[i];
+        for (int j = 0; j < 3; j++)
+        {
+            pixels_match = pixels_match && FloatEquality(actual[j], (float)expected[j]);
+        }
+    }
+
+    TEST(pixels_match, "Checkpoint, resumed tiles keep their colors");
+    CloseTileCheckpoint(&tc);
+
+    // Cut the last record short, as if the process stopped while writing it
+    FILE *fp = fopen(settings.filename, "rb");
+    fseek(fp, 0, SEEK_END);
+    long length = ftell(fp);
+    fclose(fp);
+    TEST(truncate(settings.filename, length - 100) == 0, "Checkpoint, file truncated");
+
+    OpenTileCheckpoint(&tc, &resumed, settings);
+    TEST(FinishedTileCount(&tc) == 5, "Checkpoint, partial record is dropped");
+
+    // Only the dropped tile is rendered again
+    s.checkpoint = &tc;
+    RenderScene(&s, &resumed);
+    TEST(FinishedTileCount(&tc) == 6, "Checkpoint, missing tile is rendered");
+    CloseTileCheckpoint(&tc);
+    s.checkpoint = NULL;
+
+    // A file written for another scene file or seed is started over
+    CheckpointSettings other_scene = settings;
+    other_scene.scene_hash = HashSceneJson("{}");
+    OpenTileCheckpoint(&tc, &resumed, other_scene);
+    TEST(FinishedTileCount(&tc) == 0, "Checkpoint, another scene starts over");
+    CloseTileCheckpoint(&tc);
+
+    OpenTileCheckpoint(&tc, &resumed, settings);
+    TEST(FinishedTileCount(&tc) == 0, "Checkpoint, started over file replaces the old one");
+    CloseTileCheckpoint(&tc);
+
+    CheckpointSettings other_seed = settings;
+    other_seed.seed = 1;
+    OpenTileCheckpoint(&tc, &resumed, settings);
+    s.checkpoint = &tc;
+    RenderScene(&s, &resumed);
+    CloseTileCheckpoint(&tc);
+    s.checkpoint = NULL;
+
+    OpenTileCheckpoint(&tc, &resumed, other_seed);
+    TEST(FinishedTileCount(&tc) == 0, "Checkpoint, another seed starts over");
+    CloseTileCheckpoint(&tc);
+
+    Accumulator a, loaded;
+    ConstructAccumulator(&a, 2, 1);
+    ConstructAccumulator(&loaded, 2, 1);
+    AccumulateSample(&a, 0, NewTuple3(1.0, 0.5, 0.0, 0));
+    AccumulateSample(&a, 1, NewTuple3(0.5, 0.5, 0.5, 0));
+    a.samples++;
+
+    TEST(SaveAccumulator(&a, settings), "Checkpoint, accumulator saved");
+    TEST(LoadAccumulator(&loaded, settings) && loaded.samples == 1 &&
+             memcmp(loaded.color, a.color, 2 * 3 * sizeof(float)) == 0,
+         "Checkpoint, accumulator loaded");
+
+    Accumulator wrong_size;
+    ConstructAccumulator(&wrong_size, 3, 1);
+    TEST(!LoadAccumulator(&wrong_size, settings) && wrong_size.samples == 0, "Checkpoint, accumulator of another size");
+    TEST(!LoadAccumulator(&loaded, other_scene) && !LoadAccumulator(&loaded, other_seed), "Checkpoint, accumulator of another scene or seed");
+
+    remove(settings.filename);
+    DeconstructAccumulator(&a);
+    DeconstructAccumulator(&loaded);
+    DeconstructAccumulator(&wrong_size);
+    DeconstructCanvas(&rendered);
+    DeconstructCanvas(&resumed);
+    DeconstructScene(&s);
+}
+
+void TestRenderServer()
+{
+    const char *socket_path = "./renderings/test_server.sock";
+
+    int server = fork();
+    if (server == 0)
+    {
+        ServerSettings settings = DefaultServerSettings();
+        settings.socket_path = socket_path;
+        settings.request_timeout = 0.5;
+        RunRenderServer(settings);
+        exit(0);
+    }
+
+    const char *request = "{\"scene\": \"./scenes/three_spheres.json\", \"camera\": {\"from\": [0, 1.5, -5], "
+                          "\"to\": [0, 1, 0], \"up\": [0, 1, 0], \"width\": 70, \"height\": 50, \"fov\": 1.047}}";
+
+    // Wait for the server to start listening
+    Canvas first;
+    ServerReply first_reply;
+    bool connected = false;
+    for (int attempt = 0; attempt < 100 && !connected; attempt++)
+    {
+        usleep(20000);
+        connected = access(socket_path, F_OK) == 0 && RequestServerRender(socket_path, request, &first, &first_reply);
+    }
+
+    TEST(connected && !first_reply.cached && first_reply.tiles == 6, "Render server, first request loads the scene");
+
+    Canvas second;
+    ServerReply second_reply;
+    bool rendered = RequestServerRender(socket_path, request, &second, &second_reply);
+    TEST(rendered && second_reply.cached && second_reply.scene_hash == first_reply.scene_hash, "Render server, scene is cached");
+
+    Scene s;
+    ReadScene(&s, "./scenes/three_spheres.json");
+    s.camera = NewCamera(70, 50, 1.047);
+    CameraApplyTransformation(&s.camera, ViewMatrix(NewPnt3(0, 1.5, -5), NewPnt3(0, 1, 0), NewVec3(0, 1, 0)));
+
+    Canvas local;
+    ConstructCanvas(&local, 70, 50);
+    RenderScene(&s, &local);
+
+    // The server sends 8 bit colors
+    bool matches = connected && rendered;
+    for (unsigned i = 0; matches && i < 70 * 50; i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            double expected = (int)fmax(0, fmin(local.buffer[i][j] * 255, 255)) / 255.0;
+            matches = matches && FloatEquality(second.buffer[i][j], expected) && FloatEquality(first.buffer[i][j], expected);
+        }
+    }
+
+    TEST(matches, "Render server, camera override renders the same image");
+
+    // A client that never finishes its request is answered with an error, rather than holding up the next one
+    int stalled = ConnectTo(socket_path);
+    SendAll(stalled, "{\"scene\"", 8);
+    uint32_t type, length;
+    unsigned char *payload = ReceiveMessage(stalled, &type, &length);
+    TEST(payload != NULL && type == SERVER_ERROR, "Render server, request timeout");
+    free(payload);
+    close(stalled);
+
+    // The timeout covers the whole request, a client that keeps sending a byte at a time is still cut off
+    int dribbling = ConnectTo(socket_path);
+    fflush(stdout);
+    pid_t dribbler = fork();
+    if (dribbler == 0)
+    {
+        for (int i = 0; i < 15 && send(dribbling, " ", 1, MSG_NOSIGNAL) == 1; i++)
+        {
+            usleep(200000);
+        }
+
+        exit(0);
+    }
+
+    struct pollfd reply = {.fd = dribbling, .events = POLLIN};
+    bool answered = poll(&reply, 1, 1500) > 0;
+    payload = answered ? ReceiveMessage(dribbling, &type, &length) : NULL;
+    TEST(payload != NULL && type == SERVER_ERROR, "Render server, request timeout for a slow client");
+    free(payload);
+    waitpid(dribbler, NULL, 0);
+    close(dribbling);
+
+    Canvas bad;
+    ServerReply bad_reply;
+    TEST(!RequestServerRender(socket_path, "{\"scene\": \"./scenes/missing.json\"}", &bad, &bad_reply), "Render server, missing scene");
+    TEST(!RequestServerRender(socket_path, "{\"scene\": \"./scenes/three_spheres.json\", \"camera\": {}}", &bad, &bad_reply),
+         "Render server, malformed camera");
+
+    char hash_request[64];
+    sprintf(hash_request, "{\"scene_hash\": \"%016llx\"}", (unsigned long long)first_reply.scene_hash);
+    Canvas by_hash;
+    ServerReply hash_reply;
+    TEST(RequestServerRender(socket_path, hash_request, &by_hash, &hash_reply) && hash_reply.cached, "Render server, scene by hash");
+
+    TEST(StopRenderServer(socket_path), "Render server, stopped");
+    waitpid(server, NULL, 0);
+
+    if (connected)
+    {
+        DeconstructCanvas(&first);
+    }
+
+    if (rendered)
+    {
+        DeconstructCanvas(&second);
+        DeconstructCanvas(&by_hash);
+    }
+
+    DeconstructCanvas(&local);
+    DeconstructScene(&s);
+}
+
+void TestSceneCache()
+{
+    char *first;
+    size_t file_size;
+    READ_FILE(first, file_size, "./scenes/three_spheres.json");
+
+    // Another scene, it only differs in its size
+    char *second = malloc(file_size);
+    strcpy(second, first);
+    char *width = strstr(second, "\"width\": 3840");
+    memcpy(width, "\"width\":   70", 13);
+
+    unsigned own_next = AddMaterial(NewMaterial(NewColor(7, 8, 9, 255)));
+
+    SceneCache cache;
+    ConstructSceneCache(&cache, 1);
+
+    // Materials are only added once, so each of these is new. The next goes after the scene's own
+    bool cached;
+    CacheScene(&cache, first, &cached);
+    unsigned first_next = AddMaterial(NewMaterial(NewColor(1, 2, 3, 255)));
+
+    CacheScene(&cache, second, &cached);
+    CacheScene(&cache, first, &cached);
+    unsigned reloaded_next = AddMaterial(NewMaterial(NewColor(4, 5, 6, 255)));
+    TEST(!cached && reloaded_next == first_next, "Scene cache, evicted scene's materials are freed");
+
+    DeconstructSceneCache(&cache);
+    TEST(AddMaterial(NewMaterial(NewColor(10, 11, 12, 255))) == own_next + 1, "Scene cache, process' own materials in use afterwards");
+    free(second);
+}
+
+/* Connects as a worker, takes a tile and then fails without returning it */
+static void FailingWorker(const char *address, unsigned delay)
+{
+    usleep(delay);
+
+    int fd;
+    while ((fd = ConnectTo(address)) < 0)
+    {
+        usleep(10000);
+    }
+
+    uint32_t type, length;
+    free(ReceiveMessage(fd, &type, &length));
+    SendMessage(fd, WORK_READY, NULL, 0);
+
+    unsigned char *tile = ReceiveMessage(fd, &type, &length);
+    bool issued = tile != NULL && type == WORK_TILE;
+    free(tile);
+
+    // Long enough for the other workers to be waiting for tiles
+    usleep(1000000);
+    close(fd);
+    exit(issued ? 0 : 1);
+}
+
+void TestDistributedRender()
+{
+    const char *address = "./renderings/test_workers.sock";
+
+    char *file_contents;
+    size_t file_size;
+    READ_FILE(file_contents, file_size, "./scenes/three_spheres.json");
+
+    // The same scene at a size that renders quickly
+    char *json = malloc(file_size + 1);
+    strcpy(json, file_contents);
+    char *width = strstr(json, "\"width\": 3840");
+    char *height = strstr(json, "\"height\": 2160");
+    memcpy(width, "\"width\":   70", 13);
+    memcpy(height, "\"height\":   50", 14);
+
+    // One worker fails after two tiles, the other starts once it has
+    pid_t workers[2];
+    fflush(stdout);
+    for (int i = 0; i < 2; i++)
+    {
+        workers[i] = fork();
+        if (workers[i] == 0)
+        {
+            usleep(i == 0 ? 0 : 200000);
+
+            SceneCache cache;
+            ConstructSceneCache(&cache, 1);
+
+            WorkerSettings settings = DefaultWorkerSettings();
+            settings.address = address;
+            settings.max_tiles = i == 0 ? 2 : 0;
+            bool finished = RunRenderWorker(&cache, settings);
+
+            DeconstructSceneCache(&cache);
+            exit(finished ? 0 : 1);
+        }
+    }
+
+    Canvas distributed;
+    ConstructCanvas(&distributed, 70, 50);
+
+    CoordinatorSettings settings = DefaultCoordinatorSettings();
+    settings.address = address;
+    settings.timeout = 10;
+    DistributedReport report = RenderSceneDistributed(json, &distributed, settings);
+
+    int failed_status, finished_status;
+    waitpid(workers[0], &failed_status, 0);
+    waitpid(workers[1], &finished_status, 0);
+
+    TEST(report.complete && report.workers == 2, "Distributed render, complete");
+    TEST(report.reissued_tiles >= 1, "Distributed render, failed worker's tiles reissued");
+    TEST(WEXITSTATUS(failed_status) == 1 && WEXITSTATUS(finished_status) == 0, "Distributed render, workers finish");
+    TEST(report.compressed_bytes > 0 && report.raw_bytes == 70 * 50 * 3, "Distributed render, bytes counted");
+
+    Scene s;
+    ReadSceneJson(&s, json);
+
+    Canvas local;
+    ConstructCanvas(&local, 70, 50);
+    RenderScene(&s, &local);
+
+    // Workers send 8 bit colors
+    bool matches = true;
+    for (unsigned i = 0; i < 70 * 50; i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            double expected = (int)fmax(0, fmin(local.buffer[i][j] * 255, 255)) / 255.0;
+            matches = matches && FloatEquality(distributed.buffer[i][j], expected);
+        }
+    }
+
+    TEST(matches, "Distributed render, same image as a local render");
+
+    // A single tile, both workers given it fail while a third waits with nothing to do
+    memcpy(width, "\"width\":   20", 13);
+    memcpy(height, "\"height\":   20", 14);
+
+    pid_t failing[2], idle;
+    fflush(stdout);
+    for (int i = 0; i < 2; i++)
+    {
+        failing[i] = fork();
+        if (failing[i] == 0)
+        {
+            FailingWorker(address, i == 0 ? 0 : 50000);
+        }
+    }
+
+    idle = fork();
+    if (idle == 0)
+    {
+        usleep(250000);
+
+        SceneCache cache;
+        ConstructSceneCache(&cache, 1);
+
+        WorkerSettings settings = DefaultWorkerSettings();
+        settings.address = address;
+        bool finished = RunRenderWorker(&cache, settings);
+
+        DeconstructSceneCache(&cache);
+        exit(finished ? 0 : 1);
+    }
+
+    Canvas single_tile;
+    ConstructCanvas(&single_tile, 20, 20);
+    settings.timeout = 5;
+    DistributedReport failover = RenderSceneDistributed(json, &single_tile, settings);
+
+    int failing_status[2], idle_status;
+    waitpid(failing[0], &failing_status[0], 0);
+    waitpid(failing[1], &failing_status[1], 0);
+    waitpid(idle, &idle_status, 0);
+
+    TEST(WEXITSTATUS(failing_status[0]) == 0 && WEXITSTATUS(failing_status[1]) == 0, "Distributed render, both failing workers given the tile");
+    TEST(failover.complete && failover.workers == 3 && failover.reissued_tiles == 1 && WEXITSTATUS(idle_status) == 0,
+         "Distributed render, idle worker given a failed worker's tile");
+    DeconstructCanvas(&single_tile);
+
+    Canvas flat;
+    ConstructCanvas(&flat, 40, 40);
+    for (unsigned y = 0; y < 40; y++)
+    {
+        for (unsigned x = 0; x < 40; x++)
+        {
+            WritePixel(&flat, NewColor(255, x < 20 ? 0 : 128, 0, 0), x, y);
+        }
+    }
+
+    Tile tile = CanvasTile(&flat, 0);
+    unsigned char compressed[TILE_SIZE * TILE_SIZE * 4];
+    size_t length = CompressTile(&flat, tile, compressed);
+    TEST(length == 32 * 2 * 4, "Compress tile, runs of equal colors");
+
+    Canvas round_trip;
+    ConstructCanvas(&round_trip, 40, 40);
+    bool decompressed = DecompressTile(compressed, length, &round_trip, tile);
+
+    matches = decompressed;
+    for (unsigned y = 0; y < 32; y++)
+    {
+        for (unsigned x = 0; x < 32; x++)
+        {
+            matches = matches && TupleFuzzyEqual(round_trip.buffer[y * 40 + x], flat.buffer[y * 40 + x]);
+        }
+    }
+
+    TEST(matches, "Decompress tile, round trip");
+    TEST(!DecompressTile(compressed, length - 4, &round_trip, tile), "Decompress tile, too short");
+
+    DeconstructCanvas(&round_trip);
+    DeconstructCanvas(&flat);
+    DeconstructCanvas(&local);
+    DeconstructCanvas(&distributed);
+    DeconstructScene(&s);
+    free(json);
+}
+
+/* Counts the tiles RenderSceneStreaming() hands back, in the test's own memory */
+static void CountStreamedTile(void *context, Canvas *c, Tile t)
+{
+    unsigned *pixels = context;
+    *pixels += t.width * t.height;
+}
+
+void TestRenderJob()
+{
+    Scene s;
+    ReadScene(&s, "./scenes/three_spheres.json");
+    s.camera = NewCamera(70, 50, 1.047);
+    CameraApplyTransformation(&s.camera, ViewMatrix(NewPnt3(0, 1.5, -5), NewPnt3(0, 1, 0), NewVec3(0, 1, 0)));
+
+    Canvas expected;
+    ConstructCanvas(&expected, 70, 50);
+    RenderScene(&s, &expected);
+
+    // The caller's framebuffer, rendered to in place
+    size_t buffer_size = 70 * 50 * sizeof(Tuple3);
+    Tuple3 *framebuffer = mmap(NULL, buffer_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    Canvas c;
+    ConstructCanvasOver(&c, framebuffer, 70, 50);
+
+    RenderJob job;
+    StartRender(&job, &s, &c);
+
+    // Each tile's pixels are final as soon as it is taken
+    bool taken[6] = {false};
+    bool matches = true;
+    unsigned tiles = 0;
+    Tile t;
+    while (NextFinishedTile(&job, &t, true))
+    {
+        matches = matches && t.index < 6 && !taken[t.index];
+        taken[t.index % 6] = true;
+        tiles++;
+
+        for (unsigned y = t.y; y < t.y + t.height; y++)
+        {
+            for (unsigned x = t.x; x < t.x + t.width; x++)
+            {
+                matches = matches && TupleFuzzyEqual(framebuffer[y * 70 + x], expected.buffer[y * 70 + x]);
+            }
+        }
+    }
+
+    TEST(tiles == 6 && matches, "Render job, every tile taken once with its final pixels");
+    TEST(!NextFinishedTile(&job, &t, false), "Render job, no tiles after the last");
+
+    FinishRender(&job);
+    DeconstructCanvas(&c);
+
+    matches = true;
+    for (unsigned i = 0; i < 70 * 50; i++)
+    {
+        matches = matches && TupleFuzzyEqual(framebuffer[i], expected.buffer[i]);
+    }
+
+    TEST(matches, "Render job, framebuffer kept by the caller");
+
+    unsigned pixels = 0;
+    ConstructCanvas(&c, 70, 50);
+    RenderSceneStreaming(&s, &c, CountStreamedTile, &pixels);
+    TEST(pixels == 70 * 50, "Render streaming, callback in the caller's process");
+
+    munmap(framebuffer, buffer_size);
+    DeconstructCanvas(&c);
+    DeconstructCanvas(&expected);
+    DeconstructScene(&s);
+}
+
+void TestCancelRender()
+{
+    Scene s;
+    ReadScene(&s, "./scenes/three_spheres.json");
+    s.camera = NewCamera(640, 360, 1.047);
+    CameraApplyTransformation(&s.camera, ViewMatrix(NewPnt3(0, 1.5, -5), NewPnt3(0, 1, 0), NewVec3(0, 1, 0)));
+
+    Canvas c;
+    ConstructCanvas(&c, 640, 360);
+
+    RenderJob job;
+    StartRender(&job, &s, &c);
+
+    RenderProgress started = GetRenderProgress(&job);
+    TEST(started.tile_count == 240 && started.finished_tiles < 240, "Render progress, tile count");
+
+    Tile t;
+    bool first = NextFinishedTile(&job, &t, true);
+    RenderProgress running = GetRenderProgress(&job);
+    TEST(first && running.finished_tiles >= 1 && running.remaining_seconds > 0 && isfinite(running.remaining_seconds),
+         "Render progress, estimate once a tile is finished");
+
+    CancelRender(&job);
+
+    // Only the tiles being rendered when it was cancelled are finished afterwards
+    unsigned taken = 1;
+    while (NextFinishedTile(&job, &t, true))
+    {
+        taken++;
+    }
+
+    RenderProgress cancelled = GetRenderProgress(&job);
+    TEST(taken == cancelled.finished_tiles && taken < 240 && cancelled.remaining_seconds == 0, "Render cancelled between tiles");
+    TEST(!FinishRender(&job), "Render cancelled, job incomplete");
+
+    StartRender(&job, &s, &c);
+    while (NextFinishedTile(&job, &t, true))
+    {
+    }
+
+    RenderProgress done = GetRenderProgress(&job);
+    TEST(done.finished_tiles == 240 && done.remaining_seconds == 0, "Render progress, complete");
+    TEST(FinishRender(&job), "Render job, complete");
+
+    DeconstructCanvas(&c);
+    DeconstructScene(&s);
+}
+
+void TestRenderSceneViews()
+{
+    Scene s;
+    ReadScene(&s, "./scenes/three_spheres_turntable.json");
+    TEST(s.camera_count == 4 && s.camera.width == s.cameras[0].width, "Read scene, cameras");
+
+    // Small views of different sizes, so tiles of one view run on past the end of another
+    Tuple3 from[3] = {NewPnt3(0, 1.5, -5), NewPnt3(-5, 1.5, 0), NewPnt3(0, 1.5, 5)};
+    Camera cameras[3];
+    Canvas views[3], expected[3];
+    for (unsigned i = 0; i < 3; i++)
+    {
+        cameras[i] = NewCamera(40 + 30 * i, 50 - 10 * i, 1.047);
+        CameraApplyTransformation(&cameras[i], ViewMatrix(from[i], NewPnt3(0, 1, 0), NewVec3(0, 1, 0)));
+        ConstructCanvas(&views[i], cameras[i].width, cameras[i].height);
+        ConstructCanvas(&expected[i], cameras[i].width, cameras[i].height);
+    }
+
+    RenderSceneViews(&s, cameras, views, 3);
+
+    bool matches = true;
+    for (unsigned i = 0; i < 3; i++)
+    {
+        s.camera = cameras[i];
+        RenderScene(&s, &expected[i]);
+
+        for (unsigned j = 0; j < cameras[i].width * cameras[i].height; j++)
+        {
+            matches = matches && TupleFuzzyEqual(views[i].buffer[j], expected[i].buffer[j]);
+        }
+
+        DeconstructCanvas(&views[i]);
+        DeconstructCanvas(&expected[i]);
+    }
+
+    TEST(matches, "Render scene views, same as rendering each camera");
+    DeconstructScene(&s);
+}
+
+void TestTrace()
+{
+    TEST(!TraceEnabled(), "Trace, disabled by default");
+
+    Camera camera = NewCamera(40, 40, 1.047);
+    CameraApplyTransformation(&camera, ViewMatrix(NewPnt3(0, 0, -5), NewPnt3(0, 0, 0), NewVec3(0, 1, 0)));
+
+    Scene s;
+    ConstructScene(&s, camera, NewLight(NewPnt3(-10, 10, -10)));
+    AddShape(&s, NewSphere(NewPnt3(0, 0, 0), 1.0));
+
+    Canvas c;
+    ConstructCanvas(&c, 40, 40);
+
+    StartTrace(0);
+    TEST(TraceEnabled(), "Trace, enabled by StartTrace()");
+    RenderScene(&s, &c);
+    StopTrace("./renderings/test_trace.json");
+
+    char *file_contents;
+    unsigned long file_size;
+    READ_FILE(file_contents, file_size, "./renderings/test_trace.json");
+    remove("./renderings/test_trace.json");
+
+    cJSON *json = cJSON_Parse(file_contents);
+    cJSON *events = cJSON_GetObjectItem(json, "traceEvents");
+
+    int tiles = 0;
+    int renders = 0;
+    bool complete = true;
+    for (int i = 0; i < cJSON_GetArraySize(events); i++)
+    {
+        cJSON *event = cJSON_GetArrayItem(events, i);
+        char *name = cJSON_GetStringValue(cJSON_GetObjectItem(event, "name"));
+        char *phase = cJSON_GetStringValue(cJSON_GetObjectItem(event, "ph"));
+
+        if (strcmp(phase, "X") == 0)
+        {
+            complete = complete && cJSON_GetObjectItem(event, "ts") != NULL && cJSON_GetObjectItem(event, "dur") != NULL &&
+                       cJSON_GetObjectItem(event, "tid") != NULL;
+            tiles += strcmp(name, "tile") == 0;
+            renders += strcmp(name, "RenderScene") == 0;
+        }
+    }
+
+    TEST(json != NULL && complete, "Trace, written as Chrome trace JSON");
+    TEST(tiles == 4 && renders == 1, "Trace, events for phases and tiles");
+    TEST(!TraceEnabled(), "Trace, disabled by StopTrace()");
+
+    cJSON_Delete(json);
+    DeconstructCanvas(&c);
+    DeconstructScene(&s);
+}
+
+void TestProfile()
+{
+    TEST(!ProfileEnabled(), "Profile, disabled by default");
+
+    Camera camera = NewCamera(40, 40, 1.047);
+    CameraApplyTransformation(&camera, ViewMatrix(NewPnt3(0, 0, -5), NewPnt3(0, 0, 0), NewVec3(0, 1, 0)));
+
+    Scene s;
+    ConstructScene(&s, camera, NewLight(NewPnt3(-10, 10, -10)));
+    AddShape(&s, NewSphere(NewPnt3(0, 0, 0), 1.0));
+
+    Canvas c;
+    ConstructCanvas(&c, 40, 40);
+
+    unsigned long rays = TracedRays();
+    CounterSample start = ReadCounters();
+    RenderSceneUnthreaded(&s, &c);
+    CounterSample end = ReadCounters();
+    TEST(TracedRays() - rays >= 40 * 40 && end.rays - start.rays == TracedRays() - rays, "Profile, counter samples count rays");
+    TEST(end.nanoseconds > start.nanoseconds, "Profile, counter samples are timed");
+
+    StartProfile(0);
+    TEST(ProfileEnabled(), "Profile, enabled by StartProfile()");
+    RenderScene(&s, &c);
+    StopProfile("./renderings/test_profile.json");
+
+    char *file_contents;
+    unsigned long file_size;
+    READ_FILE(file_contents, file_size, "./renderings/test_profile.json");
+    remove("./renderings/test_profile.json");
+
+    cJSON *json = cJSON_Parse(file_contents);
+    cJSON *tiles = cJSON_GetObjectItem(json, "tiles");
+    cJSON *phases = cJSON_GetObjectItem(json, "phases");
+
+    double tile_rays = 0;
+    bool complete = true;
+    for (int i = 0; i < cJSON_GetArraySize(tiles); i++)
+    {
+        cJSON *tile = cJSON_GetArrayItem(tiles, i);
+        tile_rays += cJSON_GetNumberValue(cJSON_GetObjectItem(tile, "rays"));
+        complete = complete && cJSON_GetObjectItem(tile, "ipc") != NULL && cJSON_GetObjectItem(tile, "llc_misses_per_ray") != NULL;
+    }
+
+    bool render_phase = false;
+    for (int i = 0; i < cJSON_GetArraySize(phases); i++)
+    {
+        cJSON *phase = cJSON_GetArrayItem(phases, i);
+        render_phase = render_phase || strcmp(cJSON_GetStringValue(cJSON_GetObjectItem(phase, "name")), "RenderScene") == 0;
+    }
+
+    // Whether the hardware counters opened depends on the machine, either way the file is complete
+    TEST(json != NULL && cJSON_GetObjectItem(json, "counters") != NULL && complete, "Profile, written as JSON");
+    TEST(cJSON_GetArraySize(tiles) == 4 && render_phase, "Profile, samples for phases and tiles");
+    TEST(tile_rays == (double)(end.rays - start.rays), "Profile, tiles count the rays traced in child processes");
+    TEST(!ProfileEnabled(), "Profile, disabled by StopProfile()");
+
+    cJSON_Delete(json);
+    DeconstructCanvas(&c);
+    DeconstructScene(&s);
+}
+
+/* True if each of the 'count' points falls in a different cell of a grid with 'count' cells */
+bool OnePointPerCell(double *u, double *v, unsigned columns, unsigned rows)
+{
+    bool cells[64] = {false};
+    for (unsigned i = 0; i < columns * rows; i++)
+    {
+        unsigned cell = (unsigned)(v[i] * rows) * columns + (unsigned)(u[i] * columns);
+        if (cells[cell])
+        {
+            return false;
+        }
+
+        cells[cell] = true;
+    }
+
+    return true;
+}
+
+void TestSampler()
+{
+    SAMPLER_TYPE types[] = {INDEPENDENT_SAMPLER, STRATIFIED_SAMPLER, SOBOL_SAMPLER, BLUE_NOISE_SAMPLER};
+
+    bool in_range = true;
+    bool reproducible = true;
+    for (int t = 0; t < 4; t++)
+    {
+        Sampler s = NewSampler(types[t], 16, 5);
+        for (unsigned i = 0; i < 64; i++)
+        {
+            StartPixelSample(&s, i % 8, i / 8, i % 16);
+            for (int d = 0; d < 4; d++)
+            {
+                double u, v;
+                SampleNext2D(&s, &u, &v);
+                in_range = in_range && u >= 0 && u < 1 && v >= 0 && v < 1;
+            }
+        }
+
+        // Sampling other pixels in between must not change a pixel's samples
+        double first_u, first_v, second_u, second_v;
+        StartPixelSample(&s, 3, 4, 7);
+        SampleNext1D(&s);
+        SampleNext2D(&s, &first_u, &first_v);
+
+        StartPixelSample(&s, 6, 1, 2);
+        SampleNext2D(&s, &second_u, &second_v);
+
+        StartPixelSample(&s, 3, 4, 7);
+        SampleNext1D(&s);
+        SampleNext2D(&s, &second_u, &second_v);
+
+        reproducible = reproducible && first_u == second_u && first_v == second_v;
+    }
+    TEST(in_range, "Sampler, samples lie on [0..1)");
+    TEST(reproducible, "Sampler, samples only depend on pixel, sample index and dimension");
+
+    double u[16], v[16];
+    for (int t = 1; t < 4; t++)
+    {
+        Sampler s = NewSampler(types[t], 16, 9);
+        for (unsigned i = 0; i < 16; i++)
+        {
+            StartPixelSample(&s, 2, 7, i);
+            SampleNext2D(&s, &u[i], &v[i]);
+        }
+
+        if (types[t] == STRATIFIED_SAMPLER)
+        {
+            TEST(OnePointPerCell(u, v, 4, 4), "Sampler, stratified points cover every stratum");
+        }
+        else if (types[t] == SOBOL_SAMPLER)
+        {
+            bool net = OnePointPerCell(u, v, 4, 4) && OnePointPerCell(u, v, 16, 1) && OnePointPerCell(u, v, 1, 16);
+            TEST(net, "Sampler, Sobol points form a (0,2)-net");
+        }
+        else
+        {
+            // Every pixel shares a point set, offset by the pixel's dither
+            double other_u[16], other_v[16];
+            for (unsigned i = 0; i < 16; i++)
+            {
+                StartPixelSample(&s, 5, 1, i);
+                SampleNext2D(&s, &other_u[i], &other_v[i]);
+            }
+
+            bool shifted = true;
+            double shift_u = fmod(other_u[0] - u[0] + 1.0, 1.0);
+            for (unsigned i = 1; i < 16; i++)
+            {
+                double difference = fabs(fmod(other_u[i] - u[i] + 1.0, 1.0) - shift_u);
+                shifted = shifted && (difference < 1e-9 || difference > 1 - 1e-9);
+            }
+            TEST(shifted, "Sampler, blue noise pixels share one shifted point set");
+        }
+    }
+
+    Sampler s = NewSampler(SOBOL_SAMPLER, 16, 9);
+    double a_u, a_v, b_u, b_v;
+    StartPixelSample(&s, 0, 0, 0);
+    SampleNext2D(&s, &a_u, &a_v);
+    StartPixelSample(&s, 1, 0, 0);
+    SampleNext2D(&s, &b_u, &b_v);
+    TEST(a_u != b_u && a_v != b_v, "Sampler, pixels are scrambled differently");
+
+    Sampler reseeded = NewSampler(SOBOL_SAMPLER, 16, 10);
+    StartPixelSample(&reseeded, 0, 0, 0);
+    SampleNext2D(&reseeded, &b_u, &b_v);
+    TEST(a_u != b_u && a_v != b_v, "Sampler, seeds change the noise");
+
+    for (unsigned i = 0; i < 16; i++)
+    {
+        SampleSequence2D(SOBOL_SAMPLER, i, 16, 1234, &u[i], &v[i]);
+    }
+    TEST(OnePointPerCell(u, v, 4, 4), "Sampler, scrambled point sets keep their stratification");
+
+    // Counts that do not fill a square grid must still reach every part of the square
+    unsigned counts[] = {3, 5, 7};
+    bool covered = true;
+    for (int c = 0; c < 3; c++)
+    {
+        bool regions[8][8] = {{false}};
+        for (unsigned seed = 0; seed < 256; seed++)
+        {
+            for (unsigned i = 0; i < counts[c]; i++)
+            {
+                double su, sv;
+                SampleSequence2D(STRATIFIED_SAMPLER, i, counts[c], seed, &su, &sv);
+                regions[(int)(sv * 8)][(int)(su * 8)] = true;
+            }
+        }
+
+        for (int i = 0; i < 64; i++)
+        {
+            covered = covered && regions[i / 8][i % 8];
+        }
+    }
+    TEST(covered, "Sampler, stratified counts that are not square cover every region");
+}
+
+int DoTests()
+{
+    num_failed = 0;
+    num_passed = 0;
+
+    TestScalarSubtract();
+    TestScalarAdd();
+    TestCrossProduct();
+    TestVectorReflect();
+
+    TestSet();
+    TestMatrixEqual();
+    TestMatrixMultiply();
+    TestMatrixTranspose();
+    TestMatrixInvert();
+    TestMatrixVectorMultiply();
+    TestAffine();
+    TestTupleEqual();
+    TestScalarMultiply();
+    TestScalarDivide();
+    TestTupleNegate();
+    TestTupleMagnitude();
+    TestTupleDotProduct();
+    TestTupleNormalize();
+    TestTupleMultiply();
+    TestTupleDivide();
+    TestTupleAdd();
+    TestTupleSubtract();
+
+    TestRay();
+    TestRaySphereIntersection();
+    TestRayTransform();
+    SphereNormal();
+    TestSphereGeometry();
+    TestSceneCreation();
+    TestScene();
+    TestViewMatrix();
+    TestCamera();
+    TestRayPackets();
+    TestShadow();
+    TestAreaLight();
+    TestPlane();
+    TestReflection();
+
+    TestSceneReading();
+    TestStripePattern();
+    TestMaterialTable();
+    TestRefraction();
+    TestCalculateRefraction();
+    TestCubeIntersection();
+    TestCubeNormal();
+
+    TestTree();
+    TestBounds();
+    TestPackedShapes();
+    TestSinglePrecisionTraversal();
+    TestCpuDispatch();
+    TestBatchTransforms();
+    TestPlaneScene();
+
+    TestTupleHasNans();
+    TestTupleHasInf();
+
+    TestTriangle();
+    TestReadObj();
+
+    TestSampler();
+    TestAccumulator();
+    TestPathTracer();
+    TestBudgetedRender();
+    TestDenoise();
+    TestRenderStats();
+    TestRenderRegion();
+    TestCheckpoint();
+    TestRenderServer();
+    TestSceneCache();
+    TestDistributedRender();
+    TestRenderJob();
+    TestCancelRender();
+    TestRenderSceneViews();
+    TestTrace();
+    TestProfile();
 
     printf("Test(s) Passed: %d\nTests(s) Failed: %d\n", num_passed, num_failed);
 
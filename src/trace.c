@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "shmem.h"
+#include "set.h"
+
+/* Names are copied into the event, so events can be written after the process that recorded them exits */
+#define TRACE_NAME_LENGTH 32
+
+typedef struct
+{
+    char name[TRACE_NAME_LENGTH];
+    char category[TRACE_NAME_LENGTH];
+    long argument;
+    double start;
+    double duration;
+    int tid;
+} TraceEvent;
+
+/* Shared memory, so events recorded by child processes reach the parent */
+static TraceEvent *trace_events = NULL;
+static unsigned *trace_event_count = NULL;
+static unsigned trace_capacity = 0;
+static double trace_epoch = 0;
+static int trace_pid = 0;
+
+static double Microseconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec * 1e-3;
+}
+
+void StartTrace(unsigned capacity)
+{
+    if (trace_events != NULL)
+    {
+        return;
+    }
+
+    trace_capacity = capacity == 0 ? TRACE_DEFAULT_CAPACITY : capacity;
+    trace_events = (TraceEvent *)shmalloc(trace_capacity * sizeof(TraceEvent));
+    trace_event_count = (unsigned *)shmalloc(sizeof(unsigned));
+    *trace_event_count = 0;
+
+    trace_epoch = Microseconds();
+    trace_pid = getpid();
+}
+
+bool TraceEnabled()
+{
+    return trace_events != NULL;
+}
+
+TraceScope BeginTraceScope(const char *name, const char *category, long argument)
+{
+    TraceScope scope = {
+        .name = name,
+        .category = category,
+        .argument = argument,
+        .start = trace_events == NULL ? -1.0 : Microseconds(),
+        .profiled = ProfileEnabled(),
+    };
+
+    if (scope.profiled)
+    {
+        scope.counters = ReadCounters();
+    }
+
+    return scope;
+}
+
+void EndTraceScope(TraceScope *scope)
+{
+    if (scope->profiled)
+    {
+        RecordProfileSample(scope->name, scope->category, scope->argument, &scope->counters);
+    }
+
+    if (trace_events == NULL || scope->start < 0)
+    {
+        return;
+    }
+
+    unsigned index = __atomic_fetch_add(trace_event_count, 1, __ATOMIC_RELAXED);
+    if (index >= trace_capacity)
+    {
+        return;
+    }
+
+    TraceEvent *event = &trace_events[index];
+    strncpy(event->name, scope->name, TRACE_NAME_LENGTH - 1);
+    event->name[TRACE_NAME_LENGTH - 1] = '\0';
+    strncpy(event->category, scope->category, TRACE_NAME_LENGTH - 1);
+    event->category[TRACE_NAME_LENGTH - 1] = '\0';
+
+    event->argument = scope->argument;
+    event->start = scope->start - trace_epoch;
+    event->duration = Microseconds() - scope->start;
+    event->tid = getpid();
+}
+
+void StopTrace(const char *filename)
+{
+    if (trace_events == NULL)
+    {
+        return;
+    }
+
+    unsigned recorded = *trace_event_count;
+    unsigned count = recorded > trace_capacity ? trace_capacity : recorded;
+
+    FILE *fp = fopen(filename, "w");
+    if (fp == NULL)
+    {
+        printf("Could not open '%s'\n", filename);
+    }
+    else
+    {
+        fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+
+        // Every process is shown as a thread of the process that started the trace
+        fprintf(fp, "  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, \"args\": {\"name\": \"main\"}}", trace_pid, trace_pid);
+
+        Set workers;
+        ConstructSet(&workers, sizeof(int));
+        for (unsigned i = 0; i < count; i++)
+        {
+            int tid = trace_events[i].tid;
+
+            bool seen = tid == trace_pid;
+            for (unsigned long j = 0; j < workers.length && !seen; j++)
+            {
+                seen = *(int *)Index(&workers, j) == tid;
+            }
+
+            if (!seen)
+            {
+                AppendValue(&workers, &tid);
+                fprintf(fp, ",\n  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, \"args\": {\"name\": \"worker %d\"}}", trace_pid, tid, tid);
+            }
+        }
+        DeconstructSet(&workers);
+
+        for (unsigned i = 0; i < count; i++)
+        {
+            TraceEvent *event = &trace_events[i];
+            fprintf(fp, ",\n  {\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": %d, \"tid\": %d",
+                    event->name, event->category, event->start, event->duration, trace_pid, event->tid);
+
+            if (event->argument >= 0)
+            {
+                fprintf(fp, ", \"args\": {\"index\": %ld}", event->argument);
+            }
+
+            fputc('}', fp);
+        }
+
+        fprintf(fp, "\n]}\n");
+        fclose(fp);
+
+        printf("Trace with %u event(s) written to '%s'\n", count, filename);
+        if (recorded > count)
+        {
+            printf("%u trace event(s) did not fit and were dropped\n", recorded - count);
+        }
+    }
+
+    shfree(trace_events, trace_capacity * sizeof(TraceEvent));
+    shfree(trace_event_count, sizeof(unsigned));
+    trace_events = NULL;
+    trace_event_count = NULL;
+}
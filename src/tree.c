@@ -2,14 +2,113 @@
 #include "intersection.h"
 #include "shape.h"
 #include "bounds.h"
+#include "stats.h"
+#include "trace.h"
+#include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <float.h>
+
+/* Free a node's packed columns, it falls back to scanning 'shapes' until they are rebuilt */
+static void UnpackNodeShapes(Node *n)
+{
+    for (int type = 0; type < SHAPE_TYPE_COUNT; type++)
+    {
+        free(n->columns[type].inverse_transforms);
+        free(n->columns[type].indices);
+    }
+
+    free(n->sphere_blocks.blocks);
+    free(n->sphere_blocks.indices);
+    free(n->triangle_blocks.blocks);
+    free(n->triangle_blocks.indices);
+
+    DeconstructFloatBounds(&n->child_bounds);
+
+    memset(n->columns, 0, sizeof(n->columns));
+    memset(&n->sphere_blocks, 0, sizeof(BlockColumn));
+    memset(&n->triangle_blocks, 0, sizeof(BlockColumn));
+    n->packed_length = 0;
+}
+
+static void AllocateBlocks(BlockColumn *column, unsigned count, size_t block_size)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    size_t size = ((count + SHAPE_BLOCK_WIDTH - 1) / SHAPE_BLOCK_WIDTH) * block_size;
+    column->blocks = aligned_alloc(__BIGGEST_ALIGNMENT__, size);
+    memset(column->blocks, 0, size);
+    column->indices = malloc(count * sizeof(unsigned));
+}
+
+static void PackNodeShapes(Node *n)
+{
+    UnpackNodeShapes(n);
+
+    unsigned counts[SHAPE_TYPE_COUNT] = {0};
+    for (unsigned long i = 0; i < n->shapes.length; i++)
+    {
+        counts[((Shape *)Index(&n->shapes, i))->type]++;
+    }
+
+    // Triangles always go in blocks. Spheres do unless they have been stretched, so both places are made room for
+    for (int type = 0; type < SHAPE_TYPE_COUNT; type++)
+    {
+        if (counts[type] != 0 && type != TRIANGLE)
+        {
+            n->columns[type].inverse_transforms = aligned_alloc(__BIGGEST_ALIGNMENT__, counts[type] * sizeof(Affine));
+            n->columns[type].indices = malloc(counts[type] * sizeof(unsigned));
+        }
+    }
+
+    AllocateBlocks(&n->sphere_blocks, counts[SPHERE], sizeof(SphereBlock));
+    AllocateBlocks(&n->triangle_blocks, counts[TRIANGLE], sizeof(TriangleBlock));
+
+    for (unsigned long i = 0; i < n->shapes.length; i++)
+    {
+        Shape *shape = Index(&n->shapes, i);
+        BlockColumn *blocks = shape->type == TRIANGLE ? &n->triangle_blocks : &n->sphere_blocks;
+        unsigned lane = blocks->length % SHAPE_BLOCK_WIDTH;
+        unsigned block = blocks->length / SHAPE_BLOCK_WIDTH;
+
+        bool blocked = false;
+        if (shape->type == TRIANGLE)
+        {
+            PackTriangle((TriangleBlock *)blocks->blocks + block, lane, &shape->transformation);
+            blocked = true;
+        }
+        else if (shape->type == SPHERE)
+        {
+            blocked = PackSphere((SphereBlock *)blocks->blocks + block, lane, &shape->transformation);
+        }
+
+        if (blocked)
+        {
+            blocks->indices[blocks->length] = (unsigned)i;
+            blocks->length++;
+            continue;
+        }
+
+        ShapeColumn *column = &n->columns[shape->type];
+
+        column->inverse_transforms[column->length] = shape->inverse_transform;
+        column->indices[column->length] = (unsigned)i;
+        column->length++;
+    }
+
+    n->packed_length = n->shapes.length;
+}
 
 void ConstructTree(Tree *tree)
 {
+    memset(&tree->start, 0, sizeof(Node));
     tree->start.parent = NULL;
     ConstructSet(&tree->start.shapes, sizeof(Shape));
     ConstructSet(&tree->start.children, sizeof(Node));
+    tree->precision = DOUBLE_PRECISION_TRAVERSAL;
 }
 
 void ReconstructTree(Tree *tree)
@@ -30,6 +129,7 @@ void DeconstructNode(Node *n)
 
     DeconstructSet(&n->children);
     DeconstructSet(&n->shapes);
+    UnpackNodeShapes(n);
 }
 
 void DeconstructTree(Tree *tree)
@@ -89,7 +189,9 @@ void CloneNode(Node *destination, Node *source)
 
 void CloneTree(Tree *destination, Tree *source)
 {
+    TRACE_SCOPE("CloneTree", "phase");
     CloneNode(&destination->start, &source->start);
+    destination->precision = source->precision;
 }
 
 void CopyInChild(Tree *parent, Tree *child)
@@ -113,6 +215,7 @@ void PropagateTransformOnNode(Node *node, Matrix4x4 transform)
         Shape *shape_ptr = Index(&node->shapes, i);
         ApplyTransformation(shape_ptr, transform);
     }
+    UnpackNodeShapes(node);
 
     for (unsigned long i = 0; i < node->children.length; i++)
     {
@@ -126,36 +229,145 @@ void PropagateTransform(Tree *tree, Matrix4x4 transform)
     PropagateTransformOnNode(&tree->start, transform);
 }
 
-void PropagateMaterialOnNode(Node *node, Material mat)
+void PropagateMaterialOnNode(Node *node, unsigned material)
 {
     for (unsigned long i = 0; i < node->shapes.length; i++)
     {
         Shape *shape_ptr = Index(&node->shapes, i);
-        shape_ptr->material = mat;
+        shape_ptr->material = material;
     }
 
     for (unsigned long i = 0; i < node->children.length; i++)
     {
         Node *child = Index(&node->children, i);
-        PropagateMaterialOnNode(child, mat);
+        PropagateMaterialOnNode(child, material);
+    }
+}
+
+static unsigned NumberShapesOnNode(Node *node, unsigned next_id)
+{
+    for (unsigned long i = 0; i < node->shapes.length; i++)
+    {
+        Shape *shape_ptr = Index(&node->shapes, i);
+        shape_ptr->id = next_id++;
+    }
+
+    for (unsigned long i = 0; i < node->children.length; i++)
+    {
+        next_id = NumberShapesOnNode(Index(&node->children, i), next_id);
     }
+
+    return next_id;
+}
+
+void NumberShapes(Tree *tree)
+{
+    NumberShapesOnNode(&tree->start, 1);
 }
 
 void PropagateMaterial(Tree *tree, Material material)
 {
-    PropagateMaterialOnNode(&tree->start, material);
+    // Added to the table once, every shape then shares the same entry. Each shape still
+    // holds the index itself, the BVH does not keep the nodes the shapes were grouped under
+    PropagateMaterialOnNode(&tree->start, AddMaterial(material));
 }
 
-void IntersectNode(Node *n, Ray r, Set *intersections)
+/* Per-process count of nodes visited and shapes tested, see TraversalSteps() */
+static unsigned long traversal_steps = 0;
+
+unsigned long TraversalSteps()
 {
-    for (unsigned i = 0; i < n->children.length; i++)
+    return traversal_steps;
+}
+
+/* Per-process count of rays traced, see TracedRays() */
+static unsigned long traced_rays = 0;
+
+unsigned long TracedRays()
+{
+    return traced_rays;
+}
+
+/* Tests a node's shapes one type at a time, reading only the packed columns
+ * until a shape is hit
+ */
+static void IntersectPackedShapes(Node *n, Ray r, Set *intersections)
+{
+    for (int type = 0; type < SHAPE_TYPE_COUNT; type++)
     {
-        Node *child = Index(&n->children, i);
-        IntersectNode(child, r, intersections);
+        ShapeColumn *column = &n->columns[type];
+        for (unsigned i = 0; i < column->length; i++)
+        {
+            Intersection intersection = IntersectTransformed((SHAPE_TYPE)type, &column->inverse_transforms[i], r);
+            traversal_steps++;
+
+            if (intersection.count != 0)
+            {
+                intersection.shape_ptr = Index(&n->shapes, column->indices[i]);
+                AppendValue(intersections, &intersection);
+            }
+        }
     }
+}
 
-    if (!IsInBounds(n->bounds, r))
+/* @returns The lanes in use in the given block of a column of 'length' shapes */
+static __mmask8 BlockLanes(unsigned block, unsigned length)
+{
+    unsigned remaining = length - block * SHAPE_BLOCK_WIDTH;
+    return remaining >= SHAPE_BLOCK_WIDTH ? 0xFF : (__mmask8)((1u << remaining) - 1);
+}
+
+/* Tests a node's sphere and triangle blocks, a block per call to the intersection kernels */
+static void IntersectShapeBlocks(Node *n, Ray r, Set *intersections)
+{
+    BlockColumn *spheres = &n->sphere_blocks;
+    for (unsigned block = 0; block * SHAPE_BLOCK_WIDTH < spheres->length; block++)
+    {
+        double near[SHAPE_BLOCK_WIDTH];
+        double far[SHAPE_BLOCK_WIDTH];
+
+        __mmask8 lanes = BlockLanes(block, spheres->length);
+        unsigned hits = IntersectSphereBlock((SphereBlock *)spheres->blocks + block, lanes, r, near, far);
+        traversal_steps += (unsigned long)__builtin_popcount(lanes);
+
+        for (; hits != 0; hits &= hits - 1)
+        {
+            unsigned lane = (unsigned)__builtin_ctz(hits);
+            Intersection intersection = NewIntersection(Index(&n->shapes, spheres->indices[block * SHAPE_BLOCK_WIDTH + lane]), r);
+            intersection.count = far[lane] == DBL_MAX ? 1 : 2;
+            intersection.ray_times[0] = near[lane];
+            intersection.ray_times[1] = far[lane];
+            AppendValue(intersections, &intersection);
+        }
+    }
+
+    BlockColumn *triangles = &n->triangle_blocks;
+    for (unsigned block = 0; block * SHAPE_BLOCK_WIDTH < triangles->length; block++)
     {
+        double times[SHAPE_BLOCK_WIDTH];
+
+        __mmask8 lanes = BlockLanes(block, triangles->length);
+        unsigned hits = IntersectTriangleBlock((TriangleBlock *)triangles->blocks + block, lanes, r, times);
+        traversal_steps += (unsigned long)__builtin_popcount(lanes);
+
+        for (; hits != 0; hits &= hits - 1)
+        {
+            unsigned lane = (unsigned)__builtin_ctz(hits);
+            Intersection intersection = NewIntersection(Index(&n->shapes, triangles->indices[block * SHAPE_BLOCK_WIDTH + lane]), r);
+            intersection.count = 1;
+            intersection.ray_times[0] = times[lane];
+            AppendValue(intersections, &intersection);
+        }
+    }
+}
+
+/* Tests the shapes belonging directly to a node, not its children's */
+static void IntersectNodeShapes(Node *n, Ray r, Set *intersections)
+{
+    if (n->packed_length == n->shapes.length)
+    {
+        IntersectShapeBlocks(n, r, intersections);
+        IntersectPackedShapes(n, r, intersections);
         return;
     }
 
@@ -163,6 +375,7 @@ void IntersectNode(Node *n, Ray r, Set *intersections)
     {
         Shape *this_shape = Index(&n->shapes, i);
         Intersection intersection = Intersect(this_shape, r);
+        traversal_steps++;
 
         if (intersection.count != 0)
         {
@@ -171,10 +384,87 @@ void IntersectNode(Node *n, Ray r, Set *intersections)
     }
 }
 
+void IntersectNode(Node *n, Ray r, Set *intersections)
+{
+    traversal_steps++;
+    STAT_ADD(STAT_NODE_VISITS, 1);
+
+    for (unsigned i = 0; i < n->children.length; i++)
+    {
+        Node *child = Index(&n->children, i);
+        IntersectNode(child, r, intersections);
+    }
+
+    STAT_ADD(STAT_BOX_TESTS, 1);
+    if (!IsInBounds(n->bounds, r))
+    {
+        return;
+    }
+
+    IntersectNodeShapes(n, r, intersections);
+}
+
+/* @returns true if the node's shapes are packed and its children's single precision boxes are up to date */
+static bool NodeIsPacked(Node *n)
+{
+    return n->packed_length == n->shapes.length && n->child_bounds.length == n->children.length;
+}
+
+/* Visits a node whose box has already been hit, testing its children's boxes a block at a
+ * time and only descending into the children that are hit
+ */
+static void IntersectNodeSingle(Node *n, Ray r, FloatRay *float_ray, Set *intersections)
+{
+    traversal_steps++;
+    STAT_ADD(STAT_NODE_VISITS, 1);
+
+    for (unsigned first = 0; first < n->children.length; first += FLOAT_BOUNDS_WIDTH)
+    {
+        unsigned hits = IntersectFloatBounds(&n->child_bounds, first, float_ray);
+        STAT_ADD(STAT_BOX_TESTS, n->children.length - first < FLOAT_BOUNDS_WIDTH ? n->children.length - first : FLOAT_BOUNDS_WIDTH);
+
+        for (; hits != 0; hits &= hits - 1)
+        {
+            Node *child = Index(&n->children, first + (unsigned)__builtin_ctz(hits));
+
+            if (NodeIsPacked(child))
+            {
+                IntersectNodeSingle(child, r, float_ray, intersections);
+            }
+            else
+            {
+                IntersectNode(child, r, intersections);
+            }
+        }
+    }
+
+    IntersectNodeShapes(n, r, intersections);
+}
+
 void IntersectTree(Tree *tree, Ray r, Set *intersections)
 {
-    IntersectNode(&tree->start, r, intersections);
+    traced_rays++;
+    STAT_ADD(STAT_RAYS, 1);
+
+    if (tree->precision == SINGLE_PRECISION_TRAVERSAL && NodeIsPacked(&tree->start))
+    {
+        // The root's box encloses everything else, if it is missed there is nothing to hit
+        STAT_ADD(STAT_BOX_TESTS, 1);
+        if (IsInBounds(tree->start.bounds, r))
+        {
+            FloatRay float_ray = NewFloatRay(r);
+            IntersectNodeSingle(&tree->start, r, &float_ray, intersections);
+        }
+    }
+    else
+    {
+        IntersectNode(&tree->start, r, intersections);
+    }
+
     QuickSort(intersections, (Comparator) CompareIntersections);
+
+    STAT_ADD(STAT_HIT_LIST_LENGTH, intersections->length);
+    STAT_MAX(STAT_MAX_HIT_LIST_LENGTH, intersections->length);
 }
 
 Bounds SetBounds(Set *s)
@@ -185,10 +475,9 @@ Bounds SetBounds(Set *s)
     for (unsigned i = 0; i < s->length; i++)
     {
         Shape *this_shape = Index(s, i);
-        Bounds bounds = ShapeBounds(this_shape);
 
-        min = _mm256_min_pd(bounds.minimum_bound, min);
-        max = _mm256_max_pd(bounds.maximum_bound, max);
+        min = _mm256_min_pd(this_shape->bounds.minimum_bound, min);
+        max = _mm256_max_pd(this_shape->bounds.maximum_bound, max);
     }
 
     Bounds out = {
@@ -202,6 +491,7 @@ Bounds SetBounds(Set *s)
 void TreeNodeBounds(Node *n)
 {
     Bounds out = SetBounds(&n->shapes);
+    PackNodeShapes(n);
 
     for (unsigned i = 0; i < n->children.length; i++)
     {
@@ -212,6 +502,13 @@ void TreeNodeBounds(Node *n)
         out.maximum_bound = _mm256_max_pd(child->bounds.maximum_bound, out.maximum_bound);
     }
 
+    ConstructFloatBounds(&n->child_bounds, (unsigned)n->children.length);
+    for (unsigned i = 0; i < n->children.length; i++)
+    {
+        Node *child = Index(&n->children, i);
+        SetFloatBounds(&n->child_bounds, i, child->bounds);
+    }
+
     n->bounds = out;
 }
 
@@ -239,7 +536,7 @@ void GetShapeSets(Set *bound, Set *unbound, Node *src)
     {
 
         Shape *this_shape = Index(&src->shapes, i);
-        Bounds b = ShapeBounds(this_shape);
+        Bounds b = this_shape->bounds;
 
         if (TupleHasInfOrNans(b.maximum_bound) || TupleHasInfOrNans(b.minimum_bound))
         {
@@ -260,6 +557,8 @@ void GetShapeSets(Set *bound, Set *unbound, Node *src)
 #define SHAPES_PER_CHILD 32
 void GenerateBVH(Tree *dst, Tree *src)
 {
+    TRACE_SCOPE("GenerateBVH", "phase");
+
     Set bound_shapes;
     ConstructSet(&bound_shapes, sizeof(Shape));
 
@@ -85,7 +85,7 @@ bool TupleFuzzyEqual(Tuple3 t1, Tuple3 t2)
 
 bool TupleLessThan(Tuple3 t1, Tuple3 t2)
 {
-    __mmask8 cmp = _mm256_cmp_pd_mask(t1, t2, _CMP_LT_OQ);
+    unsigned cmp = (unsigned)_mm256_movemask_pd(_mm256_cmp_pd(t1, t2, _CMP_LT_OQ));
     return (cmp >= 7);
 }
 
@@ -161,26 +161,17 @@ Tuple3 TupleNormalize(Tuple3 t1)
     return _mm256_div_pd(t1, _mm256_set1_pd(mag));
 }
 
-void InfinitiesMask(Tuple3 t1, __mmask8 *infs, __mmask8 *neg_infs)
-{
-    __m256d infinity_cmp = _mm256_cmp_pd(t1, _mm256_set1_pd(INFINITY), _CMP_EQ_OQ);
-    *infs |= (__mmask8)_mm256_movemask_pd(infinity_cmp);
-
-    __m256d neg_infinity_cmp = _mm256_cmp_pd(t1, _mm256_set1_pd(-INFINITY), _CMP_EQ_OQ);
-    *neg_infs |= (__mmask8)_mm256_movemask_pd(neg_infinity_cmp);
-}
-
 Tuple3 TupleMultiplyPreserveInf(Tuple3 t1, Tuple3 t2)
 {
-    __mmask8 neg_infs = 0;
-    __mmask8 infs = 0;
+    __m256d infinity = _mm256_set1_pd(INFINITY);
+    __m256d neg_infinity = _mm256_set1_pd(-INFINITY);
 
-    InfinitiesMask(t1, &infs, &neg_infs);
-    InfinitiesMask(t2, &infs, &neg_infs);
+    __m256d infs = _mm256_or_pd(_mm256_cmp_pd(t1, infinity, _CMP_EQ_OQ), _mm256_cmp_pd(t2, infinity, _CMP_EQ_OQ));
+    __m256d neg_infs = _mm256_or_pd(_mm256_cmp_pd(t1, neg_infinity, _CMP_EQ_OQ), _mm256_cmp_pd(t2, neg_infinity, _CMP_EQ_OQ));
 
-    Tuple3 src = _mm256_mask_mov_pd(_mm256_set1_pd(INFINITY), neg_infs, _mm256_set1_pd(-INFINITY));
+    Tuple3 src = _mm256_blendv_pd(infinity, neg_infinity, neg_infs);
 
-    return _mm256_mask_mul_pd(src, ~(neg_infs | infs), t1, t2); // Preserve inifinites
+    return _mm256_blendv_pd(_mm256_mul_pd(t1, t2), src, _mm256_or_pd(infs, neg_infs)); // Preserve inifinites
 }
 
 Tuple3 TupleMultiply(Tuple3 t1, Tuple3 t2)